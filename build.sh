@@ -319,13 +319,13 @@ if [ "${1:-}" = "deps" ]; then
 fi
 
 if [ "$1" = "clean" ]; then
-    rm -f arch/x86/boot.o arch/x86/idt.o arch/x86/user.o \
-          kernel/main.o kernel/mem.o kernel/console.o kernel/serial.o \
+    rm -f arch/x86/boot.o arch/x86/idt.o arch/x86/user.o arch/x86/context.o arch/x86/ap_boot.o arch/x86/syscall.o \
+          kernel/main.o kernel/mem.o kernel/pmm.o kernel/kmem.o kernel/lz4.o kernel/zram.o kernel/heapprof.o kernel/console.o kernel/serial.o \
           kernel/bootmode.o kernel/exoimg.o kernel/bootlogo.o kernel/embedded_logo.o \
           kernel/idt.o kernel/panic.o kernel/memutils.o kernel/fs.o kernel/vfs.o \
-          kernel/memctx.o kernel/proc.o kernel/backend_test.o kernel/script.o \
+          kernel/memctx.o kernel/proc.o kernel/sched.o kernel/pit.o kernel/smp.o kernel/clock.o kernel/ktimer.o kernel/execcache.o kernel/vmm.o kernel/futex.o kernel/pci.o kernel/ata.o kernel/blkdev.o kernel/virtio_blk.o kernel/nvme.o kernel/ahci.o kernel/lapic.o kernel/acpi.o kernel/backend_test.o kernel/script.o \
           kernel/debuglog.o kernel/syscall.o kernel/micropython.o kernel/mpy_loader.o \
-          kernel/mpy_modules.o kernel/modexec.o kernel/elf.o kernel/launchd.o kernel/vga_draw.o kernel/framebuffer.o kernel/io.o
+          kernel/mpy_modules.o kernel/modexec.o kernel/elf.o kernel/launchd.o kernel/vga_draw.o kernel/framebuffer.o kernel/io.o kernel/ata_pio.o
     rm -f kernel/*.d kernel/micropython.d
     rm -f run/*.d run/*.o run/*.elf run/*.bin run/console_mod.o run/serial_mod.o run/console_mod.d run/serial_mod.d
     rm -f run/userland/*.d run/userland/*.o run/userland/*.elf run/userland/*.bin
@@ -668,7 +668,7 @@ for src in linkdep/*.c; do
   dep="${obj%.o}.d"
   if needs_rebuild "$obj" "$src" "$dep"; then
     echo "Compiling linkdep $src → $obj"
-    $CC $MODULE_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -nostdlib -nodefaultlibs \
+    $CC $MODULE_FLAG -fPIE -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -nostdlib -nodefaultlibs \
         -Iinclude -MMD -MP -MF "$dep" -c "$src" -o "$obj"
   else
     echo "Up to date $obj"
@@ -688,11 +688,11 @@ if [ ${#DEP_OBJS[@]} -gt 0 ]; then
 fi
 shopt -u nullglob
 
-# 5) Build console and serial stubs for modules
+# 5) Build console and serial stubs for modules (PIE, like the modules)
 mkdir -p run
 echo "Building console stub → run/console_mod.o"
 if needs_rebuild run/console_mod.o kernel/console.c run/console_mod.d; then
-  $CC $MODULE_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall \
+  $CC $MODULE_FLAG -fPIE -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall \
       -DNO_DEBUGLOG -Iinclude -MMD -MP -MF run/console_mod.d \
       -c kernel/console.c -o run/console_mod.o
 else
@@ -700,7 +700,7 @@ else
 fi
 echo "Building serial stub → run/serial_mod.o"
 if needs_rebuild run/serial_mod.o kernel/serial.c run/serial_mod.d; then
-  $CC $MODULE_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall \
+  $CC $MODULE_FLAG -fPIE -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall \
       -DNO_DEBUGLOG -Iinclude -MMD -MP -MF run/serial_mod.d \
       -c kernel/serial.c -o run/serial_mod.o
 else
@@ -717,7 +717,7 @@ for src in run/*.c; do
   dep="${obj%.o}.d"
   if needs_rebuild "$obj" "$src" "$dep"; then
     echo "Compiling module $src → $obj"
-    $CC $MODULE_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -nostdlib -nodefaultlibs \
+    $CC $MODULE_FLAG -fPIE -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -nostdlib -nodefaultlibs \
         -Iinclude -MMD -MP -MF "$dep" -c "$src" -o "$obj"
   else
     echo "Module object $obj is up to date"
@@ -747,7 +747,7 @@ for src in run/*.c; do
   fi
   if should_rebuild "$elf" "${deps[@]}"; then
     echo "Linking $obj + console/serial stubs + linkdep.a → $elf"
-    $LD -m $LDARCH -Ttext ${MODULE_BASE} \
+    $LD -m $LDARCH -pie --no-dynamic-linker \
         "$obj" run/console_mod.o run/serial_mod.o ${DEP_OBJS:+run/linkdep.a} $extra \
         -o "$elf"
   else
@@ -765,9 +765,15 @@ if [ -d run/userland ]; then
     obj="run/userland/${base}.o"
     elf="run/userland/${base}.elf"
     dep="${obj%.o}.d"
+    # Spawned processes are position independent; the kernel relocates
+    # them into their address space.
+    pie_cflags=""
+    if [ "$base" = "launchd" ] || [ "$base" = "shelld" ]; then
+      pie_cflags="-fPIE"
+    fi
     if needs_rebuild "$obj" "$src" "$dep"; then
       echo "Compiling userland $src → $obj"
-      $CC $MODULE_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -nostdlib -nodefaultlibs \
+      $CC $MODULE_FLAG $pie_cflags -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -nostdlib -nodefaultlibs \
           -Iinclude -MMD -MP -MF "$dep" -c "$src" -o "$obj"
     else
       echo "Userland object $obj is up to date"
@@ -802,9 +808,15 @@ if [ -d run/userland ]; then
     fi
     if should_rebuild "$elf" "${deps[@]}"; then
       echo "Linking $obj → $elf"
-      $LD -m $LDARCH -Ttext ${MODULE_BASE} \
-          "${link_inputs[@]}" $extra \
-          -o "$elf"
+      if [ -n "$pie_cflags" ]; then
+        $LD -m $LDARCH -pie --no-dynamic-linker \
+            "${link_inputs[@]}" $extra \
+            -o "$elf"
+      else
+        $LD -m $LDARCH -Ttext ${MODULE_BASE} \
+            "${link_inputs[@]}" $extra \
+            -o "$elf"
+      fi
     else
       echo "$elf is up to date"
     fi
@@ -974,6 +986,24 @@ if needs_rebuild arch/x86/user.o arch/x86/user.S ""; then
 else
   echo "arch/x86/user.o is up to date"
 fi
+if needs_rebuild arch/x86/context.o arch/x86/context.S ""; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -c arch/x86/context.S -o arch/x86/context.o
+else
+  echo "arch/x86/context.o is up to date"
+fi
+if needs_rebuild arch/x86/ap_boot.o arch/x86/ap_boot.S ""; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -c arch/x86/ap_boot.S -o arch/x86/ap_boot.o
+else
+  echo "arch/x86/ap_boot.o is up to date"
+fi
+if needs_rebuild arch/x86/syscall.o arch/x86/syscall.S ""; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -c arch/x86/syscall.S -o arch/x86/syscall.o
+else
+  echo "arch/x86/syscall.o is up to date"
+fi
 if needs_rebuild kernel/main.o kernel/main.c kernel/main.d; then
   $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
       -MMD -MP -MF kernel/main.d -c kernel/main.c -o kernel/main.o
@@ -984,6 +1014,90 @@ if needs_rebuild kernel/mem.o kernel/mem.c kernel/mem.d; then
   $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
       -MMD -MP -MF kernel/mem.d -c kernel/mem.c -o kernel/mem.o
 fi
+if needs_rebuild kernel/pmm.o kernel/pmm.c kernel/pmm.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/pmm.d -c kernel/pmm.c -o kernel/pmm.o
+fi
+if needs_rebuild kernel/kmem.o kernel/kmem.c kernel/kmem.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/kmem.d -c kernel/kmem.c -o kernel/kmem.o
+fi
+if needs_rebuild kernel/lz4.o kernel/lz4.c kernel/lz4.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/lz4.d -c kernel/lz4.c -o kernel/lz4.o
+fi
+if needs_rebuild kernel/zram.o kernel/zram.c kernel/zram.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/zram.d -c kernel/zram.c -o kernel/zram.o
+fi
+if needs_rebuild kernel/heapprof.o kernel/heapprof.c kernel/heapprof.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/heapprof.d -c kernel/heapprof.c -o kernel/heapprof.o
+fi
+if needs_rebuild kernel/sched.o kernel/sched.c kernel/sched.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/sched.d -c kernel/sched.c -o kernel/sched.o
+fi
+if needs_rebuild kernel/pit.o kernel/pit.c kernel/pit.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/pit.d -c kernel/pit.c -o kernel/pit.o
+fi
+if needs_rebuild kernel/smp.o kernel/smp.c kernel/smp.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/smp.d -c kernel/smp.c -o kernel/smp.o
+fi
+if needs_rebuild kernel/clock.o kernel/clock.c kernel/clock.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/clock.d -c kernel/clock.c -o kernel/clock.o
+fi
+if needs_rebuild kernel/execcache.o kernel/execcache.c kernel/execcache.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/execcache.d -c kernel/execcache.c -o kernel/execcache.o
+fi
+if needs_rebuild kernel/vmm.o kernel/vmm.c kernel/vmm.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/vmm.d -c kernel/vmm.c -o kernel/vmm.o
+fi
+if needs_rebuild kernel/futex.o kernel/futex.c kernel/futex.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/futex.d -c kernel/futex.c -o kernel/futex.o
+fi
+if needs_rebuild kernel/ata.o kernel/ata.c kernel/ata.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/ata.d -c kernel/ata.c -o kernel/ata.o
+fi
+if needs_rebuild kernel/pci.o kernel/pci.c kernel/pci.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/pci.d -c kernel/pci.c -o kernel/pci.o
+fi
+if needs_rebuild kernel/blkdev.o kernel/blkdev.c kernel/blkdev.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/blkdev.d -c kernel/blkdev.c -o kernel/blkdev.o
+fi
+if needs_rebuild kernel/virtio_blk.o kernel/virtio_blk.c kernel/virtio_blk.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/virtio_blk.d -c kernel/virtio_blk.c -o kernel/virtio_blk.o
+fi
+if needs_rebuild kernel/nvme.o kernel/nvme.c kernel/nvme.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/nvme.d -c kernel/nvme.c -o kernel/nvme.o
+fi
+if needs_rebuild kernel/ahci.o kernel/ahci.c kernel/ahci.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/ahci.d -c kernel/ahci.c -o kernel/ahci.o
+fi
+if needs_rebuild kernel/ktimer.o kernel/ktimer.c kernel/ktimer.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/ktimer.d -c kernel/ktimer.c -o kernel/ktimer.o
+fi
+if needs_rebuild kernel/lapic.o kernel/lapic.c kernel/lapic.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/lapic.d -c kernel/lapic.c -o kernel/lapic.o
+fi
+if needs_rebuild kernel/acpi.o kernel/acpi.c kernel/acpi.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/acpi.d -c kernel/acpi.c -o kernel/acpi.o
+fi
 if needs_rebuild kernel/console.o kernel/console.c kernel/console.d; then
   $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
       -MMD -MP -MF kernel/console.d -c kernel/console.c -o kernel/console.o
@@ -1088,15 +1202,19 @@ if needs_rebuild kernel/io.o linkdep/io.c kernel/io.d; then
   $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
       -MMD -MP -MF kernel/io.d -c linkdep/io.c -o kernel/io.o
 fi
+if needs_rebuild kernel/ata_pio.o linkdep/ata_pio.c kernel/ata_pio.d; then
+  $CC $ARCH_FLAG -std=gnu99 -ffreestanding -O2 $STACK_FLAGS -fcf-protection=none -Wall -U__linux__ -Iinclude \
+      -MMD -MP -MF kernel/ata_pio.d -c linkdep/ata_pio.c -o kernel/ata_pio.o
+fi
 # 9) Link into flat kernel.bin
 KERNEL_OBJECTS=(
-  arch/x86/boot.o arch/x86/idt.o arch/x86/user.o
-  kernel/main.o kernel/mem.o kernel/console.o kernel/serial.o
+  arch/x86/boot.o arch/x86/idt.o arch/x86/user.o arch/x86/context.o arch/x86/ap_boot.o arch/x86/syscall.o
+  kernel/main.o kernel/mem.o kernel/pmm.o kernel/kmem.o kernel/lz4.o kernel/zram.o kernel/heapprof.o kernel/console.o kernel/serial.o
   kernel/bootmode.o kernel/exoimg.o kernel/bootlogo.o kernel/embedded_logo.o
   kernel/idt.o kernel/panic.o kernel/memutils.o kernel/fs.o kernel/vfs.o
-  kernel/memctx.o kernel/proc.o kernel/backend_test.o kernel/script.o
+  kernel/memctx.o kernel/proc.o kernel/sched.o kernel/pit.o kernel/smp.o kernel/clock.o kernel/ktimer.o kernel/execcache.o kernel/vmm.o kernel/futex.o kernel/pci.o kernel/ata.o kernel/blkdev.o kernel/virtio_blk.o kernel/nvme.o kernel/ahci.o kernel/lapic.o kernel/acpi.o kernel/backend_test.o kernel/script.o
   kernel/debuglog.o kernel/syscall.o kernel/micropython.o kernel/mpy_loader.o
-  kernel/mpy_modules.o kernel/modexec.o kernel/elf.o kernel/launchd.o kernel/embedded_userland.o kernel/vga_draw.o kernel/framebuffer.o kernel/io.o
+  kernel/mpy_modules.o kernel/modexec.o kernel/elf.o kernel/launchd.o kernel/embedded_userland.o kernel/vga_draw.o kernel/framebuffer.o kernel/io.o kernel/ata_pio.o
 )
 KERNEL_LINK_DEPS=("${KERNEL_OBJECTS[@]}" "${MP_OBJS[@]}" linker.ld)
 if should_rebuild kernel.bin "${KERNEL_LINK_DEPS[@]}"; then
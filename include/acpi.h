@@ -0,0 +1,47 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ACPI_MAX_CPUS 64
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+/* What the MADT says about the processors in the system. */
+typedef struct {
+    uint64_t lapic_base;
+    uint32_t cpu_count;
+    uint8_t apic_ids[ACPI_MAX_CPUS];
+} acpi_madt_info_t;
+
+/* Locate the RSDP in the EBDA or BIOS area and validate the root table.
+ * Returns 0 on success.
+ */
+int acpi_init(void);
+
+/* Find a table by signature. Returns NULL if it is missing or corrupt. */
+const acpi_sdt_header_t *acpi_find_table(const char *sig);
+
+/* Parse the MADT into 'out'; only enabled processors are listed. */
+int acpi_parse_madt(acpi_madt_info_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACPI_H */
@@ -0,0 +1,43 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* AHCI SATA disks. Every port with a disk gets a command list of up to
+ * 32 slots and its own FIS receive area. Drives that support native
+ * command queuing (and an HBA with CAP.SNCQ) get READ/WRITE FPDMA QUEUED,
+ * so each slot is an outstanding command the drive may reorder; others
+ * fall back to READ/WRITE DMA EXT, which the HBA issues in order.
+ * Completions arrive by MSI on AHCI_VECTOR, or are polled without it.
+ */
+#define AHCI_DISKS_MAX   4
+#define AHCI_SLOTS_MAX   32
+#define AHCI_CHUNK       256        /* sectors per command */
+#define AHCI_VECTOR      0x68
+/* Polling interval without MSI, and the limit for any one command. */
+#define AHCI_POLL_MS    1
+#define AHCI_TIMEOUT_MS 5000
+
+typedef struct {
+    uint64_t sectors;
+    uint32_t port;
+    uint32_t slots;             /* commands in flight at most */
+    int ncq;
+    int msi;
+} ahci_info_t;
+
+/* Start every AHCI disk found on the first controller and register them
+ * as "ahci0", "ahci1", ... Returns the number of disks.
+ */
+int ahci_init(void);
+int ahci_info(int disk, ahci_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AHCI_H */
@@ -0,0 +1,38 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ata_pio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Kernel front end of the primary-channel ATA PIO driver. Requests are
+ * serialised per channel; once the scheduler runs, the caller sleeps on
+ * IRQ14 between DRQ blocks and the CPU runs other threads meanwhile.
+ */
+#define ATA_IRQ 14
+/* How long to sleep for one interrupt before falling back to polling. */
+#define ATA_IRQ_TIMEOUT_MS 1000
+/* Bus-master DMA through the PCI IDE controller's primary channel. A
+ * request goes by DMA when its buffer is identity mapped below 4 GiB;
+ * PRD entries split it at 64 KiB boundaries. Anything else, or any DMA
+ * error, falls back to PIO.
+ */
+#define ATA_PRD_MAX 8
+
+/* Probe the disk and hook up IRQ14. Returns 0 if a disk is present. */
+int ata_init(void);
+int ata_info(ata_pio_info_t *info);
+/* Whether requests currently go through bus-master DMA. */
+int ata_dma_enabled(void);
+int ata_read(uint64_t lba, void *buf, size_t count);
+int ata_write(uint64_t lba, const void *buf, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ATA_H */
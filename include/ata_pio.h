@@ -8,9 +8,48 @@
 extern "C" {
 #endif
 
-void ata_pio_init(void);
-int ata_pio_read(uint32_t lba, void *buf, size_t count);
-int ata_pio_write(uint32_t lba, const void *buf, size_t count);
+#define ATA_PIO_SECTOR_SIZE 512
+/* Sectors per DRQ block requested with SET MULTIPLE MODE; drives that
+ * offer fewer get their own maximum.
+ */
+#define ATA_PIO_MULTIPLE_MAX 16
+/* Largest transfer issued as a single command. */
+#define ATA_PIO_MAX_SECTORS 256
+
+typedef struct {
+    uint64_t sectors;
+    uint32_t lba48;
+    uint32_t multiple;      /* sectors per DRQ block, 1 without READ MULTIPLE */
+    uint32_t dma;           /* drive accepts READ/WRITE DMA */
+} ata_pio_info_t;
+
+/* Sleep until the drive raises INTRQ. Returns 0 when the interrupt came,
+ * -1 on timeout; the driver then polls the status register itself.
+ */
+typedef int (*ata_pio_irq_wait_t)(void);
+
+/* IDENTIFY the primary master and enable READ/WRITE MULTIPLE. Returns 0
+ * if an ATA disk answered. Reads and writes call it on first use.
+ */
+int ata_pio_init(void);
+int ata_pio_info(ata_pio_info_t *info);
+/* Unmask the drive's interrupt and sleep in 'wait' between DRQ blocks
+ * instead of spinning; NULL goes back to polling with nIEN set.
+ */
+void ata_pio_set_irq_wait(ata_pio_irq_wait_t wait);
+/* Transfer 'count' sectors; requests beyond LBA28 use the EXT commands.
+ * Returns 0, or -1 on a drive error or timeout.
+ */
+int ata_pio_read(uint64_t lba, void *buf, size_t count);
+int ata_pio_write(uint64_t lba, const void *buf, size_t count);
+
+/* Taskfile half of a bus-master transfer of up to ATA_PIO_MAX_SECTORS:
+ * the caller programs the controller, calls ata_pio_start_dma, then
+ * starts the engine and waits for INTRQ. ata_pio_end_dma reads (and
+ * thereby acks) the final status. Both return 0 or -1.
+ */
+int ata_pio_start_dma(uint64_t lba, uint32_t count, int write);
+int ata_pio_end_dma(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,101 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Registry of sector-addressed disks. Drivers register once at boot;
+ * filesystems address a disk by index and read 512-byte sectors through
+ * it without knowing the transport.
+ */
+#define BLKDEV_MAX 8
+#define BLKDEV_NAME_MAX 15
+#define BLKDEV_SECTOR_SIZE 512
+
+/* Preference for the default disk when several are present. */
+#define BLKDEV_RANK_ATA    10
+#define BLKDEV_RANK_AHCI   20
+#define BLKDEV_RANK_VIRTIO 30
+#define BLKDEV_RANK_NVME   40
+
+typedef struct {
+    int (*read)(void *ctx, uint64_t lba, void *buf, size_t count);
+    int (*write)(void *ctx, uint64_t lba, const void *buf, size_t count);
+} blkdev_ops_t;
+
+typedef struct {
+    char name[BLKDEV_NAME_MAX + 1];
+    uint64_t sectors;
+    int rank;
+    const blkdev_ops_t *ops;
+    void *ctx;
+} blkdev_t;
+
+/* Returns the new device's index, or -1 when the table is full. */
+int blkdev_register(const char *name, uint64_t sectors, int rank, const blkdev_ops_t *ops, void *ctx);
+int blkdev_count(void);
+const blkdev_t *blkdev_get(int index);
+/* Highest-ranked device (the first registered on a tie), or -1. */
+int blkdev_default(void);
+/* Range-checked transfers; 0 on success, -1 on error. */
+int blkdev_read(int index, uint64_t lba, void *buf, size_t count);
+int blkdev_write(int index, uint64_t lba, const void *buf, size_t count);
+
+/* Request slots of one hardware queue, shared by the DMA drivers. The
+ * driver clears a slot's 'done' flag when it submits it; its reap sets
+ * it again and wakes done_waiters. Waiters sleep until that wake when
+ * 'irq' is set, poll every poll_ms otherwise, or spin if poll_ms is 0.
+ * Buffers the device cannot reach go through 'bounce', bounce_sectors
+ * at a time.
+ */
+#define BLKDEV_SLOTS_MAX 128
+
+typedef struct {
+    uint64_t free[BLKDEV_SLOTS_MAX / 64];   /* slot bitmap */
+    volatile uint8_t done[BLKDEV_SLOTS_MAX];
+    sched_waitq_t slot_waiters;
+    sched_waitq_t done_waiters;
+    void (*reap)(void *ctx);
+    void *ctx;
+    int irq;
+    uint32_t poll_ms;
+    uint32_t timeout_ms;
+    uint8_t *bounce;
+    size_t bounce_sectors;
+    int bounce_busy;
+    sched_waitq_t bounce_waiters;
+} blkdev_queue_t;
+
+/* Moves 'count' sectors at identity-mapped 'addr'; 0 or -1. */
+typedef int (*blkdev_xfer_t)(void *ctx, uint64_t lba, uintptr_t addr, size_t count, int write);
+
+/* Makes slots 0..slots-1 free and the rest unusable; the caller sets
+ * the remaining fields.
+ */
+void blkdev_queue_init(blkdev_queue_t *q, int slots, void (*reap)(void *ctx), void *ctx);
+/* Waits for a slot unless 'may_block' is 0 (the caller already has
+ * requests to wait on); -1 then, and for a cancelled caller starting a
+ * new batch.
+ */
+int blkdev_slot_alloc(blkdev_queue_t *q, int may_block);
+void blkdev_slot_free(blkdev_queue_t *q, int s);
+/* Reaps until every slot in 'ids' is done, even for a cancelled caller;
+ * -1 after timeout_ms. The device may then still own the slots, so they
+ * must not be reused.
+ */
+int blkdev_batch_wait(blkdev_queue_t *q, const int *ids, int n);
+/* Runs 'xfer' on the bounce buffer a chunk at a time, copying 'buf' in
+ * or out around it. One caller at a time owns the buffer.
+ */
+int blkdev_bounce(blkdev_queue_t *q, blkdev_xfer_t xfer, uint64_t lba, void *buf, size_t count, int write);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLKDEV_H */
@@ -0,0 +1,25 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Monotonic time since clock_init, read from the TSC. The TSC rate is
+ * measured once against the HPET when ACPI lists one, else against PIT
+ * channel 2. Until then (or if both fail) a 1 GHz TSC is assumed.
+ */
+int clock_init(void);
+uint64_t clock_ns(void);
+uint64_t clock_ms(void);
+uint64_t clock_tsc_hz(void);
+/* "hpet", "pit" or "assumed". */
+const char *clock_source(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLOCK_H */
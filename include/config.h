@@ -27,8 +27,25 @@
 #define EXOCORE_KERNEL_HEAP_SIZE (512 * 1024)
 #endif
 
+/* Upper bound on the kernel heap; 0 lets it grow until physical memory
+ * runs out.
+ */
 #ifndef EXOCORE_KERNEL_HEAP_MAX_SIZE
-#define EXOCORE_KERNEL_HEAP_MAX_SIZE (8 * 1024 * 1024)
+#define EXOCORE_KERNEL_HEAP_MAX_SIZE 0
+#endif
+
+/* Tag heap blocks with their allocation site for SYS_HEAP_PROFILE. Off by
+ * default: every mem_alloc/mem_free pays for the site lookup when on.
+ */
+#ifndef EXOCORE_HEAP_PROFILE
+#define EXOCORE_HEAP_PROFILE 0
+#endif
+
+/* Time the attached disks after the boot self-test has checked them.
+ * Results are only logged; a slow or failing pass never stops the boot.
+ */
+#ifndef EXOCORE_DISK_BENCH
+#define EXOCORE_DISK_BENCH 0
 #endif
 
 #ifndef EXOCORE_MICROPY_HEAP_SIZE
@@ -60,6 +60,10 @@ void console_clear(void);
 /** Read one character from the keyboard. */
 char console_getc(void);
 
+/** Poll the keyboard and serial port once; returns 1 and stores a character
+ *  in *out if one was available. */
+int console_try_getc(char *out);
+
 /** Set the current foreground/background attribute. */
 void console_set_attr(uint8_t fg, uint8_t bg);
 
@@ -13,11 +13,19 @@ extern "C" {
 #define ELF_DATA_LSB 1
 #define ELF_VERSION_CURRENT 1
 #define ELF_TYPE_EXEC 2
+#define ELF_TYPE_DYN 3
 #define ELF_MACHINE_X86_64 62
 #define ELF_PT_LOAD 1
+#define ELF_PT_DYNAMIC 2
 #define ELF_PF_X 1
 #define ELF_PF_W 2
 #define ELF_PF_R 4
+#define ELF_DT_NULL 0
+#define ELF_DT_RELA 7
+#define ELF_DT_RELASZ 8
+#define ELF_DT_RELAENT 9
+#define ELF_R_X86_64_NONE 0
+#define ELF_R_X86_64_RELATIVE 8
 
 typedef struct {
     uint32_t e_magic;      /* 0x7F 'E' 'L' 'F' */
@@ -53,6 +61,17 @@ typedef struct {
     uint64_t p_align;
 } __attribute__((packed)) elf_phdr_t;
 
+typedef struct {
+    int64_t d_tag;
+    uint64_t d_val;
+} __attribute__((packed)) elf_dyn_t;
+
+typedef struct {
+    uint64_t r_offset;
+    uint64_t r_info;   /* type in the low 32 bits */
+    int64_t r_addend;
+} __attribute__((packed)) elf_rela_t;
+
 typedef struct {
     uintptr_t requested_base;
     uintptr_t requested_end;
@@ -61,7 +80,46 @@ typedef struct {
     void *entry;
 } elf_image_t;
 
+#define ELF_MAX_SEGMENTS 8
+
+typedef struct {
+    size_t offset;      /* from requested_base */
+    size_t memsz;
+    size_t filesz;
+    uint64_t file_offset;
+    uint32_t flags;
+} elf_segment_t;
+
+/* Where the PT_LOAD segments land, relative to the lowest one. Bytes
+ * from file_extent to load_size are bss.
+ */
+typedef struct {
+    uintptr_t requested_base;
+    uintptr_t requested_end;
+    size_t load_size;
+    size_t file_extent;
+    size_t entry_offset;
+    int writable;
+    int relocatable;    /* ET_DYN: may run anywhere after relocation */
+    int nsegments;
+    elf_segment_t segments[ELF_MAX_SEGMENTS];
+} elf_layout_t;
+
 int elf_validate(const void *file, size_t file_size);
+int elf_layout(const void *file, size_t file_size, elf_layout_t *out);
+/* Fill 'base' with the first layout->file_extent bytes of the image. */
+void elf_place_segments(const void *file, const elf_layout_t *layout, unsigned char *base);
+/* The R_X86_64_RELATIVE table of an ET_DYN file (empty for ET_EXEC).
+ * Fails on any other relocation type, since there is no dynamic linker.
+ */
+int elf_relocations(const void *file, size_t file_size, const elf_layout_t *layout,
+                    const elf_rela_t **out, size_t *count);
+/* Apply 'relas' to the part of the laid-out image held in 'image', which
+ * starts at layout offset 'image_off' and spans 'image_len' bytes.
+ * 'load_addr' is where requested_base will be at run time.
+ */
+int elf_apply_relocations(const elf_rela_t *relas, size_t count, const elf_layout_t *layout,
+                          unsigned char *image, size_t image_off, size_t image_len, uintptr_t load_addr);
 int elf_load_process_image(int pid, const void *file, size_t file_size, elf_image_t *out);
 void elf_free_process_image(int pid, elf_image_t *image);
 
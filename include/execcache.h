@@ -0,0 +1,46 @@
+#ifndef EXECCACHE_H
+#define EXECCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "elf.h"
+#include "vmm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Validated, laid-out ELF images keyed by inode and file version, so a
+ * repeat spawn skips the VFS read, the parse and the segment copies.
+ * Images are page-aligned and stop at the end of the file data; bss is
+ * never stored.
+ */
+#define EXECCACHE_SLOTS 8
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t entries;
+    size_t bytes;
+} execcache_stats_t;
+
+/* Map 'path' into the window of 'space' on demand: read-only pages map
+ * the cached image itself, writable ones are copied and bss zero-filled
+ * when first touched. *handle keeps the image alive; drop it with
+ * execcache_release after the space is destroyed.
+ */
+int execcache_map(vmm_space_t *space, const char *path, elf_image_t *out, void **handle);
+/* Same for an image in memory that never changes or goes away, such as
+ * a multiboot module. Read-only pages map 'data' itself.
+ */
+int execcache_map_buffer(vmm_space_t *space, const void *data, size_t size, elf_image_t *out, void **handle);
+void execcache_release(void *handle);
+/* Evict idle images until about 'goal' bytes are freed. */
+size_t execcache_shrink(size_t goal);
+void execcache_get_stats(execcache_stats_t *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXECCACHE_H */
@@ -16,6 +16,11 @@ extern "C" {
  */
 void fs_mount(void *storage, size_t size);
 
+/* Point a raw mount at a relocated or resized copy of its backing store.
+ * Does nothing unless 'old' is the storage currently mounted.
+ */
+void fs_remap(const void *old, void *storage, size_t size);
+
 /* Read up to 'len' bytes from 'offset'. Returns bytes read. On a FAT32
  * mount this addresses bytes in the mounted volume image.
  */
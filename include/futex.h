@@ -0,0 +1,32 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Wait queues keyed on a process's 32-bit words, for mutexes and
+ * condition variables built in user space. Threads of one process share
+ * keys; the same address in another process is a different futex.
+ * Callers hold the kernel lock, which makes the compare-and-sleep in
+ * futex_wait atomic against futex_wake.
+ */
+#define FUTEX_ERR_AGAIN -11
+#define FUTEX_ERR_TIMEDOUT -110
+
+/* Sleep while '*addr' still holds 'val', until futex_wake on the same
+ * word or 'timeout_ms' (0 waits forever). Returns 0 when woken, which may
+ * be spurious, FUTEX_ERR_AGAIN if the word had already changed and
+ * FUTEX_ERR_TIMEDOUT on timeout.
+ */
+int futex_wait(int pid, volatile uint32_t *addr, uint32_t val, uint64_t timeout_ms);
+/* Wake up to 'count' waiters on 'addr'. Returns how many were woken. */
+int futex_wake(int pid, volatile uint32_t *addr, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FUTEX_H */
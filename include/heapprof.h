@@ -0,0 +1,57 @@
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Allocation-site heap profiler. Every live heap block is tagged with the
+ * return address of the code that allocated it, and each such call site
+ * keeps running totals plus a histogram of request sizes. Bucket i counts
+ * requests of at most 32 << i bytes; the last bucket takes everything
+ * larger.
+ */
+#define HEAPPROF_HIST_BUCKETS 8
+
+typedef struct {
+    uint64_t site;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    uint64_t total_bytes;
+    uint32_t live_count;
+    uint32_t total_count;
+    uint32_t hist[HEAPPROF_HIST_BUCKETS];
+} heapprof_site_t;
+
+typedef struct {
+    uint32_t enabled;
+    uint32_t sites;
+    uint32_t live_blocks;
+    /* Allocations not tracked because the live or site table was full. */
+    uint32_t dropped;
+    uint64_t live_bytes;
+    /* Blocks still live when their memory context was destroyed (with
+     * the profiler on) or checked by memctx_report_leaks.
+     */
+    uint64_t leaked_blocks;
+    uint64_t leaked_bytes;
+} heapprof_summary_t;
+
+void heapprof_reset(void);
+void heapprof_alloc(void *ptr, size_t size, void *site);
+void heapprof_free(void *ptr);
+/* Count a block memctx_report_leaks found still live. */
+void heapprof_leak(size_t size);
+
+void heapprof_get_summary(heapprof_summary_t *out);
+/* Copy up to 'max' sites, largest live footprint first. Returns the count. */
+int heapprof_snapshot(heapprof_site_t *out, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEAPPROF_H */
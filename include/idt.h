@@ -26,11 +26,18 @@ typedef struct {
 typedef void (*irq_handler_t)(uint32_t num, uint32_t err, uint64_t rsp);
 
 void idt_init(void);
+/* Load the shared IDT on an application processor. */
+void idt_load_cpu(void);
 void register_irq_handler(uint8_t num, irq_handler_t handler);
 void idt_handle_interrupt(uint32_t num, uint32_t err, uint64_t rsp);
 const void *idt_data(void);
 size_t idt_size(void);
 void idt_set_user_gate(uint8_t num, void *base);
+/* Save vector state with XSAVE in areas of 'bytes' (CPUID 0xD for the
+ * current XCR0) on every interrupt and syscall entry. Called once at boot,
+ * right after XCR0 enables state beyond SSE.
+ */
+void idt_use_xsave(uint32_t bytes);
 
 #ifdef __cplusplus
 }
@@ -12,9 +12,14 @@ void io_outw(uint16_t port, uint16_t val);
 uint16_t io_inw(uint16_t port);
 void io_outl(uint16_t port, uint32_t val);
 uint32_t io_inl(uint16_t port);
+/* rep insw / rep outsw: move 'count' 16-bit words between a port and memory. */
+void io_insw(uint16_t port, void *buf, uint32_t count);
+void io_outsw(uint16_t port, const void *buf, uint32_t count);
 void io_wait(void);
 uint64_t io_rdtsc(void);
 void io_cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d);
+uint64_t io_rdmsr(uint32_t msr);
+void io_wrmsr(uint32_t msr, uint64_t val);
 
 #ifdef __cplusplus
 }
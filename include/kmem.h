@@ -0,0 +1,59 @@
+#ifndef KMEM_H
+#define KMEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Round object slots up to a cache line so hot objects never share one. */
+#define KMEM_CACHE_ALIGN_LINE 0x1u
+#define KMEM_CACHE_LINE 64
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct {
+    const char *name;
+    size_t obj_size;
+    size_t slab_bytes;
+    uint32_t objs_per_slab;
+    uint32_t active;
+    uint32_t slabs;
+} kmem_cache_stats_t;
+
+/* Create a cache of fixed-size objects. 'ctor', when given, runs on every
+ * object handed out by kmem_cache_alloc. Returns NULL if no cache slot is
+ * left or the object is too large for a slab.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, uint32_t flags, kmem_ctor_t ctor);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+int kmem_cache_stats(const kmem_cache_t *cache, kmem_cache_stats_t *stats);
+/* Release cached empty slabs until 'goal' bytes are freed. Registered as a
+ * heap shrinker by the first kmem_cache_create.
+ */
+size_t kmem_reap(size_t goal);
+
+/* Growable index -> object table for subsystems that hand out small integer
+ * handles (pids, fds, node numbers). Slots are reused lowest-first.
+ */
+typedef struct {
+    void **slots;
+    int count;
+    int free_hint;
+} kmem_table_t;
+
+int kmem_table_insert(kmem_table_t *table, void *obj);
+void kmem_table_remove(kmem_table_t *table, int idx);
+void kmem_table_reset(kmem_table_t *table);
+void *kmem_table_get(const kmem_table_t *table, int idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KMEM_H */
@@ -0,0 +1,52 @@
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hierarchical timer wheel in millisecond ticks: four levels of 64 slots
+ * cover about 4.6 hours; later deadlines are parked in the last slot and
+ * re-filed as the wheel turns. Arm and cancel are O(1); advancing costs
+ * one slot per elapsed tick plus an occasional cascade.
+ */
+#define KTIMER_LEVELS 4
+#define KTIMER_SLOT_BITS 6
+#define KTIMER_SLOTS (1 << KTIMER_SLOT_BITS)
+
+typedef void (*ktimer_fn_t)(void *arg);
+
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer **pprev;      /* NULL when not armed */
+    uint64_t expires;
+    ktimer_fn_t fn;
+    void *arg;
+} ktimer_t;
+
+/* Start the wheel at 'now'. */
+void ktimer_init(uint64_t now);
+uint64_t ktimer_now(void);
+
+/* Run 'fn(arg)' once the wheel reaches 'expires'. Re-arming a pending
+ * timer moves it. Callbacks run from ktimer_advance and may re-arm.
+ */
+void ktimer_arm(ktimer_t *t, uint64_t expires, ktimer_fn_t fn, void *arg);
+int ktimer_cancel(ktimer_t *t);
+int ktimer_pending(const ktimer_t *t);
+
+/* Turn the wheel up to and including 'now', running expired timers. */
+void ktimer_advance(uint64_t now);
+
+/* Earliest tick at which something may expire; never later than the real
+ * first deadline but may be earlier. UINT64_MAX when nothing is armed.
+ */
+uint64_t ktimer_next(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KTIMER_H */
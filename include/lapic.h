@@ -0,0 +1,38 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LAPIC_TIMER_VECTOR 0x40
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/* Map the local APIC at 'base' and enable it on the calling CPU. */
+int lapic_init(uint64_t base);
+/* Enable the already mapped local APIC of an application processor. */
+void lapic_enable(void);
+int lapic_ready(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+/* INIT-SIPI-SIPI building blocks. 'page' is the 4 KiB page number of the
+ * real-mode startup code.
+ */
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_sipi(uint32_t apic_id, uint8_t page);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/* Measure the timer against the PIT once on the BSP, then start a periodic
+ * LAPIC_TIMER_VECTOR interrupt at 'hz' on the calling CPU.
+ */
+void lapic_timer_calibrate(void);
+int lapic_timer_start(uint32_t hz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LAPIC_H */
@@ -0,0 +1,25 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Compress 'len' bytes into the LZ4 block format. Returns the compressed
+ * size, or 0 if the output would not fit in 'cap' bytes.
+ */
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/* Decompress an LZ4 block. Returns the number of bytes produced, or -1 if
+ * the input is malformed or would overflow 'cap'.
+ */
+long lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LZ4_H */
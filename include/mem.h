@@ -8,6 +8,13 @@
 extern "C" {
 #endif
 
+/* Free blocks are binned by power-of-two size class. Class i holds blocks
+ * whose total size (header and footer included) lies in
+ * [1 << (i + MEM_SIZE_CLASS_MIN_SHIFT), 1 << (i + MEM_SIZE_CLASS_MIN_SHIFT + 1)).
+ */
+#define MEM_SIZE_CLASSES 28
+#define MEM_SIZE_CLASS_MIN_SHIFT 5
+
 typedef struct {
     size_t heap_used;
     size_t heap_free;
@@ -15,12 +22,48 @@ typedef struct {
     size_t heap_max;
     size_t grow_count;
     size_t alloc_fail_count;
+    uint32_t class_live[MEM_SIZE_CLASSES];
+    uint32_t class_free[MEM_SIZE_CLASSES];
+    /* Compressed tier: uncompressed and stored sizes, and decompressions. */
+    size_t zram_orig_bytes;
+    size_t zram_comp_bytes;
+    size_t zram_faults;
+    uint32_t zram_objects;
+    uint32_t zram_rejects;
+    /* Shrinker passes run after a failed allocation and bytes they freed. */
+    size_t reclaim_runs;
+    size_t reclaim_bytes;
 } mem_info_t;
 
+/* Size of the fields that predate per-class occupancy. SYS_MEM_INFO copies
+ * only this prefix for callers that do not pass a buffer length.
+ */
+#define MEM_INFO_BASIC_SIZE offsetof(mem_info_t, class_live)
+
 void mem_init(uintptr_t heap_start, size_t heap_size);
 void *mem_alloc(size_t size);
 void *mem_alloc_or_panic(size_t size);
 void mem_free(void *addr, size_t size);
+/* Resize an allocation of 'old_size' bytes (0 if unknown), growing in place
+ * into a free right neighbour or the arena frontier when possible. Returns
+ * NULL and leaves the original untouched on failure.
+ */
+void *mem_realloc(void *ptr, size_t old_size, size_t new_size);
+
+/* Reclaim callbacks. When an allocation cannot be satisfied, registered
+ * shrinkers run in ascending priority order, each asked to free roughly
+ * 'goal' bytes, and the allocation is retried after every one that frees
+ * something. Shrinkers may allocate, but never trigger a nested pass.
+ */
+#define MEM_SHRINK_PRIO_CACHE    10
+#define MEM_SHRINK_PRIO_BALLOON  20
+#define MEM_SHRINK_PRIO_COMPRESS 30
+
+typedef size_t (*mem_shrinker_t)(size_t goal);
+
+int mem_register_shrinker(const char *name, int priority, mem_shrinker_t fn);
+/* Run shrinkers until 'goal' bytes are freed. Returns the bytes freed. */
+size_t mem_reclaim(size_t goal);
 
 /* VRAM management */
 void *mem_vram_base(void);
@@ -36,7 +79,11 @@ size_t mem_app_used(int app_id);
 size_t mem_heap_free(void);
 void mem_get_info(mem_info_t *info);
 
-/* Store arbitrary data for an application */
+/* Store arbitrary data for an application. Saved blocks form the app's
+ * balloon: under pressure they are compressed into zram, lowest app
+ * priority first, and inflated again by mem_retrieve_app. A retrieved
+ * pointer stays valid only until the next reclaim pass.
+ */
 int   mem_save_app(int app_id, const void *data, size_t size);
 void *mem_retrieve_app(int app_id, int handle, size_t *size);
 
@@ -20,7 +20,16 @@ int memctx_create(int owner_pid, size_t quota);
 void *memctx_alloc(int ctx_id, size_t size);
 int memctx_free(int ctx_id, void *ptr);
 int memctx_stats(int ctx_id, memctx_stats_t *stats);
+/* Frees every block still in the context, first reporting them as
+ * leaks when EXOCORE_HEAP_PROFILE is on.
+ */
 int memctx_destroy(int ctx_id);
+/* Whether [start, end) lies in the allocated part of one of the
+ * context's regions, i.e. in memory the owner may hand to syscalls.
+ */
+int memctx_contains(int ctx_id, uintptr_t start, uintptr_t end);
+/* Log live blocks as leaks; returns how many there were, or -1. */
+int memctx_report_leaks(int ctx_id);
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,17 @@
 extern "C" {
 #endif
 
+/* CPU features the string routines can use. The caller probes CPUID (and,
+ * for AVX2, must have enabled YMM state in XCR0) and passes the result to
+ * memutils_select; until then portable word-at-a-time code runs.
+ */
+#define MEMUTILS_FEAT_ERMS 0x1u
+#define MEMUTILS_FEAT_SSE2 0x2u
+#define MEMUTILS_FEAT_AVX2 0x4u
+
+void memutils_select(unsigned features);
+const char *memutils_variant(void);
+
 void *memcpy(void *dst, const void *src, size_t n);
 void *memset(void *dst, int val, size_t n);
 int strncmp(const char *s1, const char *s2, size_t n);
@@ -6,6 +6,10 @@
 extern "C" {
 #endif
 void modexec_set_mbi(multiboot_info_t *mbi);
+/* Run a module image where it lies. ELF modules must be relocatable
+ * (PIE); flat binaries are still copied to MODULE_BASE_ADDR.
+ */
+int modexec_exec(const uint8_t *src, uint32_t size);
 int modexec_run(const char *name);
 #ifdef __cplusplus
 }
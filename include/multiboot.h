@@ -8,7 +8,10 @@ extern "C" {
 #endif
 
 #define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_MEMORY (1u << 0)
+#define MULTIBOOT_INFO_MEM_MAP (1u << 6)
 #define MULTIBOOT_INFO_FRAMEBUFFER (1u << 12)
+#define MULTIBOOT_MEMORY_AVAILABLE 1
 
 typedef struct {
     uint32_t mod_start;
@@ -17,6 +20,13 @@ typedef struct {
     uint32_t reserved;
 } multiboot_module_t;
 
+typedef struct __attribute__((packed)) {
+    uint32_t size;      /* size of this entry, not counting this field */
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} multiboot_mmap_entry_t;
+
 typedef struct __attribute__((packed)) {
     uint32_t flags;
     uint32_t mem_lower, mem_upper;
@@ -0,0 +1,53 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NVMe over PCIe, namespace 1 only. The admin queue is polled at init.
+ * Each CPU gets its own I/O submission/completion queue pair (as many as
+ * the controller grants, shared round-robin beyond that) whose MSI-X
+ * vector targets that CPU, so submitters on different CPUs never touch
+ * the same queue state. Transfers are split into NVME_CHUNK_BYTES
+ * commands described by PRP lists, up to NVME_BATCH of them per doorbell.
+ */
+#define NVME_ADMIN_DEPTH  16
+#define NVME_QUEUE_DEPTH  64
+#define NVME_CHUNK_BYTES  (128u * 1024)
+#define NVME_BATCH        16
+/* Vector of I/O queue q (1-based) is NVME_VECTOR_BASE + q - 1. */
+#define NVME_VECTOR_BASE  0x58
+/* Interrupt coalescing: one interrupt per NVME_COALESCE_ENTRIES
+ * completions or after NVME_COALESCE_100US * 100 us, whichever is first.
+ */
+#define NVME_COALESCE_ENTRIES 4
+#define NVME_COALESCE_100US   1
+/* Polling interval without MSI-X, and the limit for any one command. */
+#define NVME_POLL_MS    1
+#define NVME_TIMEOUT_MS 5000
+
+typedef struct {
+    uint64_t sectors;
+    uint32_t io_queues;
+    uint32_t queue_depth;
+    uint32_t max_transfer;      /* bytes per command */
+    int msix;
+} nvme_info_t;
+
+/* Bring up the first NVMe controller and register namespace 1 as
+ * "nvme0". Returns 0 if a usable namespace is present.
+ */
+int nvme_init(void);
+int nvme_info(nvme_info_t *info);
+int nvme_read(uint64_t lba, void *buf, size_t count);
+int nvme_write(uint64_t lba, const void *buf, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NVME_H */
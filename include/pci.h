@@ -0,0 +1,68 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* PCI configuration space through the legacy 0xCF8/0xCFC mechanism. */
+#define PCI_COMMAND 0x04
+#define PCI_COMMAND_IO     0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+#define PCI_SUBCLASS_SATA 0x06
+
+#define PCI_CAP_MSI       0x05
+#define PCI_CAP_MSIX      0x11
+#define PCI_CAP_VENDOR    0x09
+
+typedef struct {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t fn;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint16_t vendor;
+    uint16_t device;
+} pci_device_t;
+
+uint32_t pci_read32(const pci_device_t *d, uint8_t off);
+uint8_t pci_read8(const pci_device_t *d, uint8_t off);
+void pci_write32(const pci_device_t *d, uint8_t off, uint32_t val);
+uint16_t pci_read16(const pci_device_t *d, uint8_t off);
+void pci_write16(const pci_device_t *d, uint8_t off, uint16_t val);
+
+/* Fill 'out' with the 'index'th function of this class and subclass, in
+ * bus order. Returns 0 if there is one.
+ */
+int pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_device_t *out);
+int pci_find_device(uint16_t vendor, uint16_t device, int index, pci_device_t *out);
+/* Address of BAR 'n' without its flag bits; 64-bit memory BARs take the
+ * next slot as the high half. I/O BARs return the port base.
+ */
+uint64_t pci_bar(const pci_device_t *d, int n);
+/* Set bits in the command register (decode, bus mastering). */
+void pci_enable(const pci_device_t *d, uint16_t bits);
+/* Config offset of the next capability 'id' after offset 'after' (0 for
+ * the first), or 0 when there is none.
+ */
+uint8_t pci_next_cap(const pci_device_t *d, uint8_t after, uint8_t id);
+/* Point MSI-X table entry 'entry' at 'vector' on the CPU with local APIC
+ * id 'apic_id' and enable MSI-X. Returns -1 without the capability or a
+ * local APIC.
+ */
+int pci_msix_route(const pci_device_t *d, uint16_t entry, uint8_t vector, uint32_t apic_id);
+/* The same with plain MSI: one message, 'vector' on 'apic_id'. */
+int pci_msi_route(const pci_device_t *d, uint8_t vector, uint32_t apic_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PCI_H */
@@ -0,0 +1,39 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Legacy 8259 pair remapped so IRQ n arrives on vector PIC_VECTOR_BASE + n. */
+#define PIC_VECTOR_BASE 0x20
+#define PIT_BASE_HZ 1193182u
+
+/* Remap both PICs and mask every line. */
+void pic_init(void);
+void pic_unmask(uint8_t irq);
+void pic_mask(uint8_t irq);
+void pic_eoi(uint8_t irq);
+
+/* Program PIT channel 0 as a periodic rate generator. Returns the rate
+ * actually achieved, which differs from 'hz' by the divisor rounding.
+ */
+uint32_t pit_init(uint32_t hz);
+
+/* Fire IRQ0 once after 'us' (capped at 54 ms). pit_init restores the
+ * periodic rate.
+ */
+void pit_oneshot_us(uint32_t us);
+
+/* Busy-wait on PIT channel 2. Needs no interrupts, so it also works for
+ * calibrating other timers and pacing AP startup.
+ */
+void pit_delay_us(uint32_t us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIT_H */
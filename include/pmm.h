@@ -0,0 +1,48 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "multiboot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PMM_PAGE_SIZE 4096u
+#define PMM_PAGE_SHIFT 12
+/* Largest buddy block is 2^PMM_MAX_ORDER pages (64 MiB). */
+#define PMM_MAX_ORDER 14
+/* Physical memory above this is ignored (matches the boot identity map). */
+#define PMM_MAX_PHYS (64ULL * 1024 * 1024 * 1024)
+
+typedef struct {
+    size_t total_pages;
+    size_t free_pages;
+    size_t reserved_pages;
+    uint32_t free_blocks[PMM_MAX_ORDER + 1];
+} pmm_stats_t;
+
+/* Seed the allocator from the multiboot memory map (or mem_upper when no map
+ * is present). Everything below kernel_end, the multiboot modules and the
+ * multiboot tables stay reserved. Returns 0 on success.
+ */
+int pmm_init_multiboot(const multiboot_info_t *mbi, uintptr_t kernel_end);
+int pmm_ready(void);
+
+/* Allocate/free 2^order physically contiguous, naturally aligned pages. */
+void *pmm_alloc_pages(unsigned order);
+void pmm_free_pages(void *addr, unsigned order);
+/* Take the specific page at 'addr' if it is free. Returns 0 on success. */
+int pmm_claim_page(void *addr);
+
+/* Smallest order whose block holds 'bytes'; -1 if it exceeds PMM_MAX_ORDER. */
+int pmm_order_for(size_t bytes);
+size_t pmm_free_bytes(void);
+void pmm_get_stats(pmm_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PMM_H */
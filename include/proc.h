@@ -13,6 +13,19 @@ extern "C" {
 #define PROC_NAME_MAX 31
 #define PROC_MAX_FDS 16
 #define PROC_EXEC_PATH_MAX VFS_MAX_PATH
+/* Each process runs on its own kernel-allocated stack; interrupts and
+ * syscalls nest on it too.
+ */
+#define PROC_STACK_SIZE 16384
+/* Memory a process may pass to syscalls is its memory context's arenas
+ * (every proc_alloc block, its stacks and a flat image) plus these
+ * ranges outside it, i.e. a spawned image's window.
+ */
+#define PROC_MAX_REGIONS 4
+/* Threads besides the main one. They share the process's memory,
+ * address space and descriptors and each run on a PROC_STACK_SIZE stack.
+ */
+#define PROC_MAX_THREADS 8
 
 #define PROC_STATE_UNUSED 0
 #define PROC_STATE_READY  1
@@ -20,6 +33,7 @@ extern "C" {
 #define PROC_STATE_EXITED 3
 #define PROC_STATE_ZOMBIE 4
 #define PROC_STATE_DEAD 5
+#define PROC_STATE_BLOCKED 6
 
 #define PROC_ERR_NOT_FOUND -3
 #define PROC_ERR_PROTECTED -13
@@ -51,6 +65,8 @@ int proc_spawn_exec(int parent_pid, const char *path);
 int proc_set_current(int pid);
 int proc_current_pid(void);
 int proc_current_valid(void);
+/* Whether [start, end) lies inside one of the current process's regions. */
+int proc_current_range_valid(uintptr_t start, uintptr_t end);
 int proc_exit(int pid, int status);
 int proc_wait(int parent_pid, int child_pid, int *status);
 int proc_kill(int pid, int status);
@@ -65,6 +81,23 @@ long proc_read(int pid, int fd, void *buf, size_t len);
 long proc_write(int pid, int fd, const void *buf, size_t len);
 long proc_lseek(int pid, int fd, long offset, int whence);
 int proc_close(int pid, int fd);
+int proc_pipe(int pid, int fds[2]);
+long proc_splice(int pid, int fd_in, int fd_out, size_t len);
+/* Whether 'fd' names an open file; unbound 0-2 fall back to the console. */
+int proc_fd_bound(int pid, int fd);
+
+/* Start 'entry(arg)' as a new thread of 'pid'. Returns its thread id (>0).
+ * Returning from 'entry' ends only that thread.
+ */
+int proc_thread_create(int pid, uintptr_t entry, uintptr_t arg);
+/* End the calling thread; from the main thread this exits the process.
+ * Returns only if there is no calling process thread.
+ */
+int proc_thread_exit(int status);
+/* Wait for thread 'tid' of 'pid' to end and free its stack. Threads stay
+ * joinable until joined or until the process is reaped.
+ */
+int proc_thread_join(int pid, int tid, int *status);
 
 #ifdef __cplusplus
 }
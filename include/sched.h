@@ -0,0 +1,133 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "ktimer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCHED_HZ 100
+/* Timer ticks a thread may run before it is preempted. */
+#define SCHED_QUANTUM 2
+/* Longest one-shot the idle BSP programs; the PIT counter tops out at 54 ms. */
+#define SCHED_IDLE_MAX_MS 50
+/* IPI that makes an idle CPU look at its run queue. */
+#define SCHED_KICK_VECTOR 0x41
+
+#define SCHED_UNUSED   0
+#define SCHED_READY    1
+#define SCHED_RUNNING  2
+#define SCHED_BLOCKED  3
+#define SCHED_SLEEPING 4
+#define SCHED_DEAD     5
+
+struct sched_waitq;
+
+/* A kernel thread. Embedded in its owner; the scheduler never allocates. */
+typedef struct sched_thread {
+    uint64_t rsp;
+    struct sched_thread *next;
+    int state;
+    int id;
+    int cpu;                /* run queue it was last placed on */
+    volatile int cancelled;
+    ktimer_t sleep_timer;
+    void *owner;            /* copied to cpu_t.current_owner while running */
+    uintptr_t cr3;          /* address space; 0 for the kernel's */
+    struct sched_waitq *waitq;
+    struct sched_thread *wait_next;
+    uintptr_t wait_key;     /* set by sched_wait_key */
+} sched_thread_t;
+
+/* Threads blocked until some condition changes. Embedded in the object
+ * they wait on.
+ */
+typedef struct sched_waitq {
+    sched_thread_t *head;
+} sched_waitq_t;
+
+typedef void (*sched_entry_t)(void *arg);
+
+/* Remap the PIC, start the PIT and take over the boot context as the idle
+ * thread. Interrupts stay disabled in kernel code; they are only enabled
+ * while a thread runs its entry function or the idle thread halts.
+ */
+void sched_init(void);
+int sched_active(void);
+
+/* Turn an application processor's boot context into its idle thread.
+ * Called with the kernel lock held.
+ */
+void sched_ap_enter(void) __attribute__((noreturn));
+
+/* Queue 't' to run 'fn(arg)' on the stack ending at 'stack_top'. */
+int sched_thread_start(sched_thread_t *t, uintptr_t stack_top, sched_entry_t fn, void *arg);
+
+/* The running thread, or NULL for the idle/boot context. */
+sched_thread_t *sched_current(void);
+
+/* Move the running context (thread or idle/boot) to address space 'cr3';
+ * 0 returns it to the kernel's. Switches away and back keep it.
+ */
+void sched_set_address_space(uintptr_t cr3);
+/* The running context's address space, 0 for the kernel's. */
+uintptr_t sched_address_space(void);
+
+/* Give up the CPU until sched_wakeup. Callers re-check their condition
+ * in a loop; the idle context instead runs whatever is ready, or halts
+ * until the next interrupt. A cancelled thread returns at once, as it
+ * does from sched_sleep_ms.
+ */
+void sched_block(void);
+void sched_wakeup(sched_thread_t *t);
+void sched_yield(void);
+void sched_sleep_ms(uint64_t ms);
+
+/* Block on 'q' until sched_wake_all(q). Callers loop on their condition,
+ * and the idle context waits as in sched_block. Returns -1 once the
+ * thread is cancelled; the caller must then unwind instead of waiting
+ * again.
+ */
+int sched_wait(sched_waitq_t *q);
+void sched_wake_all(sched_waitq_t *q);
+
+/* Wait on a queue shared by many keys. Only sched_wake_key with the same
+ * 'key' (or sched_wake_all) ends the wait early; a nonzero 'timeout_ms'
+ * bounds it. Returns 0 when woken, -1 on timeout or cancellation. The
+ * idle context waits as in sched_block and always returns -1.
+ */
+int sched_wait_key(sched_waitq_t *q, uintptr_t key, uint64_t timeout_ms);
+/* Wake up to 'max' waiters on 'key', longest waiting first. Returns how
+ * many were woken.
+ */
+int sched_wake_key(sched_waitq_t *q, uintptr_t key, int max);
+
+/* Ask a thread to exit. It is never stopped in place, since it may own a
+ * device or have one writing into its stack: a waiting thread is woken
+ * and its waits fail until it unwinds, and every thread exits at its next
+ * tick outside the kernel or on its way out of a syscall.
+ */
+void sched_cancel(sched_thread_t *t);
+int sched_cancelled(void);
+
+/* Terminate the running thread. */
+void sched_exit(void) __attribute__((noreturn));
+
+/* Enter or leave kernel context from thread code: interrupts off and the
+ * kernel lock held.
+ */
+void sched_lock(void);
+void sched_unlock(void);
+
+/* SCHED_HZ ticks since boot, derived from the monotonic clock. */
+uint64_t sched_ticks(void);
+uint64_t sched_switches(void);
+uint64_t sched_steals(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCHED_H */
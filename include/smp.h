@@ -0,0 +1,63 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SMP_MAX_CPUS 16
+#define SMP_AP_STACK_SIZE 16384
+#define SMP_DF_STACK_SIZE 4096
+/* Real-mode startup page for the application processors. Its previous
+ * contents are saved and restored around AP bring-up.
+ */
+#define SMP_TRAMPOLINE_BASE 0x8000
+
+/* Per-CPU block. %gs points at it on every CPU. */
+typedef struct cpu {
+    struct cpu *self;
+    int index;
+    uint32_t apic_id;
+    volatile int online;
+    void *current_owner;        /* owner of the thread running here */
+    uint8_t *stack;
+    uint8_t *df_stack;
+    uint64_t gdt[7] __attribute__((aligned(16)));
+    uint8_t tss[104] __attribute__((aligned(16)));
+} cpu_t;
+
+/* Discover CPUs through the ACPI MADT and set up the BSP's local APIC and
+ * per-CPU block. Returns the number of CPUs found (at least 1).
+ */
+int smp_init(void);
+
+/* Start every other CPU with INIT-SIPI-SIPI. Each one enters the scheduler
+ * idle loop. Returns the number of CPUs online.
+ */
+int smp_boot_aps(void);
+
+int smp_cpu_count(void);
+/* Send 'vector' to the CPU with the given index. */
+void smp_send_ipi(int index, uint8_t vector);
+int smp_cpu_index(void);
+/* Local APIC id of the CPU with the given index (the BSP's if invalid). */
+uint32_t smp_cpu_apic_id(int index);
+cpu_t *smp_this_cpu(void);
+/* This CPU's current_owner, read with a single %gs load. */
+void *smp_current_owner(void);
+
+/* Big kernel lock. Kernel code on any CPU runs under it: interrupt and
+ * syscall entry take it, and it is held across thread switches, so the
+ * owner is a CPU, not a thread. Process code runs without it. Recursive
+ * per CPU; callers have interrupts disabled.
+ */
+void kernel_lock(void);
+void kernel_unlock(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SMP_H */
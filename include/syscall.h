@@ -69,7 +69,29 @@ enum {
     SYS_FB_INFO = 53,
     SYS_DISPLAY_MODE = 54,
     SYS_FB_CLEAR = 55,
-    SYS_FB_DRAW_PIXEL = 56
+    SYS_FB_DRAW_PIXEL = 56,
+    /* a1: heapprof_site_t[a2] filled largest first, a3: optional
+     * heapprof_summary_t. Returns the number of sites written.
+     */
+    SYS_HEAP_PROFILE = 57,
+    /* Monotonic nanoseconds since boot from the calibrated TSC. */
+    SYS_CLOCK_NS = 58,
+    /* a1: fd to read, a2: fd to write, a3: max bytes. One side must be a
+     * pipe; data moves without passing through a caller buffer.
+     */
+    SYS_SPLICE = 59,
+    /* a1: entry(void *arg), a2: arg. Returns the new thread's id. */
+    SYS_THREAD_CREATE = 60,
+    /* a1: status. Ends the calling thread; the main thread ends the process. */
+    SYS_THREAD_EXIT = 61,
+    /* a1: thread id, a2: optional int status. */
+    SYS_THREAD_JOIN = 62,
+    /* a1: uint32_t word, a2: expected value, a3: timeout in ms (0 = none).
+     * Sleeps only while the word still holds the expected value.
+     */
+    SYS_FUTEX_WAIT = 63,
+    /* a1: uint32_t word, a2: max waiters to wake. Returns how many woke. */
+    SYS_FUTEX_WAKE = 64
 };
 
 typedef struct { uint32_t width; uint32_t height; uint32_t pitch; uint32_t bpp; uint32_t theme; uint32_t logs_visible; } syscall_fb_info_t;
@@ -79,7 +101,13 @@ typedef struct { uint32_t width; uint32_t height; uint32_t pitch; uint32_t bpp;
 #define SYS_DISPLAY_DARK_MODE 3u
 #define SYS_DISPLAY_WHITE_MODE 4u
 
+/* Calling convention for both SYSCALL and the int 0x80 fallback: number
+ * in rax, arguments in rdi, rsi, rdx, r10, r8, r9, result in rax. SYSCALL
+ * clobbers rcx and r11; all other registers are preserved.
+ */
 void syscall_init(void);
+/* Program this CPU's SYSCALL MSRs; syscall_init covers the BSP. */
+void syscall_cpu_init(void);
 void enter_user_mode(void (*entry)(void), void *user_stack);
 
 #ifdef __cplusplus
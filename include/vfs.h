@@ -25,12 +25,18 @@ extern "C" {
 
 #define VFS_TYPE_FILE 1
 #define VFS_TYPE_DIR  2
+#define VFS_TYPE_PIPE 3
+
+/* Bytes a pipe buffers before writers block: one page. */
+#define VFS_PIPE_BUF 4096
 
 typedef struct {
     uint32_t type;
     size_t size;
     uint32_t inode;
     uint32_t children;
+    /* Changes whenever the file's contents do. */
+    uint32_t version;
 } vfs_stat_t;
 
 typedef struct {
@@ -53,10 +59,32 @@ long vfs_read(int fd, void *buf, size_t len);
 long vfs_write(int fd, const void *buf, size_t len);
 long vfs_lseek(int fd, long offset, int whence);
 int vfs_close(int fd);
+/* Share an open file: the fd stays valid until closed once per dup. */
+int vfs_dup(int fd);
+/* Anonymous pipe: fds[0] reads, fds[1] writes. Reads block while it is
+ * empty and return 0 once every writer has closed; writes block while it
+ * is full and fail once every reader has closed.
+ */
+int vfs_pipe(int fds[2]);
+/* Move up to 'len' bytes between a pipe and a file without a caller
+ * buffer, blocking like read/write on the pipe end.
+ */
+long vfs_splice(int fd_in, int fd_out, size_t len);
+/* Borrow a regular file's bytes in place. Files of a page or more start
+ * on a page boundary. The bytes stay valid and unchanged until vfs_unmap,
+ * even if the file is rewritten or unlinked meanwhile.
+ */
+typedef struct vfs_map vfs_map_t;
+const void *vfs_map(const char *path, size_t *size, vfs_map_t **map);
+void vfs_unmap(vfs_map_t *map);
 int vfs_stat(const char *path, vfs_stat_t *st);
 int vfs_fstat(int fd, vfs_stat_t *st);
 long vfs_getdents(int fd, vfs_dirent_t *ents, size_t max_ents);
 int vfs_is_ready(void);
+/* Compress closed files into zram until about 'goal' bytes of heap are
+ * released. Returns the bytes released.
+ */
+size_t vfs_pack_cold(size_t goal);
 
 #ifdef __cplusplus
 }
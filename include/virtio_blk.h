@@ -0,0 +1,45 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* virtio-blk over modern (virtio 1.0) PCI: one split virtqueue, requests
+ * of VIRTIO_BLK_CHUNK sectors each, up to VIRTIO_BLK_BATCH of them in
+ * flight per caller. With indirect descriptors a request takes one ring
+ * slot, otherwise a three-descriptor chain. Completions arrive by MSI-X
+ * on VIRTIO_BLK_VECTOR; without it the waiters poll the used ring.
+ */
+#define VIRTIO_BLK_QUEUE_MAX 128
+#define VIRTIO_BLK_CHUNK     128
+#define VIRTIO_BLK_BATCH     32
+#define VIRTIO_BLK_VECTOR    0x50
+/* Polling interval without MSI-X, and the limit for any one request. */
+#define VIRTIO_BLK_POLL_MS    1
+#define VIRTIO_BLK_TIMEOUT_MS 5000
+
+typedef struct {
+    uint64_t sectors;
+    uint32_t queue_size;
+    int indirect;
+    int msix;
+    int readonly;
+} virtio_blk_info_t;
+
+/* Find and start the first virtio-blk function and register it as
+ * "virtio0". Returns 0 if a disk is present.
+ */
+int virtio_blk_init(void);
+int virtio_blk_info(virtio_blk_info_t *info);
+int virtio_blk_read(uint64_t lba, void *buf, size_t count);
+int virtio_blk_write(uint64_t lba, const void *buf, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIRTIO_BLK_H */
@@ -0,0 +1,59 @@
+#ifndef VMM_H
+#define VMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Per-process address spaces. Each one shares the boot identity map
+ * (PML4 slot 0, built by boot.S) and adds a private window at
+ * VMM_USER_BASE whose 4 KiB pages are filled in on first touch.
+ */
+#define VMM_USER_BASE 0x0000008000000000ULL   /* PML4 slot 1 */
+#define VMM_USER_SIZE 0x0000008000000000ULL
+#define VMM_MAX_AREAS 16
+
+typedef struct vmm_space vmm_space_t;
+
+/* Record the boot page tables and enable write protection in ring 0.
+ * vmm_cpu_init repeats the latter on each application processor.
+ */
+void vmm_init(void);
+void vmm_cpu_init(void);
+
+vmm_space_t *vmm_space_create(void);
+/* Free every private page and table. The space must not be active on
+ * any CPU.
+ */
+void vmm_space_destroy(vmm_space_t *space);
+/* Value for CR3; 0 stands for the kernel's own tables. */
+uintptr_t vmm_space_root(const vmm_space_t *space);
+/* Load 'root' into CR3 unless it is already there. */
+void vmm_activate(uintptr_t root);
+
+/* Back [start, start + len) of the window lazily: page offsets below
+ * 'src_len' come from 'src', the rest read as zero. A read-only page that
+ * lies wholly inside a page-aligned 'src' maps the source page itself,
+ * so the source must outlive the space.
+ */
+int vmm_map_lazy(vmm_space_t *space, uintptr_t start, size_t len,
+                 const void *src, size_t src_len, int writable);
+/* Populate the page holding 'addr' as a fault would. */
+int vmm_fault_in(vmm_space_t *space, uintptr_t addr, int write);
+/* Resolve a #PF against the active space. Returns 0 when the access may
+ * be retried.
+ */
+int vmm_handle_fault(uintptr_t addr, uint32_t err);
+/* Physical address behind 'addr', or 0 if nothing is mapped yet. */
+uintptr_t vmm_translate(const vmm_space_t *space, uintptr_t addr);
+/* Pages allocated for this space alone (not shared, not tables). */
+size_t vmm_private_pages(const vmm_space_t *space);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VMM_H */
@@ -0,0 +1,41 @@
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Compressed in-RAM tier. Callers hand over cold buffers and get back an
+ * opaque object holding an LZ4 copy; they free the original themselves.
+ */
+typedef struct zram_obj zram_obj_t;
+
+typedef struct {
+    uint32_t objects;
+    uint32_t rejects;
+    size_t orig_bytes;
+    size_t comp_bytes;
+    size_t faults;
+} zram_stats_t;
+
+/* Returns NULL if the data does not shrink by at least 1/8 or memory for the
+ * compressed copy is unavailable.
+ */
+zram_obj_t *zram_store(const void *data, size_t len);
+/* Decompress into 'out' (at least zram_size() bytes). Counts as a fault. */
+int zram_load(const zram_obj_t *obj, void *out, size_t out_len);
+size_t zram_size(const zram_obj_t *obj);
+void zram_drop(zram_obj_t *obj);
+void zram_get_stats(zram_stats_t *stats);
+
+/* Non-zero when free physical memory has dropped below 1/8 of RAM. */
+int zram_under_pressure(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZRAM_H */
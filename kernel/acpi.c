@@ -0,0 +1,122 @@
+#include "acpi.h"
+#include "memutils.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+#define MADT_LAPIC 0
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_LAPIC_ENABLED 0x1
+
+static const acpi_sdt_header_t *root;
+static int root_is_xsdt;
+
+static uint8_t sum_bytes(const void *p, size_t len) {
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+    while (len--)
+        sum += *b++;
+    return sum;
+}
+
+static const acpi_rsdp_t *scan_rsdp(uintptr_t start, uintptr_t end) {
+    for (uintptr_t p = start; p + sizeof(acpi_rsdp_t) <= end; p += 16) {
+        const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)p;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && sum_bytes(rsdp, 20) == 0)
+            return rsdp;
+    }
+    return NULL;
+}
+
+/* Tables may sit above the boot identity map; map the header, then the
+ * whole table once its length is known.
+ */
+static const acpi_sdt_header_t *map_table(uint64_t addr) {
+    if (!addr)
+        return NULL;
+    boot_map_identity_span(addr, sizeof(acpi_sdt_header_t));
+    const acpi_sdt_header_t *h = (const acpi_sdt_header_t *)(uintptr_t)addr;
+    if (h->length < sizeof(*h) || h->length > 0x100000)
+        return NULL;
+    boot_map_identity_span(addr, h->length);
+    return sum_bytes(h, h->length) == 0 ? h : NULL;
+}
+
+int acpi_init(void) {
+    if (root)
+        return 0;
+    uint16_t segment;
+    /* EBDA segment from the BIOS data area; read via asm since GCC rejects
+     * dereferencing addresses in page zero.
+     */
+    __asm__ volatile ("movw 0x40E, %0" : "=r"(segment));
+    uintptr_t ebda = (uintptr_t)segment << 4;
+    const acpi_rsdp_t *rsdp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000)
+        rsdp = scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp)
+        rsdp = scan_rsdp(0xE0000, 0x100000);
+    if (!rsdp)
+        return -1;
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && sum_bytes(rsdp, rsdp->length) == 0) {
+        root = map_table(rsdp->xsdt_address);
+        root_is_xsdt = root != NULL;
+    }
+    if (!root)
+        root = map_table(rsdp->rsdt_address);
+    return root ? 0 : -1;
+}
+
+const acpi_sdt_header_t *acpi_find_table(const char *sig) {
+    if (!root || !sig)
+        return NULL;
+    size_t entry = root_is_xsdt ? 8 : 4;
+    size_t count = (root->length - sizeof(*root)) / entry;
+    const uint8_t *list = (const uint8_t *)(root + 1);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t addr = 0;
+        memcpy(&addr, list + i * entry, entry);
+        const acpi_sdt_header_t *h = map_table(addr);
+        if (h && memcmp(h->signature, sig, 4) == 0)
+            return h;
+    }
+    return NULL;
+}
+
+int acpi_parse_madt(acpi_madt_info_t *out) {
+    if (!out)
+        return -1;
+    memset(out, 0, sizeof(*out));
+    const acpi_sdt_header_t *madt = acpi_find_table("APIC");
+    if (!madt || madt->length < sizeof(*madt) + 8)
+        return -1;
+    const uint8_t *base = (const uint8_t *)madt;
+    uint32_t lapic32;
+    memcpy(&lapic32, base + sizeof(*madt), 4);
+    out->lapic_base = lapic32;
+    const uint8_t *p = base + sizeof(*madt) + 8;
+    const uint8_t *end = base + madt->length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        if (p[0] == MADT_LAPIC && p[1] >= 8) {
+            uint32_t flags;
+            memcpy(&flags, p + 4, 4);
+            if ((flags & MADT_LAPIC_ENABLED) && out->cpu_count < ACPI_MAX_CPUS)
+                out->apic_ids[out->cpu_count++] = p[3];
+        } else if (p[0] == MADT_LAPIC_OVERRIDE && p[1] >= 12) {
+            memcpy(&out->lapic_base, p + 4, 8);
+        }
+        p += p[1];
+    }
+    return out->cpu_count ? 0 : -1;
+}
@@ -0,0 +1,427 @@
+#include "ahci.h"
+#include "blkdev.h"
+#include "pci.h"
+#include "lapic.h"
+#include "idt.h"
+#include "sched.h"
+#include "clock.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "memutils.h"
+#include "console.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+#define PCI_PROGIF_AHCI 0x01
+#define AHCI_BAR 5
+
+/* HBA registers. */
+#define HBA_CAP 0x00
+#define HBA_GHC 0x04
+#define HBA_IS  0x08
+#define HBA_PI  0x0C
+#define HBA_PORTS 0x100
+#define HBA_PORT_SIZE 0x80
+#define HBA_PORTS_MAX 32
+
+#define CAP_NCS(cap) ((((cap) >> 8) & 0x1F) + 1)
+#define CAP_SNCQ (1u << 30)
+#define CAP_S64A (1u << 31)
+#define GHC_IE   (1u << 1)
+#define GHC_AE   (1u << 31)
+
+/* Port registers. */
+#define PX_CLB  0x00
+#define PX_CLBU 0x04
+#define PX_FB   0x08
+#define PX_FBU  0x0C
+#define PX_IS   0x10
+#define PX_IE   0x14
+#define PX_CMD  0x18
+#define PX_TFD  0x20
+#define PX_SIG  0x24
+#define PX_SSTS 0x28
+#define PX_SERR 0x30
+#define PX_SACT 0x34
+#define PX_CI   0x38
+
+#define CMD_ST  (1u << 0)
+#define CMD_FRE (1u << 4)
+#define CMD_FR  (1u << 14)
+#define CMD_CR  (1u << 15)
+#define TFD_BSY 0x80
+#define TFD_DRQ 0x08
+#define TFD_ERR 0x01
+#define SSTS_DET_PRESENT 3
+#define SIG_ATA 0x00000101
+/* D2H, PIO setup and set-device-bits FISes, and every error. */
+#define IS_COMPLETE (0x1u | 0x2u | 0x8u)
+#define IS_ERROR    ((1u << 30) | (1u << 29) | (1u << 28) | (1u << 27))
+
+#define FIS_H2D 0x27
+#define FIS_H2D_COMMAND 0x80
+#define ATA_IDENTIFY          0xEC
+#define ATA_READ_DMA_EXT      0x25
+#define ATA_WRITE_DMA_EXT     0x35
+#define ATA_READ_FPDMA_QUEUED  0x60
+#define ATA_WRITE_FPDMA_QUEUED 0x61
+
+/* Command list (1 KiB) and FIS receive area share one page; command
+ * tables of one PRD each follow in their own pages.
+ */
+#define CL_FIS_OFF   1024
+#define TABLE_BYTES  256
+#define TABLE_PRD    0x80
+#define CHDR_WRITE   (1u << 6)
+#define PRD_IRQ      (1u << 31)
+#define BOUNCE_BYTES (AHCI_CHUNK * BLKDEV_SECTOR_SIZE)
+
+typedef struct {
+    volatile uint8_t *regs;
+    ahci_info_t info;
+    int broken;
+    uint8_t *cl;
+    uint8_t *tables;
+    uint32_t issued;            /* handed to the HBA, not yet reaped */
+    volatile uint8_t failed[AHCI_SLOTS_MAX];
+    blkdev_queue_t bq;
+} ahci_port_t;
+
+static volatile uint8_t *hba;
+static uint32_t hba_cap;
+static ahci_port_t ports[AHCI_DISKS_MAX];
+static int nports;
+static int msi;
+
+static uint32_t hba_read(uint32_t off) {
+    return *(volatile uint32_t *)(hba + off);
+}
+
+static void hba_write(uint32_t off, uint32_t v) {
+    *(volatile uint32_t *)(hba + off) = v;
+}
+
+static uint32_t port_read(ahci_port_t *p, uint32_t off) {
+    return *(volatile uint32_t *)(p->regs + off);
+}
+
+static void port_write(ahci_port_t *p, uint32_t off, uint32_t v) {
+    *(volatile uint32_t *)(p->regs + off) = v;
+}
+
+/* Poll until (reg & mask) == want; -1 on timeout. */
+static int port_poll(ahci_port_t *p, uint32_t off, uint32_t mask, uint32_t want, uint64_t timeout_ms) {
+    uint64_t deadline = clock_ms() + timeout_ms;
+    while ((port_read(p, off) & mask) != want) {
+        if (clock_ms() >= deadline)
+            return -1;
+        __asm__ volatile ("pause");
+    }
+    return 0;
+}
+
+static int port_stop(ahci_port_t *p) {
+    port_write(p, PX_CMD, port_read(p, PX_CMD) & ~CMD_ST);
+    if (port_poll(p, PX_CMD, CMD_CR, 0, 500) != 0)
+        return -1;
+    port_write(p, PX_CMD, port_read(p, PX_CMD) & ~CMD_FRE);
+    return port_poll(p, PX_CMD, CMD_FR, 0, 500);
+}
+
+/* FIS receive first, so the drive's status reaches PxTFD, then the
+ * command engine once the drive is idle.
+ */
+static int port_start(ahci_port_t *p) {
+    port_write(p, PX_SERR, 0xFFFFFFFFu);
+    port_write(p, PX_IS, 0xFFFFFFFFu);
+    port_write(p, PX_CMD, port_read(p, PX_CMD) | CMD_FRE);
+    if (port_poll(p, PX_TFD, TFD_BSY | TFD_DRQ, 0, 1000) != 0)
+        return -1;
+    port_write(p, PX_CMD, port_read(p, PX_CMD) | CMD_ST);
+    return 0;
+}
+
+/* A task file error aborts every outstanding command on the port (NCQ
+ * reports them together), so all of them fail and the port restarts.
+ */
+static void port_recover(ahci_port_t *p) {
+    for (uint32_t s = 0; s < AHCI_SLOTS_MAX; ++s) {
+        if (p->issued & (1u << s)) {
+            p->failed[s] = 1;
+            p->bq.done[s] = 1;
+        }
+    }
+    p->issued = 0;
+    console_puts("ahci: port error, restarting\n");
+    if (port_stop(p) != 0 || port_start(p) != 0)
+        p->broken = 1;
+}
+
+/* A slot has finished once the HBA clears both its CI and SACT bits. */
+static void reap(void *ctx) {
+    ahci_port_t *p = ctx;
+    uint32_t is = port_read(p, PX_IS);
+    port_write(p, PX_IS, is);
+    uint32_t finished;
+    if (is & IS_ERROR) {
+        finished = p->issued;
+        port_recover(p);
+    } else {
+        finished = p->issued & ~(port_read(p, PX_SACT) | port_read(p, PX_CI));
+        p->issued &= ~finished;
+        for (uint32_t s = 0; s < AHCI_SLOTS_MAX; ++s)
+            if (finished & (1u << s))
+                p->bq.done[s] = 1;
+    }
+    if (finished)
+        sched_wake_all(&p->bq.done_waiters);
+}
+
+static void ahci_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+    lapic_eoi();
+    uint32_t is = hba_read(HBA_IS);
+    for (int i = 0; i < nports; ++i) {
+        if (is & (1u << ports[i].info.port))
+            reap(&ports[i]);
+    }
+    hba_write(HBA_IS, is);
+}
+
+/* Fill slot 's' with a one-PRD command; returns its CI/SACT bit. */
+static uint32_t build(ahci_port_t *p, int s, uint8_t command, uint64_t lba, uint32_t count,
+                      uintptr_t addr, uint32_t bytes, int write) {
+    uint8_t *t = p->tables + (size_t)s * TABLE_BYTES;
+    memset(t, 0, TABLE_PRD + 16);
+    t[0] = FIS_H2D;
+    t[1] = FIS_H2D_COMMAND;
+    t[2] = command;
+    t[4] = (uint8_t)lba;
+    t[5] = (uint8_t)(lba >> 8);
+    t[6] = (uint8_t)(lba >> 16);
+    t[7] = command == ATA_IDENTIFY ? 0 : 0x40;
+    t[8] = (uint8_t)(lba >> 24);
+    t[9] = (uint8_t)(lba >> 32);
+    t[10] = (uint8_t)(lba >> 40);
+    if (command == ATA_READ_FPDMA_QUEUED || command == ATA_WRITE_FPDMA_QUEUED) {
+        /* Sector count moves to the feature field; the count carries the tag. */
+        t[3] = (uint8_t)count;
+        t[11] = (uint8_t)(count >> 8);
+        t[12] = (uint8_t)(s << 3);
+    } else {
+        t[12] = (uint8_t)count;
+        t[13] = (uint8_t)(count >> 8);
+    }
+    uint32_t *prd = (uint32_t *)(t + TABLE_PRD);
+    prd[0] = (uint32_t)addr;
+    prd[1] = (uint32_t)((uint64_t)addr >> 32);
+    prd[3] = (bytes - 1) | PRD_IRQ;
+    uint32_t *hdr = (uint32_t *)(p->cl + (size_t)s * 32);
+    hdr[0] = 5 | (write ? CHDR_WRITE : 0) | (1u << 16);     /* 5-dword FIS, one PRD */
+    hdr[1] = 0;
+    hdr[2] = (uint32_t)(uintptr_t)t;
+    hdr[3] = (uint32_t)((uint64_t)(uintptr_t)t >> 32);
+    p->bq.done[s] = 0;
+    p->failed[s] = 0;
+    return 1u << s;
+}
+
+/* NCQ commands are marked active in SACT before they are issued. */
+static void issue(ahci_port_t *p, uint32_t mask) {
+    __sync_synchronize();
+    if (p->info.ncq)
+        port_write(p, PX_SACT, mask);
+    port_write(p, PX_CI, mask);
+    p->issued |= mask;
+}
+
+/* 'addr' is identity mapped and word aligned. */
+static int transfer(void *ctx, uint64_t lba, uintptr_t addr, size_t count, int write) {
+    ahci_port_t *p = ctx;
+    uint8_t command;
+    if (p->info.ncq)
+        command = write ? ATA_WRITE_FPDMA_QUEUED : ATA_READ_FPDMA_QUEUED;
+    else
+        command = write ? ATA_WRITE_DMA_EXT : ATA_READ_DMA_EXT;
+    int ids[AHCI_SLOTS_MAX];
+    while (count) {
+        int n = 0;
+        uint32_t mask = 0;
+        while (count && n < AHCI_SLOTS_MAX) {
+            int s = blkdev_slot_alloc(&p->bq, n == 0);
+            if (s < 0)
+                break;
+            uint32_t chunk = count > AHCI_CHUNK ? AHCI_CHUNK : (uint32_t)count;
+            mask |= build(p, s, command, lba, chunk, addr, chunk * BLKDEV_SECTOR_SIZE, write);
+            ids[n++] = s;
+            lba += chunk;
+            addr += (uintptr_t)chunk * BLKDEV_SECTOR_SIZE;
+            count -= chunk;
+        }
+        if (n == 0)
+            return -1;
+        issue(p, mask);
+        if (blkdev_batch_wait(&p->bq, ids, n) != 0) {
+            /* The HBA may still own the slots; never reuse them. */
+            p->broken = 1;
+            console_puts("ahci: command timed out\n");
+            return -1;
+        }
+        int rc = 0;
+        for (int i = 0; i < n; ++i) {
+            if (p->failed[ids[i]])
+                rc = -1;
+            blkdev_slot_free(&p->bq, ids[i]);
+        }
+        if (rc != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int request(ahci_port_t *p, uint64_t lba, void *buf, size_t count, int write) {
+    if (p->broken)
+        return -1;
+    if (count == 0)
+        return 0;
+    uintptr_t addr = (uintptr_t)buf;
+    /* Process windows are not identity mapped; PRDs need word alignment,
+     * and 32-bit HBAs memory below 4 GiB.
+     */
+    if (addr >= VMM_USER_BASE || (addr & 1) || (!(hba_cap & CAP_S64A) && addr + count * BLKDEV_SECTOR_SIZE > 0x100000000ull))
+        return blkdev_bounce(&p->bq, transfer, lba, buf, count, write);
+    return transfer(p, lba, addr, count, write);
+}
+
+static int blk_read(void *ctx, uint64_t lba, void *buf, size_t count) {
+    return request(ctx, lba, buf, count, 0);
+}
+
+static int blk_write(void *ctx, uint64_t lba, const void *buf, size_t count) {
+    return request(ctx, lba, (void *)buf, count, 1);
+}
+
+static const blkdev_ops_t ahci_blk_ops = { blk_read, blk_write };
+
+/* IDENTIFY through slot 0 into the bounce buffer, polled. */
+static int identify(ahci_port_t *p, uint16_t *id) {
+    build(p, 0, ATA_IDENTIFY, 0, 0, (uintptr_t)p->bq.bounce, 512, 0);
+    port_write(p, PX_IS, 0xFFFFFFFFu);
+    port_write(p, PX_CI, 1);
+    uint64_t deadline = clock_ms() + AHCI_TIMEOUT_MS;
+    while (port_read(p, PX_CI) & 1) {
+        if ((port_read(p, PX_IS) & IS_ERROR) || clock_ms() >= deadline)
+            return -1;
+        __asm__ volatile ("pause");
+    }
+    if (port_read(p, PX_TFD) & TFD_ERR)
+        return -1;
+    memcpy(id, p->bq.bounce, 512);
+    return 0;
+}
+
+static int port_setup(ahci_port_t *p, uint32_t port) {
+    p->regs = hba + HBA_PORTS + port * HBA_PORT_SIZE;
+    p->info.port = port;
+    if ((port_read(p, PX_SSTS) & 0xF) != SSTS_DET_PRESENT || port_read(p, PX_SIG) != SIG_ATA)
+        return -1;
+    p->cl = pmm_alloc_pages(0);
+    p->tables = pmm_alloc_pages(1);
+    p->bq.bounce = pmm_alloc_pages(5);
+    if (!p->cl || !p->tables || !p->bq.bounce)
+        return -1;
+    if (!(hba_cap & CAP_S64A) && (uint64_t)(uintptr_t)p->tables + 2 * PMM_PAGE_SIZE > 0x100000000ull)
+        return -1;
+    memset(p->cl, 0, PMM_PAGE_SIZE);
+    if (port_stop(p) != 0)
+        return -1;
+    uint64_t cl = (uintptr_t)p->cl;
+    port_write(p, PX_CLB, (uint32_t)cl);
+    port_write(p, PX_CLBU, (uint32_t)(cl >> 32));
+    port_write(p, PX_FB, (uint32_t)(cl + CL_FIS_OFF));
+    port_write(p, PX_FBU, (uint32_t)((cl + CL_FIS_OFF) >> 32));
+    if (port_start(p) != 0)
+        return -1;
+    uint16_t id[256];
+    if (identify(p, id) != 0 || !(id[83] & (1u << 10)))
+        return -1;  /* LBA48 only */
+    p->info.sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                      ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+    p->info.ncq = (hba_cap & CAP_SNCQ) && (id[76] & (1u << 8));
+    uint32_t slots = CAP_NCS(hba_cap);
+    if (p->info.ncq && (uint32_t)(id[75] & 0x1F) + 1 < slots)
+        slots = (uint32_t)(id[75] & 0x1F) + 1;
+    p->info.slots = slots;
+    blkdev_queue_init(&p->bq, (int)slots, reap, p);
+    p->bq.irq = msi;
+    p->bq.poll_ms = AHCI_POLL_MS;
+    p->bq.timeout_ms = AHCI_TIMEOUT_MS;
+    p->bq.bounce_sectors = AHCI_CHUNK;
+    p->issued = 0;
+    port_write(p, PX_IE, msi ? IS_COMPLETE | IS_ERROR : 0);
+    return 0;
+}
+
+/* Undo a failed port_setup so the next port can use the entry. */
+static void port_release(ahci_port_t *p) {
+    if (p->cl)
+        port_stop(p);
+    if (p->cl)
+        pmm_free_pages(p->cl, 0);
+    if (p->tables)
+        pmm_free_pages(p->tables, 1);
+    if (p->bq.bounce)
+        pmm_free_pages(p->bq.bounce, 5);
+    memset(p, 0, sizeof(*p));
+}
+
+int ahci_init(void) {
+    pci_device_t d;
+    int found = -1;
+    if (nports)
+        return nports;
+    for (int i = 0; pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, i, &d) == 0; ++i) {
+        if (d.prog_if == PCI_PROGIF_AHCI) {
+            found = 0;
+            break;
+        }
+    }
+    if (found != 0)
+        return 0;
+    pci_enable(&d, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    uint64_t abar = pci_bar(&d, AHCI_BAR);
+    boot_map_identity_span(abar, HBA_PORTS + HBA_PORTS_MAX * HBA_PORT_SIZE);
+    hba = (volatile uint8_t *)(uintptr_t)abar;
+    hba_write(HBA_GHC, hba_read(HBA_GHC) | GHC_AE);
+    hba_cap = hba_read(HBA_CAP);
+    if (sched_active() && pci_msi_route(&d, AHCI_VECTOR, lapic_id()) == 0) {
+        msi = 1;
+        register_irq_handler(AHCI_VECTOR, ahci_irq);
+    }
+    uint32_t pi = hba_read(HBA_PI);
+    for (uint32_t port = 0; port < HBA_PORTS_MAX && nports < AHCI_DISKS_MAX; ++port) {
+        ahci_port_t *p = &ports[nports];
+        if (!(pi & (1u << port)))
+            continue;
+        if (port_setup(p, port) != 0) {
+            port_release(p);
+            continue;
+        }
+        p->info.msi = msi;
+        char name[] = "ahci0";
+        name[4] = (char)('0' + nports);
+        blkdev_register(name, p->info.sectors, BLKDEV_RANK_AHCI, &ahci_blk_ops, p);
+        nports++;
+    }
+    hba_write(HBA_IS, 0xFFFFFFFFu);
+    if (msi)
+        hba_write(HBA_GHC, hba_read(HBA_GHC) | GHC_IE);
+    return nports;
+}
+
+int ahci_info(int disk, ahci_info_t *info) {
+    if (disk < 0 || disk >= nports || !info)
+        return -1;
+    *info = ports[disk].info;
+    return 0;
+}
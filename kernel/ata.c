@@ -0,0 +1,254 @@
+#include "ata.h"
+#include "idt.h"
+#include "pit.h"
+#include "sched.h"
+#include "clock.h"
+#include "pci.h"
+#include "io.h"
+#include "vmm.h"
+#include "console.h"
+#include "blkdev.h"
+
+/* Bus-master registers of the primary channel, relative to BAR4. */
+#define BM_COMMAND 0x0
+#define BM_STATUS  0x2
+#define BM_PRDT    0x4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ  0x08      /* device to memory */
+#define BM_ST_ACTIVE 0x01
+#define BM_ST_ERROR  0x02
+#define BM_ST_IRQ    0x04
+#define PRD_EOT 0x8000
+/* Controller status polls after a lost interrupt; about 1 us each. */
+#define BM_POLL_LIMIT 5000000u
+
+typedef struct {
+    uint32_t addr;
+    uint16_t bytes;         /* 0 means 64 KiB */
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+static int present;
+static uint16_t bm_base;
+static int dma_enabled;
+/* Aligned to its size, so the table never crosses a 64 KiB boundary. */
+static ata_prd_t prdt[ATA_PRD_MAX] __attribute__((aligned(sizeof(ata_prd_t) * ATA_PRD_MAX)));
+static volatile int irq_pending;
+static sched_waitq_t irq_waiters;
+static int channel_busy;
+static sched_waitq_t channel_waiters;
+
+/* The driver reads the status register afterwards, which acks the drive. */
+static void ata_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+    irq_pending = 1;
+    pic_eoi(ATA_IRQ);
+    sched_wake_all(&irq_waiters);
+}
+
+/* A cancelled caller stops sleeping; it still polls the drive to the
+ * end of the command before giving up the channel.
+ */
+static int ata_irq_wait(void) {
+    uint64_t deadline = clock_ms() + ATA_IRQ_TIMEOUT_MS;
+    while (!irq_pending) {
+        uint64_t now = clock_ms();
+        if (now >= deadline)
+            return -1;
+        if (sched_wait_key(&irq_waiters, 0, deadline - now) != 0 && sched_cancelled())
+            return -1;
+    }
+    irq_pending = 0;
+    return 0;
+}
+
+/* The primary channel must sit at the legacy ports the PIO driver uses
+ * (compatibility mode) and the function must be a bus master.
+ */
+static void dma_probe(void) {
+    pci_device_t ide;
+    ata_pio_info_t disk;
+    if (ata_pio_info(&disk) != 0 || !disk.dma)
+        return;
+    for (int i = 0; pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, i, &ide) == 0; ++i) {
+        uint32_t bar4 = pci_read32(&ide, 0x20);
+        if ((ide.prog_if & 0x80) && !(ide.prog_if & 0x01) && (bar4 & 1)) {
+            pci_enable(&ide, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+            bm_base = (uint16_t)pci_bar(&ide, 4);
+            dma_enabled = 1;
+            return;
+        }
+    }
+}
+
+static int blk_read(void *ctx, uint64_t lba, void *buf, size_t count) {
+    (void)ctx;
+    return ata_read(lba, buf, count);
+}
+
+static int blk_write(void *ctx, uint64_t lba, const void *buf, size_t count) {
+    (void)ctx;
+    return ata_write(lba, buf, count);
+}
+
+static const blkdev_ops_t ata_blk_ops = { blk_read, blk_write };
+
+int ata_init(void) {
+    present = ata_pio_init() == 0;
+    if (!present)
+        return -1;
+    if (sched_active()) {
+        register_irq_handler(PIC_VECTOR_BASE + ATA_IRQ, ata_irq);
+        pic_unmask(ATA_IRQ);
+        ata_pio_set_irq_wait(ata_irq_wait);
+    }
+    dma_probe();
+    ata_pio_info_t disk;
+    ata_pio_info(&disk);
+    blkdev_register("ata0", disk.sectors, BLKDEV_RANK_ATA, &ata_blk_ops, 0);
+    return 0;
+}
+
+int ata_info(ata_pio_info_t *info) {
+    return present ? ata_pio_info(info) : -1;
+}
+
+int ata_dma_enabled(void) {
+    return dma_enabled;
+}
+
+/* Physically contiguous means identity mapped here: anything below the
+ * process windows. PRD addresses are 32-bit and must be even.
+ */
+static int dma_reachable(const void *buf, size_t count) {
+    uintptr_t start = (uintptr_t)buf;
+    uint64_t end = (uint64_t)start + (uint64_t)count * ATA_PIO_SECTOR_SIZE;
+    return dma_enabled && !(start & 1) && start < VMM_USER_BASE && end <= 0x100000000ull;
+}
+
+static void build_prdt(uintptr_t addr, uint32_t bytes) {
+    int n = 0;
+    while (bytes) {
+        uint32_t chunk = 0x10000u - (uint32_t)(addr & 0xFFFF);
+        if (chunk > bytes)
+            chunk = bytes;
+        prdt[n].addr = (uint32_t)addr;
+        prdt[n].bytes = (uint16_t)chunk;
+        prdt[n].flags = 0;
+        addr += chunk;
+        bytes -= chunk;
+        n++;
+    }
+    prdt[n - 1].flags = PRD_EOT;
+}
+
+/* Sleep for the completion interrupt; the controller's status settles a
+ * lost one.
+ */
+static int dma_wait(void) {
+    if (sched_active())
+        ata_irq_wait();
+    for (uint32_t i = 0; i < BM_POLL_LIMIT; ++i) {
+        uint8_t st = io_inb(bm_base + BM_STATUS);
+        if ((st & BM_ST_IRQ) || !(st & BM_ST_ACTIVE))
+            return st & BM_ST_ERROR ? -1 : 0;
+    }
+    return -1;
+}
+
+/* One command of at most ATA_PIO_MAX_SECTORS, so at most three PRDs. */
+static int dma_command(uint64_t lba, uintptr_t addr, uint32_t n, int write) {
+    uint8_t dir = write ? 0 : BM_CMD_READ;
+    build_prdt(addr, n * ATA_PIO_SECTOR_SIZE);
+    io_outb(bm_base + BM_COMMAND, dir);
+    io_outl(bm_base + BM_PRDT, (uint32_t)(uintptr_t)prdt);
+    io_outb(bm_base + BM_STATUS, io_inb(bm_base + BM_STATUS) | BM_ST_ERROR | BM_ST_IRQ);
+    irq_pending = 0;
+    if (ata_pio_start_dma(lba, n, write) != 0)
+        return -1;
+    io_outb(bm_base + BM_COMMAND, dir | BM_CMD_START);
+    int rc = dma_wait();
+    io_outb(bm_base + BM_COMMAND, dir);
+    io_outb(bm_base + BM_STATUS, io_inb(bm_base + BM_STATUS) | BM_ST_ERROR | BM_ST_IRQ);
+    if (ata_pio_end_dma() != 0)
+        rc = -1;
+    return rc;
+}
+
+static int dma_transfer(uint64_t lba, uintptr_t addr, size_t count, int write) {
+    while (count) {
+        if (sched_cancelled())
+            return -1;
+        uint32_t n = count > ATA_PIO_MAX_SECTORS ? ATA_PIO_MAX_SECTORS : (uint32_t)count;
+        if (dma_command(lba, addr, n, write) != 0) {
+            /* Keep the slow path from here on rather than retrying. */
+            dma_enabled = 0;
+            console_puts("ata: DMA failed, using PIO\n");
+            return -1;
+        }
+        lba += n;
+        addr += (uintptr_t)n * ATA_PIO_SECTOR_SIZE;
+        count -= n;
+    }
+    return 0;
+}
+
+/* PIO a command at a time, so a cancelled caller stops after the one in
+ * flight instead of leaving the drive midway through a command.
+ */
+static int pio_transfer(uint64_t lba, uint8_t *buf, size_t count, int write) {
+    while (count) {
+        if (sched_cancelled())
+            return -1;
+        uint32_t n = count > ATA_PIO_MAX_SECTORS ? ATA_PIO_MAX_SECTORS : (uint32_t)count;
+        if ((write ? ata_pio_write(lba, buf, n) : ata_pio_read(lba, buf, n)) != 0)
+            return -1;
+        lba += n;
+        buf += (size_t)n * ATA_PIO_SECTOR_SIZE;
+        count -= n;
+    }
+    return 0;
+}
+
+/* The channel takes one command at a time, and its owner may sleep. */
+static int channel_acquire(void) {
+    while (channel_busy) {
+        if (sched_wait(&channel_waiters) != 0)
+            return -1;
+    }
+    channel_busy = 1;
+    return 0;
+}
+
+static void channel_release(void) {
+    channel_busy = 0;
+    sched_wake_all(&channel_waiters);
+}
+
+int ata_read(uint64_t lba, void *buf, size_t count) {
+    if (!present)
+        return -1;
+    if (channel_acquire() != 0)
+        return -1;
+    int rc = -1;
+    if (dma_reachable(buf, count))
+        rc = dma_transfer(lba, (uintptr_t)buf, count, 0);
+    if (rc != 0)
+        rc = pio_transfer(lba, buf, count, 0);
+    channel_release();
+    return rc;
+}
+
+int ata_write(uint64_t lba, const void *buf, size_t count) {
+    if (!present)
+        return -1;
+    if (channel_acquire() != 0)
+        return -1;
+    int rc = -1;
+    if (dma_reachable(buf, count))
+        rc = dma_transfer(lba, (uintptr_t)buf, count, 1);
+    if (rc != 0)
+        rc = pio_transfer(lba, (uint8_t *)buf, count, 1);
+    channel_release();
+    return rc;
+}
@@ -6,8 +6,26 @@
 #include "proc.h"
 #include "memctx.h"
 #include "mem.h"
+#include "pmm.h"
+#include "kmem.h"
+#include "heapprof.h"
+#include "config.h"
 #include "memutils.h"
+#include "sched.h"
+#include "clock.h"
+#include "syscall.h"
+#include "io.h"
+#include "smp.h"
 #include "elf.h"
+#include "execcache.h"
+#include "vmm.h"
+#include "modexec.h"
+#include "futex.h"
+#include "ata.h"
+#include "virtio_blk.h"
+#include "nvme.h"
+#include "ahci.h"
+#include "blkdev.h"
 #include "launchd.h"
 #include "bootmode.h"
 #include "exoimg.h"
@@ -187,6 +205,90 @@ static int test_heap_growth(void) {
     return 0;
 }
 
+static int test_pmm(void) {
+    if (!pmm_ready())
+        return 0;
+    size_t before = pmm_free_bytes();
+    uint8_t *a = pmm_alloc_pages(0);
+    uint8_t *b = pmm_alloc_pages(2);
+    if (expect(a != 0 && b != 0 && ((uintptr_t)b & (4 * PMM_PAGE_SIZE - 1)) == 0, "pmm_alloc_aligned") != 0)
+        return -1;
+    if (expect(pmm_free_bytes() == before - 5 * PMM_PAGE_SIZE, "pmm_free_accounting") != 0)
+        return -1;
+    pmm_free_pages(b, 2);
+    if (expect(pmm_claim_page(b + PMM_PAGE_SIZE) == 0 && pmm_claim_page(b + PMM_PAGE_SIZE) != 0, "pmm_claim_page") != 0)
+        return -1;
+    pmm_free_pages(b + PMM_PAGE_SIZE, 0);
+    /* The head and a lower-half page of a larger free block. */
+    uint8_t *c = pmm_alloc_pages(3);
+    if (expect(c != 0, "pmm_alloc_order3") != 0)
+        return -1;
+    pmm_free_pages(c, 3);
+    if (expect(pmm_claim_page(c + 2 * PMM_PAGE_SIZE) == 0 && pmm_claim_page(c) == 0 &&
+               pmm_free_bytes() == before - 3 * PMM_PAGE_SIZE, "pmm_claim_inside_free_block") != 0)
+        return -1;
+    pmm_free_pages(c, 0);
+    pmm_free_pages(c + 2 * PMM_PAGE_SIZE, 0);
+    pmm_free_pages(a, 0);
+    if (expect(pmm_free_bytes() == before, "pmm_free_restored") != 0)
+        return -1;
+    return 0;
+}
+
+static int test_kmem(void) {
+    static void *objs[200];
+    kmem_cache_stats_t stats;
+    kmem_cache_t *cache = kmem_cache_create("selftest", 40, KMEM_CACHE_ALIGN_LINE, NULL);
+    if (expect(cache != 0, "kmem_cache_create") != 0)
+        return -1;
+    int aligned = 1;
+    for (int i = 0; i < 200; ++i) {
+        objs[i] = kmem_cache_alloc(cache);
+        aligned = aligned && objs[i] && ((uintptr_t)objs[i] & (KMEM_CACHE_LINE - 1)) == 0;
+    }
+    if (expect(aligned && kmem_cache_stats(cache, &stats) == 0 && stats.active == 200, "kmem_cache_alloc_aligned") != 0)
+        return -1;
+    for (int i = 0; i < 200; ++i)
+        kmem_cache_free(cache, objs[i]);
+    if (expect(kmem_cache_stats(cache, &stats) == 0 && stats.active == 0 && stats.slabs <= 1, "kmem_cache_free") != 0)
+        return -1;
+    if (expect(kmem_reap((size_t)-1) > 0 && kmem_cache_stats(cache, &stats) == 0 && stats.slabs == 0, "kmem_reap") != 0)
+        return -1;
+
+    int fds[48];
+    int opened = 0;
+    while (opened < 48 && (fds[opened] = vfs_open("/", VFS_O_RDONLY)) >= 0)
+        ++opened;
+    for (int i = 0; i < opened; ++i)
+        vfs_close(fds[i]);
+    if (expect(opened == 48, "vfs_open_files_unbounded") != 0)
+        return -1;
+    return 0;
+}
+
+static int test_vfs_pack(void) {
+    static char text[8192];
+    static char back[8192];
+    for (size_t i = 0; i < sizeof(text); ++i)
+        text[i] = "cold tmpfs data "[i % 16];
+    int fd = vfs_open("/cold.txt", VFS_O_CREAT | VFS_O_RDWR | VFS_O_TRUNC);
+    if (expect(fd >= 0 && vfs_write(fd, text, sizeof(text)) == (long)sizeof(text) && vfs_close(fd) == 0, "vfs_pack_write") != 0)
+        return -1;
+    mem_info_t info;
+    if (expect(vfs_pack_cold(sizeof(text)) >= sizeof(text), "vfs_pack_cold") != 0)
+        return -1;
+    mem_get_info(&info);
+    if (expect(info.zram_objects > 0 && info.zram_comp_bytes < info.zram_orig_bytes, "zram_stats") != 0)
+        return -1;
+    fd = vfs_open("/cold.txt", VFS_O_RDONLY);
+    long got = fd >= 0 ? vfs_read(fd, back, sizeof(back)) : -1;
+    vfs_close(fd);
+    vfs_unlink("/cold.txt");
+    if (expect(got == (long)sizeof(back) && memcmp(text, back, sizeof(back)) == 0, "vfs_unpack_on_open") != 0)
+        return -1;
+    return 0;
+}
+
 static int test_memctx(void) {
     memctx_stats_t stats;
     int ctx = memctx_create(100, 256);
@@ -204,8 +306,36 @@ static int test_memctx(void) {
         return -1;
     if (expect(memctx_stats(ctx, &stats) == 0 && stats.used == 128 && stats.allocations == 1, "memctx_stats_after_free") != 0)
         return -1;
+    heapprof_summary_t before;
+    heapprof_summary_t after;
+    heapprof_get_summary(&before);
+    if (expect(memctx_report_leaks(ctx) == 1, "memctx_report_leaks") != 0)
+        return -1;
+    heapprof_get_summary(&after);
+    if (expect(after.leaked_blocks == before.leaked_blocks + 1 && after.leaked_bytes == before.leaked_bytes + 128, "memctx_leak_report") != 0)
+        return -1;
     if (expect(memctx_destroy(ctx) == 0, "memctx_destroy") != 0)
         return -1;
+    /* The slot is reused at once, but the old id must not reach it. */
+    int reused = memctx_create(100, 0);
+    int stale_ok = reused > 0 && reused != ctx && memctx_alloc(ctx, 16) == 0 && memctx_stats(ctx, &stats) != 0;
+    memctx_destroy(reused);
+    if (expect(stale_ok, "memctx_stale_id") != 0)
+        return -1;
+
+    size_t pages_before = pmm_free_bytes();
+    ctx = memctx_create(101, 0);
+    int all_ok = ctx > 0;
+    for (int i = 0; i < 300 && all_ok; ++i)
+        all_ok = memctx_alloc(ctx, 48 + (i % 5) * 32) != 0;
+    if (expect(all_ok, "memctx_many_blocks") != 0)
+        return -1;
+    heapprof_get_summary(&before);
+    if (expect(memctx_destroy(ctx) == 0 && pmm_free_bytes() == pages_before, "memctx_bulk_destroy") != 0)
+        return -1;
+    heapprof_get_summary(&after);
+    if (expect(after.leaked_blocks == before.leaked_blocks + (EXOCORE_HEAP_PROFILE ? 300 : 0), "memctx_destroy_leak_report") != 0)
+        return -1;
     return 0;
 }
 
@@ -294,6 +424,182 @@ static int test_elf_loader(void) {
     return 0;
 }
 
+static int write_test_file(const char *path, const void *data, size_t len) {
+    int fd = vfs_open(path, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+    long put = fd >= 0 ? vfs_write(fd, data, len) : -1;
+    if (fd >= 0)
+        vfs_close(fd);
+    return put == (long)len ? 0 : -1;
+}
+
+static int test_exec_cache(void) {
+    unsigned char img[512];
+    elf_image_t a, b;
+    void *ha = 0, *hb = 0;
+    execcache_stats_t before, after;
+    vmm_space_t *sa = vmm_space_create();
+    vmm_space_t *sb = vmm_space_create();
+    if (expect(sa && sb, "execcache_spaces") != 0)
+        return -1;
+
+    /* Text pages of every spawn map the cached copy itself. */
+    make_test_elf(img, sizeof(img), ELF_MACHINE_X86_64, ELF_PT_LOAD, 16);
+    if (expect(write_test_file("/ectest.elf", img, sizeof(img)) == 0, "execcache_write_image") != 0)
+        return -1;
+    execcache_get_stats(&before);
+    int ok = execcache_map(sa, "/ectest.elf", &a, &ha) == 0 &&
+             execcache_map(sb, "/ectest.elf", &b, &hb) == 0;
+    execcache_get_stats(&after);
+    if (expect(ok && a.load_base == b.load_base && (uintptr_t)a.entry == VMM_USER_BASE + 0x100 &&
+               after.misses == before.misses + 1 && after.hits == before.hits + 1, "execcache_hit") != 0)
+        return -1;
+    uintptr_t pa = vmm_fault_in(sa, (uintptr_t)a.entry, 0) == 0 ? vmm_translate(sa, (uintptr_t)a.entry) : 0;
+    uintptr_t pb = vmm_fault_in(sb, (uintptr_t)b.entry, 0) == 0 ? vmm_translate(sb, (uintptr_t)b.entry) : 0;
+    if (expect(pa && pa == pb && *(unsigned char *)pa == 0xC3 && vmm_private_pages(sa) == 0 &&
+               vmm_fault_in(sa, (uintptr_t)a.entry, 1) != 0, "execcache_shares_text") != 0)
+        return -1;
+    vmm_space_destroy(sb);
+    execcache_release(hb);
+
+    /* Writable segments are copied on first touch; bss is never stored. */
+    elf_phdr_t *ph = (elf_phdr_t *)(img + sizeof(elf_header_t));
+    ph->p_flags |= ELF_PF_W;
+    ph->p_memsz = 3 * 4096;
+    if (expect(write_test_file("/ectest.elf", img, sizeof(img)) == 0, "execcache_rewrite_image") != 0)
+        return -1;
+    sb = vmm_space_create();
+    execcache_get_stats(&before);
+    ok = sb && execcache_map(sb, "/ectest.elf", &b, &hb) == 0;
+    execcache_get_stats(&after);
+    if (expect(ok && after.misses == before.misses + 1 && vmm_private_pages(sb) == 0, "execcache_rewrite_misses") != 0)
+        return -1;
+    /* A real fault through the page tables, as the process would take. */
+    uintptr_t cr3 = vmm_space_root(sb);
+    vmm_activate(cr3);
+    unsigned char *entry = b.entry;
+    unsigned char first = entry[0];
+    entry[4096] = 0x5A;
+    vmm_activate(0);
+    uintptr_t data = vmm_translate(sb, (uintptr_t)entry);
+    if (expect(first == 0xC3 && vmm_private_pages(sb) == 2 && data && data != pa &&
+               vmm_translate(sb, (uintptr_t)entry + 2 * 4096) == 0, "execcache_private_data_on_demand") != 0)
+        return -1;
+    vmm_space_destroy(sa);
+    execcache_release(ha);
+    vmm_space_destroy(sb);
+    execcache_release(hb);
+    size_t freed = execcache_shrink((size_t)-1);
+    execcache_get_stats(&after);
+    if (expect(freed > 0 && after.entries == 0, "execcache_shrinker") != 0)
+        return -1;
+    vfs_unlink("/ectest.elf");
+    return 0;
+}
+
+/* A PIE with page-aligned text and one relocated pointer in its data. */
+#define TEST_PIE_SIZE 0x1060
+static unsigned char test_pie[TEST_PIE_SIZE] __attribute__((aligned(4096)));
+
+static void make_test_pie(void) {
+    memset(test_pie, 0, sizeof(test_pie));
+    elf_header_t *eh = (elf_header_t*)test_pie;
+    elf_phdr_t *ph = (elf_phdr_t*)(test_pie + sizeof(elf_header_t));
+    eh->e_magic = ELF_MAGIC;
+    eh->e_class = ELF_CLASS_64;
+    eh->e_data = ELF_DATA_LSB;
+    eh->e_version = ELF_VERSION_CURRENT;
+    eh->e_type = ELF_TYPE_DYN;
+    eh->e_machine = ELF_MACHINE_X86_64;
+    eh->e_version2 = ELF_VERSION_CURRENT;
+    eh->e_entry = 0x100;
+    eh->e_phoff = sizeof(elf_header_t);
+    eh->e_ehsize = sizeof(elf_header_t);
+    eh->e_phentsize = sizeof(elf_phdr_t);
+    eh->e_phnum = 3;
+    ph[0].p_type = ELF_PT_LOAD;
+    ph[0].p_flags = ELF_PF_R | ELF_PF_X;
+    ph[0].p_filesz = ph[0].p_memsz = 0x1000;
+    ph[0].p_align = 0x1000;
+    ph[1].p_type = ELF_PT_LOAD;
+    ph[1].p_flags = ELF_PF_R | ELF_PF_W;
+    ph[1].p_offset = ph[1].p_vaddr = 0x1000;
+    ph[1].p_filesz = 0x60;
+    ph[1].p_memsz = 0x80;
+    ph[1].p_align = 0x1000;
+    ph[2].p_type = ELF_PT_DYNAMIC;
+    ph[2].p_offset = ph[2].p_vaddr = 0x1020;
+    ph[2].p_filesz = ph[2].p_memsz = 4 * sizeof(elf_dyn_t);
+    test_pie[0x100] = 0xC3;
+    elf_rela_t *rela = (elf_rela_t*)(test_pie + 0x1008);
+    rela->r_offset = 0x1000;
+    rela->r_info = ELF_R_X86_64_RELATIVE;
+    rela->r_addend = 0x100;
+    elf_dyn_t *dyn = (elf_dyn_t*)(test_pie + 0x1020);
+    dyn[0].d_tag = ELF_DT_RELA;
+    dyn[0].d_val = 0x1008;
+    dyn[1].d_tag = ELF_DT_RELASZ;
+    dyn[1].d_val = sizeof(elf_rela_t);
+    dyn[2].d_tag = ELF_DT_RELAENT;
+    dyn[2].d_val = sizeof(elf_rela_t);
+}
+
+static int test_exec_pie(void) {
+    elf_image_t image;
+    void *handle = 0;
+    make_test_pie();
+    if (expect(elf_validate(test_pie, sizeof(test_pie)) == 0 &&
+               write_test_file("/pietest.elf", test_pie, sizeof(test_pie)) == 0, "pie_accepted") != 0)
+        return -1;
+    vmm_space_t *space = vmm_space_create();
+    if (expect(space && execcache_map(space, "/pietest.elf", &image, &handle) == 0 &&
+               (uintptr_t)image.entry == VMM_USER_BASE + 0x100, "pie_mapped") != 0)
+        return -1;
+    /* Text maps the ramdisk's own page; no staging copy. */
+    vfs_map_t *map;
+    size_t size;
+    const unsigned char *file = vfs_map("/pietest.elf", &size, &map);
+    uintptr_t text = vmm_fault_in(space, (uintptr_t)image.entry, 0) == 0 ? vmm_translate(space, (uintptr_t)image.entry) : 0;
+    vfs_unmap(map);
+    if (expect(file && text == (uintptr_t)file + 0x100 && vmm_private_pages(space) == 0, "pie_text_in_place") != 0)
+        return -1;
+    uintptr_t slot = VMM_USER_BASE + 0x1000;
+    uintptr_t data = vmm_fault_in(space, slot, 1) == 0 ? vmm_translate(space, slot) : 0;
+    if (expect(data && *(uint64_t *)data == VMM_USER_BASE + 0x100 && vmm_private_pages(space) == 1, "pie_relative_reloc") != 0)
+        return -1;
+    /* Rewriting the file leaves the running image alone. */
+    int fd = vfs_open("/pietest.elf", VFS_O_WRONLY);
+    vfs_lseek(fd, 0x100, VFS_SEEK_SET);
+    unsigned char nop = 0x90;
+    long put = vfs_write(fd, &nop, 1);
+    vfs_close(fd);
+    if (expect(put == 1 && *(unsigned char *)text == 0xC3, "pie_mapping_survives_rewrite") != 0)
+        return -1;
+    vmm_space_destroy(space);
+    execcache_release(handle);
+    vfs_unlink("/pietest.elf");
+
+    /* Modules run where they lie; the entry is a bare ret. */
+    unsigned char exec_img[512];
+    make_test_elf(exec_img, sizeof(exec_img), ELF_MACHINE_X86_64, ELF_PT_LOAD, 16);
+    if (expect(modexec_exec(test_pie, sizeof(test_pie)) == 0 &&
+               modexec_exec(test_pie, sizeof(test_pie)) == 0, "module_runs_in_place") != 0)
+        return -1;
+    if (expect(modexec_exec(exec_img, sizeof(exec_img)) != 0, "module_needs_pie") != 0)
+        return -1;
+    /* A caller running in its own space gets it back. */
+    vmm_space_t *caller = vmm_space_create();
+    if (caller)
+        sched_set_address_space(vmm_space_root(caller));
+    int kept = caller && modexec_exec(test_pie, sizeof(test_pie)) == 0 &&
+               sched_address_space() == vmm_space_root(caller);
+    sched_set_address_space(0);
+    vmm_space_destroy(caller);
+    if (expect(kept, "module_restores_caller_space") != 0)
+        return -1;
+    execcache_shrink((size_t)-1);
+    return 0;
+}
+
 static int test_process_model_cleanup(void) {
     proc_info_t info;
     proc_init();
@@ -361,6 +667,704 @@ static int test_proc(void) {
     return 0;
 }
 
+static volatile int sched_test_runs[2];
+static sched_thread_t sched_test_threads[2];
+static uint8_t sched_test_stacks[2][4096] __attribute__((aligned(16)));
+
+static void sched_test_thread(void *arg) {
+    volatile int *runs = arg;
+    sched_lock();
+    for (int i = 0; i < 3; ++i) {
+        (*runs)++;
+        sched_sleep_ms(10);
+    }
+    sched_unlock();
+}
+
+static volatile uint32_t sched_spread_mask;
+static volatile uint64_t sched_spread_until;
+
+/* Spins like a CPU-bound process: interrupts on, no kernel lock. */
+static void sched_spin_thread(void *arg) {
+    (void)arg;
+    while (sched_ticks() < sched_spread_until)
+        __sync_fetch_and_or(&sched_spread_mask, 1u << smp_cpu_index());
+}
+
+static int test_sched_spread(void) {
+    if (smp_cpu_count() < 2)
+        return 0;
+    sched_spread_mask = 0;
+    sched_spread_until = sched_ticks() + SCHED_HZ / 5;
+    for (int i = 0; i < 2; ++i) {
+        sched_test_threads[i].state = SCHED_UNUSED;
+        sched_thread_start(&sched_test_threads[i], (uintptr_t)(sched_test_stacks[i] + sizeof(sched_test_stacks[i])),
+                           sched_spin_thread, 0);
+    }
+    while (sched_test_threads[0].state != SCHED_DEAD || sched_test_threads[1].state != SCHED_DEAD)
+        sched_block();
+    return expect(sched_spread_mask != 0 && (sched_spread_mask & (sched_spread_mask - 1)) != 0, "sched_steals_across_cpus");
+}
+
+static int test_sched(void) {
+    if (!sched_active())
+        return 0;
+    uint64_t start = sched_ticks();
+    uint64_t start_ms = clock_ms();
+    for (int i = 0; i < 2; ++i) {
+        sched_test_runs[i] = 0;
+        if (expect(sched_thread_start(&sched_test_threads[i], (uintptr_t)(sched_test_stacks[i] + sizeof(sched_test_stacks[i])),
+                                      sched_test_thread, (void *)&sched_test_runs[i]) == 0, "sched_thread_start") != 0)
+            return -1;
+    }
+    while ((sched_test_threads[0].state != SCHED_DEAD || sched_test_threads[1].state != SCHED_DEAD) &&
+           sched_ticks() - start < SCHED_HZ)
+        sched_block();
+    if (expect(sched_test_runs[0] == 3 && sched_test_runs[1] == 3 &&
+               sched_test_threads[0].state == SCHED_DEAD && sched_test_threads[1].state == SCHED_DEAD, "sched_threads_sleep_and_exit") != 0)
+        return -1;
+    if (expect(sched_ticks() > start, "sched_timer_ticks") != 0)
+        return -1;
+    /* Three 10 ms sleeps each; the wheel never fires a sleeper early. */
+    if (expect(clock_ms() - start_ms >= 30, "sched_sleep_duration") != 0)
+        return -1;
+    return test_sched_spread();
+}
+
+static uint64_t syscall_fast(uint64_t n, uint64_t a1) {
+    uint64_t r;
+    __asm__ volatile ("syscall" : "=a"(r) : "a"(n), "D"(a1) : "rcx", "r11", "memory");
+    return r;
+}
+
+static uint64_t syscall_int80(uint64_t n, uint64_t a1) {
+    uint64_t r;
+    __asm__ volatile ("int $0x80" : "=a"(r) : "a"(n), "D"(a1) : "memory");
+    return r;
+}
+
+#define SYSCALL_BENCH_ITERS 1000
+
+static void bench_log(const char *name, uint64_t cycles) {
+    test_log("[backend-test] bench ");
+    test_log(name);
+    test_log(" cycles/call=");
+    console_udec((uint32_t)(cycles / SYSCALL_BENCH_ITERS));
+    test_log("\n");
+}
+
+/* Entry cost of both gates plus a pointer-validated call, run as the
+ * current process left behind by test_proc.
+ */
+static int test_syscall_bench(void) {
+    int pid = proc_current_pid();
+    char *buf = pid > 0 ? proc_alloc(pid, 64) : 0;
+    if (expect(buf && proc_current_range_valid((uintptr_t)buf, (uintptr_t)buf + 64) &&
+               !proc_current_range_valid((uintptr_t)buf, (uintptr_t)buf + 65), "proc_current_range_valid") != 0)
+        return -1;
+    /* Validity follows the memory context's arenas, so there is no cap
+     * on how many live blocks can back syscall buffers.
+     */
+    void *extra[40];
+    int all_valid = 1;
+    for (int i = 0; i < 40; ++i) {
+        extra[i] = proc_alloc(pid, 16);
+        all_valid &= extra[i] && proc_current_range_valid((uintptr_t)extra[i], (uintptr_t)extra[i] + 16);
+    }
+    for (int i = 39; i >= 0; --i)
+        proc_free(pid, extra[i]);
+    if (expect(all_valid, "proc_alloc_many_blocks_valid") != 0)
+        return -1;
+    /* SYS_MEM_ALLOC memory is the caller's and round-trips through
+     * SYS_MEM_FREE.
+     */
+    char *heap = (char *)(uintptr_t)syscall_fast(SYS_MEM_ALLOC, 64);
+    int heap_ok = heap && proc_current_range_valid((uintptr_t)heap, (uintptr_t)heap + 64);
+    if (heap) {
+        register uint64_t size __asm__("rsi") = 64;
+        uint64_t r;
+        __asm__ volatile ("syscall" : "=a"(r) : "a"((uint64_t)SYS_MEM_FREE), "D"(heap), "r"(size) : "rcx", "r11", "memory");
+        heap_ok &= r == 0;
+    }
+    if (expect(heap_ok, "sys_mem_alloc_is_process_memory") != 0)
+        return -1;
+    uint64_t t0 = io_rdtsc();
+    for (int i = 0; i < SYSCALL_BENCH_ITERS; ++i)
+        syscall_int80(SYS_GETPID, 0);
+    uint64_t t1 = io_rdtsc();
+    for (int i = 0; i < SYSCALL_BENCH_ITERS; ++i)
+        syscall_fast(SYS_GETPID, 0);
+    uint64_t t2 = io_rdtsc();
+    uint64_t cwd_ok = 0;
+    for (int i = 0; i < SYSCALL_BENCH_ITERS; ++i) {
+        register uint64_t len __asm__("rsi") = 64;
+        uint64_t r;
+        __asm__ volatile ("syscall" : "=a"(r) : "a"((uint64_t)SYS_VFS_GETCWD), "D"(buf), "r"(len) : "rcx", "r11", "memory");
+        cwd_ok += r == 0;
+    }
+    uint64_t t3 = io_rdtsc();
+    bench_log("getpid_int80", t1 - t0);
+    bench_log("getpid_syscall", t2 - t1);
+    bench_log("getcwd_syscall", t3 - t2);
+    return expect(cwd_ok == SYSCALL_BENCH_ITERS && proc_free(pid, buf) == 0 &&
+                  !proc_current_range_valid((uintptr_t)buf, (uintptr_t)buf + 1), "syscall_bench");
+}
+
+static int test_syscall_entry(void) {
+    uint64_t t0 = syscall_int80(SYS_CLOCK_NS, 0);
+    uint64_t t1 = syscall_fast(SYS_CLOCK_NS, 0);
+    uint64_t t2 = syscall_int80(SYS_CLOCK_NS, 0);
+    if (expect(t0 <= t1 && t1 <= t2, "syscall_fast_matches_int80") != 0)
+        return -1;
+    if (expect(syscall_fast(9999, 0) == (uint64_t)-1 && syscall_int80(9999, 0) == (uint64_t)-1, "syscall_unknown_number") != 0)
+        return -1;
+    /* Only rax, rcx and r11 may change across SYSCALL. */
+    register uint64_t r8 __asm__("r8") = 0x88;
+    register uint64_t r9 __asm__("r9") = 0x99;
+    register uint64_t r10 __asm__("r10") = 0xAA;
+    uint64_t rdx = 0xDD;
+    __asm__ volatile ("syscall"
+                      : "+r"(r8), "+r"(r9), "+r"(r10), "+d"(rdx)
+                      : "a"((uint64_t)SYS_CLOCK_NS)
+                      : "rcx", "r11", "memory");
+    if (expect(r8 == 0x88 && r9 == 0x99 && r10 == 0xAA && rdx == 0xDD, "syscall_preserves_registers") != 0)
+        return -1;
+    return test_syscall_bench();
+}
+
+#define PIPE_TEST_BYTES (3 * VFS_PIPE_BUF + 123)
+static int pipe_test_fds[2];
+static sched_thread_t pipe_test_thread;
+static uint8_t pipe_test_stack[4096] __attribute__((aligned(16)));
+
+static void pipe_writer_thread(void *arg) {
+    (void)arg;
+    static unsigned char chunk[1000];
+    sched_lock();
+    size_t sent = 0;
+    while (sent < PIPE_TEST_BYTES) {
+        size_t n = PIPE_TEST_BYTES - sent < sizeof(chunk) ? PIPE_TEST_BYTES - sent : sizeof(chunk);
+        for (size_t i = 0; i < n; ++i)
+            chunk[i] = (unsigned char)(sent + i);
+        if (vfs_write(pipe_test_fds[1], chunk, n) != (long)n)
+            break;
+        sent += n;
+    }
+    vfs_close(pipe_test_fds[1]);
+    sched_unlock();
+}
+
+static int splice_test_fds[3];
+static volatile long splice_test_result;
+static sched_thread_t splice_test_thread;
+static uint8_t splice_test_stack[4096] __attribute__((aligned(16)));
+
+static void splice_waiter_thread(void *arg) {
+    (void)arg;
+    sched_lock();
+    splice_test_result = vfs_splice(splice_test_fds[0], splice_test_fds[2], 16);
+    sched_unlock();
+}
+
+/* The file end is closed while the splice sleeps on an empty pipe. */
+static int test_splice_closed_target(void) {
+    splice_test_result = 1;
+    splice_test_fds[2] = vfs_open("/splice-closed.txt", VFS_O_CREAT | VFS_O_RDWR | VFS_O_TRUNC);
+    if (expect(splice_test_fds[2] >= 0 && vfs_pipe(splice_test_fds) == 0 &&
+               sched_thread_start(&splice_test_thread, (uintptr_t)(splice_test_stack + sizeof(splice_test_stack)),
+                                  splice_waiter_thread, 0) == 0, "splice_waiter_start") != 0)
+        return -1;
+    for (int i = 0; i < 1000 && splice_test_thread.state != SCHED_BLOCKED; ++i)
+        sched_yield();
+    vfs_close(splice_test_fds[2]);
+    vfs_write(splice_test_fds[1], "x", 1);
+    for (int i = 0; i < 1000 && splice_test_result == 1; ++i)
+        sched_yield();
+    long result = splice_test_result;
+    vfs_close(splice_test_fds[0]);
+    vfs_close(splice_test_fds[1]);
+    vfs_unlink("/splice-closed.txt");
+    return expect(result == -1, "splice_target_closed_while_blocked");
+}
+
+static int test_pipe(void) {
+    int fds[2];
+    char out[16];
+    if (expect(vfs_pipe(fds) == 0, "pipe_create") != 0)
+        return -1;
+    if (expect(vfs_write(fds[1], "abc", 3) == 3 && vfs_read(fds[0], out, sizeof(out)) == 3 && memcmp(out, "abc", 3) == 0, "pipe_roundtrip") != 0)
+        return -1;
+    if (expect(vfs_read(fds[1], out, 1) < 0 && vfs_write(fds[0], "x", 1) < 0 && vfs_lseek(fds[0], 0, VFS_SEEK_SET) < 0, "pipe_end_modes") != 0)
+        return -1;
+    int src = vfs_open("/splice-src.txt", VFS_O_CREAT | VFS_O_RDWR | VFS_O_TRUNC);
+    int dst = vfs_open("/splice-dst.txt", VFS_O_CREAT | VFS_O_RDWR | VFS_O_TRUNC);
+    vfs_write(src, "splice-data", 11);
+    vfs_lseek(src, 0, VFS_SEEK_SET);
+    long in = vfs_splice(src, fds[1], sizeof(out));
+    long moved = vfs_splice(fds[0], dst, sizeof(out));
+    vfs_lseek(dst, 0, VFS_SEEK_SET);
+    memset(out, 0, sizeof(out));
+    int spliced = in == 11 && moved == 11 && vfs_read(dst, out, sizeof(out)) == 11 && memcmp(out, "splice-data", 11) == 0;
+    vfs_close(src);
+    vfs_close(dst);
+    vfs_unlink("/splice-src.txt");
+    vfs_unlink("/splice-dst.txt");
+    if (expect(spliced, "pipe_splice") != 0)
+        return -1;
+    vfs_close(fds[1]);
+    if (expect(vfs_read(fds[0], out, 1) == 0, "pipe_eof") != 0)
+        return -1;
+    vfs_close(fds[0]);
+    if (!sched_active())
+        return 0;
+    /* More than the ring holds: the writer must block and be woken. */
+    if (expect(vfs_pipe(pipe_test_fds) == 0 &&
+               sched_thread_start(&pipe_test_thread, (uintptr_t)(pipe_test_stack + sizeof(pipe_test_stack)),
+                                  pipe_writer_thread, 0) == 0, "pipe_writer_start") != 0)
+        return -1;
+    unsigned char buf[700];
+    size_t got = 0;
+    int ordered = 1;
+    for (;;) {
+        long n = vfs_read(pipe_test_fds[0], buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        for (long i = 0; i < n; ++i)
+            ordered &= buf[i] == (unsigned char)(got + (size_t)i);
+        got += (size_t)n;
+    }
+    vfs_close(pipe_test_fds[0]);
+    if (expect(got == PIPE_TEST_BYTES && ordered, "pipe_blocking_stream") != 0)
+        return -1;
+    return test_splice_closed_target();
+}
+
+static volatile uint32_t futex_test_words[3];
+static volatile int futex_test_results[3];
+
+/* Thread 1 waits with a timeout; the others until woken or killed. */
+static void futex_test_thread(void *arg) {
+    uintptr_t i = (uintptr_t)arg;
+    sched_lock();
+    futex_test_results[i] = futex_wait(proc_current_pid(), &futex_test_words[i], 0, i == 1 ? 20 : 0);
+    sched_unlock();
+}
+
+static volatile int wait_test_child;
+static volatile int wait_test_result;
+static volatile int wait_test_status;
+
+/* A worker thread, not the main one, reaps its process's child. */
+static void wait_test_thread(void *arg) {
+    int pid = (int)(uintptr_t)arg;
+    int status = -1;
+    sched_lock();
+    wait_test_result = proc_wait(pid, wait_test_child, &status);
+    wait_test_status = status;
+    sched_unlock();
+}
+
+static int test_threads(void) {
+    if (!sched_active())
+        return 0;
+    int parent = proc_current_pid();
+    int pid = proc_create("thread-test", parent);
+    for (int i = 0; i < 3; ++i) {
+        futex_test_words[i] = 0;
+        futex_test_results[i] = 1;
+    }
+    int waiter = proc_thread_create(pid, (uintptr_t)futex_test_thread, 0);
+    int timed = proc_thread_create(pid, (uintptr_t)futex_test_thread, 1);
+    if (expect(pid > 0 && waiter > 0 && timed > 0 && waiter != timed, "thread_create") != 0)
+        return -1;
+    if (expect(futex_wait(pid, &futex_test_words[0], 1, 0) == FUTEX_ERR_AGAIN, "futex_value_changed") != 0)
+        return -1;
+    /* Once the waiter has queued, exactly one wake reaches it. */
+    int woken = 0;
+    for (int tries = 0; tries < 100 && !woken; ++tries) {
+        sched_sleep_ms(1);
+        woken = futex_wake(pid, &futex_test_words[0], 4);
+    }
+    int status = -1;
+    if (expect(woken == 1 && proc_thread_join(pid, waiter, &status) == 0 && status == 0 &&
+               futex_test_results[0] == 0, "futex_wake_and_join") != 0)
+        return -1;
+    if (expect(proc_thread_join(pid, timed, 0) == 0 && futex_test_results[1] == FUTEX_ERR_TIMEDOUT, "futex_timeout") != 0)
+        return -1;
+    if (expect(proc_thread_join(pid, waiter, 0) != 0, "thread_join_once") != 0)
+        return -1;
+    wait_test_child = proc_create("wait-child", pid);
+    wait_test_result = 0;
+    int reaper = proc_thread_create(pid, (uintptr_t)wait_test_thread, (uintptr_t)pid);
+    sched_sleep_ms(2);
+    proc_exit(wait_test_child, 7);
+    if (expect(reaper > 0 && proc_thread_join(pid, reaper, 0) == 0 && wait_test_result == wait_test_child &&
+               wait_test_status == 7, "proc_wait_from_worker_thread") != 0)
+        return -1;
+    /* Exiting the process wakes a thread blocked on a futex to unwind,
+     * then reclaims it.
+     */
+    if (expect(proc_thread_create(pid, (uintptr_t)futex_test_thread, 2) > 0, "thread_create_stuck") != 0)
+        return -1;
+    sched_sleep_ms(2);
+    proc_exit(pid, 0);
+    return expect(proc_wait(parent, pid, &status) == pid && futex_test_results[2] == 0, "thread_killed_with_process");
+}
+
+/* Read-only, so it is safe on a real disk. Attach one with
+ *   QEMU_EXTRA="-drive file=disk.img,format=raw,if=ide,index=0" ./build.sh
+ * (a raw image of at least ATA_BENCH_BYTES) to check multi-sector reads
+ * against single ones and, with EXOCORE_DISK_BENCH, compare one sector
+ * per command with full multi-sector commands, and DMA with PIO.
+ */
+#define ATA_BENCH_BYTES (4u * 1024 * 1024)
+
+static unsigned char ata_bench_buf[ATA_PIO_MAX_SECTORS * ATA_PIO_SECTOR_SIZE];
+
+/* Benchmarks only log; their outcome is never a test failure. */
+static void bench_done(int ok, const char *name) {
+    test_log("[backend-test] bench ");
+    test_log(name);
+    test_log(ok ? " done\n" : " could not complete\n");
+}
+
+static int disk_bench_pass(const char *name, int (*read)(uint64_t, void *, size_t),
+                           void *buf, uint32_t per_cmd, uint32_t sectors) {
+    uint64_t t0 = clock_ns();
+    for (uint32_t lba = 0; lba < sectors; lba += per_cmd) {
+        if (read(lba, buf, per_cmd) != 0)
+            return -1;
+    }
+    uint64_t ns = clock_ns() - t0;
+    test_log("[backend-test] bench ");
+    test_log(name);
+    test_log(" sectors/cmd=");
+    console_udec(per_cmd);
+    test_log(" KiB/s=");
+    console_udec((uint32_t)((uint64_t)sectors * ATA_PIO_SECTOR_SIZE * 1000000000ull / (ns ? ns : 1) / 1024));
+    test_log("\n");
+    return 0;
+}
+
+/* The shared slot, batch and bounce helpers against a fake device that
+ * completes whatever was submitted on the next reap.
+ */
+static blkdev_queue_t fake_queue;
+static uint8_t fake_submitted[BLKDEV_SLOTS_MAX];
+static unsigned char fake_disk[5 * BLKDEV_SECTOR_SIZE];
+static unsigned char fake_bounce[2 * BLKDEV_SECTOR_SIZE];
+static int fake_xfers;
+
+static void fake_reap(void *ctx) {
+    (void)ctx;
+    for (int s = 0; s < BLKDEV_SLOTS_MAX; ++s)
+        if (fake_submitted[s])
+            fake_queue.done[s] = 1;
+}
+
+static int fake_xfer(void *ctx, uint64_t lba, uintptr_t addr, size_t count, int write) {
+    (void)ctx;
+    unsigned char *sector = fake_disk + lba * BLKDEV_SECTOR_SIZE;
+    if (write)
+        memcpy(sector, (void *)addr, count * BLKDEV_SECTOR_SIZE);
+    else
+        memcpy((void *)addr, sector, count * BLKDEV_SECTOR_SIZE);
+    fake_xfers++;
+    return 0;
+}
+
+static int test_blkdev_queue(void) {
+    blkdev_queue_t *q = &fake_queue;
+    blkdev_queue_init(q, 70, fake_reap, 0);
+    int ids[70];
+    int distinct = 1;
+    for (int i = 0; i < 70; ++i) {
+        ids[i] = blkdev_slot_alloc(q, 0);
+        distinct &= ids[i] == i;
+    }
+    if (expect(distinct && blkdev_slot_alloc(q, 0) == -1, "blkdev_slot_alloc_all") != 0)
+        return -1;
+    blkdev_slot_free(q, 66);
+    if (expect(blkdev_slot_alloc(q, 0) == 66, "blkdev_slot_free_reuse") != 0)
+        return -1;
+    memset(fake_submitted, 0, sizeof(fake_submitted));
+    fake_submitted[3] = fake_submitted[65] = 1;
+    int batch[2] = { 3, 65 };
+    int stuck[2] = { 3, 4 };
+    q->timeout_ms = 0;
+    if (expect(blkdev_batch_wait(q, batch, 2) == 0 && blkdev_batch_wait(q, stuck, 2) == -1, "blkdev_batch_wait") != 0)
+        return -1;
+    q->bounce = fake_bounce;
+    q->bounce_sectors = 2;
+    static unsigned char in[5 * BLKDEV_SECTOR_SIZE], out[5 * BLKDEV_SECTOR_SIZE];
+    for (size_t i = 0; i < sizeof(in); ++i)
+        in[i] = (unsigned char)(i * 7);
+    fake_xfers = 0;
+    int rc = blkdev_bounce(q, fake_xfer, 0, in, 5, 1) | blkdev_bounce(q, fake_xfer, 0, out, 5, 0);
+    return expect(rc == 0 && fake_xfers == 6 && memcmp(in, out, sizeof(in)) == 0 && !q->bounce_busy, "blkdev_bounce");
+}
+
+static int test_ata_bench(void) {
+    ata_pio_info_t disk;
+    if (ata_info(&disk) != 0 || disk.sectors < ATA_BENCH_BYTES / ATA_PIO_SECTOR_SIZE)
+        return 0;
+    static unsigned char single[8 * ATA_PIO_SECTOR_SIZE];
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (ata_read(i, single + i * ATA_PIO_SECTOR_SIZE, 1) != 0)
+            return expect(0, "ata_read_single");
+    }
+    if (expect(ata_read(0, ata_bench_buf, ATA_PIO_MAX_SECTORS) == 0 &&
+               memcmp(ata_bench_buf, single, sizeof(single)) == 0, "ata_multiple_matches_single") != 0)
+        return -1;
+    if (!EXOCORE_DISK_BENCH)
+        return 0;
+    uint32_t sectors = ATA_BENCH_BYTES / ATA_PIO_SECTOR_SIZE;
+    int ok = disk_bench_pass("ata_read", ata_read, ata_bench_buf, 1, sectors) == 0 &&
+             disk_bench_pass("ata_read", ata_read, ata_bench_buf, ATA_PIO_MAX_SECTORS, sectors) == 0;
+    /* With DMA on, ata_read no longer moves the data itself; the PIO
+     * baseline goes to the driver directly (nothing else uses the disk).
+     */
+    if (ata_dma_enabled())
+        ok = ok && disk_bench_pass("ata_pio_read", ata_pio_read, ata_bench_buf, ATA_PIO_MAX_SECTORS, sectors) == 0;
+    bench_done(ok, "ata_bench");
+    return 0;
+}
+
+/* Same for a virtio-blk disk, e.g.
+ *   QEMU_EXTRA="-drive file=disk.img,format=raw,if=none,id=d0 -device virtio-blk-pci,drive=d0"
+ * The largest calls keep VIRTIO_BLK_BATCH/2 requests in flight at once.
+ */
+#define VIRTIO_BENCH_PER_CALL (VIRTIO_BLK_CHUNK * VIRTIO_BLK_BATCH / 2)
+
+static unsigned char blk_bench_buf[VIRTIO_BENCH_PER_CALL * BLKDEV_SECTOR_SIZE];
+
+static int test_virtio_blk_bench(void) {
+    virtio_blk_info_t disk;
+    if (virtio_blk_info(&disk) != 0 || disk.sectors < ATA_BENCH_BYTES / BLKDEV_SECTOR_SIZE)
+        return 0;
+    const blkdev_t *def = blkdev_get(blkdev_default());
+    if (expect(def && def->rank >= BLKDEV_RANK_VIRTIO, "blkdev_default_highest_rank") != 0)
+        return -1;
+    static unsigned char single[8 * BLKDEV_SECTOR_SIZE];
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (virtio_blk_read(i, single + i * BLKDEV_SECTOR_SIZE, 1) != 0)
+            return expect(0, "virtio_blk_read_single");
+    }
+    if (expect(virtio_blk_read(0, blk_bench_buf, VIRTIO_BENCH_PER_CALL) == 0 &&
+               memcmp(blk_bench_buf, single, sizeof(single)) == 0, "virtio_blk_batch_matches_single") != 0)
+        return -1;
+    if (!EXOCORE_DISK_BENCH)
+        return 0;
+    uint32_t sectors = ATA_BENCH_BYTES / BLKDEV_SECTOR_SIZE;
+    int ok = disk_bench_pass("virtio_blk_read", virtio_blk_read, blk_bench_buf, 1, sectors) == 0 &&
+             disk_bench_pass("virtio_blk_read", virtio_blk_read, blk_bench_buf, VIRTIO_BLK_CHUNK, sectors) == 0 &&
+             disk_bench_pass("virtio_blk_read", virtio_blk_read, blk_bench_buf, VIRTIO_BENCH_PER_CALL, sectors) == 0;
+    bench_done(ok, "virtio_blk_bench");
+    return 0;
+}
+
+/* fio-style random 4 KiB reads over the first ATA_BENCH_BYTES of a disk:
+ * BLK_RAND_IOS reads split across 'jobs' threads with one read in flight
+ * each (iodepth = jobs), reporting IOPS and completion latency
+ * percentiles.
+ */
+#define BLK_RAND_IOS 2048
+#define BLK_RAND_JOBS_MAX 8
+#define BLK_RAND_BLOCK 8
+
+typedef struct {
+    int dev;
+    uint32_t first;
+    uint32_t count;
+    uint64_t seed;
+    int failed;
+} blk_rand_job_t;
+
+static uint32_t blk_rand_lat[BLK_RAND_IOS];
+static blk_rand_job_t blk_rand_jobs[BLK_RAND_JOBS_MAX];
+static sched_thread_t blk_rand_threads[BLK_RAND_JOBS_MAX];
+static uint8_t blk_rand_stacks[BLK_RAND_JOBS_MAX][8192] __attribute__((aligned(16)));
+static unsigned char blk_rand_bufs[BLK_RAND_JOBS_MAX][BLK_RAND_BLOCK * BLKDEV_SECTOR_SIZE] __attribute__((aligned(4096)));
+
+static void blk_rand_job(void *arg) {
+    blk_rand_job_t *job = arg;
+    unsigned char *buf = blk_rand_bufs[job - blk_rand_jobs];
+    uint64_t x = job->seed;
+    uint32_t blocks = ATA_BENCH_BYTES / BLKDEV_SECTOR_SIZE / BLK_RAND_BLOCK;
+    for (uint32_t i = job->first; i < job->first + job->count; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        uint64_t lba = ((x >> 33) % blocks) * BLK_RAND_BLOCK;
+        uint64_t t0 = clock_ns();
+        if (blkdev_read(job->dev, lba, buf, BLK_RAND_BLOCK) != 0) {
+            job->failed = 1;
+            return;
+        }
+        blk_rand_lat[i] = (uint32_t)(clock_ns() - t0);
+    }
+}
+
+static void blk_rand_log(const char *label, uint32_t ns) {
+    test_log(label);
+    console_udec(ns / 1000);
+}
+
+static int blk_rand_bench(int dev, int jobs) {
+    uint32_t per_job = BLK_RAND_IOS / (uint32_t)jobs;
+    uint64_t t0 = clock_ns();
+    for (int j = 0; j < jobs; ++j) {
+        blk_rand_jobs[j].dev = dev;
+        blk_rand_jobs[j].first = (uint32_t)j * per_job;
+        blk_rand_jobs[j].count = per_job;
+        blk_rand_jobs[j].seed = 0x9E3779B97F4A7C15ull * (uint64_t)(j + 1);
+        blk_rand_jobs[j].failed = 0;
+        if (!sched_active()) {
+            blk_rand_job(&blk_rand_jobs[j]);
+            continue;
+        }
+        blk_rand_threads[j].state = SCHED_UNUSED;
+        sched_thread_start(&blk_rand_threads[j], (uintptr_t)(blk_rand_stacks[j] + sizeof(blk_rand_stacks[j])),
+                           blk_rand_job, &blk_rand_jobs[j]);
+    }
+    for (int j = 0; j < jobs && sched_active(); ++j) {
+        while (blk_rand_threads[j].state != SCHED_DEAD)
+            sched_block();
+    }
+    uint64_t ns = clock_ns() - t0;
+    uint32_t n = per_job * (uint32_t)jobs;
+    for (int j = 0; j < jobs; ++j)
+        if (blk_rand_jobs[j].failed)
+            return -1;
+    for (uint32_t i = 1; i < n; ++i) {
+        uint32_t v = blk_rand_lat[i];
+        uint32_t k = i;
+        for (; k > 0 && blk_rand_lat[k - 1] > v; --k)
+            blk_rand_lat[k] = blk_rand_lat[k - 1];
+        blk_rand_lat[k] = v;
+    }
+    test_log("[backend-test] bench ");
+    test_log(blkdev_get(dev)->name);
+    test_log(" randread bs=4k jobs=");
+    console_udec((uint32_t)jobs);
+    test_log(" iops=");
+    console_udec((uint32_t)((uint64_t)n * 1000000000ull / (ns ? ns : 1)));
+    blk_rand_log(" p50_us=", blk_rand_lat[n / 2]);
+    blk_rand_log(" p99_us=", blk_rand_lat[n * 99 / 100]);
+    blk_rand_log(" p999_us=", blk_rand_lat[n * 999 / 1000]);
+    blk_rand_log(" max_us=", blk_rand_lat[n - 1]);
+    test_log("\n");
+    return 0;
+}
+
+/* NVMe, e.g.
+ *   QEMU_EXTRA="-drive file=disk.img,format=raw,if=none,id=n0 -device nvme,serial=exo,drive=n0"
+ * Sequential passes as above, an unaligned buffer through the bounce
+ * path, then random reads with one job and with one job per CPU (up to
+ * BLK_RAND_JOBS_MAX), which spreads submissions over the per-CPU queues.
+ */
+static int test_nvme_bench(void) {
+    nvme_info_t disk;
+    if (nvme_info(&disk) != 0 || disk.sectors < ATA_BENCH_BYTES / BLKDEV_SECTOR_SIZE)
+        return 0;
+    int dev = -1;
+    for (int i = 0; i < blkdev_count(); ++i)
+        if (strcmp(blkdev_get(i)->name, "nvme0") == 0)
+            dev = i;
+    static unsigned char single[8 * BLKDEV_SECTOR_SIZE];
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (nvme_read(i, single + i * BLKDEV_SECTOR_SIZE, 1) != 0)
+            return expect(0, "nvme_read_single");
+    }
+    if (expect(nvme_read(0, blk_bench_buf, VIRTIO_BENCH_PER_CALL) == 0 &&
+               memcmp(blk_bench_buf, single, sizeof(single)) == 0, "nvme_batch_matches_single") != 0)
+        return -1;
+    if (expect(nvme_read(0, blk_bench_buf + 2, 8) == 0 &&
+               memcmp(blk_bench_buf + 2, single, sizeof(single)) == 0, "nvme_unaligned_read") != 0)
+        return -1;
+    if (!EXOCORE_DISK_BENCH)
+        return 0;
+    uint32_t sectors = ATA_BENCH_BYTES / BLKDEV_SECTOR_SIZE;
+    int jobs = smp_cpu_count() < BLK_RAND_JOBS_MAX ? smp_cpu_count() : BLK_RAND_JOBS_MAX;
+    int ok = dev >= 0 &&
+             disk_bench_pass("nvme_read", nvme_read, blk_bench_buf, BLK_RAND_BLOCK, sectors) == 0 &&
+             disk_bench_pass("nvme_read", nvme_read, blk_bench_buf, VIRTIO_BENCH_PER_CALL, sectors) == 0 &&
+             blk_rand_bench(dev, 1) == 0 &&
+             (jobs < 2 || blk_rand_bench(dev, jobs) == 0);
+    bench_done(ok, "nvme_bench");
+    return 0;
+}
+
+/* AHCI, e.g.
+ *   QEMU_EXTRA="-drive file=disk.img,format=raw,if=none,id=s0 -device ahci,id=ahci -device ide-hd,drive=s0,bus=ahci.0"
+ * Random reads run with BLK_RAND_JOBS_MAX jobs whatever the CPU count:
+ * they sleep on their commands, so with NCQ that many are queued on the
+ * drive at once.
+ */
+static int test_ahci_bench(void) {
+    ahci_info_t disk;
+    if (ahci_info(0, &disk) != 0 || disk.sectors < ATA_BENCH_BYTES / BLKDEV_SECTOR_SIZE)
+        return 0;
+    int dev = -1;
+    for (int i = 0; i < blkdev_count(); ++i)
+        if (strcmp(blkdev_get(i)->name, "ahci0") == 0)
+            dev = i;
+    if (expect(dev >= 0, "ahci_registered") != 0)
+        return -1;
+    static unsigned char single[8 * BLKDEV_SECTOR_SIZE];
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (blkdev_read(dev, i, single + i * BLKDEV_SECTOR_SIZE, 1) != 0)
+            return expect(0, "ahci_read_single");
+    }
+    if (expect(blkdev_read(dev, 0, blk_bench_buf, VIRTIO_BENCH_PER_CALL) == 0 &&
+               memcmp(blk_bench_buf, single, sizeof(single)) == 0, "ahci_batch_matches_single") != 0)
+        return -1;
+    if (!EXOCORE_DISK_BENCH)
+        return 0;
+    int ok = blk_rand_bench(dev, 1) == 0 && blk_rand_bench(dev, BLK_RAND_JOBS_MAX) == 0;
+    bench_done(ok, "ahci_bench");
+    return 0;
+}
+
+static volatile int disk_kill_dev;
+static volatile int disk_kill_reads;
+
+/* Reads until its process is killed, into a buffer on its own stack. */
+static void disk_kill_thread(void *arg) {
+    (void)arg;
+    unsigned char buf[8 * BLKDEV_SECTOR_SIZE] __attribute__((aligned(16)));
+    sched_lock();
+    while (blkdev_read(disk_kill_dev, 0, buf, 8) == 0)
+        disk_kill_reads++;
+    sched_unlock();
+}
+
+/* A process killed while it waits on the disk lets its request finish
+ * before its stack goes, and leaves the device usable.
+ */
+static int test_disk_kill(void) {
+    if (!sched_active())
+        return 0;
+    for (int dev = 0; dev < blkdev_count(); ++dev) {
+        const blkdev_t *d = blkdev_get(dev);
+        if (d->sectors < 8)
+            continue;
+        int parent = proc_current_pid();
+        int pid = proc_create("disk-kill", parent);
+        disk_kill_dev = dev;
+        disk_kill_reads = 0;
+        if (expect(pid > 0 && proc_thread_create(pid, (uintptr_t)disk_kill_thread, 0) > 0, "disk_kill_thread_create") != 0)
+            return -1;
+        for (int tries = 0; tries < 1000 && disk_kill_reads < 2; ++tries)
+            sched_sleep_ms(1);
+        proc_kill(pid, 0);
+        int status = -1;
+        static unsigned char after[BLKDEV_SECTOR_SIZE];
+        if (expect(disk_kill_reads >= 2 && proc_wait(parent, pid, &status) == pid &&
+                   blkdev_read(dev, 0, after, 1) == 0, "disk_read_after_kill") != 0)
+            return -1;
+    }
+    return 0;
+}
+
 int backend_selftest_run(void) {
     test_log("[backend-test] starting backend driver tests\n");
     int failures = 0;
@@ -376,11 +1380,26 @@ int backend_selftest_run(void) {
     failures += test_embedded_initramfs_install() == 0 ? 0 : 1;
     proc_init();
     failures += test_elf_loader() == 0 ? 0 : 1;
+    failures += test_exec_cache() == 0 ? 0 : 1;
+    failures += test_exec_pie() == 0 ? 0 : 1;
     failures += test_process_model_cleanup() == 0 ? 0 : 1;
     proc_init();
     failures += test_memctx() == 0 ? 0 : 1;
+    failures += test_pmm() == 0 ? 0 : 1;
+    failures += test_kmem() == 0 ? 0 : 1;
+    failures += test_vfs_pack() == 0 ? 0 : 1;
     failures += test_heap_growth() == 0 ? 0 : 1;
     failures += test_proc() == 0 ? 0 : 1;
+    failures += test_sched() == 0 ? 0 : 1;
+    failures += test_syscall_entry() == 0 ? 0 : 1;
+    failures += test_pipe() == 0 ? 0 : 1;
+    failures += test_threads() == 0 ? 0 : 1;
+    failures += test_blkdev_queue() == 0 ? 0 : 1;
+    failures += test_ata_bench() == 0 ? 0 : 1;
+    failures += test_virtio_blk_bench() == 0 ? 0 : 1;
+    failures += test_nvme_bench() == 0 ? 0 : 1;
+    failures += test_ahci_bench() == 0 ? 0 : 1;
+    failures += test_disk_kill() == 0 ? 0 : 1;
     if (failures == 0) {
         test_log("[backend-test] ALL BACKEND TESTS PASSED\n");
         return 0;
@@ -0,0 +1,137 @@
+#include "blkdev.h"
+#include "clock.h"
+#include "memutils.h"
+
+static blkdev_t devices[BLKDEV_MAX];
+static int ndevices;
+
+int blkdev_register(const char *name, uint64_t sectors, int rank, const blkdev_ops_t *ops, void *ctx) {
+    if (ndevices == BLKDEV_MAX || !ops || !ops->read)
+        return -1;
+    blkdev_t *d = &devices[ndevices];
+    size_t i = 0;
+    for (; name && name[i] && i < BLKDEV_NAME_MAX; ++i)
+        d->name[i] = name[i];
+    d->name[i] = '\0';
+    d->sectors = sectors;
+    d->rank = rank;
+    d->ops = ops;
+    d->ctx = ctx;
+    return ndevices++;
+}
+
+int blkdev_count(void) {
+    return ndevices;
+}
+
+const blkdev_t *blkdev_get(int index) {
+    return index >= 0 && index < ndevices ? &devices[index] : 0;
+}
+
+int blkdev_default(void) {
+    int best = -1;
+    for (int i = 0; i < ndevices; ++i) {
+        if (best < 0 || devices[i].rank > devices[best].rank)
+            best = i;
+    }
+    return best;
+}
+
+static const blkdev_t *check(int index, uint64_t lba, size_t count) {
+    const blkdev_t *d = blkdev_get(index);
+    if (!d || lba > d->sectors || count > d->sectors - lba)
+        return 0;
+    return d;
+}
+
+int blkdev_read(int index, uint64_t lba, void *buf, size_t count) {
+    const blkdev_t *d = check(index, lba, count);
+    return d ? d->ops->read(d->ctx, lba, buf, count) : -1;
+}
+
+int blkdev_write(int index, uint64_t lba, const void *buf, size_t count) {
+    const blkdev_t *d = check(index, lba, count);
+    return d && d->ops->write ? d->ops->write(d->ctx, lba, buf, count) : -1;
+}
+
+void blkdev_queue_init(blkdev_queue_t *q, int slots, void (*reap)(void *ctx), void *ctx) {
+    memset(q->free, 0, sizeof(q->free));
+    memset((void *)q->done, 0, sizeof(q->done));
+    for (int s = 0; s < slots && s < BLKDEV_SLOTS_MAX; ++s)
+        q->free[s / 64] |= 1ull << (s % 64);
+    q->reap = reap;
+    q->ctx = ctx;
+}
+
+int blkdev_slot_alloc(blkdev_queue_t *q, int may_block) {
+    /* A cancelled caller starts no new batch. */
+    if (may_block && sched_cancelled())
+        return -1;
+    for (;;) {
+        for (int w = 0; w < BLKDEV_SLOTS_MAX / 64; ++w) {
+            if (q->free[w]) {
+                int b = __builtin_ctzll(q->free[w]);
+                q->free[w] &= ~(1ull << b);
+                return w * 64 + b;
+            }
+        }
+        if (!may_block || sched_wait(&q->slot_waiters) != 0)
+            return -1;
+    }
+}
+
+void blkdev_slot_free(blkdev_queue_t *q, int s) {
+    q->free[s / 64] |= 1ull << (s % 64);
+    sched_wake_all(&q->slot_waiters);
+}
+
+static int batch_pending(const blkdev_queue_t *q, const int *ids, int n) {
+    for (int i = 0; i < n; ++i)
+        if (!q->done[ids[i]])
+            return 1;
+    return 0;
+}
+
+int blkdev_batch_wait(blkdev_queue_t *q, const int *ids, int n) {
+    uint64_t deadline = clock_ms() + q->timeout_ms;
+    for (;;) {
+        q->reap(q->ctx);
+        if (!batch_pending(q, ids, n))
+            return 0;
+        uint64_t now = clock_ms();
+        if (now >= deadline)
+            return -1;
+        /* Once cancelled the caller can no longer sleep, but its requests
+         * still point into its buffers: it polls them to completion.
+         */
+        if (sched_active() && (q->irq || q->poll_ms) && !sched_cancelled())
+            sched_wait_key(&q->done_waiters, 0, q->irq ? deadline - now : q->poll_ms);
+        else
+            __asm__ volatile ("pause");
+    }
+}
+
+int blkdev_bounce(blkdev_queue_t *q, blkdev_xfer_t xfer, uint64_t lba, void *buf, size_t count, int write) {
+    uint8_t *p = buf;
+    while (q->bounce_busy) {
+        if (sched_wait(&q->bounce_waiters) != 0)
+            return -1;
+    }
+    q->bounce_busy = 1;
+    int rc = 0;
+    while (count && rc == 0) {
+        size_t n = count > q->bounce_sectors ? q->bounce_sectors : count;
+        size_t bytes = n * BLKDEV_SECTOR_SIZE;
+        if (write)
+            memcpy(q->bounce, p, bytes);
+        rc = xfer(q->ctx, lba, (uintptr_t)q->bounce, n, write);
+        if (rc == 0 && !write)
+            memcpy(p, q->bounce, bytes);
+        lba += n;
+        p += bytes;
+        count -= n;
+    }
+    q->bounce_busy = 0;
+    sched_wake_all(&q->bounce_waiters);
+    return rc;
+}
@@ -0,0 +1,105 @@
+#include "clock.h"
+#include "acpi.h"
+#include "io.h"
+#include "pit.h"
+#include "memutils.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+#define CALIBRATE_US 10000
+#define CALIBRATE_ROUNDS 3
+
+#define HPET_CAP 0x00
+#define HPET_CONFIG 0x10
+#define HPET_COUNTER 0xF0
+#define HPET_ENABLE 0x1
+
+static uint64_t tsc_base;
+static uint64_t tsc_hz = 1000000000ULL;
+/* Nanoseconds per TSC cycle in 32.32 fixed point. */
+static uint64_t ns_mult = 1ULL << 32;
+static const char *source = "assumed";
+
+static uint64_t hpet_reg(volatile uint8_t *hpet, uint32_t reg) {
+    return *(volatile uint64_t *)(hpet + reg);
+}
+
+static uint64_t calibrate_hpet(void) {
+    const acpi_sdt_header_t *table = acpi_find_table("HPET");
+    if (!table || table->length < 52)
+        return 0;
+    uint64_t base;
+    memcpy(&base, (const uint8_t *)table + 44, sizeof(base));
+    if (!base)
+        return 0;
+    boot_map_identity_span(base, 1024);
+    volatile uint8_t *hpet = (volatile uint8_t *)(uintptr_t)base;
+    uint32_t period_fs = (uint32_t)(hpet_reg(hpet, HPET_CAP) >> 32);
+    if (period_fs == 0 || period_fs > 100000000u)
+        return 0;
+    *(volatile uint64_t *)(hpet + HPET_CONFIG) = hpet_reg(hpet, HPET_CONFIG) | HPET_ENABLE;
+    uint64_t need = (uint64_t)CALIBRATE_US * 1000000000ULL / period_fs;
+    uint64_t best = 0;
+    for (int i = 0; i < CALIBRATE_ROUNDS; ++i) {
+        uint64_t h0 = hpet_reg(hpet, HPET_COUNTER);
+        uint64_t t0 = io_rdtsc();
+        uint64_t h1;
+        do {
+            h1 = hpet_reg(hpet, HPET_COUNTER);
+        } while (h1 - h0 < need);
+        uint64_t t1 = io_rdtsc();
+        uint64_t elapsed_ns = (h1 - h0) * period_fs / 1000000u;
+        uint64_t hz = (t1 - t0) * 1000000000ULL / elapsed_ns;
+        if (!best || hz < best)
+            best = hz;
+    }
+    return best;
+}
+
+/* Port I/O after the terminal count only ever inflates the count, so the
+ * smallest of a few rounds is the most accurate.
+ */
+static uint64_t calibrate_pit(void) {
+    uint64_t best = 0;
+    for (int i = 0; i < CALIBRATE_ROUNDS; ++i) {
+        uint64_t t0 = io_rdtsc();
+        pit_delay_us(CALIBRATE_US);
+        uint64_t t1 = io_rdtsc();
+        uint64_t hz = (t1 - t0) * (1000000u / CALIBRATE_US);
+        if (!best || hz < best)
+            best = hz;
+    }
+    return best;
+}
+
+int clock_init(void) {
+    uint64_t hz = 0;
+    acpi_init();
+    if ((hz = calibrate_hpet()) != 0)
+        source = "hpet";
+    else if ((hz = calibrate_pit()) != 0)
+        source = "pit";
+    if (hz) {
+        tsc_hz = hz;
+        ns_mult = (1000000000ULL << 32) / hz;
+    }
+    tsc_base = io_rdtsc();
+    return hz ? 0 : -1;
+}
+
+uint64_t clock_ns(void) {
+    uint64_t delta = io_rdtsc() - tsc_base;
+    return (uint64_t)(((unsigned __int128)delta * ns_mult) >> 32);
+}
+
+uint64_t clock_ms(void) {
+    return clock_ns() / 1000000ULL;
+}
+
+uint64_t clock_tsc_hz(void) {
+    return tsc_hz;
+}
+
+const char *clock_source(void) {
+    return source;
+}
@@ -336,33 +336,41 @@ static char scancode_to_ascii(uint8_t sc) {
     return kbd_shift ? shifted : normal;
 }
 
-char console_getc(void) {
-    while (1) {
-        if (pending_pos < pending_len) {
-            console_release_display_hold();
-            return pending_input[pending_pos++];
+int console_try_getc(char *out) {
+    if (pending_pos < pending_len) {
+        console_release_display_hold();
+        *out = pending_input[pending_pos++];
+        return 1;
+    }
+    pending_len = 0;
+    pending_pos = 0;
+    if (serial_read_ready()) {
+        int ch = serial_getc();
+        if (ch == '\r') {
+            ch = '\n';
         }
-        pending_len = 0;
-        pending_pos = 0;
-        if (serial_read_ready()) {
-            int ch = serial_getc();
-            if (ch == '\r') {
-                ch = '\n';
-            }
-            if (ch >= 0) {
-                console_release_display_hold();
-                return (char)ch;
-            }
+        if (ch >= 0) {
+            console_release_display_hold();
+            *out = (char)ch;
+            return 1;
         }
-        uint8_t sc = 0;
-        if (ps2_try_read_scancode(&sc)) {
-            char translated = scancode_to_ascii(sc);
-            if (translated) {
-                console_release_display_hold();
-                return translated;
-            }
+    }
+    uint8_t sc = 0;
+    if (ps2_try_read_scancode(&sc)) {
+        char translated = scancode_to_ascii(sc);
+        if (translated) {
+            console_release_display_hold();
+            *out = translated;
+            return 1;
         }
     }
+    return 0;
+}
+
+char console_getc(void) {
+    char c;
+    while (!console_try_getc(&c)) {}
+    return c;
 }
 
 void console_udec(uint32_t v) {
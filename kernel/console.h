@@ -56,6 +56,9 @@ void console_clear(void);
 /* Read one character from PS/2 keyboard or serial fallback. */
 char console_getc(void);
 
+/* Poll keyboard and serial once; 1 and *out set if a character was ready. */
+int console_try_getc(char *out);
+
 /* Set the current foreground/background attribute. */
 void console_set_attr(uint8_t fg, uint8_t bg);
 
@@ -10,13 +10,18 @@
 #include <stdio.h>
 #endif
 
+/* The log starts small and doubles in place as it fills, up to the max. */
+#define DEBUGLOG_INITIAL_SIZE (16 * 1024)
+#define DEBUGLOG_MAX_SIZE (64 * 1024)
+
 static char *log_buf;
 static size_t log_pos;
 static size_t log_size;
 static uint64_t log_start;
+static int log_growing;
 
 void debuglog_init(void) {
-    log_size = 64 * 1024;
+    log_size = DEBUGLOG_INITIAL_SIZE;
     log_buf = mem_alloc(log_size);
     if (!log_buf)
         log_size = 0;
@@ -25,8 +30,27 @@ void debuglog_init(void) {
     log_start = io_rdtsc();
 }
 
+static void debuglog_grow(void) {
+    if (log_growing || log_size >= DEBUGLOG_MAX_SIZE)
+        return;
+    /* mem_realloc may log through the console, which lands back here. */
+    log_growing = 1;
+    size_t new_size = log_size * 2;
+    char *grown = mem_realloc(log_buf, log_size, new_size);
+    if (grown) {
+        fs_remap(log_buf, grown, new_size);
+        log_buf = grown;
+        log_size = new_size;
+    }
+    log_growing = 0;
+}
+
 void debuglog_char(char c) {
-    if (!log_buf || log_pos >= log_size)
+    if (!log_buf)
+        return;
+    if (log_pos >= log_size)
+        debuglog_grow();
+    if (log_pos >= log_size)
         return;
     log_buf[log_pos++] = c;
 }
@@ -66,7 +66,7 @@ int elf_validate(const void *file, size_t file_size) {
         return -1;
     if (eh->e_version != ELF_VERSION_CURRENT || eh->e_version2 != ELF_VERSION_CURRENT)
         return -1;
-    if (eh->e_type != ELF_TYPE_EXEC || eh->e_machine != ELF_MACHINE_X86_64)
+    if ((eh->e_type != ELF_TYPE_EXEC && eh->e_type != ELF_TYPE_DYN) || eh->e_machine != ELF_MACHINE_X86_64)
         return -1;
     if (eh->e_ehsize != sizeof(elf_header_t) || eh->e_phentsize != sizeof(elf_phdr_t) || eh->e_phnum == 0)
         return -1;
@@ -79,7 +79,7 @@ int elf_validate(const void *file, size_t file_size) {
     return inspect_load_range(eh, ph, file_size, &min_vaddr, &max_vaddr, &loads);
 }
 
-int elf_load_process_image(int pid, const void *file, size_t file_size, elf_image_t *out) {
+int elf_layout(const void *file, size_t file_size, elf_layout_t *out) {
     if (!out || elf_validate(file, file_size) != 0)
         return -1;
     const elf_header_t *eh = (const elf_header_t*)file;
@@ -88,30 +88,140 @@ int elf_load_process_image(int pid, const void *file, size_t file_size, elf_imag
     int loads;
     if (inspect_load_range(eh, ph, file_size, &min_vaddr, &max_vaddr, &loads) != 0)
         return -1;
-    (void)loads;
-
-    size_t load_size = (size_t)(max_vaddr - min_vaddr);
-    unsigned char *base = proc_alloc(pid, load_size);
-    if (!base)
-        return -1;
-    memset(base, 0, load_size);
-
+    out->requested_base = (uintptr_t)min_vaddr;
+    out->requested_end = (uintptr_t)max_vaddr;
+    out->load_size = (size_t)(max_vaddr - min_vaddr);
+    out->entry_offset = (size_t)(eh->e_entry - min_vaddr);
+    out->file_extent = 0;
+    out->writable = 0;
+    out->relocatable = eh->e_type == ELF_TYPE_DYN;
+    out->nsegments = 0;
     for (uint16_t i = 0; i < eh->e_phnum; ++i) {
         if (ph[i].p_type != ELF_PT_LOAD)
             continue;
-        size_t dest_off = (size_t)(ph[i].p_vaddr - min_vaddr);
-        if (dest_off > load_size || ph[i].p_memsz > load_size - dest_off) {
-            proc_free(pid, base);
+        if (out->nsegments == ELF_MAX_SEGMENTS)
             return -1;
-        }
+        elf_segment_t *seg = &out->segments[out->nsegments++];
+        seg->offset = (size_t)(ph[i].p_vaddr - min_vaddr);
+        seg->memsz = (size_t)ph[i].p_memsz;
+        seg->filesz = (size_t)ph[i].p_filesz;
+        seg->file_offset = ph[i].p_offset;
+        seg->flags = ph[i].p_flags;
+        if (ph[i].p_filesz && seg->offset + (size_t)ph[i].p_filesz > out->file_extent)
+            out->file_extent = seg->offset + (size_t)ph[i].p_filesz;
+        if (ph[i].p_flags & ELF_PF_W)
+            out->writable = 1;
+    }
+    return 0;
+}
+
+void elf_place_segments(const void *file, const elf_layout_t *layout, unsigned char *base) {
+    const elf_header_t *eh = (const elf_header_t*)file;
+    const elf_phdr_t *ph = (const elf_phdr_t*)((const unsigned char*)file + eh->e_phoff);
+    memset(base, 0, layout->file_extent);
+    for (uint16_t i = 0; i < eh->e_phnum; ++i) {
+        if (ph[i].p_type != ELF_PT_LOAD)
+            continue;
+        size_t dest_off = (size_t)(ph[i].p_vaddr - layout->requested_base);
         memcpy(base + dest_off, (const unsigned char*)file + ph[i].p_offset, (size_t)ph[i].p_filesz);
     }
+}
 
-    out->requested_base = (uintptr_t)min_vaddr;
-    out->requested_end = (uintptr_t)max_vaddr;
+/* File offset of 'len' bytes at 'vaddr', if a segment stores them. */
+static int file_offset_of(const elf_layout_t *layout, uint64_t vaddr, uint64_t len, uint64_t *out) {
+    for (int i = 0; i < layout->nsegments; ++i) {
+        const elf_segment_t *seg = &layout->segments[i];
+        uint64_t start = layout->requested_base + seg->offset;
+        if (vaddr >= start && vaddr - start <= seg->filesz && len <= seg->filesz - (vaddr - start)) {
+            *out = seg->file_offset + (vaddr - start);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int elf_relocations(const void *file, size_t file_size, const elf_layout_t *layout,
+                    const elf_rela_t **out, size_t *count) {
+    *out = 0;
+    *count = 0;
+    if (!layout->relocatable)
+        return 0;
+    const elf_header_t *eh = (const elf_header_t*)file;
+    const elf_phdr_t *ph = (const elf_phdr_t*)((const unsigned char*)file + eh->e_phoff);
+    const elf_phdr_t *dynamic = 0;
+    for (uint16_t i = 0; i < eh->e_phnum; ++i) {
+        if (ph[i].p_type == ELF_PT_DYNAMIC)
+            dynamic = &ph[i];
+    }
+    if (!dynamic)
+        return 0;
+    if (!range_inside(dynamic->p_offset, dynamic->p_filesz, file_size))
+        return -1;
+    const elf_dyn_t *dyn = (const elf_dyn_t*)((const unsigned char*)file + dynamic->p_offset);
+    size_t ndyn = (size_t)(dynamic->p_filesz / sizeof(elf_dyn_t));
+    uint64_t rela = 0, relasz = 0, relaent = sizeof(elf_rela_t);
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != ELF_DT_NULL; ++i) {
+        if (dyn[i].d_tag == ELF_DT_RELA)
+            rela = dyn[i].d_val;
+        else if (dyn[i].d_tag == ELF_DT_RELASZ)
+            relasz = dyn[i].d_val;
+        else if (dyn[i].d_tag == ELF_DT_RELAENT)
+            relaent = dyn[i].d_val;
+    }
+    if (relasz == 0)
+        return 0;
+    uint64_t off;
+    if (relaent != sizeof(elf_rela_t) || relasz % sizeof(elf_rela_t) != 0 ||
+        file_offset_of(layout, rela, relasz, &off) != 0 || !range_inside(off, relasz, file_size))
+        return -1;
+    const elf_rela_t *relas = (const elf_rela_t*)((const unsigned char*)file + off);
+    size_t n = (size_t)(relasz / sizeof(elf_rela_t));
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t type = (uint32_t)relas[i].r_info;
+        if (type != ELF_R_X86_64_RELATIVE && type != ELF_R_X86_64_NONE)
+            return -1;
+    }
+    *out = relas;
+    *count = n;
+    return 0;
+}
+
+int elf_apply_relocations(const elf_rela_t *relas, size_t count, const elf_layout_t *layout,
+                          unsigned char *image, size_t image_off, size_t image_len, uintptr_t load_addr) {
+    for (size_t i = 0; i < count; ++i) {
+        if ((uint32_t)relas[i].r_info != ELF_R_X86_64_RELATIVE)
+            continue;
+        uint64_t target = relas[i].r_offset - layout->requested_base;
+        if (relas[i].r_offset < layout->requested_base || target < image_off ||
+            target - image_off > image_len || image_len - (target - image_off) < sizeof(uint64_t))
+            return -1;
+        uint64_t value = load_addr - layout->requested_base + (uint64_t)relas[i].r_addend;
+        memcpy(image + (target - image_off), &value, sizeof(value));
+    }
+    return 0;
+}
+
+int elf_load_process_image(int pid, const void *file, size_t file_size, elf_image_t *out) {
+    elf_layout_t layout;
+    const elf_rela_t *relas;
+    size_t nrelas;
+    if (!out || elf_layout(file, file_size, &layout) != 0 ||
+        elf_relocations(file, file_size, &layout, &relas, &nrelas) != 0)
+        return -1;
+    unsigned char *base = proc_alloc(pid, layout.load_size);
+    if (!base)
+        return -1;
+    elf_place_segments(file, &layout, base);
+    memset(base + layout.file_extent, 0, layout.load_size - layout.file_extent);
+    if (elf_apply_relocations(relas, nrelas, &layout, base, 0, layout.load_size, (uintptr_t)base) != 0) {
+        proc_free(pid, base);
+        return -1;
+    }
+    out->requested_base = layout.requested_base;
+    out->requested_end = layout.requested_end;
     out->load_base = base;
-    out->load_size = load_size;
-    out->entry = base + (eh->e_entry - min_vaddr);
+    out->load_size = layout.load_size;
+    out->entry = base + layout.entry_offset;
     return 0;
 }
 
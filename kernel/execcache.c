@@ -0,0 +1,308 @@
+#include "execcache.h"
+#include "vfs.h"
+#include "mem.h"
+#include "memutils.h"
+
+#define EXEC_PAGE 4096u
+
+typedef struct {
+    int used;               /* 0 while the slot is free or filling */
+    uint32_t inode;         /* key of VFS images */
+    uint32_t version;
+    const void *buffer;     /* key of images in fixed memory */
+    int stale;              /* file changed; freed once 'refs' drops */
+    elf_layout_t layout;
+    vfs_map_t *file_map;    /* pins 'file' while segments map it in place */
+    const unsigned char *file;
+    size_t file_size;
+    uint32_t in_place;      /* segments mapped straight from the file */
+    void *raw;              /* allocation backing 'pages' */
+    size_t raw_size;
+    unsigned char *pages;   /* page-aligned copy of the other segments */
+    size_t stage_lo;        /* window offsets 'pages' covers */
+    size_t stage_hi;
+    size_t bias;            /* requested_base's offset within its page */
+    uint32_t refs;          /* address spaces mapping it */
+    uint64_t last_use;
+} exec_entry_t;
+
+static exec_entry_t entries[EXECCACHE_SLOTS];
+static uint64_t use_clock;
+static int registered;
+static uint32_t hits;
+static uint32_t misses;
+
+static size_t page_down(size_t v) { return v & ~(size_t)(EXEC_PAGE - 1); }
+static size_t page_up(size_t v) { return (v + EXEC_PAGE - 1) & ~(size_t)(EXEC_PAGE - 1); }
+
+static void drop_entry(exec_entry_t *e) {
+    if (e->raw)
+        mem_free(e->raw, e->raw_size);
+    vfs_unmap(e->file_map);
+    memset(e, 0, sizeof(*e));
+}
+
+static exec_entry_t *find_entry(const vfs_stat_t *st) {
+    for (int i = 0; i < EXECCACHE_SLOTS; ++i) {
+        exec_entry_t *e = &entries[i];
+        if (!e->used || e->buffer || e->stale || e->inode != st->inode)
+            continue;
+        if (e->version == st->version)
+            return e;
+        /* Rewritten since it was cached. */
+        if (e->refs)
+            e->stale = 1;
+        else
+            drop_entry(e);
+    }
+    return 0;
+}
+
+/* An empty slot, else the least recently used idle one. */
+static exec_entry_t *claim_slot(void) {
+    exec_entry_t *victim = 0;
+    for (int i = 0; i < EXECCACHE_SLOTS; ++i) {
+        exec_entry_t *e = &entries[i];
+        if (!e->used)
+            return e;
+        if (!e->refs && (!victim || e->last_use < victim->last_use))
+            victim = e;
+    }
+    if (victim)
+        drop_entry(victim);
+    return victim;
+}
+
+static int pages_overlap(size_t a_start, size_t a_len, size_t b_start, size_t b_len) {
+    return page_down(a_start) < page_up(b_start + b_len) && page_down(b_start) < page_up(a_start + a_len);
+}
+
+/* Read-only segments whose file bytes sit at the same page offset as
+ * their load address can map the file buffer itself, unless a relocation
+ * lands in them or they share a page with a segment that is copied.
+ */
+static uint32_t pick_in_place(const unsigned char *file, const elf_layout_t *l, size_t bias,
+                              const elf_rela_t *relas, size_t nrelas) {
+    uint32_t mask = 0;
+    if ((uintptr_t)file & (EXEC_PAGE - 1))
+        return 0;
+    for (int i = 0; i < l->nsegments; ++i) {
+        const elf_segment_t *seg = &l->segments[i];
+        if ((seg->flags & ELF_PF_W) || seg->memsz != seg->filesz ||
+            ((bias + seg->offset - seg->file_offset) & (EXEC_PAGE - 1)))
+            continue;
+        mask |= 1u << i;
+    }
+    for (size_t r = 0; r < nrelas; ++r) {
+        size_t target = (size_t)(relas[r].r_offset - l->requested_base);
+        for (int i = 0; i < l->nsegments; ++i) {
+            if (pages_overlap(bias + target, sizeof(uint64_t), bias + l->segments[i].offset, l->segments[i].memsz))
+                mask &= ~(1u << i);
+        }
+    }
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int i = 0; i < l->nsegments; ++i) {
+            for (int j = 0; j < l->nsegments && (mask & (1u << i)); ++j) {
+                if (!(mask & (1u << j)) &&
+                    pages_overlap(bias + l->segments[i].offset, l->segments[i].memsz,
+                                  bias + l->segments[j].offset, l->segments[j].memsz)) {
+                    mask &= ~(1u << i);
+                    changed = 1;
+                }
+            }
+        }
+    }
+    return mask;
+}
+
+/* Copy the segments that cannot be mapped in place, then relocate them
+ * for the fixed window address every space shares.
+ */
+static int stage_segments(exec_entry_t *e, const elf_rela_t *relas, size_t nrelas) {
+    const elf_layout_t *l = &e->layout;
+    size_t lo = (size_t)-1, hi = 0;
+    for (int i = 0; i < l->nsegments; ++i) {
+        const elf_segment_t *seg = &l->segments[i];
+        if ((e->in_place & (1u << i)) || seg->filesz == 0)
+            continue;
+        if (page_down(e->bias + seg->offset) < lo)
+            lo = page_down(e->bias + seg->offset);
+        if (page_up(e->bias + seg->offset + seg->filesz) > hi)
+            hi = page_up(e->bias + seg->offset + seg->filesz);
+    }
+    if (hi == 0)
+        return nrelas ? -1 : 0;
+    e->raw_size = hi - lo + EXEC_PAGE;
+    e->raw = mem_alloc(e->raw_size);
+    if (!e->raw)
+        return -1;
+    e->pages = (unsigned char *)page_up((uintptr_t)e->raw);
+    e->stage_lo = lo;
+    e->stage_hi = hi;
+    memset(e->pages, 0, hi - lo);
+    for (int i = 0; i < l->nsegments; ++i) {
+        const elf_segment_t *seg = &l->segments[i];
+        if (!(e->in_place & (1u << i)) && seg->filesz)
+            memcpy(e->pages + (e->bias + seg->offset - lo), e->file + seg->file_offset, seg->filesz);
+    }
+    size_t image_off = lo > e->bias ? lo - e->bias : 0;
+    return elf_apply_relocations(relas, nrelas, l, e->pages + (e->bias + image_off - lo), image_off,
+                                 hi - e->bias - image_off, (uintptr_t)VMM_USER_BASE + e->bias);
+}
+
+/* Lay out e->file: pick the in-place segments and stage the rest. */
+static int build_entry(exec_entry_t *e) {
+    const elf_rela_t *relas;
+    size_t nrelas;
+    if (elf_layout(e->file, e->file_size, &e->layout) != 0 ||
+        elf_relocations(e->file, e->file_size, &e->layout, &relas, &nrelas) != 0)
+        return -1;
+    /* Keep link-time page offsets so whole pages can be shared. */
+    e->bias = e->layout.requested_base & (EXEC_PAGE - 1);
+    e->in_place = pick_in_place(e->file, &e->layout, e->bias, relas, nrelas);
+    return stage_segments(e, relas, nrelas);
+}
+
+static exec_entry_t *fill_entry(const char *path, const vfs_stat_t *st) {
+    exec_entry_t *e = claim_slot();
+    if (!e)
+        return 0;
+    e->file = vfs_map(path, &e->file_size, &e->file_map);
+    if (!e->file || e->file_size != st->size || build_entry(e) != 0) {
+        drop_entry(e);
+        return 0;
+    }
+    if (!e->in_place) {
+        vfs_unmap(e->file_map);
+        e->file_map = 0;
+        e->file = 0;
+    }
+    e->inode = st->inode;
+    e->version = st->version;
+    e->used = 1;
+    return e;
+}
+
+static void register_shrinker(void) {
+    if (!registered) {
+        mem_register_shrinker("execcache", MEM_SHRINK_PRIO_CACHE, execcache_shrink);
+        registered = 1;
+    }
+}
+
+static int map_entry(exec_entry_t *e, vmm_space_t *space, elf_image_t *out, void **handle) {
+    e->last_use = ++use_clock;
+    for (int i = 0; i < e->layout.nsegments; ++i) {
+        const elf_segment_t *seg = &e->layout.segments[i];
+        size_t start = page_down(e->bias + seg->offset);
+        size_t end = page_up(e->bias + seg->offset + seg->memsz);
+        const unsigned char *src = 0;
+        size_t src_len = 0;
+        if (e->in_place & (1u << i)) {
+            size_t file_page = page_down((size_t)seg->file_offset);
+            src = e->file + file_page;
+            src_len = e->file_size - file_page;
+        } else if (e->pages && start >= e->stage_lo && start < e->stage_hi) {
+            src = e->pages + (start - e->stage_lo);
+            src_len = e->stage_hi - start;
+        }
+        if (vmm_map_lazy(space, VMM_USER_BASE + start, end - start, src, src_len,
+                         (seg->flags & ELF_PF_W) != 0) != 0)
+            return -1;
+    }
+    e->refs++;
+    *handle = e;
+    unsigned char *base = (unsigned char *)(uintptr_t)VMM_USER_BASE + e->bias;
+    out->requested_base = e->layout.requested_base;
+    out->requested_end = e->layout.requested_end;
+    out->load_base = base;
+    out->load_size = e->layout.load_size;
+    out->entry = base + e->layout.entry_offset;
+    return 0;
+}
+
+int execcache_map(vmm_space_t *space, const char *path, elf_image_t *out, void **handle) {
+    vfs_stat_t st;
+    if (!space || !out || !handle || vfs_stat(path, &st) != 0 || st.type != VFS_TYPE_FILE || st.size == 0)
+        return -1;
+    register_shrinker();
+    exec_entry_t *e = find_entry(&st);
+    if (e) {
+        hits++;
+    } else {
+        misses++;
+        e = fill_entry(path, &st);
+        if (!e)
+            return -1;
+    }
+    return map_entry(e, space, out, handle);
+}
+
+int execcache_map_buffer(vmm_space_t *space, const void *data, size_t size, elf_image_t *out, void **handle) {
+    if (!space || !data || !size || !out || !handle)
+        return -1;
+    register_shrinker();
+    exec_entry_t *e = 0;
+    for (int i = 0; i < EXECCACHE_SLOTS && !e; ++i) {
+        if (entries[i].used && entries[i].buffer == data && entries[i].file_size == size)
+            e = &entries[i];
+    }
+    if (e) {
+        hits++;
+    } else {
+        misses++;
+        e = claim_slot();
+        if (!e)
+            return -1;
+        e->file = data;
+        e->file_size = size;
+        if (build_entry(e) != 0) {
+            drop_entry(e);
+            return -1;
+        }
+        e->buffer = data;
+        e->used = 1;
+    }
+    return map_entry(e, space, out, handle);
+}
+
+void execcache_release(void *handle) {
+    exec_entry_t *e = handle;
+    if (!e || !e->refs)
+        return;
+    if (--e->refs == 0 && e->stale)
+        drop_entry(e);
+}
+
+size_t execcache_shrink(size_t goal) {
+    size_t freed = 0;
+    while (freed < goal) {
+        exec_entry_t *victim = 0;
+        for (int i = 0; i < EXECCACHE_SLOTS; ++i) {
+            exec_entry_t *e = &entries[i];
+            if (e->used && !e->refs && (!victim || e->last_use < victim->last_use))
+                victim = e;
+        }
+        if (!victim)
+            break;
+        /* Pinned file bytes belong to the VFS; only the copy is ours. */
+        freed += victim->raw_size;
+        drop_entry(victim);
+    }
+    return freed;
+}
+
+void execcache_get_stats(execcache_stats_t *st) {
+    if (!st)
+        return;
+    memset(st, 0, sizeof(*st));
+    st->hits = hits;
+    st->misses = misses;
+    for (int i = 0; i < EXECCACHE_SLOTS; ++i) {
+        if (entries[i].used) {
+            st->entries++;
+            st->bytes += entries[i].raw_size;
+        }
+    }
+}
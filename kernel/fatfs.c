@@ -1,19 +1,21 @@
 #include "fatfs.h"
-#include "ata_pio.h"
+#include "blkdev.h"
 #include "memutils.h"
 
-/* Minimal FAT filesystem driver that uses the existing ATA PIO block
- * device driver. It supports mounting a volume located at a starting
+/* Minimal FAT filesystem driver on top of the default block device
+ * (see blkdev.h). It supports mounting a volume located at a starting
  * LBA and performing raw sector reads and writes. The driver also scans
  * the filesystem for sectors that fail to read, treating them as bad.
  */
 
 static uint32_t fat_start_lba = 0;
+static int fat_dev = -1;
 
 int fat_mount(uint32_t lba_start) {
     unsigned char sector[512];
     fat_start_lba = lba_start;
-    if (ata_pio_read(lba_start, sector, 1) != 0)
+    fat_dev = blkdev_default();
+    if (blkdev_read(fat_dev, lba_start, sector, 1) != 0)
         return -1;
     /* Verify boot sector signature */
     if (sector[510] != 0x55 || sector[511] != 0xAA)
@@ -27,18 +29,18 @@ int fat_mount(uint32_t lba_start) {
 }
 
 int fat_read(uint32_t lba, void *buffer, size_t count) {
-    return ata_pio_read(fat_start_lba + lba, buffer, count);
+    return blkdev_read(fat_dev, fat_start_lba + lba, buffer, count);
 }
 
 int fat_write(uint32_t lba, const void *buffer, size_t count) {
-    return ata_pio_write(fat_start_lba + lba, buffer, count);
+    return blkdev_write(fat_dev, fat_start_lba + lba, buffer, count);
 }
 
 int fat_scan_bad_sectors(void) {
     unsigned char sector[512];
     int bad = 0;
     for (uint32_t i = 0; i < 16; ++i) {
-        if (ata_pio_read(fat_start_lba + i, sector, 1) != 0)
+        if (blkdev_read(fat_dev, fat_start_lba + i, sector, 1) != 0)
             ++bad;
     }
     return bad;
@@ -320,6 +320,13 @@ void fs_mount(void *storage, size_t size) {
     console_putc('\n');
 }
 
+void fs_remap(const void *old, void *storage, size_t size) {
+    if (!old || fs_data != (const unsigned char *)old || fs_mode != FS_MODE_RAW)
+        return;
+    fs_data = (unsigned char *)storage;
+    fs_size = size;
+}
+
 size_t fs_read(size_t offset, void *buf, size_t len) {
     if (!buf || !range_ok(offset, 0))
         return 0;
@@ -0,0 +1,38 @@
+#include "futex.h"
+#include "sched.h"
+
+/* Waiters for every futex share a bucket's queue and are told apart by
+ * key: the pid in the top bits over a canonical lower-half address.
+ */
+#define FUTEX_BUCKET_BITS 6
+
+static sched_waitq_t buckets[1 << FUTEX_BUCKET_BITS];
+
+static uintptr_t futex_key(int pid, volatile uint32_t *addr) {
+    return ((uintptr_t)(uint32_t)pid << 48) | ((uintptr_t)addr & 0xFFFFFFFFFFFFull);
+}
+
+static sched_waitq_t *bucket_for(uintptr_t key) {
+    return &buckets[((key >> 2) * 0x9E3779B97F4A7C15ull) >> (64 - FUTEX_BUCKET_BITS)];
+}
+
+int futex_wait(int pid, volatile uint32_t *addr, uint32_t val, uint64_t timeout_ms) {
+    if (!addr || ((uintptr_t)addr & 3))
+        return -1;
+    if (*addr != val)
+        return FUTEX_ERR_AGAIN;
+    uintptr_t key = futex_key(pid, addr);
+    if (sched_wait_key(bucket_for(key), key, timeout_ms) == 0)
+        return 0;
+    /* The idle context cannot queue; it reports a spurious wakeup. */
+    return timeout_ms && sched_current() ? FUTEX_ERR_TIMEDOUT : 0;
+}
+
+int futex_wake(int pid, volatile uint32_t *addr, int count) {
+    if (!addr || ((uintptr_t)addr & 3))
+        return -1;
+    if (count <= 0)
+        return 0;
+    uintptr_t key = futex_key(pid, addr);
+    return sched_wake_key(bucket_for(key), key, count);
+}
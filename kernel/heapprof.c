@@ -0,0 +1,150 @@
+#include "heapprof.h"
+#include "config.h"
+#include "memutils.h"
+
+/* Live blocks are kept in a linear-probing table keyed by address. It is
+ * static so recording an allocation never allocates, and deletion shifts
+ * later entries back instead of leaving tombstones.
+ */
+#define HEAPPROF_LIVE_SLOTS 4096
+#define HEAPPROF_LIVE_LIMIT (HEAPPROF_LIVE_SLOTS * 3 / 4)
+#define HEAPPROF_SITE_SLOTS 256
+#define HEAPPROF_SITE_LIMIT (HEAPPROF_SITE_SLOTS * 7 / 8)
+
+typedef struct {
+    uintptr_t ptr;
+    uint32_t size;
+    uint32_t site;
+} heapprof_live_t;
+
+static heapprof_live_t live[HEAPPROF_LIVE_SLOTS];
+static heapprof_site_t sites[HEAPPROF_SITE_SLOTS];
+static heapprof_summary_t summary;
+
+static uint32_t hash_addr(uintptr_t addr, uint32_t slots) {
+    uint64_t h = (uint64_t)(addr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32) & (slots - 1);
+}
+
+static int bucket_for(size_t size) {
+    int b = 0;
+    while (b < HEAPPROF_HIST_BUCKETS - 1 && size > ((size_t)32 << b))
+        b++;
+    return b;
+}
+
+void heapprof_reset(void) {
+    memset(live, 0, sizeof(live));
+    memset(sites, 0, sizeof(sites));
+    memset(&summary, 0, sizeof(summary));
+}
+
+static int site_slot(uintptr_t site) {
+    uint32_t i = hash_addr(site, HEAPPROF_SITE_SLOTS);
+    while (sites[i].site) {
+        if (sites[i].site == site)
+            return (int)i;
+        i = (i + 1) & (HEAPPROF_SITE_SLOTS - 1);
+    }
+    if (summary.sites >= HEAPPROF_SITE_LIMIT)
+        return -1;
+    sites[i].site = site;
+    summary.sites++;
+    return (int)i;
+}
+
+void heapprof_alloc(void *ptr, size_t size, void *site) {
+    if (!EXOCORE_HEAP_PROFILE || !ptr)
+        return;
+    /* Site 0 would read as an empty slot. */
+    uintptr_t key = site ? (uintptr_t)site : 1;
+    int s = summary.live_blocks < HEAPPROF_LIVE_LIMIT ? site_slot(key) : -1;
+    if (s < 0) {
+        summary.dropped++;
+        return;
+    }
+    uint32_t i = hash_addr((uintptr_t)ptr, HEAPPROF_LIVE_SLOTS);
+    while (live[i].ptr)
+        i = (i + 1) & (HEAPPROF_LIVE_SLOTS - 1);
+    live[i].ptr = (uintptr_t)ptr;
+    live[i].size = size > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)size;
+    live[i].site = (uint32_t)s;
+
+    heapprof_site_t *st = &sites[s];
+    st->live_bytes += size;
+    st->live_count++;
+    st->total_bytes += size;
+    st->total_count++;
+    st->hist[bucket_for(size)]++;
+    if (st->live_bytes > st->peak_bytes)
+        st->peak_bytes = st->live_bytes;
+    summary.live_blocks++;
+    summary.live_bytes += size;
+}
+
+void heapprof_free(void *ptr) {
+    if (!EXOCORE_HEAP_PROFILE || !ptr || summary.live_blocks == 0)
+        return;
+    uint32_t mask = HEAPPROF_LIVE_SLOTS - 1;
+    uint32_t i = hash_addr((uintptr_t)ptr, HEAPPROF_LIVE_SLOTS);
+    while (live[i].ptr != (uintptr_t)ptr) {
+        if (!live[i].ptr)
+            return; /* allocated while the table was full */
+        i = (i + 1) & mask;
+    }
+    heapprof_site_t *st = &sites[live[i].site];
+    st->live_bytes -= live[i].size;
+    st->live_count--;
+    summary.live_blocks--;
+    summary.live_bytes -= live[i].size;
+
+    /* Pull back any later entry whose home slot the hole now cuts off. */
+    uint32_t hole = i;
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!live[j].ptr)
+            break;
+        uint32_t home = hash_addr(live[j].ptr, HEAPPROF_LIVE_SLOTS);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            live[hole] = live[j];
+            hole = j;
+        }
+    }
+    live[hole].ptr = 0;
+}
+
+void heapprof_leak(size_t size) {
+    summary.leaked_blocks++;
+    summary.leaked_bytes += size;
+}
+
+void heapprof_get_summary(heapprof_summary_t *out) {
+    if (!out)
+        return;
+    *out = summary;
+    out->enabled = EXOCORE_HEAP_PROFILE ? 1 : 0;
+}
+
+int heapprof_snapshot(heapprof_site_t *out, int max) {
+    if (!out || max <= 0)
+        return 0;
+    int n = 0;
+    for (int i = 0; i < HEAPPROF_SITE_SLOTS; i++) {
+        if (!sites[i].site)
+            continue;
+        /* Insertion into the sorted prefix; the last entry falls off. */
+        int pos = n < max ? n : max;
+        while (pos > 0 && out[pos - 1].live_bytes < sites[i].live_bytes) {
+            if (pos < max)
+                out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos < max) {
+            out[pos] = sites[i];
+            if (n < max)
+                n++;
+        }
+    }
+    return n;
+}
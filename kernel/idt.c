@@ -3,6 +3,8 @@
 #include "panic.h"
 #include "serial.h"
 #include "runstate.h"
+#include "smp.h"
+#include "vmm.h"
 #include <stddef.h>
 #include <string.h>
 
@@ -121,6 +123,15 @@ void idt_set_user_gate(uint8_t num, void *base) {
     idt_set_gate(num, (uint64_t)(uintptr_t)base, 0x08, 0xEE, 0);
 }
 
+/* Read by the interrupt and syscall stubs. */
+uint64_t idt_fpu_area = 512;
+uint32_t idt_fpu_xsave;
+
+void idt_use_xsave(uint32_t bytes) {
+    idt_fpu_area = (bytes + 63) & ~63u;
+    idt_fpu_xsave = 1;
+}
+
 void register_irq_handler(uint8_t num, irq_handler_t handler) {
     handlers[num] = handler;
 }
@@ -135,11 +146,23 @@ void idt_init(void) {
     idt_load(&idtp);
 }
 
+void idt_load_cpu(void) {
+    idt_ptr_t idtp = { sizeof(idt) - 1, (uint64_t)idt };
+    idt_load(&idtp);
+}
+
 void idt_handle_interrupt(uint32_t num, uint32_t err, uint64_t rsp) {
     uint64_t *stack = (uint64_t*)rsp;
     uint64_t rip = stack[17];
+    kernel_lock();
+    /* Touching a lazily mapped page of a process window. */
+    if (num == 14 && vmm_handle_fault((uintptr_t)read_cr2(), err) == 0) {
+        kernel_unlock();
+        return;
+    }
     if (handlers[num]) {
         handlers[num](num, err, rsp);
+        kernel_unlock();
         return;
     }
 
@@ -196,6 +219,7 @@ void idt_handle_interrupt(uint32_t num, uint32_t err, uint64_t rsp) {
         serial_write("\n");
 
         if (num == 3 || num == 1) {
+            kernel_unlock();
             return;
         } else {
             const char *type = current_user_app ? "User app" : "Kernel process";
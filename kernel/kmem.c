@@ -0,0 +1,255 @@
+#include "kmem.h"
+#include "mem.h"
+#include "memutils.h"
+#include "pmm.h"
+#include "panic.h"
+
+#define KMEM_MAX_CACHES 32
+#define KMEM_MIN_OBJS_PER_SLAB 8
+#define KMEM_HEAP_SLAB 0xFFu
+
+/* A slab is a naturally aligned run of pages (or an aligned window inside a
+ * heap block before the page allocator is up). Its header sits at the start
+ * so an object's slab is found by masking its address. Free objects are
+ * chained through their first word.
+ */
+typedef struct kmem_slab {
+    kmem_cache_t *cache;
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+    void *free;
+    uint32_t inuse;
+    uint32_t order;
+    void *raw;
+} kmem_slab_t;
+
+struct kmem_cache {
+    const char *name;
+    size_t obj_size;
+    size_t slot_size;
+    size_t first_offset;
+    size_t slab_bytes;
+    uint32_t order;
+    uint32_t objs_per_slab;
+    kmem_ctor_t ctor;
+    kmem_slab_t *partial;
+    kmem_slab_t *full;
+    kmem_slab_t *empty;
+    uint32_t active;
+    uint32_t slabs;
+    int used;
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+
+static void slab_unlink(kmem_slab_t **list, kmem_slab_t *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void slab_push(kmem_slab_t **list, kmem_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, uint32_t flags, kmem_ctor_t ctor) {
+    if (size == 0)
+        return NULL;
+    size_t align = (flags & KMEM_CACHE_ALIGN_LINE) ? KMEM_CACHE_LINE : sizeof(void *);
+    size_t slot = size < sizeof(void *) ? sizeof(void *) : size;
+    slot = (slot + align - 1) & ~(align - 1);
+    size_t first = (sizeof(kmem_slab_t) + align - 1) & ~(align - 1);
+    int order = pmm_order_for(first + slot * KMEM_MIN_OBJS_PER_SLAB);
+    if (order < 0)
+        return NULL;
+    mem_register_shrinker("kmem", MEM_SHRINK_PRIO_CACHE, kmem_reap);
+    for (int i = 0; i < KMEM_MAX_CACHES; ++i) {
+        if (caches[i].used)
+            continue;
+        kmem_cache_t *cache = &caches[i];
+        memset(cache, 0, sizeof(*cache));
+        cache->used = 1;
+        cache->name = name;
+        cache->obj_size = size;
+        cache->slot_size = slot;
+        cache->first_offset = first;
+        cache->order = (uint32_t)order;
+        cache->slab_bytes = (size_t)PMM_PAGE_SIZE << order;
+        cache->objs_per_slab = (uint32_t)((cache->slab_bytes - first) / slot);
+        cache->ctor = ctor;
+        return cache;
+    }
+    return NULL;
+}
+
+static kmem_slab_t *slab_new(kmem_cache_t *cache) {
+    uint8_t *base = NULL;
+    void *raw = NULL;
+    uint32_t order = cache->order;
+    if (pmm_ready())
+        base = pmm_alloc_pages(order);
+    if (!base) {
+        /* Over-allocate so the slab can be aligned to its own size. */
+        raw = mem_alloc(cache->slab_bytes * 2);
+        if (!raw)
+            return NULL;
+        base = (uint8_t *)(((uintptr_t)raw + cache->slab_bytes - 1) & ~(uintptr_t)(cache->slab_bytes - 1));
+        order = KMEM_HEAP_SLAB;
+    }
+    kmem_slab_t *slab = (kmem_slab_t *)base;
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->inuse = 0;
+    slab->order = order;
+    slab->raw = raw;
+    slab->free = NULL;
+    uint8_t *obj = base + cache->first_offset + (size_t)(cache->objs_per_slab - 1) * cache->slot_size;
+    for (uint32_t i = 0; i < cache->objs_per_slab; ++i, obj -= cache->slot_size) {
+        *(void **)obj = slab->free;
+        slab->free = obj;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t *cache, kmem_slab_t *slab) {
+    cache->slabs--;
+    if (slab->order == KMEM_HEAP_SLAB)
+        mem_free(slab->raw, cache->slab_bytes * 2);
+    else
+        pmm_free_pages(slab, slab->order);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache)
+        return NULL;
+    kmem_slab_t *slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab)
+            slab_unlink(&cache->empty, slab);
+        else
+            slab = slab_new(cache);
+        if (!slab)
+            return NULL;
+        slab_push(&cache->partial, slab);
+    }
+    void *obj = slab->free;
+    slab->free = *(void **)obj;
+    slab->inuse++;
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_unlink(&cache->partial, slab);
+        slab_push(&cache->full, slab);
+    }
+    cache->active++;
+    if (cache->ctor)
+        cache->ctor(obj);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!cache || !obj)
+        return;
+    kmem_slab_t *slab = (kmem_slab_t *)((uintptr_t)obj & ~(uintptr_t)(cache->slab_bytes - 1));
+    if (slab->cache != cache || slab->inuse == 0)
+        panic("kmem: object freed to the wrong cache");
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_unlink(&cache->full, slab);
+        slab_push(&cache->partial, slab);
+    }
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->active--;
+    if (slab->inuse == 0) {
+        /* Keep one empty slab around to absorb alloc/free churn. */
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty)
+            slab_release(cache, slab);
+        else
+            slab_push(&cache->empty, slab);
+    }
+}
+
+size_t kmem_reap(size_t goal) {
+    size_t freed = 0;
+    for (int i = 0; i < KMEM_MAX_CACHES && freed < goal; ++i) {
+        kmem_cache_t *cache = &caches[i];
+        while (cache->used && cache->empty && freed < goal) {
+            kmem_slab_t *slab = cache->empty;
+            slab_unlink(&cache->empty, slab);
+            slab_release(cache, slab);
+            freed += cache->slab_bytes;
+        }
+    }
+    return freed;
+}
+
+int kmem_cache_stats(const kmem_cache_t *cache, kmem_cache_stats_t *stats) {
+    if (!cache || !stats)
+        return -1;
+    stats->name = cache->name;
+    stats->obj_size = cache->obj_size;
+    stats->slab_bytes = cache->slab_bytes;
+    stats->objs_per_slab = cache->objs_per_slab;
+    stats->active = cache->active;
+    stats->slabs = cache->slabs;
+    return 0;
+}
+
+int kmem_table_insert(kmem_table_t *table, void *obj) {
+    if (!table || !obj)
+        return -1;
+    for (int i = table->free_hint; i < table->count; ++i) {
+        if (!table->slots[i]) {
+            table->slots[i] = obj;
+            table->free_hint = i + 1;
+            return i;
+        }
+    }
+    int old = table->count;
+    int count = old ? old * 2 : 16;
+    void **slots = mem_realloc(table->slots, (size_t)old * sizeof(void *), (size_t)count * sizeof(void *));
+    if (!slots)
+        return -1;
+    memset(slots + old, 0, (size_t)(count - old) * sizeof(void *));
+    table->slots = slots;
+    table->count = count;
+    table->slots[old] = obj;
+    table->free_hint = old + 1;
+    return old;
+}
+
+void kmem_table_remove(kmem_table_t *table, int idx) {
+    if (!table || idx < 0 || idx >= table->count)
+        return;
+    table->slots[idx] = NULL;
+    if (idx < table->free_hint)
+        table->free_hint = idx;
+}
+
+void kmem_table_reset(kmem_table_t *table) {
+    if (!table)
+        return;
+    if (table->slots)
+        mem_free(table->slots, (size_t)table->count * sizeof(void *));
+    table->slots = NULL;
+    table->count = 0;
+    table->free_hint = 0;
+}
+
+void *kmem_table_get(const kmem_table_t *table, int idx) {
+    if (!table || idx < 0 || idx >= table->count)
+        return NULL;
+    return table->slots[idx];
+}
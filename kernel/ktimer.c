@@ -0,0 +1,129 @@
+#include "ktimer.h"
+
+#define SLOT_MASK (KTIMER_SLOTS - 1)
+#define LEVEL_SPAN(l) (1ULL << (KTIMER_SLOT_BITS * ((l) + 1)))
+
+static ktimer_t *wheel[KTIMER_LEVELS][KTIMER_SLOTS];
+static uint64_t base;       /* next tick to process */
+static uint32_t armed;
+
+static void link_slot(ktimer_t **slot, ktimer_t *t) {
+    t->next = *slot;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+static void unlink_timer(ktimer_t *t) {
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = 0;
+    t->pprev = 0;
+}
+
+/* File a timer by how far its deadline is from 'base'. */
+static void place(ktimer_t *t) {
+    uint64_t expires = t->expires;
+    if (expires < base)
+        expires = base;
+    uint64_t delta = expires - base;
+    int level = 0;
+    while (level < KTIMER_LEVELS - 1 && delta >= LEVEL_SPAN(level))
+        level++;
+    if (delta >= LEVEL_SPAN(KTIMER_LEVELS - 1))
+        expires = base + LEVEL_SPAN(KTIMER_LEVELS - 1) - 1;
+    unsigned slot = (unsigned)(expires >> (KTIMER_SLOT_BITS * level)) & SLOT_MASK;
+    link_slot(&wheel[level][slot], t);
+}
+
+/* Re-file every timer in one slot of 'level'; returns the slot index so
+ * the caller knows whether the next level also wrapped.
+ */
+static unsigned cascade(int level) {
+    unsigned slot = (unsigned)(base >> (KTIMER_SLOT_BITS * level)) & SLOT_MASK;
+    ktimer_t *list = wheel[level][slot];
+    wheel[level][slot] = 0;
+    while (list) {
+        ktimer_t *t = list;
+        list = t->next;
+        t->next = 0;
+        t->pprev = 0;
+        place(t);
+    }
+    return slot;
+}
+
+void ktimer_init(uint64_t now) {
+    for (int l = 0; l < KTIMER_LEVELS; ++l)
+        for (int s = 0; s < KTIMER_SLOTS; ++s)
+            wheel[l][s] = 0;
+    base = now;
+    armed = 0;
+}
+
+uint64_t ktimer_now(void) {
+    return base;
+}
+
+void ktimer_arm(ktimer_t *t, uint64_t expires, ktimer_fn_t fn, void *arg) {
+    if (!t)
+        return;
+    if (t->pprev)
+        unlink_timer(t);
+    else
+        armed++;
+    t->expires = expires;
+    t->fn = fn;
+    t->arg = arg;
+    place(t);
+}
+
+int ktimer_cancel(ktimer_t *t) {
+    if (!t || !t->pprev)
+        return 0;
+    unlink_timer(t);
+    armed--;
+    return 1;
+}
+
+int ktimer_pending(const ktimer_t *t) {
+    return t && t->pprev != 0;
+}
+
+void ktimer_advance(uint64_t now) {
+    while (base <= now) {
+        unsigned slot = (unsigned)base & SLOT_MASK;
+        if (slot == 0) {
+            for (int level = 1; level < KTIMER_LEVELS && cascade(level) == 0; ++level) {}
+        }
+        ktimer_t *list = wheel[0][slot];
+        wheel[0][slot] = 0;
+        if (list)
+            list->pprev = &list;
+        base++;
+        while (list) {
+            ktimer_t *t = list;
+            unlink_timer(t);
+            armed--;
+            if (t->fn)
+                t->fn(t->arg);
+        }
+        if (!armed && base <= now)
+            base = now + 1;
+    }
+}
+
+uint64_t ktimer_next(void) {
+    if (!armed)
+        return UINT64_MAX;
+    for (unsigned i = 0; i < KTIMER_SLOTS; ++i) {
+        uint64_t tick = base + i;
+        if (i && (tick & SLOT_MASK) == 0)
+            return tick;            /* a cascade may bring earlier work */
+        if (wheel[0][tick & SLOT_MASK])
+            return tick;
+    }
+    return base + KTIMER_SLOTS;
+}
@@ -0,0 +1,103 @@
+#include "lapic.h"
+#include "pit.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+#define LAPIC_ID        0x020
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ICR_LOW   0x300
+#define LAPIC_ICR_HIGH  0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_ICR_PENDING 0x1000
+#define LAPIC_ICR_INIT  0x4500      /* INIT, level assert */
+#define LAPIC_ICR_SIPI  0x4600
+#define LAPIC_ICR_FIXED 0x4000
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_LVT_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV16 0x3
+
+#define CALIBRATE_US 10000
+
+static volatile uint32_t *regs;
+static uint32_t ticks_per_10ms;
+
+static uint32_t rd(uint32_t reg) {
+    return regs[reg / 4];
+}
+
+static void wr(uint32_t reg, uint32_t val) {
+    regs[reg / 4] = val;
+}
+
+int lapic_init(uint64_t base) {
+    if (!base)
+        return -1;
+    boot_map_identity_span(base, 4096);
+    regs = (volatile uint32_t *)(uintptr_t)base;
+    lapic_enable();
+    return 0;
+}
+
+void lapic_enable(void) {
+    if (regs)
+        wr(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+int lapic_ready(void) {
+    return regs != 0;
+}
+
+uint32_t lapic_id(void) {
+    return regs ? rd(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void) {
+    wr(LAPIC_EOI, 0);
+}
+
+static void send_ipi(uint32_t apic_id, uint32_t low) {
+    wr(LAPIC_ICR_HIGH, apic_id << 24);
+    wr(LAPIC_ICR_LOW, low);
+    while (rd(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {}
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    send_ipi(apic_id, LAPIC_ICR_INIT);
+}
+
+void lapic_send_sipi(uint32_t apic_id, uint8_t page) {
+    send_ipi(apic_id, LAPIC_ICR_SIPI | page);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    send_ipi(apic_id, LAPIC_ICR_FIXED | vector);
+}
+
+void lapic_timer_calibrate(void) {
+    if (!regs)
+        return;
+    wr(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    wr(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    wr(LAPIC_TIMER_INIT, 0xFFFFFFFFu);
+    pit_delay_us(CALIBRATE_US);
+    ticks_per_10ms = 0xFFFFFFFFu - rd(LAPIC_TIMER_CUR);
+    wr(LAPIC_TIMER_INIT, 0);
+}
+
+int lapic_timer_start(uint32_t hz) {
+    if (!regs || !ticks_per_10ms || hz == 0)
+        return -1;
+    uint32_t count = (uint32_t)((uint64_t)ticks_per_10ms * 100u / hz);
+    if (count == 0)
+        count = 1;
+    wr(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    wr(LAPIC_LVT_TIMER, LAPIC_LVT_PERIODIC | LAPIC_TIMER_VECTOR);
+    wr(LAPIC_TIMER_INIT, count);
+    return 0;
+}
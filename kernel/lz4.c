@@ -0,0 +1,141 @@
+#include "lz4.h"
+#include "memutils.h"
+
+/* Greedy single-pass LZ4 block compressor. It follows the format's end
+ * rules: the last match starts at least LZ4_MFLIMIT bytes before the end
+ * and the final LZ4_LAST_LITERALS bytes are always literals.
+ */
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG 12
+
+static uint32_t hash_table[1u << LZ4_HASH_LOG];
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static size_t length_bytes(size_t n) {
+    return n >= 15 ? (n - 15) / 255 + 1 : 0;
+}
+
+static uint8_t *put_length(uint8_t *op, size_t n) {
+    if (n < 15)
+        return op;
+    n -= 15;
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+    size_t anchor = 0;
+
+    if (len > LZ4_MFLIMIT) {
+        size_t limit = len - LZ4_MFLIMIT;
+        size_t match_end = len - LZ4_LAST_LITERALS;
+        memset(hash_table, 0, sizeof(hash_table));
+        size_t ip = 1;
+        hash_table[hash4(read32(src))] = 0;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash4(seq);
+            size_t ref = hash_table[h];
+            hash_table[h] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(src + ref) != seq) {
+                ++ip;
+                continue;
+            }
+            size_t mlen = LZ4_MIN_MATCH;
+            while (ip + mlen < match_end && src[ref + mlen] == src[ip + mlen])
+                ++mlen;
+            size_t lit = ip - anchor;
+            size_t need = 1 + length_bytes(lit) + lit + 2 + length_bytes(mlen - LZ4_MIN_MATCH);
+            if ((size_t)(oend - op) < need)
+                return 0;
+            size_t mcode = mlen - LZ4_MIN_MATCH;
+            *op++ = (uint8_t)(((lit < 15 ? lit : 15) << 4) | (mcode < 15 ? mcode : 15));
+            op = put_length(op, lit);
+            memcpy(op, src + anchor, lit);
+            op += lit;
+            size_t off = ip - ref;
+            *op++ = (uint8_t)off;
+            *op++ = (uint8_t)(off >> 8);
+            op = put_length(op, mcode);
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    size_t lit = len - anchor;
+    size_t need = 1 + length_bytes(lit) + lit;
+    if ((size_t)(oend - op) < need)
+        return 0;
+    *op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    op = put_length(op, lit);
+    memcpy(op, src + anchor, lit);
+    op += lit;
+    return (size_t)(op - dst);
+}
+
+long lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= len)
+                    return -1;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > len - ip || lit > cap - op)
+            return -1;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == len)
+            break;
+        if (len - ip < 2)
+            return -1;
+        size_t off = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (off == 0 || off > op)
+            return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= len)
+                    return -1;
+                b = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > cap - op)
+            return -1;
+        /* Byte copy: the match may overlap the bytes it produces. */
+        const uint8_t *match = dst + op - off;
+        for (size_t i = 0; i < mlen; ++i)
+            dst[op + i] = match[i];
+        op += mlen;
+    }
+    return (long)op;
+}
@@ -7,6 +7,7 @@
 #include "elf.h"
 #include "console.h"
 #include "mem.h"
+#include "pmm.h"
 #include "panic.h"
 #include "idt.h"
 #include "serial.h"
@@ -18,6 +19,7 @@
 #include "mpy_loader.h"
 #include "modexec.h"
 #include "syscall.h"
+#include "vmm.h"
 #include "buildinfo.h"
 #include "version.h"
 #include "vga_draw.h"
@@ -27,6 +29,13 @@
 #include "bootmode.h"
 #include "bootlogo.h"
 #include "proc.h"
+#include "sched.h"
+#include "smp.h"
+#include "clock.h"
+#include "ata.h"
+#include "virtio_blk.h"
+#include "nvme.h"
+#include "ahci.h"
 #include <string.h>
 
 int debug_mode = 0;
@@ -39,6 +48,75 @@ volatile int current_user_app = 0;
 extern uint8_t end;
 extern void boot_map_identity_span(uint64_t base, uint64_t size);
 
+/* boot.S only maps the first GiB; extend the identity map over every
+ * available region so the page allocator can hand out all of RAM.
+ */
+static void map_available_memory(const multiboot_info_t *mbi) {
+    if (!(mbi->flags & MULTIBOOT_INFO_MEM_MAP))
+        return;
+    uintptr_t cur = (uintptr_t)mbi->mmap_addr;
+    uintptr_t stop = cur + mbi->mmap_length;
+    while (cur < stop) {
+        const multiboot_mmap_entry_t *e = (const multiboot_mmap_entry_t *)cur;
+        if (e->type == MULTIBOOT_MEMORY_AVAILABLE && e->addr + e->len > 0x40000000ULL)
+            boot_map_identity_span(e->addr, e->len);
+        cur += e->size + sizeof(e->size);
+    }
+}
+
+/* Probe CPUID for the string-routine variants. AVX2 additionally needs YMM
+ * state switched on in XCR0, which is done here when the CPU supports it.
+ */
+static unsigned cpu_memutils_features(void) {
+    uint32_t eax, ebx, ecx, edx;
+    unsigned features = 0;
+    io_cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    io_cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint32_t ecx1 = ecx;
+    if (edx & (1u << 26))
+        features |= MEMUTILS_FEAT_SSE2;
+    if (max_leaf < 7)
+        return features;
+    io_cpuid(7, &eax, &ebx, &ecx, &edx);
+    if (ebx & (1u << 9))
+        features |= MEMUTILS_FEAT_ERMS;
+    int xsave = (ecx1 & (1u << 26)) != 0;
+    int avx = (ecx1 & (1u << 28)) != 0;
+    if ((ebx & (1u << 5)) && xsave && avx) {
+        uint64_t cr4;
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | (1ULL << 18)));
+        uint32_t lo, hi;
+        __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        lo |= 0x7; /* x87 | SSE | AVX */
+        __asm__ volatile ("xsetbv" : : "a"(lo), "d"(hi), "c"(0));
+        /* Entry stubs must now preserve the YMM upper halves too. */
+        uint32_t size;
+        __asm__ volatile ("cpuid" : "=a"(eax), "=b"(size), "=c"(ecx), "=d"(edx) : "a"(0xD), "c"(0));
+        idt_use_xsave(size);
+        features |= MEMUTILS_FEAT_AVX2;
+    }
+    return features;
+}
+
+/* Seed the page allocator and carve the initial kernel heap from it. The
+ * heap falls back to the memory right after the kernel image if the
+ * multiboot map is missing or unusable.
+ */
+static void heap_init(multiboot_info_t *mbi) {
+    void *heap = NULL;
+    map_available_memory(mbi);
+    if (pmm_init_multiboot(mbi, (uintptr_t)&end) == 0) {
+        int order = pmm_order_for(EXOCORE_KERNEL_HEAP_SIZE);
+        if (order >= 0)
+            heap = pmm_alloc_pages((unsigned)order);
+    }
+    if (!heap)
+        heap = &end;
+    mem_init((uintptr_t)heap, EXOCORE_KERNEL_HEAP_SIZE);
+}
+
 static inline void dbg_puts(const char *s) { if (debug_mode) console_puts(s); }
 static inline void dbg_putc(char c) { if (debug_mode) console_putc(c); }
 static inline void dbg_udec(uint32_t v) { if (debug_mode) console_udec(v); }
@@ -98,6 +176,7 @@ static void __attribute__((unused)) mp_store_module(const char *name, const uint
 /* Entry point, called by boot.S (magic in RDI, mbi ptr in RSI) */
 void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
     int framebuffer_ready = 0;
+    memutils_select(cpu_memutils_features());
     bootmode_init();
     debuglog_print_timestamp();
     dbg_puts("kernel_main start\n");
@@ -206,17 +285,22 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
         dbg_puts(" ecx=0x");
         dbg_uhex(ecx);
         dbg_putc('\n');
-        dbg_puts("Initializing memory manager at 0x");
+        dbg_puts("memutils=");
+        dbg_puts(memutils_variant());
+        dbg_putc('\n');
+        dbg_puts("Initializing memory manager, kernel_end=0x");
         dbg_uhex((uint64_t)(uintptr_t)&end);
         dbg_puts("\n");
         debuglog_print_timestamp();
-        mem_init((uintptr_t)&end, EXOCORE_KERNEL_HEAP_SIZE);
-        debuglog_memdump(&end, 64);
-        dbg_puts("heap_end=0x");
-        dbg_uhex((uint64_t)(uintptr_t)&end + EXOCORE_KERNEL_HEAP_MAX_SIZE);
+        heap_init(mbi);
+        mem_info_t heap_info;
+        mem_get_info(&heap_info);
+        dbg_puts("heap_max=0x");
+        dbg_uhex(heap_info.heap_max);
         dbg_putc('\n');
         idt_init();
         syscall_init();
+        vmm_init();
         debuglog_print_timestamp();
         dbg_puts("IDT initialized\n");
         debuglog_memdump((void*)idt_init, 64);
@@ -225,9 +309,10 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
         dbg_puts("Debug log ready\n");
         debuglog_memdump(debuglog_buffer(), 64);
     } else {
-        mem_init((uintptr_t)&end, EXOCORE_KERNEL_HEAP_SIZE);
+        heap_init(mbi);
         idt_init();
         syscall_init();
+        vmm_init();
         debuglog_init();
     }
 
@@ -269,6 +354,79 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
 
     if (bootmode_progress_visible()) bootlogo_draw_progress(38);
 
+    /* Timer interrupts start here. Kernel code keeps running with interrupts
+     * masked; from now on the boot context is the scheduler's idle thread.
+     * The other CPUs come up once the scheduler can take them.
+     */
+    smp_init();
+    clock_init();
+    sched_init();
+    int cpus_online = smp_boot_aps();
+    if (debug_mode) {
+        console_puts("clock: source=");
+        console_puts(clock_source());
+        console_puts(" tsc_mhz=");
+        console_udec((uint32_t)(clock_tsc_hz() / 1000000u));
+        console_putc('\n');
+        console_puts("smp: cpus online=");
+        console_udec((uint32_t)cpus_online);
+        console_putc('\n');
+    }
+
+    /* Probed once IRQs can be routed, so disk waits sleep on IRQ14. */
+    if (ata_init() == 0 && debug_mode) {
+        ata_pio_info_t disk;
+        ata_info(&disk);
+        console_puts("ata: primary master MiB=");
+        console_udec((uint32_t)(disk.sectors >> 11));
+        console_puts(disk.lba48 ? " lba48" : " lba28");
+        console_puts(" multiple=");
+        console_udec(disk.multiple);
+        console_puts(ata_dma_enabled() ? " dma=busmaster" : " dma=off");
+        console_putc('\n');
+    }
+    if (virtio_blk_init() == 0 && debug_mode) {
+        virtio_blk_info_t vdisk;
+        virtio_blk_info(&vdisk);
+        console_puts("virtio-blk: MiB=");
+        console_udec((uint32_t)(vdisk.sectors >> 11));
+        console_puts(" queue=");
+        console_udec(vdisk.queue_size);
+        console_puts(vdisk.indirect ? " indirect" : " chained");
+        console_puts(vdisk.msix ? " irq=msix" : " irq=poll");
+        if (vdisk.readonly)
+            console_puts(" ro");
+        console_putc('\n');
+    }
+    if (nvme_init() == 0 && debug_mode) {
+        nvme_info_t ndisk;
+        nvme_info(&ndisk);
+        console_puts("nvme: namespace 1 MiB=");
+        console_udec((uint32_t)(ndisk.sectors >> 11));
+        console_puts(" io_queues=");
+        console_udec(ndisk.io_queues);
+        console_puts(" depth=");
+        console_udec(ndisk.queue_depth);
+        console_puts(" max_xfer_KiB=");
+        console_udec(ndisk.max_transfer / 1024);
+        console_puts(ndisk.msix ? " irq=msix" : " irq=poll");
+        console_putc('\n');
+    }
+    int sata_disks = ahci_init();
+    for (int i = 0; i < sata_disks && debug_mode; ++i) {
+        ahci_info_t sdisk;
+        ahci_info(i, &sdisk);
+        console_puts("ahci: port ");
+        console_udec(sdisk.port);
+        console_puts(" MiB=");
+        console_udec((uint32_t)(sdisk.sectors >> 11));
+        console_puts(" slots=");
+        console_udec(sdisk.slots);
+        console_puts(sdisk.ncq ? " ncq" : " dma");
+        console_puts(sdisk.msi ? " irq=msi" : " irq=poll");
+        console_putc('\n');
+    }
+
     if (backend_selftest_run() != 0) {
         panic("Backend self-test failed");
     }
@@ -301,12 +459,10 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
     if (bootmode_progress_visible()) bootlogo_draw_progress(100);
 
 #if FEATURE_RUN_DIR
-    /* 5) Load & execute modules. Modules are linked to run at
-       * MODULE_BASE_ADDR, but GRUB may load them at arbitrary addresses.
-       * Copy each module to the expected location before jumping. */
+    /* 5) Execute modules. ELF modules are position independent and run
+       * from wherever GRUB loaded them (see modexec_exec). */
     mp_runtime_init();
     multiboot_module_t *mods = (multiboot_module_t*)(uintptr_t)mbi->mods_addr;
-    uint8_t *const load_addr = (uint8_t*)MODULE_BASE_ADDR;
     for (uint32_t i = 0; i < mbi->mods_count; i++) {
         debuglog_print_timestamp();
         const char *mstr = (const char*)(uintptr_t)mods[i].string;
@@ -322,11 +478,8 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
             continue;
         }
 
-        /* Copy module to fixed address */
         uint8_t *src  = (uint8_t*)(uintptr_t)mods[i].mod_start;
         uint32_t size = mods[i].mod_end - mods[i].mod_start;
-        memcpy(load_addr, src, size);
-        uint8_t *base = load_addr;
 
         /* check for TinyScript or MicroPython */
         int is_ts = 0;
@@ -434,10 +587,9 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
         dbg_puts("  src=0x"); dbg_uhex((uint64_t)(uintptr_t)src);
         dbg_puts(" size="); dbg_udec(size); dbg_putc('\n');
         debuglog_hexdump(src, size > 64 ? 64 : size);
-        debuglog_memdump(base, size > 128 ? 128 : size);
 
         /* Skip unknown non-ELF modules or run as MicroPython */
-        if (*(uint32_t*)base != ELF_MAGIC) {
+        if (size < 4 || *(uint32_t*)src != ELF_MAGIC) {
 #if MODULE_MODE != MODULE_MODE_ELF
             if (size >= 7 && memcmp(src, "#mpyexo", 7) == 0) {
                 console_puts("  MicroPython script\n");
@@ -468,44 +620,16 @@ void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
         continue;
 #else
 
-        elf_header_t *eh = (elf_header_t*)base;
-        elf_phdr_t   *ph = (elf_phdr_t*)(base + eh->e_phoff);
-
-        /* Determine base virtual address */
-        uint32_t first_vaddr = 0;
-        for (int p = 0; p < eh->e_phnum; p++) {
-            if (ph[p].p_type == PT_LOAD) { first_vaddr = ph[p].p_vaddr; break; }
-        }
-
-        /* Load each PT_LOAD segment and zero BSS */
-        uint32_t max_size = 0;
-        for (int p = 0; p < eh->e_phnum; p++) {
-            if (ph[p].p_type != PT_LOAD) continue;
-            dbg_puts("   segment off=0x"); dbg_uhex(ph[p].p_offset);
-            dbg_puts(" filesz="); dbg_udec(ph[p].p_filesz);
-            dbg_puts(" memsz="); dbg_udec(ph[p].p_memsz); dbg_putc('\n');
-            uint32_t off = ph[p].p_vaddr - first_vaddr;
-            memcpy(base + off, src + ph[p].p_offset, ph[p].p_filesz);
-            if (ph[p].p_memsz > ph[p].p_filesz)
-                memset(base + off + ph[p].p_filesz, 0, ph[p].p_memsz - ph[p].p_filesz);
-            if (off + ph[p].p_memsz > max_size)
-                max_size = off + ph[p].p_memsz;
-        }
-        if (max_size > size)
-            memset(base + size, 0, max_size - size);
-
-        uintptr_t entry = (uintptr_t)base + (eh->e_entry - first_vaddr);
-
-        dbg_puts("  Jumping to entry 0x");
-        dbg_uhex((uint64_t)entry);
-        dbg_putc('\n');
-        if (debug_mode) { serial_write("  Jumping to entry 0x"); serial_uhex((uint64_t)entry); serial_write("\n"); }
-
         current_program = mstr ? mstr : "module";
         current_user_app = is_user;
-        ((void(*)(void))entry)();
+        int ran = modexec_exec(src, size);
         current_program = "kernel";
         current_user_app = 0;
+        if (ran != 0) {
+            dbg_puts("  ELF-module is not a loadable PIE, skipped\n");
+            if (debug_mode) serial_write("  ELF-module is not a loadable PIE, skipped\n");
+            continue;
+        }
         dbg_puts("  ELF-module returned\n");
         dbg_puts(" heap_free=");
         dbg_udec(mem_heap_free());
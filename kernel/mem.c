@@ -6,6 +6,9 @@
 #include "runstate.h"
 #include "vga_draw.h"
 #include "config.h"
+#include "pmm.h"
+#include "zram.h"
+#include "heapprof.h"
 
 #define MAX_APPS 16
 
@@ -17,28 +20,60 @@ typedef struct {
     struct {
         void   *addr;
         size_t  size;
+        zram_obj_t *packed;
     } blocks[16];
     int block_count;
 } app_mem_t;
 
 static app_mem_t apps[MAX_APPS];
-static uint8_t *heap_start;
-static uint8_t *heap_ptr;
-static uint8_t *heap_committed_end;
-static uint8_t *heap_max_end;
 static size_t heap_used_bytes;
+static size_t heap_free_bytes;
 static size_t heap_grow_count;
 static size_t heap_alloc_fail_count;
+static size_t reclaim_runs;
+static size_t reclaim_bytes;
 static int next_id = 1;
-static uint8_t swap_space[64 * 1024];
-static uint8_t *swap_ptr;
 
+#define MEM_MAX_SHRINKERS 8
+
+typedef struct {
+    const char *name;
+    int priority;
+    mem_shrinker_t fn;
+} mem_shrinker_entry_t;
+
+/* Kept sorted by priority. Survives mem_init so subsystems register once. */
+static mem_shrinker_entry_t shrinkers[MEM_MAX_SHRINKERS];
+static int shrinker_count;
+static int reclaim_active;
+
+static size_t deflate_balloons(size_t goal);
+
+/* Arena 0 is the boot heap handed to mem_init. Further arenas are started
+ * whenever the page allocator cannot extend the newest one in place.
+ */
+#define MEM_MAX_ARENAS 32
+
+/* An arena is a contiguous region carved from the bottom up. Everything
+ * below the frontier is tiled by blocks; the frontier itself acts as the
+ * wilderness block and absorbs any free block that ends at it.
+ */
+typedef struct {
+    uint8_t *start;
+    uint8_t *frontier;
+    uint8_t *committed_end;
+} mem_arena_t;
+
+/* Every block carries a header and a footer (boundary tag) holding its total
+ * size with MEM_BLOCK_USED in bit 0, so both neighbours of a block can be
+ * found in constant time when it is freed.
+ */
 typedef struct mem_block {
-    size_t total_size;   /* bytes including header */
-    size_t user_size;    /* bytes available to caller */
+    size_t size;
     uint32_t guard;
-    struct mem_block *next;
-    int from_swap;
+    uint32_t arena;
+    struct mem_block *next_free;
+    struct mem_block *prev_free;
 } mem_block_t;
 
 typedef struct {
@@ -46,7 +81,13 @@ typedef struct {
     uint32_t locks;
 } vram_lock_t;
 
-static mem_block_t *free_list;
+static mem_arena_t arenas[MEM_MAX_ARENAS];
+static int arena_count;
+static size_t heap_committed_bytes;
+static mem_block_t *bins[MEM_SIZE_CLASSES];
+static uint32_t bin_map;
+static uint32_t class_live[MEM_SIZE_CLASSES];
+static uint32_t class_free[MEM_SIZE_CLASSES];
 static uint8_t *vram_base = (uint8_t *)0xB8000;
 static size_t vram_size = VGA_DRAW_COLS * VGA_DRAW_ROWS * 2;
 static vram_lock_t vram_locks[4];
@@ -54,6 +95,13 @@ static vram_lock_t vram_locks[4];
 #define MEM_GUARD_ACTIVE 0xC0DEFACEU
 #define MEM_GUARD_FREED  0xDEADFA11U
 
+#define MEM_BLOCK_USED ((size_t)1)
+#define MEM_ALIGN 16
+#define MEM_FOOTER_SIZE sizeof(size_t)
+#define MEM_OVERHEAD (sizeof(mem_block_t) + MEM_FOOTER_SIZE)
+#define MEM_MIN_BLOCK ((MEM_OVERHEAD + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1))
+#define MEM_BIN_SCAN_LIMIT 8
+
 static void log_mem_event(const char *msg) {
     console_puts(msg);
 }
@@ -82,123 +130,215 @@ static void mem_vram_init(void) {
     }
 }
 
-static mem_block_t *split_block(mem_block_t *blk, size_t total_needed, mem_block_t **prev) {
-    size_t available = blk->total_size;
-    if (available >= total_needed + sizeof(mem_block_t) + 8) {
-        mem_block_t *remainder = (mem_block_t *)((uint8_t *)blk + total_needed);
-        remainder->total_size = available - total_needed;
-        remainder->user_size = remainder->total_size - sizeof(mem_block_t);
+static size_t block_size(const mem_block_t *blk) {
+    return blk->size & ~MEM_BLOCK_USED;
+}
+
+static size_t block_user_size(const mem_block_t *blk) {
+    return block_size(blk) - MEM_OVERHEAD;
+}
+
+static size_t *block_footer(mem_block_t *blk) {
+    return (size_t *)((uint8_t *)blk + block_size(blk) - MEM_FOOTER_SIZE);
+}
+
+static void block_set(mem_block_t *blk, size_t size, int used) {
+    blk->size = size | (used ? MEM_BLOCK_USED : 0);
+    *block_footer(blk) = blk->size;
+}
+
+static int size_class(size_t size) {
+    int bit = 63 - __builtin_clzll((unsigned long long)size);
+    int cls = bit - MEM_SIZE_CLASS_MIN_SHIFT;
+    if (cls < 0)
+        return 0;
+    if (cls >= MEM_SIZE_CLASSES)
+        return MEM_SIZE_CLASSES - 1;
+    return cls;
+}
+
+static void bin_insert(mem_block_t *blk) {
+    int cls = size_class(block_size(blk));
+    blk->prev_free = NULL;
+    blk->next_free = bins[cls];
+    if (bins[cls])
+        bins[cls]->prev_free = blk;
+    bins[cls] = blk;
+    bin_map |= 1u << cls;
+    class_free[cls]++;
+    heap_free_bytes += block_size(blk);
+}
+
+static void bin_remove(mem_block_t *blk) {
+    int cls = size_class(block_size(blk));
+    if (blk->prev_free)
+        blk->prev_free->next_free = blk->next_free;
+    else
+        bins[cls] = blk->next_free;
+    if (blk->next_free)
+        blk->next_free->prev_free = blk->prev_free;
+    if (!bins[cls])
+        bin_map &= ~(1u << cls);
+    blk->next_free = NULL;
+    blk->prev_free = NULL;
+    class_free[cls]--;
+    heap_free_bytes -= block_size(blk);
+}
+
+/* Pick a free block of at least 'total' bytes. The request's own class is
+ * probed for a short first-fit run; any block in a higher non-empty class
+ * is guaranteed to fit, so the bin bitmap finds one with a single ctz.
+ */
+static mem_block_t *bin_find(size_t total) {
+    int cls = size_class(total);
+    int scanned = 0;
+    for (mem_block_t *blk = bins[cls]; blk && scanned < MEM_BIN_SCAN_LIMIT; blk = blk->next_free, ++scanned) {
+        if (block_size(blk) >= total)
+            return blk;
+    }
+    uint32_t higher = (cls + 1 < MEM_SIZE_CLASSES) ? bin_map & ~((2u << cls) - 1) : 0;
+    if (!higher)
+        return NULL;
+    return bins[__builtin_ctz(higher)];
+}
+
+static mem_block_t *split_block(mem_block_t *blk, size_t total) {
+    size_t available = block_size(blk);
+    bin_remove(blk);
+    if (available >= total + MEM_MIN_BLOCK) {
+        mem_block_t *remainder = (mem_block_t *)((uint8_t *)blk + total);
         remainder->guard = MEM_GUARD_FREED;
-        remainder->from_swap = blk->from_swap;
-        remainder->next = blk->next;
-        blk->total_size = total_needed;
-        blk->user_size = total_needed - sizeof(mem_block_t);
-        blk->next = NULL;
-        *prev = remainder;
-    } else {
-        *prev = blk->next;
+        remainder->arena = blk->arena;
+        block_set(remainder, available - total, 0);
+        bin_insert(remainder);
+        available = total;
     }
+    block_set(blk, available, 1);
     blk->guard = MEM_GUARD_ACTIVE;
-    blk->next = NULL;
     return blk;
 }
 
-static int same_backing_region(mem_block_t *a, mem_block_t *b) {
-    return a->from_swap == b->from_swap;
+static void log_heap_growth(size_t old) {
+    heap_grow_count++;
+    console_puts("mem: grew heap from ");
+    console_udec(old);
+    console_puts(" to ");
+    console_udec(heap_committed_bytes);
+    console_puts(" bytes\n");
 }
 
-static int blocks_adjacent(mem_block_t *left, mem_block_t *right) {
-    uint8_t *left_end = (uint8_t *)left + left->total_size;
-    return left_end == (uint8_t *)right;
+static int heap_may_commit(size_t bytes) {
+    return !EXOCORE_KERNEL_HEAP_MAX_SIZE || heap_committed_bytes + bytes <= EXOCORE_KERNEL_HEAP_MAX_SIZE;
 }
 
-static void coalesce_block(mem_block_t *blk) {
-    mem_block_t *it = free_list;
-    while (it) {
-        if (it != blk && same_backing_region(it, blk)) {
-            if (blocks_adjacent(it, blk)) {
-                it->total_size += blk->total_size;
-                it->user_size = it->total_size - sizeof(mem_block_t);
-                blk->total_size = 0;
-                blk = it;
-                it = free_list;
-                continue;
-            }
-            if (blocks_adjacent(blk, it)) {
-                blk->total_size += it->total_size;
-                blk->user_size = blk->total_size - sizeof(mem_block_t);
-                it->total_size = 0;
-                it = free_list;
-                continue;
-            }
-        }
-        it = it->next;
+/* Claim the pages directly above the newest arena until 'end' is
+ * committed, within the heap cap. Pages claimed before a failure stay
+ * with the arena.
+ */
+static int arena_extend(mem_arena_t *arena, uint8_t *end) {
+    if (arena != &arenas[arena_count - 1] || !pmm_ready())
+        return end <= arena->committed_end ? 0 : -1;
+    while (end > arena->committed_end && heap_may_commit(PMM_PAGE_SIZE) &&
+           pmm_claim_page(arena->committed_end) == 0) {
+        arena->committed_end += PMM_PAGE_SIZE;
+        heap_committed_bytes += PMM_PAGE_SIZE;
     }
+    return end <= arena->committed_end ? 0 : -1;
 }
 
-static void compact_free_list(void) {
-    mem_block_t **link = &free_list;
-    while (*link) {
-        if ((*link)->total_size == 0) {
-            *link = (*link)->next;
-        } else {
-            link = &(*link)->next;
-        }
+/* Extend the newest arena one page at a time while the pages directly
+ * above it are free; otherwise open a new arena from a fresh buddy block.
+ */
+static mem_arena_t *heap_grow(size_t total) {
+    if (!pmm_ready() || arena_count == 0)
+        return NULL;
+    size_t old = heap_committed_bytes;
+    size_t pages_bytes = (total + PMM_PAGE_SIZE - 1) & ~(size_t)(PMM_PAGE_SIZE - 1);
+    if (pages_bytes > pmm_free_bytes())
+        return NULL;
+    if (!heap_may_commit(pages_bytes))
+        return NULL;
+
+    mem_arena_t *arena = &arenas[arena_count - 1];
+    if (arena_extend(arena, arena->frontier + total) == 0) {
+        log_heap_growth(old);
+        return arena;
     }
-}
 
-static mem_block_t *acquire_from_free_list(size_t total) {
-    mem_block_t **prev = &free_list;
-    mem_block_t *blk = free_list;
-    mem_block_t **best_prev = NULL;
-    mem_block_t *best_blk = NULL;
-    while (blk) {
-        if (blk->total_size >= total) {
-            if (!best_blk || blk->total_size < best_blk->total_size) {
-                best_blk = blk;
-                best_prev = prev;
-                if (blk->total_size == total)
-                    break;
-            }
-        }
-        prev = &blk->next;
-        blk = blk->next;
+    if (arena_count >= MEM_MAX_ARENAS)
+        return NULL;
+    int order = pmm_order_for(total);
+    uint8_t *chunk = order < 0 ? NULL : (uint8_t *)pmm_alloc_pages((unsigned)order);
+    if (!chunk) {
+        if (heap_committed_bytes != old)
+            log_heap_growth(old);
+        return NULL;
     }
-    if (best_blk)
-        return split_block(best_blk, total, best_prev);
-    return NULL;
+    arena = &arenas[arena_count++];
+    arena->start = chunk;
+    arena->frontier = chunk;
+    arena->committed_end = chunk + ((size_t)PMM_PAGE_SIZE << order);
+    heap_committed_bytes += (size_t)PMM_PAGE_SIZE << order;
+    log_heap_growth(old);
+    return arena;
 }
 
-static mem_block_t *fresh_block(uint8_t **cursor, uint8_t *limit, size_t total) {
-    if (*cursor + total > limit)
+static mem_block_t *fresh_block(size_t total) {
+    mem_arena_t *arena = NULL;
+    for (int i = arena_count - 1; i >= 0; --i) {
+        if (arenas[i].frontier + total <= arenas[i].committed_end) {
+            arena = &arenas[i];
+            break;
+        }
+    }
+    if (!arena)
+        arena = heap_grow(total);
+    if (!arena)
         return NULL;
-    mem_block_t *blk = (mem_block_t *)*cursor;
-    *cursor += total;
-    blk->total_size = total;
-    blk->user_size = total - sizeof(mem_block_t);
+    mem_block_t *blk = (mem_block_t *)arena->frontier;
+    arena->frontier += total;
     blk->guard = MEM_GUARD_ACTIVE;
-    blk->next = NULL;
-    blk->from_swap = (limit == swap_space + sizeof(swap_space));
+    blk->arena = (uint32_t)(arena - arenas);
+    blk->next_free = NULL;
+    blk->prev_free = NULL;
+    block_set(blk, total, 1);
     return blk;
 }
 
+static mem_arena_t *arena_of(uint8_t *ptr) {
+    for (int i = 0; i < arena_count; ++i) {
+        if (ptr_in_region(ptr, arenas[i].start, arenas[i].frontier))
+            return &arenas[i];
+    }
+    return NULL;
+}
+
 void mem_init(uintptr_t heap_start_addr, size_t heap_size) {
     console_puts("mem_init heap_start=0x");
     console_uhex((uint64_t)heap_start_addr);
     console_puts(" size=");
     console_udec(heap_size);
     console_putc('\n');
-    heap_start = (uint8_t*)heap_start_addr;
-    heap_ptr = heap_start;
-    heap_committed_end = heap_ptr + heap_size;
-    heap_max_end = heap_ptr + EXOCORE_KERNEL_HEAP_MAX_SIZE;
-    if (heap_max_end < heap_committed_end)
-        heap_max_end = heap_committed_end;
+    uint8_t *heap_start = (uint8_t *)(((uintptr_t)heap_start_addr + MEM_ALIGN - 1) & ~(uintptr_t)(MEM_ALIGN - 1));
+    mem_arena_t *heap = &arenas[0];
+    heap->start = heap_start;
+    heap->frontier = heap_start;
+    heap->committed_end = (uint8_t *)heap_start_addr + heap_size;
+    arena_count = 1;
+    heap_committed_bytes = (size_t)(heap->committed_end - heap->start);
     heap_used_bytes = 0;
+    heap_free_bytes = 0;
     heap_grow_count = 0;
     heap_alloc_fail_count = 0;
-    swap_ptr = swap_space;
-    free_list = NULL;
+    heapprof_reset();
+    reclaim_runs = 0;
+    reclaim_bytes = 0;
+    for (int i = 0; i < MEM_SIZE_CLASSES; i++) {
+        bins[i] = NULL;
+        class_live[i] = 0;
+        class_free[i] = 0;
+    }
+    bin_map = 0;
     mem_vram_init();
     for (int i = 0; i < MAX_APPS; i++) {
         apps[i].id = 0;
@@ -209,56 +349,216 @@ void mem_init(uintptr_t heap_start_addr, size_t heap_size) {
         for (int j = 0; j < 16; j++) {
             apps[i].blocks[j].addr = NULL;
             apps[i].blocks[j].size = 0;
+            apps[i].blocks[j].packed = NULL;
         }
     }
+    mem_register_shrinker("app-balloon", MEM_SHRINK_PRIO_BALLOON, deflate_balloons);
 }
 
-void *mem_alloc(size_t size) {
+int mem_register_shrinker(const char *name, int priority, mem_shrinker_t fn) {
+    if (!fn)
+        return -1;
+    for (int i = 0; i < shrinker_count; i++) {
+        if (shrinkers[i].fn == fn)
+            return 0;
+    }
+    if (shrinker_count >= MEM_MAX_SHRINKERS)
+        return -1;
+    int pos = shrinker_count;
+    while (pos > 0 && shrinkers[pos - 1].priority > priority) {
+        shrinkers[pos] = shrinkers[pos - 1];
+        pos--;
+    }
+    shrinkers[pos].name = name;
+    shrinkers[pos].priority = priority;
+    shrinkers[pos].fn = fn;
+    shrinker_count++;
+    return 0;
+}
+
+static size_t run_shrinker(int idx, size_t goal) {
+    size_t freed = shrinkers[idx].fn(goal);
+    if (freed) {
+        reclaim_bytes += freed;
+        console_puts("mem: shrinker ");
+        console_puts(shrinkers[idx].name);
+        console_puts(" freed=");
+        console_udec(freed);
+        console_putc('\n');
+    }
+    return freed;
+}
+
+size_t mem_reclaim(size_t goal) {
+    if (reclaim_active)
+        return 0;
+    reclaim_active = 1;
+    reclaim_runs++;
+    size_t freed = 0;
+    for (int i = 0; i < shrinker_count && freed < goal; i++)
+        freed += run_shrinker(i, goal - freed);
+    reclaim_active = 0;
+    return freed;
+}
+
+static mem_block_t *find_block(size_t total) {
+    mem_block_t *blk = bin_find(total);
+    if (blk)
+        blk = split_block(blk, total);
+    if (!blk)
+        blk = fresh_block(total);
+    return blk;
+}
+
+/* Last resort before failing an allocation: run the shrinkers one at a time
+ * and retry after each that gives memory back, so the cheapest reclaim that
+ * suffices is the only one paid for.
+ */
+static mem_block_t *reclaim_block(size_t total) {
+    if (reclaim_active)
+        return NULL;
+    reclaim_active = 1;
+    reclaim_runs++;
+    mem_block_t *blk = NULL;
+    for (int i = 0; i < shrinker_count && !blk; i++) {
+        if (run_shrinker(i, total))
+            blk = find_block(total);
+    }
+    reclaim_active = 0;
+    return blk;
+}
+
+/* Allocate on behalf of 'site', the code address the profiler charges. */
+static void *alloc_at(size_t size, void *site) {
+    size_t request = size;
     size = (size + 7) & ~7;
-    size_t total = sizeof(mem_block_t) + size;
-    total = (total + 7) & ~7;
+    size_t total = MEM_OVERHEAD + size;
+    total = (total + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    if (total < size)
+        return NULL;
 
     log_mem_event("mem_alloc size=");
     console_udec(size);
     console_puts(" heap_ptr=0x");
-    console_uhex((uint64_t)(uintptr_t)heap_ptr);
+    console_uhex((uint64_t)(uintptr_t)arenas[arena_count - 1].frontier);
     console_putc('\n');
 
-    mem_block_t *blk = acquire_from_free_list(total);
-    if (!blk) {
-        if (heap_ptr + total > heap_committed_end) {
-            size_t old = (size_t)(heap_committed_end - heap_start);
-            size_t need = (size_t)((heap_ptr + total) - heap_committed_end);
-            size_t grow = (need + 4095) & ~(size_t)4095;
-            if (heap_committed_end + grow <= heap_max_end) {
-                heap_committed_end += grow;
-                heap_grow_count++;
-                console_puts("mem: grew heap from ");
-                console_udec(old);
-                console_puts(" to ");
-                console_udec((size_t)(heap_committed_end - heap_start));
-                console_puts(" bytes\n");
-            }
-        }
-        blk = fresh_block(&heap_ptr, heap_committed_end, total);
-    }
-    if (!blk) {
-        blk = fresh_block(&swap_ptr, swap_space + sizeof(swap_space), total);
-    }
+    mem_block_t *blk = find_block(total);
+    if (!blk)
+        blk = reclaim_block(total);
     if (!blk) {
         heap_alloc_fail_count++;
         return NULL;
     }
 
-    console_puts(blk->from_swap ? " swap alloc addr=0x" : " alloc addr=0x");
+    console_puts(" alloc addr=0x");
     console_uhex((uint64_t)(uintptr_t)(blk + 1));
     console_putc('\n');
-    heap_used_bytes += blk->user_size;
+    heap_used_bytes += block_user_size(blk);
+    class_live[size_class(block_size(blk))]++;
+    heapprof_alloc(blk + 1, request, site);
     return (void *)(blk + 1);
 }
 
+void *mem_alloc(size_t size) {
+    return alloc_at(size, __builtin_return_address(0));
+}
+
+/* Turn everything past the first 'total' bytes of a used block into a free
+ * block, merging it with a free right neighbour or the frontier.
+ */
+static void trim_block(mem_block_t *blk, size_t total) {
+    size_t size = block_size(blk);
+    if (size < total + MEM_MIN_BLOCK)
+        return;
+    mem_arena_t *arena = &arenas[blk->arena];
+    uint8_t *tail = (uint8_t *)blk + total;
+    uint8_t *right_addr = (uint8_t *)blk + size;
+    block_set(blk, total, 1);
+    if (right_addr == arena->frontier) {
+        arena->frontier = tail;
+        return;
+    }
+    size_t tail_size = size - total;
+    mem_block_t *right = (mem_block_t *)right_addr;
+    if (!(right->size & MEM_BLOCK_USED)) {
+        bin_remove(right);
+        tail_size += block_size(right);
+    }
+    mem_block_t *rest = (mem_block_t *)tail;
+    rest->guard = MEM_GUARD_FREED;
+    rest->arena = blk->arena;
+    block_set(rest, tail_size, 0);
+    bin_insert(rest);
+}
+
+void *mem_realloc(void *ptr, size_t old_size, size_t new_size) {
+    void *site = __builtin_return_address(0);
+    if (!ptr)
+        return alloc_at(new_size, site);
+    if (new_size == 0) {
+        mem_free(ptr, old_size);
+        return NULL;
+    }
+    mem_block_t *blk = ((mem_block_t *)ptr) - 1;
+    if (!arena_of((uint8_t *)blk))
+        panic("mem: realloc outside managed region");
+    ensure_block_integrity(blk, "mem_realloc");
+    if (!(blk->size & MEM_BLOCK_USED) || *block_footer(blk) != blk->size)
+        panic("mem: corrupt boundary tag");
+    size_t user_size = block_user_size(blk);
+    if (old_size > user_size)
+        panic("mem: realloc size larger than allocation");
+
+    size_t rounded = (new_size + 7) & ~(size_t)7;
+    size_t total = (MEM_OVERHEAD + rounded + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    if (total < new_size)
+        return NULL;
+    size_t size = block_size(blk);
+    mem_arena_t *arena = &arenas[blk->arena];
+    uint8_t *right_addr = (uint8_t *)blk + size;
+    int in_place = 0;
+
+    if (total <= size) {
+        in_place = 1;
+    } else if (right_addr == arena->frontier) {
+        if (arena_extend(arena, (uint8_t *)blk + total) == 0) {
+            arena->frontier = (uint8_t *)blk + total;
+            size = total;
+            in_place = 1;
+        }
+    } else {
+        mem_block_t *right = (mem_block_t *)right_addr;
+        if (!(right->size & MEM_BLOCK_USED) && size + block_size(right) >= total) {
+            bin_remove(right);
+            size += block_size(right);
+            in_place = 1;
+        }
+    }
+
+    if (in_place) {
+        class_live[size_class(block_size(blk))]--;
+        heap_used_bytes -= user_size;
+        block_set(blk, size, 1);
+        trim_block(blk, total);
+        class_live[size_class(block_size(blk))]++;
+        heap_used_bytes += block_user_size(blk);
+        heapprof_free(ptr);
+        heapprof_alloc(ptr, new_size, site);
+        return ptr;
+    }
+
+    void *moved = alloc_at(new_size, site);
+    if (!moved)
+        return NULL;
+    size_t keep = old_size ? old_size : user_size;
+    memcpy(moved, ptr, keep < new_size ? keep : new_size);
+    mem_free(ptr, old_size);
+    return moved;
+}
+
 void *mem_alloc_or_panic(size_t size) {
-    void *ptr = mem_alloc(size);
+    void *ptr = alloc_at(size, __builtin_return_address(0));
     if (!ptr)
         panic("mem: out of memory");
     return ptr;
@@ -275,6 +575,7 @@ int mem_register_app(uint8_t priority) {
             for (int j = 0; j < 16; j++) {
                 apps[i].blocks[j].addr = NULL;
                 apps[i].blocks[j].size = 0;
+                apps[i].blocks[j].packed = NULL;
             }
             console_puts("mem_register_app id=");
             console_udec(apps[i].id);
@@ -292,7 +593,7 @@ void *mem_alloc_app(int app_id, size_t size) {
     console_puts(" size=");
     console_udec(size);
     console_putc('\n');
-    void *addr = mem_alloc(size);
+    void *addr = alloc_at(size, __builtin_return_address(0));
     if (!addr)
         return NULL;
     for (int i = 0; i < MAX_APPS; i++) {
@@ -319,13 +620,9 @@ size_t mem_app_used(int app_id) {
 }
 
 size_t mem_heap_free(void) {
-    size_t free_bytes = (size_t)(heap_committed_end - heap_ptr);
-    free_bytes += (size_t)(sizeof(swap_space) - (swap_ptr - swap_space));
-    mem_block_t *blk = free_list;
-    while (blk) {
-        free_bytes += blk->total_size;
-        blk = blk->next;
-    }
+    size_t free_bytes = heap_free_bytes;
+    for (int i = 0; i < arena_count; i++)
+        free_bytes += (size_t)(arenas[i].committed_end - arenas[i].frontier);
     return free_bytes;
 }
 
@@ -333,10 +630,27 @@ void mem_get_info(mem_info_t *info) {
     if (!info) return;
     info->heap_used = heap_used_bytes;
     info->heap_free = mem_heap_free();
-    info->heap_committed = (size_t)(heap_committed_end - heap_start);
-    info->heap_max = (size_t)(heap_max_end - heap_start);
+    info->heap_committed = heap_committed_bytes;
+    info->heap_max = heap_committed_bytes + (pmm_ready() ? pmm_free_bytes() : 0);
+    if (EXOCORE_KERNEL_HEAP_MAX_SIZE && info->heap_max > EXOCORE_KERNEL_HEAP_MAX_SIZE)
+        info->heap_max = EXOCORE_KERNEL_HEAP_MAX_SIZE;
+    if (info->heap_max < heap_committed_bytes)
+        info->heap_max = heap_committed_bytes;
     info->grow_count = heap_grow_count;
     info->alloc_fail_count = heap_alloc_fail_count;
+    info->reclaim_runs = reclaim_runs;
+    info->reclaim_bytes = reclaim_bytes;
+    for (int i = 0; i < MEM_SIZE_CLASSES; i++) {
+        info->class_live[i] = class_live[i];
+        info->class_free[i] = class_free[i];
+    }
+    zram_stats_t zs;
+    zram_get_stats(&zs);
+    info->zram_orig_bytes = zs.orig_bytes;
+    info->zram_comp_bytes = zs.comp_bytes;
+    info->zram_faults = zs.faults;
+    info->zram_objects = zs.objects;
+    info->zram_rejects = zs.rejects;
 }
 
 int mem_save_app(int app_id, const void *data, size_t size) {
@@ -365,11 +679,65 @@ int mem_save_app(int app_id, const void *data, size_t size) {
     return -1;
 }
 
+static size_t deflate_app_block(app_mem_t *app, int idx) {
+    void *addr = app->blocks[idx].addr;
+    size_t size = app->blocks[idx].size;
+    if (!addr || app->blocks[idx].packed)
+        return 0;
+    zram_obj_t *obj = zram_store(addr, size);
+    if (!obj)
+        return 0;
+    mem_free(addr, size);
+    app->blocks[idx].addr = NULL;
+    app->blocks[idx].packed = obj;
+    app->used -= (uint32_t)((size + 7) & ~(size_t)7);
+    return size;
+}
+
+static int inflate_app_block(app_mem_t *app, int idx) {
+    size_t size = app->blocks[idx].size;
+    void *dst = mem_alloc_app(app->id, size);
+    if (!dst)
+        return -1;
+    if (zram_load(app->blocks[idx].packed, dst, size) != 0) {
+        mem_free(dst, size);
+        app->used -= (uint32_t)((size + 7) & ~(size_t)7);
+        return -1;
+    }
+    zram_drop(app->blocks[idx].packed);
+    app->blocks[idx].packed = NULL;
+    app->blocks[idx].addr = dst;
+    return 0;
+}
+
+/* Compress saved blocks of the lowest-priority apps first. */
+static size_t deflate_balloons(size_t goal) {
+    uint8_t visited[MAX_APPS] = {0};
+    size_t freed = 0;
+    while (freed < goal) {
+        int victim = -1;
+        for (int i = 0; i < MAX_APPS; i++) {
+            if (apps[i].id == 0 || visited[i])
+                continue;
+            if (victim < 0 || apps[i].priority < apps[victim].priority)
+                victim = i;
+        }
+        if (victim < 0)
+            break;
+        visited[victim] = 1;
+        for (int j = 0; j < apps[victim].block_count && freed < goal; j++)
+            freed += deflate_app_block(&apps[victim], j);
+    }
+    return freed;
+}
+
 void *mem_retrieve_app(int app_id, int handle, size_t *size) {
     for (int i = 0; i < MAX_APPS; i++) {
         if (apps[i].id == app_id) {
             if (handle < 0 || handle >= apps[i].block_count)
                 return NULL;
+            if (apps[i].blocks[handle].packed && inflate_app_block(&apps[i], handle) != 0)
+                return NULL;
             if (size)
                 *size = apps[i].blocks[handle].size;
             console_puts("mem_retrieve_app id=");
@@ -387,41 +755,69 @@ void mem_free(void *addr, size_t size) {
     if (!addr)
         return;
     mem_block_t *blk = ((mem_block_t *)addr) - 1;
-    if (!ptr_in_region((uint8_t *)blk, heap_start, heap_max_end) &&
-        !ptr_in_region((uint8_t *)blk, swap_space, swap_space + sizeof(swap_space))) {
+    mem_arena_t *arena = arena_of((uint8_t *)blk);
+    if (!arena)
         panic("mem: free outside managed region");
-    }
     ensure_block_integrity(blk, "mem_free");
+    if (&arenas[blk->arena] != arena)
+        panic("mem: block arena mismatch");
+    if (!(blk->size & MEM_BLOCK_USED) || *block_footer(blk) != blk->size)
+        panic("mem: corrupt boundary tag");
 
-    if (size && size > blk->user_size) {
+    size_t user_size = block_user_size(blk);
+    if (size && size > user_size) {
         panic("mem: free size larger than allocation");
     }
+    heapprof_free(addr);
 
     if (debug_mode) {
 #if UINTPTR_MAX == 0xffffffff
         uint32_t *p = addr;
-        size_t n = blk->user_size / sizeof(uint32_t);
+        size_t n = user_size / sizeof(uint32_t);
         for (size_t i = 0; i < n; i++)
             p[i] = 0xDEADBEEF;
         size_t off = n * sizeof(uint32_t);
 #else
         uint64_t *p = addr;
-        size_t n = blk->user_size / sizeof(uint64_t);
+        size_t n = user_size / sizeof(uint64_t);
         for (size_t i = 0; i < n; i++)
             p[i] = 0xDEADBEEFDEADBEEFULL;
         size_t off = n * sizeof(uint64_t);
 #endif
         uint8_t *b = (uint8_t *)addr;
-        for (size_t i = off; i < blk->user_size; i++)
+        for (size_t i = off; i < user_size; i++)
             b[i] = 0xEF;
     }
 
-    if (heap_used_bytes >= blk->user_size) heap_used_bytes -= blk->user_size;
+    if (heap_used_bytes >= user_size) heap_used_bytes -= user_size;
+    class_live[size_class(block_size(blk))]--;
     blk->guard = MEM_GUARD_FREED;
-    blk->next = free_list;
-    free_list = blk;
-    coalesce_block(blk);
-    compact_free_list();
+
+    /* Boundary-tag coalescing: the left neighbour's footer sits just below
+     * our header and the right neighbour's header just past our footer.
+     */
+    size_t total = block_size(blk);
+    if ((uint8_t *)blk > arena->start) {
+        size_t left_tag = *(size_t *)((uint8_t *)blk - MEM_FOOTER_SIZE);
+        if (!(left_tag & MEM_BLOCK_USED)) {
+            mem_block_t *left = (mem_block_t *)((uint8_t *)blk - left_tag);
+            bin_remove(left);
+            total += left_tag;
+            blk = left;
+        }
+    }
+    uint8_t *right_addr = (uint8_t *)blk + total;
+    if (right_addr == arena->frontier) {
+        arena->frontier = (uint8_t *)blk;
+        return;
+    }
+    mem_block_t *right = (mem_block_t *)right_addr;
+    if (!(right->size & MEM_BLOCK_USED)) {
+        bin_remove(right);
+        total += block_size(right);
+    }
+    block_set(blk, total, 0);
+    bin_insert(blk);
 }
 
 void *mem_vram_base(void) {
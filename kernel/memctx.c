@@ -1,63 +1,147 @@
 #include "memctx.h"
 #include "mem.h"
 #include "memutils.h"
+#include "pmm.h"
+#include "kmem.h"
+#include "heapprof.h"
+#include "console.h"
+#include "config.h"
 
-#define MEMCTX_MAX_CONTEXTS 32
-#define MEMCTX_MAX_BLOCKS 128
+#define MEMCTX_BLOCK_MAGIC 0x4D435842U
+#define MEMCTX_ALIGN 16
+/* Smallest region requested from the page allocator (16 KiB). */
+#define MEMCTX_REGION_MIN_ORDER 2
+#define MEMCTX_REGION_HEAP 0xFF
 
-typedef struct {
-    void *ptr;
+/* A context owns a chain of regions and bump-allocates from the newest
+ * one. Each allocation is prefixed by a block header linking it into the
+ * context's live list, so freeing needs no table lookup and destroying a
+ * context just hands its regions back.
+ */
+typedef struct memctx_region {
+    struct memctx_region *next;
+    uint8_t *cur;
+    uint8_t *end;
+    uint32_t order;
+    uint32_t live;
+} memctx_region_t;
+
+typedef struct memctx_block {
+    struct memctx_block *next;
+    struct memctx_block *prev;
+    memctx_region_t *region;
     size_t size;
+    uint32_t magic;
     int ctx_id;
+    void *site;
 } memctx_block_t;
 
 typedef struct {
-    int active;
+    int slot;
     int id;
     int owner_pid;
     memctx_stats_t stats;
+    memctx_region_t *regions;
+    memctx_block_t *live;
 } memctx_t;
 
-static memctx_t contexts[MEMCTX_MAX_CONTEXTS];
-static memctx_block_t blocks[MEMCTX_MAX_BLOCKS];
-static int next_ctx_id = 1;
+static kmem_cache_t *ctx_cache;
+static kmem_table_t contexts;
+/* A context id is its table slot plus a generation in the upper bits,
+ * so lookups index the table directly and a stale id never matches the
+ * slot's next owner.
+ */
+#define MEMCTX_SLOT_BITS 12
+#define MEMCTX_SLOT_MASK ((1 << MEMCTX_SLOT_BITS) - 1)
+#define MEMCTX_GEN_MAX   ((0x7FFFFFFF >> MEMCTX_SLOT_BITS) - 1)
+static int next_ctx_gen = 1;
+
+#define REGION_HDR ((sizeof(memctx_region_t) + MEMCTX_ALIGN - 1) & ~(size_t)(MEMCTX_ALIGN - 1))
 
 static memctx_t *find_ctx(int ctx_id) {
-    for (int i = 0; i < MEMCTX_MAX_CONTEXTS; ++i) {
-        if (contexts[i].active && contexts[i].id == ctx_id)
-            return &contexts[i];
+    if (ctx_id <= 0)
+        return 0;
+    memctx_t *ctx = kmem_table_get(&contexts, ctx_id & MEMCTX_SLOT_MASK);
+    return ctx && ctx->id == ctx_id ? ctx : 0;
+}
+
+static memctx_region_t *region_new(size_t need) {
+    size_t bytes = REGION_HDR + need;
+    uint8_t *base = 0;
+    uint32_t order = MEMCTX_REGION_HEAP;
+    int pmm_order = pmm_order_for(bytes);
+    if (pmm_order >= 0 && pmm_order < MEMCTX_REGION_MIN_ORDER)
+        pmm_order = MEMCTX_REGION_MIN_ORDER;
+    if (pmm_order >= 0 && pmm_ready()) {
+        base = pmm_alloc_pages((unsigned)pmm_order);
+        if (base) {
+            order = (uint32_t)pmm_order;
+            bytes = (size_t)PMM_PAGE_SIZE << pmm_order;
+        }
     }
-    return 0;
+    if (!base) {
+        /* No page allocator yet (or it is exhausted): fall back to the heap. */
+        bytes = REGION_HDR + need;
+        base = mem_alloc(bytes);
+        if (!base)
+            return 0;
+    }
+    memctx_region_t *region = (memctx_region_t *)base;
+    region->next = 0;
+    region->cur = base + REGION_HDR;
+    region->end = base + bytes;
+    region->order = order;
+    region->live = 0;
+    return region;
 }
 
-static memctx_block_t *find_block(int ctx_id, void *ptr) {
-    for (int i = 0; i < MEMCTX_MAX_BLOCKS; ++i) {
-        if (blocks[i].ptr == ptr && blocks[i].ctx_id == ctx_id)
-            return &blocks[i];
+static void region_release(memctx_region_t *region) {
+    if (region->order == MEMCTX_REGION_HEAP)
+        mem_free(region, (size_t)(region->end - (uint8_t *)region));
+    else
+        pmm_free_pages(region, region->order);
+}
+
+static void release_ctx(memctx_t *ctx) {
+    memctx_region_t *region = ctx->regions;
+    while (region) {
+        memctx_region_t *next = region->next;
+        region_release(region);
+        region = next;
     }
-    return 0;
+    kmem_table_remove(&contexts, ctx->slot);
+    kmem_cache_free(ctx_cache, ctx);
 }
 
 void memctx_init(void) {
-    memset(contexts, 0, sizeof(contexts));
-    memset(blocks, 0, sizeof(blocks));
-    next_ctx_id = 1;
+    if (!ctx_cache)
+        ctx_cache = kmem_cache_create("memctx", sizeof(memctx_t), 0, NULL);
+    for (int i = 0; i < contexts.count; ++i) {
+        memctx_t *ctx = kmem_table_get(&contexts, i);
+        if (ctx)
+            release_ctx(ctx);
+    }
+    kmem_table_reset(&contexts);
+    next_ctx_gen = 1;
 }
 
 int memctx_create(int owner_pid, size_t quota) {
-    for (int i = 0; i < MEMCTX_MAX_CONTEXTS; ++i) {
-        if (!contexts[i].active) {
-            contexts[i].active = 1;
-            contexts[i].id = next_ctx_id++;
-            contexts[i].owner_pid = owner_pid;
-            contexts[i].stats.quota = quota;
-            contexts[i].stats.used = 0;
-            contexts[i].stats.peak = 0;
-            contexts[i].stats.allocations = 0;
-            return contexts[i].id;
-        }
+    memctx_t *ctx = kmem_cache_alloc(ctx_cache);
+    if (!ctx)
+        return -1;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->slot = kmem_table_insert(&contexts, ctx);
+    if (ctx->slot < 0 || ctx->slot > MEMCTX_SLOT_MASK) {
+        if (ctx->slot >= 0)
+            kmem_table_remove(&contexts, ctx->slot);
+        kmem_cache_free(ctx_cache, ctx);
+        return -1;
     }
-    return -1;
+    ctx->id = (next_ctx_gen << MEMCTX_SLOT_BITS) | ctx->slot;
+    next_ctx_gen = next_ctx_gen == MEMCTX_GEN_MAX ? 1 : next_ctx_gen + 1;
+    ctx->owner_pid = owner_pid;
+    ctx->stats.quota = quota;
+    return ctx->id;
 }
 
 void *memctx_alloc(int ctx_id, size_t size) {
@@ -69,45 +153,78 @@ void *memctx_alloc(int ctx_id, size_t size) {
     if (ctx->stats.quota && ctx->stats.used + size > ctx->stats.quota)
         return 0;
 
-    int slot = -1;
-    for (int i = 0; i < MEMCTX_MAX_BLOCKS; ++i) {
-        if (!blocks[i].ptr) {
-            slot = i;
-            break;
-        }
-    }
-    if (slot < 0)
+    size_t total = (sizeof(memctx_block_t) + size + MEMCTX_ALIGN - 1) & ~(size_t)(MEMCTX_ALIGN - 1);
+    if (total < size)
         return 0;
+    memctx_region_t *region = ctx->regions;
+    if (!region || (size_t)(region->end - region->cur) < total) {
+        region = region_new(total);
+        if (!region)
+            return 0;
+        region->next = ctx->regions;
+        ctx->regions = region;
+    }
 
-    void *ptr = mem_alloc(size);
-    if (!ptr)
-        return 0;
+    memctx_block_t *blk = (memctx_block_t *)region->cur;
+    region->cur += total;
+    region->live++;
+    blk->region = region;
+    blk->size = size;
+    blk->magic = MEMCTX_BLOCK_MAGIC;
+    blk->ctx_id = ctx_id;
+    blk->site = __builtin_return_address(0);
+    blk->prev = 0;
+    blk->next = ctx->live;
+    if (ctx->live)
+        ctx->live->prev = blk;
+    ctx->live = blk;
 
-    blocks[slot].ptr = ptr;
-    blocks[slot].size = size;
-    blocks[slot].ctx_id = ctx_id;
     ctx->stats.used += size;
     if (ctx->stats.used > ctx->stats.peak)
         ctx->stats.peak = ctx->stats.used;
     ctx->stats.allocations++;
-    return ptr;
+    return blk + 1;
 }
 
 int memctx_free(int ctx_id, void *ptr) {
     if (!ptr)
         return -1;
     memctx_t *ctx = find_ctx(ctx_id);
-    memctx_block_t *blk = find_block(ctx_id, ptr);
-    if (!ctx || !blk)
+    if (!ctx)
+        return -1;
+    memctx_block_t *blk = ((memctx_block_t *)ptr) - 1;
+    if (blk->magic != MEMCTX_BLOCK_MAGIC || blk->ctx_id != ctx_id)
         return -1;
-    mem_free(ptr, blk->size);
+    if (blk->prev)
+        blk->prev->next = blk->next;
+    else
+        ctx->live = blk->next;
+    if (blk->next)
+        blk->next->prev = blk->prev;
+    blk->magic = 0;
     if (ctx->stats.used >= blk->size)
         ctx->stats.used -= blk->size;
     if (ctx->stats.allocations)
         ctx->stats.allocations--;
-    blk->ptr = 0;
-    blk->size = 0;
-    blk->ctx_id = 0;
+
+    /* Space is only reclaimed when it sits on top of the bump pointer or
+     * when the region holds no live blocks at all.
+     */
+    memctx_region_t *region = blk->region;
+    size_t total = (sizeof(memctx_block_t) + blk->size + MEMCTX_ALIGN - 1) & ~(size_t)(MEMCTX_ALIGN - 1);
+    if ((uint8_t *)blk + total == region->cur)
+        region->cur = (uint8_t *)blk;
+    if (--region->live == 0) {
+        if (region == ctx->regions) {
+            region->cur = (uint8_t *)region + REGION_HDR;
+        } else {
+            memctx_region_t *prev = ctx->regions;
+            while (prev->next != region)
+                prev = prev->next;
+            prev->next = region->next;
+            region_release(region);
+        }
+    }
     return 0;
 }
 
@@ -119,18 +236,60 @@ int memctx_stats(int ctx_id, memctx_stats_t *stats) {
     return 0;
 }
 
-int memctx_destroy(int ctx_id) {
+/* For owners that expect to have freed everything: log the first few live
+ * blocks with their allocation sites and fold all of them into the
+ * profile. Destroying a context frees its blocks on purpose and reports
+ * nothing.
+ */
+#define MEMCTX_LEAK_REPORT 4
+
+int memctx_contains(int ctx_id, uintptr_t start, uintptr_t end) {
+    memctx_t *ctx = find_ctx(ctx_id);
+    if (!ctx || end < start)
+        return 0;
+    for (memctx_region_t *region = ctx->regions; region; region = region->next) {
+        if (start >= (uintptr_t)region + REGION_HDR && end <= (uintptr_t)region->cur)
+            return 1;
+    }
+    return 0;
+}
+
+int memctx_report_leaks(int ctx_id) {
     memctx_t *ctx = find_ctx(ctx_id);
     if (!ctx)
         return -1;
-    for (int i = 0; i < MEMCTX_MAX_BLOCKS; ++i) {
-        if (blocks[i].ptr && blocks[i].ctx_id == ctx_id) {
-            mem_free(blocks[i].ptr, blocks[i].size);
-            blocks[i].ptr = 0;
-            blocks[i].size = 0;
-            blocks[i].ctx_id = 0;
-        }
+    int shown = 0;
+    for (memctx_block_t *blk = ctx->live; blk; blk = blk->next) {
+        heapprof_leak(blk->size);
+        if (shown++ >= MEMCTX_LEAK_REPORT)
+            continue;
+        console_puts("memctx: leak ctx=");
+        console_udec(ctx->id);
+        console_puts(" pid=");
+        console_udec(ctx->owner_pid);
+        console_puts(" size=");
+        console_udec(blk->size);
+        console_puts(" site=0x");
+        console_uhex((uint64_t)(uintptr_t)blk->site);
+        console_putc('\n');
     }
-    memset(ctx, 0, sizeof(*ctx));
+    if (shown > MEMCTX_LEAK_REPORT) {
+        console_puts("memctx: ... ");
+        console_udec(shown - MEMCTX_LEAK_REPORT);
+        console_puts(" more leaked blocks, ");
+        console_udec(ctx->stats.used);
+        console_puts(" bytes total\n");
+    }
+    return shown;
+}
+
+int memctx_destroy(int ctx_id) {
+    memctx_t *ctx = find_ctx(ctx_id);
+    if (!ctx)
+        return -1;
+    /* Profiling builds name whatever the owner never freed. */
+    if (EXOCORE_HEAP_PROFILE)
+        memctx_report_leaks(ctx_id);
+    release_ctx(ctx);
     return 0;
 }
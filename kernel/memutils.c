@@ -1,18 +1,316 @@
 #include <stddef.h>
-void *memcpy(void *dst, const void *src, size_t n) {
+#include <stdint.h>
+#include "memutils.h"
+
+/* The loops below must not be turned back into calls to the functions they
+ * implement.
+ */
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+/* memcpy, memset, memcmp and strlen dispatch through pointers chosen by
+ * memutils_select. Before that runs the generic word-at-a-time versions
+ * are used, so early boot code and host builds need no setup.
+ */
+#define MEMUTILS_SMALL 64
+/* From here rep movsb/stosb beats the vector loops on ERMS parts. */
+#define MEMUTILS_ERMS_MIN 2048
+/* Copies and fills this large skip the cache with non-temporal stores. */
+#define MEMUTILS_NT_THRESHOLD (4 * 1024 * 1024)
+
+typedef uint64_t u64u __attribute__((aligned(1), may_alias));
+typedef long long v16 __attribute__((vector_size(16), may_alias));
+typedef long long v16u __attribute__((vector_size(16), aligned(1), may_alias));
+typedef char v16b __attribute__((vector_size(16)));
+typedef long long v32 __attribute__((vector_size(32), may_alias));
+typedef long long v32u __attribute__((vector_size(32), aligned(1), may_alias));
+
+static void *copy_generic(void *dst, const void *src, size_t n) {
     unsigned char *d = dst;
     const unsigned char *s = src;
-    for (size_t i = 0; i < n; i++)
-        d[i] = s[i];
+    for (; n >= 8; n -= 8, d += 8, s += 8)
+        *(u64u *)d = *(const u64u *)s;
+    while (n--)
+        *d++ = *s++;
     return dst;
 }
-void *memset(void *dst, int val, size_t n) {
+
+static void *fill_generic(void *dst, int val, size_t n) {
+    unsigned char *d = dst;
+    uint64_t v = (unsigned char)val * 0x0101010101010101ULL;
+    for (; n >= 8; n -= 8, d += 8)
+        *(u64u *)d = v;
+    while (n--)
+        *d++ = (unsigned char)val;
+    return dst;
+}
+
+static int cmp_generic(const void *s1, const void *s2, size_t n) {
+    const unsigned char *a = s1;
+    const unsigned char *b = s2;
+    for (; n >= 8 && *(const u64u *)a == *(const u64u *)b; n -= 8, a += 8, b += 8)
+        ;
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i])
+            return a[i] - b[i];
+    }
+    return 0;
+}
+
+static size_t strlen_generic(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+/* ERMS: the microcode string ops beat any loop once past the startup cost. */
+static void *copy_erms(void *dst, const void *src, size_t n) {
+    void *d = dst;
+    __asm__ volatile ("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dst;
+}
+
+static void *fill_erms(void *dst, int val, size_t n) {
+    void *d = dst;
+    __asm__ volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+    return dst;
+}
+
+/* The vector copies store one unaligned head, then run aligned stores from
+ * the next boundary and finish with an unaligned tail that may overlap
+ * bytes already written.
+ */
+static void *copy_sse2(void *dst, const void *src, size_t n) {
+    if (n < MEMUTILS_SMALL)
+        return copy_generic(dst, src, n);
     unsigned char *d = dst;
-    for (size_t i = 0; i < n; i++)
-        d[i] = (unsigned char)val;
+    const unsigned char *s = src;
+    v16 tail = *(const v16u *)(s + n - 16);
+    unsigned char *tail_dst = d + n - 16;
+    *(v16u *)d = *(const v16u *)s;
+    size_t skew = 16 - ((uintptr_t)d & 15);
+    d += skew;
+    s += skew;
+    n -= skew;
+    if (n >= MEMUTILS_NT_THRESHOLD) {
+        for (; n >= 64; n -= 64, d += 64, s += 64) {
+            __builtin_ia32_movntdq((v16 *)d, *(const v16u *)s);
+            __builtin_ia32_movntdq((v16 *)(d + 16), *(const v16u *)(s + 16));
+            __builtin_ia32_movntdq((v16 *)(d + 32), *(const v16u *)(s + 32));
+            __builtin_ia32_movntdq((v16 *)(d + 48), *(const v16u *)(s + 48));
+        }
+        __builtin_ia32_sfence();
+    } else {
+        for (; n >= 64; n -= 64, d += 64, s += 64) {
+            v16 a = *(const v16u *)s;
+            v16 b = *(const v16u *)(s + 16);
+            v16 c = *(const v16u *)(s + 32);
+            v16 e = *(const v16u *)(s + 48);
+            *(v16 *)d = a;
+            *(v16 *)(d + 16) = b;
+            *(v16 *)(d + 32) = c;
+            *(v16 *)(d + 48) = e;
+        }
+    }
+    for (; n >= 16; n -= 16, d += 16, s += 16)
+        *(v16 *)d = *(const v16u *)s;
+    *(v16u *)tail_dst = tail;
     return dst;
 }
 
+static void *fill_sse2(void *dst, int val, size_t n) {
+    if (n < MEMUTILS_SMALL)
+        return fill_generic(dst, val, n);
+    unsigned char *d = dst;
+    unsigned char *end = d + n;
+    long long w = (long long)((unsigned char)val * 0x0101010101010101ULL);
+    v16 v = { w, w };
+    *(v16u *)d = v;
+    size_t skew = 16 - ((uintptr_t)d & 15);
+    d += skew;
+    n -= skew;
+    if (n >= MEMUTILS_NT_THRESHOLD) {
+        for (; n >= 64; n -= 64, d += 64) {
+            __builtin_ia32_movntdq((v16 *)d, v);
+            __builtin_ia32_movntdq((v16 *)(d + 16), v);
+            __builtin_ia32_movntdq((v16 *)(d + 32), v);
+            __builtin_ia32_movntdq((v16 *)(d + 48), v);
+        }
+        __builtin_ia32_sfence();
+    }
+    for (; n >= 64; n -= 64, d += 64) {
+        *(v16 *)d = v;
+        *(v16 *)(d + 16) = v;
+        *(v16 *)(d + 32) = v;
+        *(v16 *)(d + 48) = v;
+    }
+    for (; n >= 16; n -= 16, d += 16)
+        *(v16 *)d = v;
+    *(v16u *)(end - 16) = v;
+    return dst;
+}
+
+static int cmp_sse2(const void *s1, const void *s2, size_t n) {
+    const unsigned char *a = s1;
+    const unsigned char *b = s2;
+    for (; n >= 16; n -= 16, a += 16, b += 16) {
+        v16b eq = (v16b)*(const v16u *)a == (v16b)*(const v16u *)b;
+        unsigned mask = (unsigned)__builtin_ia32_pmovmskb128(eq) ^ 0xFFFFu;
+        if (mask) {
+            int i = __builtin_ctz(mask);
+            return a[i] - b[i];
+        }
+    }
+    return cmp_generic(a, b, n);
+}
+
+/* Aligned 16-byte loads never cross a page, so reading a little before the
+ * start or past the terminator is safe.
+ */
+static size_t strlen_sse2(const char *s) {
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    v16b zero = { 0 };
+    unsigned mask = (unsigned)__builtin_ia32_pmovmskb128(*(const v16b *)p == zero);
+    mask &= 0xFFFFu << ((uintptr_t)s & 15);
+    while (!mask) {
+        p += 16;
+        mask = (unsigned)__builtin_ia32_pmovmskb128(*(const v16b *)p == zero);
+    }
+    return (size_t)(p + __builtin_ctz(mask) - s);
+}
+
+__attribute__((target("avx2")))
+static void *copy_avx2(void *dst, const void *src, size_t n) {
+    if (n < MEMUTILS_SMALL)
+        return copy_generic(dst, src, n);
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    v32 tail = *(const v32u *)(s + n - 32);
+    unsigned char *tail_dst = d + n - 32;
+    *(v32u *)d = *(const v32u *)s;
+    size_t skew = 32 - ((uintptr_t)d & 31);
+    d += skew;
+    s += skew;
+    n -= skew;
+    if (n >= MEMUTILS_NT_THRESHOLD) {
+        for (; n >= 128; n -= 128, d += 128, s += 128) {
+            __builtin_ia32_movntdq256((v32 *)d, *(const v32u *)s);
+            __builtin_ia32_movntdq256((v32 *)(d + 32), *(const v32u *)(s + 32));
+            __builtin_ia32_movntdq256((v32 *)(d + 64), *(const v32u *)(s + 64));
+            __builtin_ia32_movntdq256((v32 *)(d + 96), *(const v32u *)(s + 96));
+        }
+        __builtin_ia32_sfence();
+    } else {
+        for (; n >= 128; n -= 128, d += 128, s += 128) {
+            v32 a = *(const v32u *)s;
+            v32 b = *(const v32u *)(s + 32);
+            v32 c = *(const v32u *)(s + 64);
+            v32 e = *(const v32u *)(s + 96);
+            *(v32 *)d = a;
+            *(v32 *)(d + 32) = b;
+            *(v32 *)(d + 64) = c;
+            *(v32 *)(d + 96) = e;
+        }
+    }
+    for (; n >= 32; n -= 32, d += 32, s += 32)
+        *(v32 *)d = *(const v32u *)s;
+    *(v32u *)tail_dst = tail;
+    __builtin_ia32_vzeroupper();
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void *fill_avx2(void *dst, int val, size_t n) {
+    if (n < MEMUTILS_SMALL)
+        return fill_generic(dst, val, n);
+    unsigned char *d = dst;
+    unsigned char *end = d + n;
+    long long w = (long long)((unsigned char)val * 0x0101010101010101ULL);
+    v32 v = { w, w, w, w };
+    *(v32u *)d = v;
+    size_t skew = 32 - ((uintptr_t)d & 31);
+    d += skew;
+    n -= skew;
+    if (n >= MEMUTILS_NT_THRESHOLD) {
+        for (; n >= 128; n -= 128, d += 128) {
+            __builtin_ia32_movntdq256((v32 *)d, v);
+            __builtin_ia32_movntdq256((v32 *)(d + 32), v);
+            __builtin_ia32_movntdq256((v32 *)(d + 64), v);
+            __builtin_ia32_movntdq256((v32 *)(d + 96), v);
+        }
+        __builtin_ia32_sfence();
+    }
+    for (; n >= 128; n -= 128, d += 128) {
+        *(v32 *)d = v;
+        *(v32 *)(d + 32) = v;
+        *(v32 *)(d + 64) = v;
+        *(v32 *)(d + 96) = v;
+    }
+    for (; n >= 32; n -= 32, d += 32)
+        *(v32 *)d = v;
+    *(v32u *)(end - 32) = v;
+    __builtin_ia32_vzeroupper();
+    return dst;
+}
+
+/* Requests are split three ways: short ones go to the vector loops, which
+ * have no startup cost, mid-sized ones to rep movsb/stosb where ERMS makes
+ * it fastest, and ones past the cache size to the non-temporal loops.
+ */
+static void *(*copy_impl)(void *, const void *, size_t) = copy_generic;
+static void *(*copy_mid_impl)(void *, const void *, size_t) = copy_generic;
+static void *(*copy_large_impl)(void *, const void *, size_t) = copy_generic;
+static void *(*fill_impl)(void *, int, size_t) = fill_generic;
+static void *(*fill_mid_impl)(void *, int, size_t) = fill_generic;
+static void *(*fill_large_impl)(void *, int, size_t) = fill_generic;
+static int (*cmp_impl)(const void *, const void *, size_t) = cmp_generic;
+static size_t (*strlen_impl)(const char *) = strlen_generic;
+static const char *variant = "generic";
+
+void memutils_select(unsigned features) {
+    int erms = (features & MEMUTILS_FEAT_ERMS) != 0;
+    copy_impl = copy_generic;
+    fill_impl = fill_generic;
+    cmp_impl = cmp_generic;
+    strlen_impl = strlen_generic;
+    variant = erms ? "erms" : "generic";
+    if (features & MEMUTILS_FEAT_SSE2) {
+        copy_impl = copy_sse2;
+        fill_impl = fill_sse2;
+        cmp_impl = cmp_sse2;
+        strlen_impl = strlen_sse2;
+        variant = erms ? "sse2+erms" : "sse2";
+    }
+    if (features & MEMUTILS_FEAT_AVX2) {
+        copy_impl = copy_avx2;
+        fill_impl = fill_avx2;
+        variant = erms ? "avx2+erms" : "avx2";
+    }
+    copy_large_impl = copy_impl == copy_generic && erms ? copy_erms : copy_impl;
+    fill_large_impl = fill_impl == fill_generic && erms ? fill_erms : fill_impl;
+    copy_mid_impl = erms ? copy_erms : copy_impl;
+    fill_mid_impl = erms ? fill_erms : fill_impl;
+}
+
+const char *memutils_variant(void) {
+    return variant;
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    if (n < MEMUTILS_ERMS_MIN)
+        return copy_impl(dst, src, n);
+    if (n < MEMUTILS_NT_THRESHOLD)
+        return copy_mid_impl(dst, src, n);
+    return copy_large_impl(dst, src, n);
+}
+
+void *memset(void *dst, int val, size_t n) {
+    if (n < MEMUTILS_ERMS_MIN)
+        return fill_impl(dst, val, n);
+    if (n < MEMUTILS_NT_THRESHOLD)
+        return fill_mid_impl(dst, val, n);
+    return fill_large_impl(dst, val, n);
+}
+
 int strncmp(const char *s1, const char *s2, size_t n) {
     for (size_t i = 0; i < n; i++) {
         unsigned char c1 = s1[i];
@@ -33,14 +331,14 @@ int strcmp(const char *s1, const char *s2) {
 }
 
 size_t strlen(const char *s) {
-    size_t len = 0;
-    while (s[len]) len++;
-    return len;
+    return strlen_impl(s);
 }
 
 void *memmove(void *dst, const void *src, size_t n) {
     unsigned char *d = dst;
     const unsigned char *s = src;
+    if (d + n <= s || s + n <= d)
+        return memcpy(dst, src, n);
     if (d < s) {
         for (size_t i = 0; i < n; i++)
             d[i] = s[i];
@@ -53,13 +351,7 @@ void *memmove(void *dst, const void *src, size_t n) {
 }
 
 int memcmp(const void *s1, const void *s2, size_t n) {
-    const unsigned char *a = s1;
-    const unsigned char *b = s2;
-    for (size_t i = 0; i < n; i++) {
-        if (a[i] != b[i])
-            return a[i] - b[i];
-    }
-    return 0;
+    return cmp_impl(s1, s2, n);
 }
 
 char *strchr(const char *s, int c) {
@@ -3,6 +3,10 @@
 #include "console.h"
 #include "config.h"
 #include "multiboot.h"
+#include "elf.h"
+#include "execcache.h"
+#include "sched.h"
+#include "vmm.h"
 #include <string.h>
 
 static multiboot_info_t *g_mbi = NULL;
@@ -11,21 +15,54 @@ void modexec_set_mbi(multiboot_info_t *mbi) {
     g_mbi = mbi;
 }
 
+int modexec_exec(const uint8_t *src, uint32_t size) {
+    if (size < 4 || *(const uint32_t*)src != ELF_MAGIC) {
+        /* Flat binaries carry no relocations; they still need their
+         * link address.
+         */
+        uint8_t *base = (uint8_t*)MODULE_BASE_ADDR;
+        memcpy(base, src, size);
+        ((void(*)(void))base)();
+        return 0;
+    }
+    /* ELF modules run from GRUB's copy: read-only pages map it directly,
+     * data and bss are private to this run. Only PIE images can run away
+     * from their link address.
+     */
+    if (size < sizeof(elf_header_t) || ((const elf_header_t*)src)->e_type != ELF_TYPE_DYN)
+        return -1;
+    vmm_space_t *space = vmm_space_create();
+    elf_image_t image;
+    void *handle = NULL;
+    if (!space || execcache_map_buffer(space, src, size, &image, &handle) != 0) {
+        vmm_space_destroy(space);
+        return -1;
+    }
+    /* SYS_MPY_EXEC_FILE gets here from a process; hand its space back. */
+    uintptr_t caller = sched_address_space();
+    sched_set_address_space(vmm_space_root(space));
+    ((void(*)(void))image.entry)();
+    sched_set_address_space(caller);
+    vmm_space_destroy(space);
+    execcache_release(handle);
+    return 0;
+}
+
 int modexec_run(const char *name) {
     if (!g_mbi) return -1;
     multiboot_module_t *mods = (multiboot_module_t*)(uintptr_t)g_mbi->mods_addr;
     for (uint32_t i = 0; i < g_mbi->mods_count; ++i) {
         const char *mstr = (const char*)(uintptr_t)mods[i].string;
         if (mstr && strcmp(mstr, name) == 0) {
-            uint8_t *src  = (uint8_t*)(uintptr_t)mods[i].mod_start;
+            const uint8_t *src = (const uint8_t*)(uintptr_t)mods[i].mod_start;
             uint32_t size = mods[i].mod_end - mods[i].mod_start;
-            uint8_t *base = (uint8_t*)MODULE_BASE_ADDR;
-            memcpy(base, src, size);
             console_puts("exec.o ");
             console_puts(name);
             console_putc('\n');
-            void (*entry)(void) = (void(*)(void))base;
-            entry();
+            if (modexec_exec(src, size) != 0) {
+                console_puts("exec.o failed: not a PIE image\n");
+                return -1;
+            }
             return 0;
         }
     }
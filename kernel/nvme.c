@@ -0,0 +1,481 @@
+#include "nvme.h"
+#include "blkdev.h"
+#include "pci.h"
+#include "lapic.h"
+#include "idt.h"
+#include "smp.h"
+#include "sched.h"
+#include "clock.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "memutils.h"
+#include "console.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+#define PCI_SUBCLASS_NVM 0x08
+#define PCI_PROGIF_NVME  0x02
+
+/* Controller registers. */
+#define REG_CAP  0x00
+#define REG_CC   0x14
+#define REG_CSTS 0x1C
+#define REG_AQA  0x24
+#define REG_ASQ  0x28
+#define REG_ACQ  0x30
+#define REG_DOORBELL 0x1000
+
+#define CC_EN        0x1
+#define CC_IOSQES    (6u << 16)     /* 64-byte submission entries */
+#define CC_IOCQES    (4u << 20)     /* 16-byte completion entries */
+#define CSTS_RDY     0x1
+#define CSTS_CFS     0x2
+
+#define ADMIN_CREATE_SQ    0x01
+#define ADMIN_CREATE_CQ    0x05
+#define ADMIN_IDENTIFY     0x06
+#define ADMIN_SET_FEATURES 0x09
+#define IO_WRITE 0x01
+#define IO_READ  0x02
+
+#define FEAT_NUM_QUEUES   0x07
+#define FEAT_IRQ_COALESCE 0x08
+#define IDENTIFY_NAMESPACE  0
+#define IDENTIFY_CONTROLLER 1
+
+#define PAGE 4096u
+#define PRP_LIST_BYTES 512          /* per command; never crosses a page */
+#define NSID 1
+
+typedef struct {
+    uint32_t cdw0;                  /* opcode | command id << 16 */
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} __attribute__((packed)) nvme_sqe_t;
+
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint32_t sq;                    /* head | queue id << 16 */
+    uint32_t status;                /* command id | phase << 16 | status << 17 */
+} __attribute__((packed)) nvme_cqe_t;
+
+typedef struct {
+    uint16_t status;
+    uint32_t result;
+} nvme_slot_t;
+
+/* One submission/completion pair. Command ids are slot indices, and a
+ * slot stays owned until its completion is reaped, so at most depth - 1
+ * commands are ever in the submission queue.
+ */
+typedef struct {
+    uint16_t id;
+    uint16_t depth;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint8_t phase;
+    volatile nvme_sqe_t *sq;
+    volatile nvme_cqe_t *cq;
+    volatile uint32_t *sq_db;
+    volatile uint32_t *cq_db;
+    uint64_t *prp;
+    nvme_slot_t slots[NVME_QUEUE_DEPTH];
+    blkdev_queue_t bq;
+} nvme_queue_t;
+
+static int present;
+static int broken;
+static nvme_info_t disk;
+static volatile uint8_t *regs;
+static uint32_t doorbell_stride;
+static nvme_queue_t queues[SMP_MAX_CPUS + 1];   /* [0] is the admin queue */
+static uint8_t *ident;
+
+static uint32_t reg_read32(uint32_t off) {
+    return *(volatile uint32_t *)(regs + off);
+}
+
+static void reg_write32(uint32_t off, uint32_t v) {
+    *(volatile uint32_t *)(regs + off) = v;
+}
+
+static uint64_t reg_read64(uint32_t off) {
+    return reg_read32(off) | ((uint64_t)reg_read32(off + 4) << 32);
+}
+
+static void reg_write64(uint32_t off, uint64_t v) {
+    reg_write32(off, (uint32_t)v);
+    reg_write32(off + 4, (uint32_t)(v >> 32));
+}
+
+static void reap(void *ctx);
+
+/* Queue memory comes from the page allocator, so it is identity mapped. */
+static int queue_setup(nvme_queue_t *q, uint16_t id, uint16_t depth, int io) {
+    q->id = id;
+    q->depth = depth;
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+    q->sq = pmm_alloc_pages(0);
+    q->cq = pmm_alloc_pages(0);
+    if (!q->sq || !q->cq)
+        return -1;
+    memset((void *)q->sq, 0, PAGE);
+    memset((void *)q->cq, 0, PAGE);
+    q->sq_db = (volatile uint32_t *)(regs + REG_DOORBELL + (2u * id) * doorbell_stride);
+    q->cq_db = (volatile uint32_t *)(regs + REG_DOORBELL + (2u * id + 1) * doorbell_stride);
+    blkdev_queue_init(&q->bq, depth - 1, reap, q);
+    q->bq.timeout_ms = NVME_TIMEOUT_MS;
+    if (io) {
+        q->prp = pmm_alloc_pages(3);
+        q->bq.bounce = pmm_alloc_pages(5);
+        if (!q->prp || !q->bq.bounce)
+            return -1;
+        q->bq.poll_ms = NVME_POLL_MS;
+        q->bq.bounce_sectors = disk.max_transfer / BLKDEV_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+/* Mark finished commands and hand the consumed entries back. */
+static void reap(void *ctx) {
+    nvme_queue_t *q = ctx;
+    int any = 0;
+    for (;;) {
+        volatile nvme_cqe_t *e = &q->cq[q->cq_head];
+        uint32_t st = e->status;
+        if (((st >> 16) & 1) != q->phase)
+            break;
+        uint16_t cid = (uint16_t)st;
+        if (cid < NVME_QUEUE_DEPTH) {
+            q->slots[cid].status = (uint16_t)(st >> 17);
+            q->slots[cid].result = e->result;
+            q->bq.done[cid] = 1;
+        }
+        if (++q->cq_head == q->depth) {
+            q->cq_head = 0;
+            q->phase ^= 1;
+        }
+        any = 1;
+    }
+    if (any) {
+        *q->cq_db = q->cq_head;
+        sched_wake_all(&q->bq.done_waiters);
+    }
+}
+
+static void nvme_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)err; (void)rsp;
+    lapic_eoi();
+    uint32_t id = num - NVME_VECTOR_BASE + 1;
+    if (id <= disk.io_queues)
+        reap(&queues[id]);
+}
+
+/* Copy 'cmd' into the next submission entry as command 's'; the tail
+ * doorbell is rung per batch.
+ */
+static void submit(nvme_queue_t *q, int s, const nvme_sqe_t *cmd) {
+    volatile nvme_sqe_t *e = &q->sq[q->sq_tail];
+    *(nvme_sqe_t *)e = *cmd;
+    e->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t)s << 16);
+    q->bq.done[s] = 0;
+    if (++q->sq_tail == q->depth)
+        q->sq_tail = 0;
+}
+
+static void ring(nvme_queue_t *q) {
+    __sync_synchronize();
+    *q->sq_db = q->sq_tail;
+}
+
+/* Admin commands run one at a time during init, polled. */
+static int admin(nvme_sqe_t *cmd, uint32_t *result) {
+    nvme_queue_t *q = &queues[0];
+    int s = blkdev_slot_alloc(&q->bq, 0);
+    if (s < 0)
+        return -1;
+    submit(q, s, cmd);
+    ring(q);
+    if (blkdev_batch_wait(&q->bq, &s, 1) != 0)
+        return -1;
+    if (result)
+        *result = q->slots[s].result;
+    int rc = q->slots[s].status ? -1 : 0;
+    blkdev_slot_free(&q->bq, s);
+    return rc;
+}
+
+static int identify(uint32_t cns, uint32_t nsid) {
+    nvme_sqe_t cmd = {0};
+    cmd.cdw0 = ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.prp1 = (uintptr_t)ident;
+    cmd.cdw10 = cns;
+    return admin(&cmd, 0);
+}
+
+static int set_feature(uint32_t fid, uint32_t value, uint32_t *result) {
+    nvme_sqe_t cmd = {0};
+    cmd.cdw0 = ADMIN_SET_FEATURES;
+    cmd.cdw10 = fid;
+    cmd.cdw11 = value;
+    return admin(&cmd, result);
+}
+
+/* Completion queue first; its interrupt goes to the queue's own vector. */
+static int create_io_queue(nvme_queue_t *q, int vector_entry) {
+    nvme_sqe_t cmd = {0};
+    cmd.cdw0 = ADMIN_CREATE_CQ;
+    cmd.prp1 = (uintptr_t)q->cq;
+    cmd.cdw10 = ((uint32_t)(q->depth - 1) << 16) | q->id;
+    cmd.cdw11 = 0x1 | (q->bq.irq ? 0x2 | ((uint32_t)vector_entry << 16) : 0);
+    if (admin(&cmd, 0) != 0)
+        return -1;
+    nvme_sqe_t sq = {0};
+    sq.cdw0 = ADMIN_CREATE_SQ;
+    sq.prp1 = (uintptr_t)q->sq;
+    sq.cdw10 = ((uint32_t)(q->depth - 1) << 16) | q->id;
+    sq.cdw11 = 0x1 | ((uint32_t)q->id << 16);
+    return admin(&sq, 0);
+}
+
+/* PRP1 covers the first (possibly partial) page; PRP2 is either the
+ * second page or the slot's list of every page after the first.
+ */
+static void build_prps(nvme_queue_t *q, int s, nvme_sqe_t *cmd, uintptr_t addr, uint32_t bytes) {
+    uint32_t first = PAGE - (uint32_t)(addr & (PAGE - 1));
+    cmd->prp1 = addr;
+    cmd->prp2 = 0;
+    if (bytes <= first)
+        return;
+    uintptr_t page = (addr & ~(uintptr_t)(PAGE - 1)) + PAGE;
+    if (bytes - first <= PAGE) {
+        cmd->prp2 = page;
+        return;
+    }
+    uint64_t *list = (uint64_t *)((uint8_t *)q->prp + (size_t)s * PRP_LIST_BYTES);
+    uint32_t pages = (bytes - first + PAGE - 1) / PAGE;
+    for (uint32_t i = 0; i < pages; ++i)
+        list[i] = page + (uintptr_t)i * PAGE;
+    cmd->prp2 = (uintptr_t)list;
+}
+
+/* 'addr' is identity mapped and dword aligned. */
+static int transfer(void *ctx, uint64_t lba, uintptr_t addr, size_t count, int write) {
+    nvme_queue_t *q = ctx;
+    uint32_t max_sectors = disk.max_transfer / BLKDEV_SECTOR_SIZE;
+    int ids[NVME_BATCH];
+    while (count) {
+        int n = 0;
+        while (count && n < NVME_BATCH) {
+            int s = blkdev_slot_alloc(&q->bq, n == 0);
+            if (s < 0)
+                break;
+            uint32_t chunk = count > max_sectors ? max_sectors : (uint32_t)count;
+            nvme_sqe_t cmd = {0};
+            cmd.cdw0 = write ? IO_WRITE : IO_READ;
+            cmd.nsid = NSID;
+            build_prps(q, s, &cmd, addr, chunk * BLKDEV_SECTOR_SIZE);
+            cmd.cdw10 = (uint32_t)lba;
+            cmd.cdw11 = (uint32_t)(lba >> 32);
+            cmd.cdw12 = chunk - 1;
+            submit(q, s, &cmd);
+            ids[n++] = s;
+            lba += chunk;
+            addr += (uintptr_t)chunk * BLKDEV_SECTOR_SIZE;
+            count -= chunk;
+        }
+        if (n == 0)
+            return -1;
+        ring(q);
+        if (blkdev_batch_wait(&q->bq, ids, n) != 0) {
+            /* The controller may still own the slots; never reuse them. */
+            broken = 1;
+            console_puts("nvme: command timed out\n");
+            return -1;
+        }
+        int rc = 0;
+        for (int i = 0; i < n; ++i) {
+            if (q->slots[ids[i]].status)
+                rc = -1;
+            blkdev_slot_free(&q->bq, ids[i]);
+        }
+        if (rc != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* The submitting CPU's own queue pair. */
+static nvme_queue_t *this_queue(void) {
+    return &queues[1 + (uint32_t)smp_cpu_index() % disk.io_queues];
+}
+
+static int request(uint64_t lba, void *buf, size_t count, int write) {
+    if (!present || broken)
+        return -1;
+    if (count == 0)
+        return 0;
+    nvme_queue_t *q = this_queue();
+    /* Process windows are not identity mapped; PRPs need dword alignment. */
+    if ((uintptr_t)buf >= VMM_USER_BASE || ((uintptr_t)buf & 3))
+        return blkdev_bounce(&q->bq, transfer, lba, buf, count, write);
+    return transfer(q, lba, (uintptr_t)buf, count, write);
+}
+
+int nvme_read(uint64_t lba, void *buf, size_t count) {
+    return request(lba, buf, count, 0);
+}
+
+int nvme_write(uint64_t lba, const void *buf, size_t count) {
+    return request(lba, (void *)buf, count, 1);
+}
+
+static int blk_read(void *ctx, uint64_t lba, void *buf, size_t count) {
+    (void)ctx;
+    return nvme_read(lba, buf, count);
+}
+
+static int blk_write(void *ctx, uint64_t lba, const void *buf, size_t count) {
+    (void)ctx;
+    return nvme_write(lba, buf, count);
+}
+
+static const blkdev_ops_t nvme_blk_ops = { blk_read, blk_write };
+
+static int wait_ready(int ready, uint64_t timeout_ms) {
+    uint64_t deadline = clock_ms() + timeout_ms;
+    while (((reg_read32(REG_CSTS) & CSTS_RDY) != 0) != ready) {
+        if ((reg_read32(REG_CSTS) & CSTS_CFS) || clock_ms() >= deadline)
+            return -1;
+        __asm__ volatile ("pause");
+    }
+    return 0;
+}
+
+/* Reset, then bring the controller up with the admin queue pair. */
+static int enable_controller(uint64_t cap) {
+    uint64_t timeout = ((cap >> 24) & 0xFF) * 500 + 500;
+    if (reg_read32(REG_CC) & CC_EN) {
+        reg_write32(REG_CC, 0);
+        if (wait_ready(0, timeout) != 0)
+            return -1;
+    }
+    nvme_queue_t *aq = &queues[0];
+    if (queue_setup(aq, 0, NVME_ADMIN_DEPTH, 0) != 0)
+        return -1;
+    reg_write32(REG_AQA, ((uint32_t)(NVME_ADMIN_DEPTH - 1) << 16) | (NVME_ADMIN_DEPTH - 1));
+    reg_write64(REG_ASQ, (uintptr_t)aq->sq);
+    reg_write64(REG_ACQ, (uintptr_t)aq->cq);
+    reg_write32(REG_CC, CC_EN | CC_IOSQES | CC_IOCQES);
+    return wait_ready(1, timeout);
+}
+
+/* Namespace 1 in 512-byte blocks; other formats are not supported. */
+static int probe_namespace(void) {
+    if (identify(IDENTIFY_CONTROLLER, 0) != 0)
+        return -1;
+    uint8_t mdts = ident[77];
+    disk.max_transfer = NVME_CHUNK_BYTES;
+    if (mdts && (PAGE << mdts) < disk.max_transfer)
+        disk.max_transfer = PAGE << mdts;
+    if (identify(IDENTIFY_NAMESPACE, NSID) != 0)
+        return -1;
+    uint64_t nsze;
+    memcpy(&nsze, ident, sizeof(nsze));
+    uint8_t format = ident[26] & 0xF;
+    uint32_t lbaf;
+    memcpy(&lbaf, ident + 128 + 4 * format, sizeof(lbaf));
+    if (nsze == 0 || ((lbaf >> 16) & 0xFF) != 9) {
+        console_puts("nvme: namespace 1 missing or not 512-byte blocks\n");
+        return -1;
+    }
+    disk.sectors = nsze;
+    return 0;
+}
+
+/* One pair per CPU, capped by what the controller grants. */
+static int create_io_queues(const pci_device_t *d, uint64_t cap) {
+    uint32_t want = (uint32_t)smp_cpu_count();
+    uint32_t granted;
+    if (set_feature(FEAT_NUM_QUEUES, ((want - 1) << 16) | (want - 1), &granted) != 0)
+        return -1;
+    uint32_t nsq = (granted & 0xFFFF) + 1;
+    uint32_t ncq = (granted >> 16) + 1;
+    uint32_t n = want < nsq ? want : nsq;
+    n = n < ncq ? n : ncq;
+    uint16_t depth = NVME_QUEUE_DEPTH;
+    if ((cap & 0xFFFF) + 1 < depth)
+        depth = (uint16_t)((cap & 0xFFFF) + 1);
+    disk.msix = sched_active();
+    for (uint32_t i = 1; i <= n; ++i) {
+        nvme_queue_t *q = &queues[i];
+        if (queue_setup(q, (uint16_t)i, depth, 1) != 0)
+            return -1;
+        /* MSI-X entry i, aimed at the CPU that submits to queue i. */
+        uint8_t vector = (uint8_t)(NVME_VECTOR_BASE + i - 1);
+        q->bq.irq = disk.msix && pci_msix_route(d, (uint16_t)i, vector, smp_cpu_apic_id((int)i - 1)) == 0;
+        if (q->bq.irq)
+            register_irq_handler(vector, nvme_irq);
+        else
+            disk.msix = 0;
+        if (create_io_queue(q, (int)i) != 0)
+            return -1;
+    }
+    disk.io_queues = n;
+    disk.queue_depth = depth;
+    return 0;
+}
+
+int nvme_init(void) {
+    pci_device_t d;
+    int found = -1;
+    if (present)
+        return 0;
+    for (int i = 0; pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_NVM, i, &d) == 0; ++i) {
+        if (d.prog_if == PCI_PROGIF_NVME) {
+            found = 0;
+            break;
+        }
+    }
+    if (found != 0 || (pci_read32(&d, 0x10) & 1))
+        return -1;
+    pci_enable(&d, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    uint64_t base = pci_bar(&d, 0);
+    boot_map_identity_span(base, REG_DOORBELL);
+    regs = (volatile uint8_t *)(uintptr_t)base;
+    uint64_t cap = reg_read64(REG_CAP);
+    if (((cap >> 48) & 0xF) != 0 || !((cap >> 37) & 1))
+        return -1;  /* needs 4 KiB pages and the NVM command set */
+    doorbell_stride = 4u << ((cap >> 32) & 0xF);
+    boot_map_identity_span(base + REG_DOORBELL, 2u * (SMP_MAX_CPUS + 1) * doorbell_stride);
+    ident = pmm_alloc_pages(0);
+    if (!ident || enable_controller(cap) != 0 || probe_namespace() != 0 ||
+        create_io_queues(&d, cap) != 0) {
+        console_puts("nvme: controller init failed\n");
+        return -1;
+    }
+    set_feature(FEAT_IRQ_COALESCE, ((uint32_t)NVME_COALESCE_100US << 8) | (NVME_COALESCE_ENTRIES - 1), 0);
+    present = 1;
+    blkdev_register("nvme0", disk.sectors, BLKDEV_RANK_NVME, &nvme_blk_ops, 0);
+    return 0;
+}
+
+int nvme_info(nvme_info_t *info) {
+    if (!present || !info)
+        return -1;
+    *info = disk;
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "pci.h"
+#include "io.h"
+#include "lapic.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+#define PCI_VENDOR_NONE    0xFFFF
+#define PCI_CLASS_REG      0x08
+#define PCI_HEADER_REG     0x0C    /* header type in bits 16-23 */
+#define PCI_BAR0           0x10
+#define PCI_STATUS_CAPS    0x10    /* in the status half of PCI_COMMAND */
+#define PCI_CAP_PTR        0x34
+#define MSIX_CTRL_ENABLE   0x8000
+#define MSIX_CTRL_MASK_ALL 0x4000
+#define MSIX_ENTRY_SIZE    16
+#define MSI_ADDRESS_BASE   0xFEE00000u
+#define MSI_CTRL_ENABLE    0x0001
+#define MSI_CTRL_MME       0x0070  /* multiple message enable */
+#define MSI_CTRL_64BIT     0x0080
+
+static void select_reg(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t off) {
+    io_outl(PCI_CONFIG_ADDRESS, 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)dev << 11) |
+                                ((uint32_t)fn << 8) | (off & 0xFC));
+}
+
+static uint32_t read_raw(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t off) {
+    select_reg(bus, dev, fn, off);
+    return io_inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const pci_device_t *d, uint8_t off) {
+    return read_raw(d->bus, d->dev, d->fn, off);
+}
+
+void pci_write32(const pci_device_t *d, uint8_t off, uint32_t val) {
+    select_reg(d->bus, d->dev, d->fn, off);
+    io_outl(PCI_CONFIG_DATA, val);
+}
+
+uint8_t pci_read8(const pci_device_t *d, uint8_t off) {
+    return (uint8_t)(pci_read32(d, off) >> ((off & 3) * 8));
+}
+
+uint16_t pci_read16(const pci_device_t *d, uint8_t off) {
+    return (uint16_t)(pci_read32(d, off) >> ((off & 2) * 8));
+}
+
+void pci_write16(const pci_device_t *d, uint8_t off, uint16_t val) {
+    uint32_t shift = (off & 2) * 8;
+    uint32_t word = pci_read32(d, off);
+    word = (word & ~(0xFFFFu << shift)) | ((uint32_t)val << shift);
+    pci_write32(d, off, word);
+}
+
+/* Walk every present function in bus order and return the 'index'th one
+ * 'match' accepts.
+ */
+static int scan(int (*match)(const pci_device_t *d, uint32_t key), uint32_t key, int index, pci_device_t *out) {
+    for (uint32_t bus = 0; bus < 256; ++bus) {
+        for (uint8_t dev = 0; dev < 32; ++dev) {
+            uint8_t fns = 1;
+            for (uint8_t fn = 0; fn < fns; ++fn) {
+                uint32_t id = read_raw((uint8_t)bus, dev, fn, 0);
+                if ((id & 0xFFFF) == PCI_VENDOR_NONE)
+                    continue;
+                if (fn == 0 && (read_raw((uint8_t)bus, dev, 0, PCI_HEADER_REG) >> 16) & 0x80)
+                    fns = 8;
+                uint32_t cls = read_raw((uint8_t)bus, dev, fn, PCI_CLASS_REG);
+                pci_device_t d;
+                d.bus = (uint8_t)bus;
+                d.dev = dev;
+                d.fn = fn;
+                d.class_code = (uint8_t)(cls >> 24);
+                d.subclass = (uint8_t)(cls >> 16);
+                d.prog_if = (uint8_t)(cls >> 8);
+                d.vendor = (uint16_t)id;
+                d.device = (uint16_t)(id >> 16);
+                if (match(&d, key) && index-- == 0) {
+                    *out = d;
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+static int match_class(const pci_device_t *d, uint32_t key) {
+    return d->class_code == (key >> 8) && d->subclass == (key & 0xFF);
+}
+
+static int match_id(const pci_device_t *d, uint32_t key) {
+    return d->vendor == (key >> 16) && d->device == (key & 0xFFFF);
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_device_t *out) {
+    return scan(match_class, ((uint32_t)class_code << 8) | subclass, index, out);
+}
+
+int pci_find_device(uint16_t vendor, uint16_t device, int index, pci_device_t *out) {
+    return scan(match_id, ((uint32_t)vendor << 16) | device, index, out);
+}
+
+uint64_t pci_bar(const pci_device_t *d, int n) {
+    uint32_t lo = pci_read32(d, (uint8_t)(PCI_BAR0 + n * 4));
+    if (lo & 1)
+        return lo & ~3u;
+    uint64_t base = lo & ~0xFu;
+    if (((lo >> 1) & 3) == 2 && n < 5)
+        base |= (uint64_t)pci_read32(d, (uint8_t)(PCI_BAR0 + (n + 1) * 4)) << 32;
+    return base;
+}
+
+void pci_enable(const pci_device_t *d, uint16_t bits) {
+    pci_write16(d, PCI_COMMAND, pci_read16(d, PCI_COMMAND) | bits);
+}
+
+uint8_t pci_next_cap(const pci_device_t *d, uint8_t after, uint8_t id) {
+    if (!(pci_read16(d, PCI_COMMAND + 2) & PCI_STATUS_CAPS))
+        return 0;
+    uint8_t off = after ? pci_read8(d, after + 1) : pci_read8(d, PCI_CAP_PTR);
+    /* 48 capabilities fill config space; more means a loop. */
+    for (int guard = 0; off >= 0x40 && guard < 48; ++guard) {
+        off &= 0xFC;
+        if (pci_read8(d, off) == id)
+            return off;
+        off = pci_read8(d, off + 1);
+    }
+    return 0;
+}
+
+int pci_msix_route(const pci_device_t *d, uint16_t entry, uint8_t vector, uint32_t apic_id) {
+    uint8_t cap = pci_next_cap(d, 0, PCI_CAP_MSIX);
+    if (!cap || !lapic_ready())
+        return -1;
+    uint16_t ctrl = pci_read16(d, cap + 2);
+    uint32_t entries = (ctrl & 0x7FFu) + 1;
+    if (entry >= entries)
+        return -1;
+    uint32_t table = pci_read32(d, cap + 4);
+    uint64_t base = pci_bar(d, (int)(table & 7)) + (table & ~7u);
+    pci_enable(d, PCI_COMMAND_MEMORY);
+    boot_map_identity_span(base, entries * MSIX_ENTRY_SIZE);
+    volatile uint32_t *e = (volatile uint32_t *)(uintptr_t)(base + (uint64_t)entry * MSIX_ENTRY_SIZE);
+    e[0] = MSI_ADDRESS_BASE | ((apic_id & 0xFF) << 12);
+    e[1] = 0;
+    e[2] = vector;
+    e[3] = 0;   /* unmask */
+    pci_write16(d, cap + 2, (uint16_t)((ctrl | MSIX_CTRL_ENABLE) & ~MSIX_CTRL_MASK_ALL));
+    return 0;
+}
+
+int pci_msi_route(const pci_device_t *d, uint8_t vector, uint32_t apic_id) {
+    uint8_t cap = pci_next_cap(d, 0, PCI_CAP_MSI);
+    if (!cap || !lapic_ready())
+        return -1;
+    uint16_t ctrl = pci_read16(d, cap + 2);
+    pci_write32(d, cap + 4, MSI_ADDRESS_BASE | ((apic_id & 0xFF) << 12));
+    if (ctrl & MSI_CTRL_64BIT) {
+        pci_write32(d, cap + 8, 0);
+        pci_write16(d, cap + 12, vector);
+    } else {
+        pci_write16(d, cap + 8, vector);
+    }
+    pci_write16(d, cap + 2, (uint16_t)((ctrl & ~MSI_CTRL_MME) | MSI_CTRL_ENABLE));
+    return 0;
+}
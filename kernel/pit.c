@@ -0,0 +1,88 @@
+#include "pit.h"
+#include "io.h"
+
+#define PIC1_CMD  0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD  0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI   0x20
+
+#define PIT_CH0  0x40
+#define PIT_CH2  0x42
+#define PIT_CMD  0x43
+#define PIT_GATE 0x61   /* bit 0: ch2 gate, bit 1: speaker, bit 5: ch2 out */
+
+void pic_init(void) {
+    /* ICW1: edge triggered, cascade, ICW4 follows */
+    io_outb(PIC1_CMD, 0x11); io_wait();
+    io_outb(PIC2_CMD, 0x11); io_wait();
+    io_outb(PIC1_DATA, PIC_VECTOR_BASE); io_wait();
+    io_outb(PIC2_DATA, PIC_VECTOR_BASE + 8); io_wait();
+    io_outb(PIC1_DATA, 0x04); io_wait();   /* slave on IRQ2 */
+    io_outb(PIC2_DATA, 0x02); io_wait();
+    io_outb(PIC1_DATA, 0x01); io_wait();   /* 8086 mode */
+    io_outb(PIC2_DATA, 0x01); io_wait();
+    io_outb(PIC1_DATA, 0xFF);
+    io_outb(PIC2_DATA, 0xFF);
+}
+
+void pic_unmask(uint8_t irq) {
+    if (irq >= 8) {
+        io_outb(PIC2_DATA, io_inb(PIC2_DATA) & ~(1u << (irq - 8)));
+        irq = 2;
+    }
+    io_outb(PIC1_DATA, io_inb(PIC1_DATA) & ~(1u << irq));
+}
+
+void pic_mask(uint8_t irq) {
+    if (irq >= 8)
+        io_outb(PIC2_DATA, io_inb(PIC2_DATA) | (1u << (irq - 8)));
+    else
+        io_outb(PIC1_DATA, io_inb(PIC1_DATA) | (1u << irq));
+}
+
+void pic_eoi(uint8_t irq) {
+    if (irq >= 8)
+        io_outb(PIC2_CMD, PIC_EOI);
+    io_outb(PIC1_CMD, PIC_EOI);
+}
+
+uint32_t pit_init(uint32_t hz) {
+    if (hz == 0)
+        hz = 100;
+    uint32_t divisor = (PIT_BASE_HZ + hz / 2) / hz;
+    if (divisor == 0)
+        divisor = 1;
+    if (divisor > 0xFFFF)
+        divisor = 0xFFFF;
+    io_outb(PIT_CMD, 0x34);                 /* ch0, lo/hi, mode 2 */
+    io_outb(PIT_CH0, divisor & 0xFF);
+    io_outb(PIT_CH0, (divisor >> 8) & 0xFF);
+    return PIT_BASE_HZ / divisor;
+}
+
+void pit_oneshot_us(uint32_t us) {
+    uint32_t count = (uint32_t)((uint64_t)us * PIT_BASE_HZ / 1000000u);
+    if (count == 0)
+        count = 1;
+    if (count > 0xFFFF)
+        count = 0xFFFF;
+    io_outb(PIT_CMD, 0x30);                 /* ch0, lo/hi, mode 0 */
+    io_outb(PIT_CH0, count & 0xFF);
+    io_outb(PIT_CH0, (count >> 8) & 0xFF);
+}
+
+void pit_delay_us(uint32_t us) {
+    while (us) {
+        uint32_t chunk = us > 50000 ? 50000 : us;
+        uint32_t count = (uint32_t)((uint64_t)chunk * PIT_BASE_HZ / 1000000u);
+        us -= chunk;
+        if (count == 0)
+            count = 1;
+        io_outb(PIT_GATE, (io_inb(PIT_GATE) & ~0x02) | 0x01);
+        io_outb(PIT_CMD, 0xB0);             /* ch2, lo/hi, mode 0 */
+        io_outb(PIT_CH2, count & 0xFF);
+        io_outb(PIT_CH2, (count >> 8) & 0xFF);
+        while (!(io_inb(PIT_GATE) & 0x20)) {}
+    }
+}
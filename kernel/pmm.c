@@ -0,0 +1,324 @@
+#include "pmm.h"
+#include "memutils.h"
+#include "console.h"
+#include "panic.h"
+
+/* Binary buddy page-frame allocator. Every physical page below the highest
+ * usable address gets one metadata byte: free block heads record their
+ * order, allocated heads record theirs, pages inside a block are tails and
+ * anything never handed to the allocator stays reserved. Free blocks are
+ * threaded onto per-order lists through the pages themselves, which relies
+ * on the boot identity map covering all managed memory.
+ */
+
+#define PMM_META_TAIL     0x00
+#define PMM_META_USED     0x40
+#define PMM_META_FREE     0x80
+#define PMM_META_RESERVED 0xFF
+
+#define PMM_MAX_RESERVED 64
+
+typedef struct pmm_node {
+    struct pmm_node *next;
+    struct pmm_node *prev;
+} pmm_node_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} pmm_range_t;
+
+static uint8_t *page_meta;
+static size_t page_count;
+static pmm_node_t *free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_blocks[PMM_MAX_ORDER + 1];
+static size_t free_pages;
+static size_t managed_pages;
+static int pmm_active;
+
+static pmm_range_t reserved[PMM_MAX_RESERVED];
+static int reserved_count;
+
+static void *pfn_addr(size_t pfn) {
+    return (void *)(uintptr_t)((uint64_t)pfn << PMM_PAGE_SHIFT);
+}
+
+static void list_push(unsigned order, size_t pfn) {
+    pmm_node_t *node = (pmm_node_t *)pfn_addr(pfn);
+    node->prev = NULL;
+    node->next = free_lists[order];
+    if (free_lists[order])
+        free_lists[order]->prev = node;
+    free_lists[order] = node;
+    page_meta[pfn] = (uint8_t)(PMM_META_FREE | order);
+    free_blocks[order]++;
+    free_pages += (size_t)1 << order;
+}
+
+static void list_remove(unsigned order, size_t pfn) {
+    pmm_node_t *node = (pmm_node_t *)pfn_addr(pfn);
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        free_lists[order] = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    page_meta[pfn] = PMM_META_TAIL;
+    free_blocks[order]--;
+    free_pages -= (size_t)1 << order;
+}
+
+static void free_block(size_t pfn, unsigned order) {
+    while (order < PMM_MAX_ORDER) {
+        size_t buddy = pfn ^ ((size_t)1 << order);
+        if (buddy + ((size_t)1 << order) > page_count)
+            break;
+        if (page_meta[buddy] != (uint8_t)(PMM_META_FREE | order))
+            break;
+        list_remove(order, buddy);
+        if (buddy < pfn)
+            pfn = buddy;
+        ++order;
+    }
+    list_push(order, pfn);
+}
+
+static void add_reserved(uint64_t start, uint64_t end) {
+    if (end <= start || reserved_count >= PMM_MAX_RESERVED)
+        return;
+    start &= ~(uint64_t)(PMM_PAGE_SIZE - 1);
+    end = (end + PMM_PAGE_SIZE - 1) & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+    reserved[reserved_count].start = start;
+    reserved[reserved_count].end = end;
+    reserved_count++;
+}
+
+/* Visit the parts of [start, end) that miss every reserved range. */
+typedef int (*pmm_range_fn)(uint64_t start, uint64_t end);
+
+static int for_each_usable(uint64_t start, uint64_t end, int first, pmm_range_fn fn) {
+    if (end <= start)
+        return 0;
+    for (int i = first; i < reserved_count; ++i) {
+        if (reserved[i].start < end && reserved[i].end > start) {
+            if (for_each_usable(start, reserved[i].start, i + 1, fn))
+                return 1;
+            return for_each_usable(reserved[i].end, end, i + 1, fn);
+        }
+    }
+    return fn(start, end);
+}
+
+static size_t meta_bytes_needed;
+static uint64_t meta_found;
+
+static int place_meta(uint64_t start, uint64_t end) {
+    if (end - start >= meta_bytes_needed) {
+        meta_found = start;
+        return 1;
+    }
+    return 0;
+}
+
+static int seed_range(uint64_t start, uint64_t end) {
+    for (uint64_t pfn = start >> PMM_PAGE_SHIFT; pfn < (end >> PMM_PAGE_SHIFT) && pfn < page_count; ++pfn) {
+        if (page_meta[pfn] != PMM_META_RESERVED)
+            continue;
+        page_meta[pfn] = PMM_META_TAIL;
+        managed_pages++;
+        free_block((size_t)pfn, 0);
+    }
+    return 0;
+}
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} pmm_region_t;
+
+#define PMM_MAX_REGIONS 32
+
+static int collect_regions(const multiboot_info_t *mbi, pmm_region_t *out) {
+    int count = 0;
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uintptr_t cur = (uintptr_t)mbi->mmap_addr;
+        uintptr_t stop = cur + mbi->mmap_length;
+        while (cur < stop && count < PMM_MAX_REGIONS) {
+            const multiboot_mmap_entry_t *e = (const multiboot_mmap_entry_t *)cur;
+            if (e->type == MULTIBOOT_MEMORY_AVAILABLE && e->len) {
+                out[count].start = e->addr;
+                out[count].end = e->addr + e->len;
+                count++;
+            }
+            cur += e->size + sizeof(e->size);
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        out[0].start = 0x100000;
+        out[0].end = 0x100000 + (uint64_t)mbi->mem_upper * 1024;
+        count = 1;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (out[i].end > PMM_MAX_PHYS)
+            out[i].end = PMM_MAX_PHYS;
+        out[i].start = (out[i].start + PMM_PAGE_SIZE - 1) & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+        out[i].end &= ~(uint64_t)(PMM_PAGE_SIZE - 1);
+    }
+    return count;
+}
+
+static void reserve_multiboot(const multiboot_info_t *mbi, uintptr_t kernel_end) {
+    add_reserved(0, kernel_end);
+    add_reserved((uintptr_t)mbi, (uintptr_t)mbi + sizeof(*mbi));
+    if (mbi->flags & (1u << 2))
+        add_reserved(mbi->cmdline, (uint64_t)mbi->cmdline + PMM_PAGE_SIZE);
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP)
+        add_reserved(mbi->mmap_addr, (uint64_t)mbi->mmap_addr + mbi->mmap_length);
+    if ((mbi->flags & (1u << 3)) && mbi->mods_count) {
+        const multiboot_module_t *mods = (const multiboot_module_t *)(uintptr_t)mbi->mods_addr;
+        add_reserved(mbi->mods_addr, (uint64_t)mbi->mods_addr + mbi->mods_count * sizeof(*mods));
+        for (uint32_t i = 0; i < mbi->mods_count; ++i) {
+            add_reserved(mods[i].mod_start, mods[i].mod_end);
+            if (mods[i].string)
+                add_reserved(mods[i].string, (uint64_t)mods[i].string + PMM_PAGE_SIZE);
+        }
+    }
+}
+
+int pmm_init_multiboot(const multiboot_info_t *mbi, uintptr_t kernel_end) {
+    pmm_region_t regions[PMM_MAX_REGIONS];
+    pmm_active = 0;
+    reserved_count = 0;
+    free_pages = 0;
+    managed_pages = 0;
+    for (int i = 0; i <= PMM_MAX_ORDER; ++i) {
+        free_lists[i] = NULL;
+        free_blocks[i] = 0;
+    }
+    if (!mbi)
+        return -1;
+    int count = collect_regions(mbi, regions);
+    uint64_t top = 0;
+    for (int i = 0; i < count; ++i) {
+        if (regions[i].end > top)
+            top = regions[i].end;
+    }
+    if (top == 0)
+        return -1;
+    page_count = (size_t)(top >> PMM_PAGE_SHIFT);
+    reserve_multiboot(mbi, kernel_end);
+
+    meta_bytes_needed = (page_count + PMM_PAGE_SIZE - 1) & ~(size_t)(PMM_PAGE_SIZE - 1);
+    meta_found = 0;
+    for (int i = 0; i < count && !meta_found; ++i)
+        for_each_usable(regions[i].start, regions[i].end, 0, place_meta);
+    if (!meta_found)
+        return -1;
+    page_meta = (uint8_t *)(uintptr_t)meta_found;
+    add_reserved(meta_found, meta_found + meta_bytes_needed);
+    memset(page_meta, PMM_META_RESERVED, page_count);
+
+    for (int i = 0; i < count; ++i)
+        for_each_usable(regions[i].start, regions[i].end, 0, seed_range);
+    pmm_active = 1;
+
+    console_puts("pmm: managing ");
+    console_udec((uint32_t)(managed_pages >> (20 - PMM_PAGE_SHIFT)));
+    console_puts(" MiB, free=");
+    console_udec((uint32_t)(free_pages >> (20 - PMM_PAGE_SHIFT)));
+    console_puts(" MiB\n");
+    return 0;
+}
+
+int pmm_ready(void) {
+    return pmm_active;
+}
+
+void *pmm_alloc_pages(unsigned order) {
+    if (!pmm_active || order > PMM_MAX_ORDER)
+        return NULL;
+    unsigned o = order;
+    while (o <= PMM_MAX_ORDER && !free_lists[o])
+        ++o;
+    if (o > PMM_MAX_ORDER)
+        return NULL;
+    size_t pfn = (size_t)((uintptr_t)free_lists[o] >> PMM_PAGE_SHIFT);
+    list_remove(o, pfn);
+    while (o > order) {
+        --o;
+        list_push(o, pfn + ((size_t)1 << o));
+    }
+    page_meta[pfn] = (uint8_t)(PMM_META_USED | order);
+    return pfn_addr(pfn);
+}
+
+/* Find the free block containing the page, then split it down to order 0,
+ * returning every half that does not hold the page to the free lists.
+ */
+int pmm_claim_page(void *addr) {
+    size_t pfn = (size_t)((uintptr_t)addr >> PMM_PAGE_SHIFT);
+    if (!pmm_active || ((uintptr_t)addr & (PMM_PAGE_SIZE - 1)) || pfn >= page_count)
+        return -1;
+    /* Free heads are aligned to their order, so the enclosing block, if
+     * any, starts at the page's head for some order no larger than its own.
+     */
+    for (unsigned o = 0; o <= PMM_MAX_ORDER; ++o) {
+        size_t head = pfn & ~(((size_t)1 << o) - 1);
+        uint8_t meta = page_meta[head];
+        if (meta != PMM_META_RESERVED && (meta & PMM_META_FREE) &&
+            (unsigned)(meta & ~PMM_META_FREE) >= o) {
+            o = meta & ~PMM_META_FREE;
+            list_remove(o, head);
+            while (o > 0) {
+                --o;
+                size_t half = (size_t)1 << o;
+                if (pfn >= head + half) {
+                    list_push(o, head);
+                    head += half;
+                } else {
+                    list_push(o, head + half);
+                }
+            }
+            page_meta[pfn] = PMM_META_USED;
+            return 0;
+        }
+        if (meta != PMM_META_TAIL)
+            return -1;
+    }
+    return -1;
+}
+
+void pmm_free_pages(void *addr, unsigned order) {
+    if (!addr)
+        return;
+    size_t pfn = (size_t)((uintptr_t)addr >> PMM_PAGE_SHIFT);
+    if (!pmm_active || ((uintptr_t)addr & (PMM_PAGE_SIZE - 1)) || pfn >= page_count)
+        panic("pmm: free of unmanaged page");
+    if (page_meta[pfn] != (uint8_t)(PMM_META_USED | order))
+        panic("pmm: double free or order mismatch");
+    page_meta[pfn] = PMM_META_TAIL;
+    free_block(pfn, order);
+}
+
+int pmm_order_for(size_t bytes) {
+    size_t pages = (bytes + PMM_PAGE_SIZE - 1) >> PMM_PAGE_SHIFT;
+    int order = 0;
+    while (((size_t)1 << order) < pages) {
+        if (++order > PMM_MAX_ORDER)
+            return -1;
+    }
+    return order;
+}
+
+size_t pmm_free_bytes(void) {
+    return free_pages << PMM_PAGE_SHIFT;
+}
+
+void pmm_get_stats(pmm_stats_t *stats) {
+    if (!stats)
+        return;
+    stats->total_pages = managed_pages;
+    stats->free_pages = free_pages;
+    stats->reserved_pages = page_count - managed_pages;
+    for (int i = 0; i <= PMM_MAX_ORDER; ++i)
+        stats->free_blocks[i] = free_blocks[i];
+}
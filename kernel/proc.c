@@ -3,19 +3,57 @@
 #include "memutils.h"
 #include "console.h"
 #include "panic.h"
+#include "kmem.h"
+#include "sched.h"
+#include "smp.h"
+#include "execcache.h"
+#include "vmm.h"
 
-#define PROC_MAX 16
-#define PROC_STACK_SIZE 4096
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} proc_region_t;
+
+typedef struct proc_thread {
+    sched_thread_t thread;      /* first, so sched_current() casts back */
+    struct proc_thread *next;
+    uintptr_t entry;
+    uintptr_t arg;
+    void *stack;
+    int tid;
+    int done;
+    int exit_status;
+    sched_waitq_t joiners;
+} proc_thread_t;
 
 typedef struct {
     proc_info_t info;
-    int used;
+    int slot;
+    int started;
+    /* Any thread of this process waiting in proc_wait. */
+    sched_waitq_t child_exits;
+    sched_thread_t thread;
     int fds[PROC_MAX_FDS];
+    int nregions;
+    proc_region_t regions[PROC_MAX_REGIONS];
+    /* Spawned images live in their own address space, mapped on demand
+     * from an exec cache entry.
+     */
+    vmm_space_t *space;
+    void *exec_image;
+    proc_thread_t *threads;
+    int nthreads;
+    int next_tid;
 } proc_entry_t;
 
-static proc_entry_t procs[PROC_MAX];
+static kmem_cache_t *proc_cache;
+static kmem_cache_t *thread_cache;
+static kmem_table_t procs;
 static int next_pid = 1;
-static int current_pid = 0;
+/* Current process of the boot context; threads publish theirs per CPU. */
+static proc_entry_t *boot_current;
+/* proc_wait callers with no process, i.e. kernel threads. */
+static sched_waitq_t kernel_child_exits;
 
 static int proc_exit_locked(int pid, int status);
 
@@ -23,14 +61,76 @@ static int proc_is_terminal_state(int state) {
     return state == PROC_STATE_EXITED || state == PROC_STATE_ZOMBIE || state == PROC_STATE_DEAD;
 }
 
+static proc_entry_t *proc_at(int slot) {
+    return kmem_table_get(&procs, slot);
+}
+
 static proc_entry_t *find_proc(int pid) {
-    for (int i = 0; i < PROC_MAX; ++i) {
-        if (procs[i].used && procs[i].info.pid == pid)
-            return &procs[i];
+    for (int i = 0; i < procs.count; ++i) {
+        proc_entry_t *proc = proc_at(i);
+        if (proc && proc->info.pid == pid)
+            return proc;
+    }
+    return 0;
+}
+
+/* O(1): the running thread's owner comes straight from the per-CPU
+ * block, so syscalls never search procs[] to find their caller.
+ */
+static proc_entry_t *current_proc(void) {
+    proc_entry_t *proc = smp_current_owner();
+    if (proc || sched_current())
+        return proc;
+    return boot_current;
+}
+
+static void free_threads(proc_entry_t *proc) {
+    while (proc->threads) {
+        proc_thread_t *t = proc->threads;
+        proc->threads = t->next;
+        kmem_cache_free(thread_cache, t);
+    }
+    proc->nthreads = 0;
+}
+
+/* Whether any thread may still run on the process's stacks. */
+static int proc_threads_live(const proc_entry_t *proc) {
+    if (proc->started && proc->thread.state != SCHED_DEAD)
+        return 1;
+    for (const proc_thread_t *t = proc->threads; t; t = t->next) {
+        if (t->thread.state != SCHED_DEAD)
+            return 1;
     }
     return 0;
 }
 
+static void release_proc(proc_entry_t *proc) {
+    if (!proc)
+        return;
+    if (boot_current == proc)
+        boot_current = 0;
+    for (int fd = 0; fd < PROC_MAX_FDS; ++fd) {
+        if (proc->fds[fd] >= 0)
+            vfs_close(proc->fds[fd]);
+    }
+    vmm_space_destroy(proc->space);
+    execcache_release(proc->exec_image);
+    /* Stacks and a flat image are the kernel's blocks; hand them back so
+     * memctx_destroy only reports what the process itself left behind.
+     */
+    int ctx = proc->info.memctx;
+    for (proc_thread_t *t = proc->threads; t; t = t->next)
+        memctx_free(ctx, t->stack);
+    if (proc->info.stack_pointer)
+        memctx_free(ctx, (void *)(proc->info.stack_pointer - PROC_STACK_SIZE));
+    if (!proc->space && proc->info.image_base)
+        memctx_free(ctx, (void *)proc->info.image_base);
+    free_threads(proc);
+    memctx_destroy(ctx);
+    kmem_table_remove(&procs, proc->slot);
+    kmem_cache_free(proc_cache, proc);
+}
+
 static void copy_text(char *dst, size_t dst_len, const char *src) {
     size_t i = 0;
     if (!dst || dst_len == 0)
@@ -54,9 +154,19 @@ static const char *basename_from_path(const char *path) {
 }
 
 void proc_init(void) {
-    memset(procs, 0, sizeof(procs));
+    if (!proc_cache)
+        proc_cache = kmem_cache_create("proc", sizeof(proc_entry_t), KMEM_CACHE_ALIGN_LINE, NULL);
+    if (!thread_cache)
+        thread_cache = kmem_cache_create("proc_thread", sizeof(proc_thread_t), KMEM_CACHE_ALIGN_LINE, NULL);
+    for (int i = 0; i < procs.count; ++i) {
+        if (proc_at(i)) {
+            free_threads(proc_at(i));
+            kmem_cache_free(proc_cache, proc_at(i));
+        }
+    }
+    kmem_table_reset(&procs);
     next_pid = 1;
-    current_pid = 0;
+    boot_current = 0;
     memctx_init();
 }
 
@@ -65,24 +175,35 @@ int proc_create(const char *name, int parent_pid) {
         return -1;
     if (parent_pid == 0 && next_pid != 1)
         return -1;
-    for (int i = 0; i < PROC_MAX; ++i) {
-        if (!procs[i].used) {
-            memset(&procs[i], 0, sizeof(procs[i]));
-            procs[i].used = 1;
-            procs[i].info.pid = next_pid++;
-            procs[i].info.parent_pid = parent_pid;
-            procs[i].info.state = PROC_STATE_READY;
-            procs[i].info.exit_status = 0;
-            procs[i].info.memctx = memctx_create(procs[i].info.pid, 0);
-            if (procs[i].info.memctx < 0) { memset(&procs[i], 0, sizeof(procs[i])); return PROC_ERR_NOMEM; }
-            copy_text(procs[i].info.name, sizeof(procs[i].info.name), name);
-            copy_text(procs[i].info.cwd, sizeof(procs[i].info.cwd), "/");
-            for (int fd = 0; fd < PROC_MAX_FDS; ++fd)
-                procs[i].fds[fd] = -1;
-            return procs[i].info.pid;
-        }
-    }
-    return PROC_ERR_NOMEM;
+    proc_entry_t *proc = kmem_cache_alloc(proc_cache);
+    if (!proc)
+        return PROC_ERR_NOMEM;
+    memset(proc, 0, sizeof(*proc));
+    proc->slot = kmem_table_insert(&procs, proc);
+    if (proc->slot < 0) { kmem_cache_free(proc_cache, proc); return PROC_ERR_NOMEM; }
+    proc->info.pid = next_pid++;
+    proc->info.parent_pid = parent_pid;
+    proc->info.state = PROC_STATE_READY;
+    proc->info.exit_status = 0;
+    proc->info.memctx = memctx_create(proc->info.pid, 0);
+    if (proc->info.memctx < 0) { kmem_table_remove(&procs, proc->slot); kmem_cache_free(proc_cache, proc); return PROC_ERR_NOMEM; }
+    copy_text(proc->info.name, sizeof(proc->info.name), name);
+    copy_text(proc->info.cwd, sizeof(proc->info.cwd), "/");
+    for (int fd = 0; fd < PROC_MAX_FDS; ++fd)
+        proc->fds[fd] = -1;
+    return proc->info.pid;
+}
+
+/* Syscall buffers outside the memory context are only accepted inside
+ * these regions, so an image that does not fit must not be attached.
+ */
+static int add_region(proc_entry_t *proc, void *ptr, size_t size) {
+    if (proc->nregions >= PROC_MAX_REGIONS)
+        return -1;
+    proc->regions[proc->nregions].start = (uintptr_t)ptr;
+    proc->regions[proc->nregions].end = (uintptr_t)ptr + size;
+    proc->nregions++;
+    return 0;
 }
 
 int proc_attach_image(int pid, const char *path, const elf_image_t *image) {
@@ -95,6 +216,8 @@ int proc_attach_image(int pid, const char *path, const elf_image_t *image) {
     proc->info.requested_base = image->requested_base;
     proc->info.requested_end = image->requested_end;
     copy_text(proc->info.exe_path, sizeof(proc->info.exe_path), path);
+    if (proc->space && add_region(proc, image->load_base, image->load_size) < 0)
+        return -1;
     void *stack = proc_alloc(pid, PROC_STACK_SIZE);
     if (!stack)
         return -1;
@@ -106,58 +229,86 @@ int proc_set_current(int pid) {
     proc_entry_t *proc = find_proc(pid);
     if (!proc || proc_is_terminal_state(proc->info.state))
         return -1;
-    if (current_pid) {
-        proc_entry_t *old = find_proc(current_pid);
-        if (old && old->info.state == PROC_STATE_RUNNING)
-            old->info.state = PROC_STATE_READY;
-    }
-    current_pid = pid;
+    proc_entry_t *old = boot_current;
+    if (old && !old->started && old->info.state == PROC_STATE_RUNNING)
+        old->info.state = PROC_STATE_READY;
+    boot_current = proc;
     proc->info.state = PROC_STATE_RUNNING;
     return 0;
 }
 
 int proc_current_pid(void) {
-    return current_pid;
+    proc_entry_t *proc = current_proc();
+    return proc ? proc->info.pid : 0;
 }
 
 int proc_current_valid(void) {
-    proc_entry_t *proc = find_proc(current_pid);
-    return proc && current_pid > 0 && proc->info.state == PROC_STATE_RUNNING;
+    proc_entry_t *proc = current_proc();
+    return proc && proc->info.pid > 0 && proc->info.state == PROC_STATE_RUNNING;
+}
+
+int proc_current_range_valid(uintptr_t start, uintptr_t end) {
+    proc_entry_t *proc = current_proc();
+    if (!proc)
+        return 0;
+    if (memctx_contains(proc->info.memctx, start, end))
+        return 1;
+    for (int i = 0; i < proc->nregions; ++i) {
+        if (start >= proc->regions[i].start && end <= proc->regions[i].end)
+            return 1;
+    }
+    return 0;
+}
+
+/* What observers see: RUNNING is stored for every live started process,
+ * the thread tells whether it is on the CPU, queued or waiting.
+ */
+static int proc_visible_state(const proc_entry_t *proc) {
+    if (!proc->started || proc->info.state != PROC_STATE_RUNNING)
+        return proc->info.state;
+    if (proc->thread.state == SCHED_RUNNING)
+        return PROC_STATE_RUNNING;
+    if (proc->thread.state == SCHED_BLOCKED || proc->thread.state == SCHED_SLEEPING)
+        return PROC_STATE_BLOCKED;
+    return PROC_STATE_READY;
+}
+
+static void proc_thread_main(void *arg) {
+    proc_entry_t *proc = arg;
+    void (*entry)(void) = (void (*)(void))proc->info.entry_point;
+    entry();
+    sched_lock();
+    /* Returning from _start is an implicit exit(0). */
+    proc_exit_locked(proc->info.pid, 0);
+    sched_exit();
 }
 
 int proc_start_flat(int pid) {
     proc_entry_t *proc = find_proc(pid);
-    if (!proc || !proc->info.entry_point || proc_is_terminal_state(proc->info.state))
-        return -1;
-    int previous = current_pid;
-    if (proc_set_current(pid) != 0)
+    if (!proc || !proc->info.entry_point || proc->started || proc_is_terminal_state(proc->info.state))
         return -1;
-    void (*entry)(void) = (void (*)(void))proc->info.entry_point;
+    /* Spawned processes see their image through their own page tables but
+     * share the kernel's identity map. They run on their proc-owned stack
+     * so syscall pointer validation accepts stack buffers such as shelld's
+     * SYS_READ character storage.
+     */
     uintptr_t stack_top = proc->info.stack_pointer & ~(uintptr_t)0xFul;
-#if defined(__x86_64__)
-    /* Flat userland processes still run in the kernel address space, but they
-     * need to run on their proc-owned stack so syscall pointer validation
-     * accepts stack buffers such as shelld's SYS_READ character storage.
+    proc->thread.id = pid;
+    proc->thread.owner = proc;
+    proc->thread.cr3 = vmm_space_root(proc->space);
+    if (sched_thread_start(&proc->thread, stack_top, proc_thread_main, proc) != 0)
+        return -1;
+    proc->started = 1;
+    proc->info.state = PROC_STATE_RUNNING;
+    if (sched_current())
+        return 0;
+    /* The boot context has nothing else to do; it idles until the process
+     * (in practice launchd) finishes.
      */
-    __asm__ volatile (
-        "mov %%rsp, %%r12\n"
-        "mov %0, %%rsp\n"
-        "call *%1\n"
-        "mov %%r12, %%rsp\n"
-        :
-        : "r"(stack_top), "r"(entry)
-        : "memory", "r12", "rax", "rcx", "rdx", "rsi", "rdi",
-          "r8", "r9", "r10", "r11");
-#else
-    entry();
-#endif
-    proc = find_proc(pid);
-    if (proc && !proc_is_terminal_state(proc->info.state))
-        proc_exit_locked(pid, 0);
-    if (previous && previous != pid && find_proc(previous))
-        proc_set_current(previous);
-    else if (current_pid == pid)
-        current_pid = 0;
+    while ((proc = find_proc(pid)) && !proc_is_terminal_state(proc->info.state))
+        sched_block();
+    if (boot_current == proc)
+        boot_current = 0;
     return 0;
 }
 
@@ -176,15 +327,31 @@ static int proc_exit_locked(int pid, int status) {
         }
     }
     if (pid != 1) {
-        for (int i = 0; i < PROC_MAX; ++i) {
-            if (procs[i].used && procs[i].info.parent_pid == pid)
-                procs[i].info.parent_pid = 1;
+        for (int i = 0; i < procs.count; ++i) {
+            proc_entry_t *other = proc_at(i);
+            if (other && other->info.parent_pid == pid)
+                other->info.parent_pid = 1;
         }
     }
     proc->info.exit_status = status;
     proc->info.state = PROC_STATE_EXITED;
-    if (current_pid == pid)
-        current_pid = 0;
+    if (boot_current == proc)
+        boot_current = 0;
+    proc_entry_t *parent = find_proc(proc->info.parent_pid);
+    sched_wake_all(parent ? &parent->child_exits : &kernel_child_exits);
+    /* Stop every other thread first; the caller may be one of them. They
+     * finish any disk request in flight before exiting, and proc_wait
+     * releases the process only after the last one has.
+     */
+    sched_thread_t *self = sched_current();
+    for (proc_thread_t *t = proc->threads; t; t = t->next) {
+        if (&t->thread != self)
+            sched_cancel(&t->thread);
+    }
+    if (proc->started && &proc->thread != self)
+        sched_cancel(&proc->thread);
+    if (self && self->owner == proc)
+        sched_exit();
     return 0;
 }
 
@@ -194,12 +361,25 @@ int proc_exit(int pid, int status) {
 
 int proc_wait(int parent_pid, int child_pid, int *status) {
     proc_entry_t *child = find_proc(child_pid);
+    proc_entry_t *parent = find_proc(parent_pid);
+    while (child && child->info.parent_pid == parent_pid && proc_threads_live(child)) {
+        if (sched_cancelled())
+            return -1;
+        if (proc_is_terminal_state(child->info.state)) {
+            /* Killed, but its threads are still unwinding or running on
+             * another CPU; their stacks stay in use until they exit.
+             */
+            sched_sleep_ms(1);
+        } else if (sched_wait(parent ? &parent->child_exits : &kernel_child_exits) != 0) {
+            return -1;
+        }
+        child = find_proc(child_pid);
+    }
     if (!child || child->info.parent_pid != parent_pid || child->info.state != PROC_STATE_EXITED)
         return -1;
     if (status)
         *status = child->info.exit_status;
-    memctx_destroy(child->info.memctx);
-    memset(child, 0, sizeof(*child));
+    release_proc(child);
     return child_pid;
 }
 
@@ -208,6 +388,7 @@ int proc_info(int pid, proc_info_t *info) {
     if (!proc || !info)
         return -1;
     *info = proc->info;
+    info->state = proc_visible_state(proc);
     return 0;
 }
 
@@ -228,10 +409,13 @@ long proc_list(proc_info_t *infos, size_t max_infos) {
     if (!infos && max_infos)
         return -1;
     size_t out = 0;
-    for (int i = 0; i < PROC_MAX; ++i) {
-        if (procs[i].used) {
-            if (out < max_infos)
-                infos[out] = procs[i].info;
+    for (int i = 0; i < procs.count; ++i) {
+        proc_entry_t *proc = proc_at(i);
+        if (proc) {
+            if (out < max_infos) {
+                infos[out] = proc->info;
+                infos[out].state = proc_visible_state(proc);
+            }
             ++out;
         }
     }
@@ -252,15 +436,6 @@ int proc_free(int pid, void *ptr) {
     return memctx_free(proc->info.memctx, ptr);
 }
 
-static int read_vfs_file(const char *path, void *buf, size_t size) {
-    int fd = vfs_open(path, VFS_O_RDONLY);
-    if (fd < 0)
-        return -1;
-    long got = vfs_read(fd, buf, size);
-    vfs_close(fd);
-    return got == (long)size ? 0 : -1;
-}
-
 int proc_spawn_exec(int parent_pid, const char *path) {
     if (!path || !find_proc(parent_pid))
         return -1;
@@ -270,34 +445,163 @@ int proc_spawn_exec(int parent_pid, const char *path) {
     int pid = proc_create(basename_from_path(path), parent_pid);
     if (pid < 0)
         return pid;
-    void *file = proc_alloc(pid, st.size);
-    if (!file) { memctx_destroy(find_proc(pid)->info.memctx); memset(find_proc(pid), 0, sizeof(proc_entry_t)); return PROC_ERR_NOMEM; }
-    if (read_vfs_file(path, file, st.size) != 0) { memctx_destroy(find_proc(pid)->info.memctx); memset(find_proc(pid), 0, sizeof(proc_entry_t)); return -1; }
+    /* Children inherit open descriptors, so a shell can hand them pipe
+     * ends with dup2 before spawning.
+     */
+    proc_entry_t *parent = find_proc(parent_pid);
+    proc_entry_t *child = find_proc(pid);
+    for (int fd = 0; fd < PROC_MAX_FDS; ++fd) {
+        if (parent->fds[fd] >= 0)
+            child->fds[fd] = vfs_dup(parent->fds[fd]);
+    }
+    /* Nothing is copied here: text pages map the exec cache's copy and
+     * data/bss pages are committed as the child touches them.
+     */
     elf_image_t image;
     memset(&image, 0, sizeof(image));
-    if (elf_load_process_image(pid, file, st.size, &image) != 0) { memctx_destroy(find_proc(pid)->info.memctx); memset(find_proc(pid), 0, sizeof(proc_entry_t)); return PROC_ERR_NOMEM; }
-    if (proc_attach_image(pid, path, &image) != 0) { elf_free_process_image(pid, &image); memctx_destroy(find_proc(pid)->info.memctx); memset(find_proc(pid), 0, sizeof(proc_entry_t)); return PROC_ERR_NOMEM; }
-    int start = proc_start_flat(pid);
-    return start == 0 ? pid : -1;
+    child->space = vmm_space_create();
+    if (!child->space || execcache_map(child->space, path, &image, &child->exec_image) != 0) {
+        release_proc(find_proc(pid));
+        return PROC_ERR_NOMEM;
+    }
+    if (proc_attach_image(pid, path, &image) != 0) { release_proc(find_proc(pid)); return PROC_ERR_NOMEM; }
+    /* From a running process the child is only queued; the caller decides
+     * whether to SYS_PROC_WAIT for it.
+     */
+    if (proc_start_flat(pid) != 0) {
+        release_proc(find_proc(pid));
+        return -1;
+    }
+    return pid;
 }
 
-int proc_open(int pid, const char *path, int flags) {
+static void proc_thread_finish(proc_thread_t *t, int status) __attribute__((noreturn));
+
+static void proc_thread_finish(proc_thread_t *t, int status) {
+    t->exit_status = status;
+    t->done = 1;
+    sched_wake_all(&t->joiners);
+    sched_exit();
+}
+
+static void proc_thread_entry(void *arg) {
+    proc_thread_t *t = arg;
+    void (*entry)(void *) = (void (*)(void *))t->entry;
+    entry((void *)t->arg);
+    sched_lock();
+    proc_thread_finish(t, 0);
+}
+
+int proc_thread_create(int pid, uintptr_t entry, uintptr_t arg) {
     proc_entry_t *proc = find_proc(pid);
-    if (!proc || proc_is_terminal_state(proc->info.state))
+    if (!proc || !entry || proc_is_terminal_state(proc->info.state) || proc->nthreads >= PROC_MAX_THREADS)
         return -1;
-    int real_fd = vfs_open(path, flags);
-    if (real_fd < 0)
+    proc_thread_t *t = kmem_cache_alloc(thread_cache);
+    if (!t)
+        return PROC_ERR_NOMEM;
+    memset(t, 0, sizeof(*t));
+    t->stack = proc_alloc(pid, PROC_STACK_SIZE);
+    if (!t->stack) {
+        kmem_cache_free(thread_cache, t);
+        return PROC_ERR_NOMEM;
+    }
+    t->entry = entry;
+    t->arg = arg;
+    t->tid = ++proc->next_tid;
+    t->thread.id = t->tid;
+    t->thread.owner = proc;
+    t->thread.cr3 = vmm_space_root(proc->space);
+    if (sched_thread_start(&t->thread, (uintptr_t)t->stack + PROC_STACK_SIZE, proc_thread_entry, t) != 0) {
+        proc_free(pid, t->stack);
+        kmem_cache_free(thread_cache, t);
         return -1;
+    }
+    t->next = proc->threads;
+    proc->threads = t;
+    proc->nthreads++;
+    return t->tid;
+}
+
+int proc_thread_exit(int status) {
+    proc_entry_t *proc = current_proc();
+    sched_thread_t *self = sched_current();
+    if (!proc || !self || self->owner != proc)
+        return -1;
+    if (self == &proc->thread)
+        return proc_exit_locked(proc->info.pid, status);
+    proc_thread_finish((proc_thread_t *)self, status);
+}
+
+static proc_thread_t **find_thread(proc_entry_t *proc, int tid) {
+    proc_thread_t **link = &proc->threads;
+    while (*link && (*link)->tid != tid)
+        link = &(*link)->next;
+    return link;
+}
+
+int proc_thread_join(int pid, int tid, int *status) {
+    proc_entry_t *proc = find_proc(pid);
+    if (!proc)
+        return PROC_ERR_NOT_FOUND;
+    proc_thread_t *t = *find_thread(proc, tid);
+    if (!t || &t->thread == sched_current())
+        return -1;
+    while (t->thread.state != SCHED_DEAD) {
+        if (sched_wait(&t->joiners) != 0)
+            return -1;
+        /* The idle context only polls; the process may be gone. */
+        if (!(proc = find_proc(pid)) || !(t = *find_thread(proc, tid)))
+            return PROC_ERR_NOT_FOUND;
+    }
+    if (status)
+        *status = t->done ? t->exit_status : -1;
+    *find_thread(proc, tid) = t->next;
+    proc->nthreads--;
+    proc_free(pid, t->stack);
+    kmem_cache_free(thread_cache, t);
+    return 0;
+}
+
+static int install_fd(proc_entry_t *proc, int backing) {
     for (int fd = 0; fd < PROC_MAX_FDS; ++fd) {
         if (proc->fds[fd] < 0) {
-            proc->fds[fd] = real_fd;
+            proc->fds[fd] = backing;
             return fd;
         }
     }
-    vfs_close(real_fd);
     return -1;
 }
 
+int proc_open(int pid, const char *path, int flags) {
+    proc_entry_t *proc = find_proc(pid);
+    if (!proc || proc_is_terminal_state(proc->info.state))
+        return -1;
+    int real_fd = vfs_open(path, flags);
+    if (real_fd < 0)
+        return -1;
+    int fd = install_fd(proc, real_fd);
+    if (fd < 0)
+        vfs_close(real_fd);
+    return fd;
+}
+
+int proc_pipe(int pid, int fds[2]) {
+    proc_entry_t *proc = find_proc(pid);
+    int ends[2];
+    if (!proc || !fds || proc_is_terminal_state(proc->info.state) || vfs_pipe(ends) != 0)
+        return -1;
+    fds[0] = install_fd(proc, ends[0]);
+    fds[1] = fds[0] >= 0 ? install_fd(proc, ends[1]) : -1;
+    if (fds[1] < 0) {
+        if (fds[0] >= 0)
+            proc->fds[fds[0]] = -1;
+        vfs_close(ends[0]);
+        vfs_close(ends[1]);
+        return -1;
+    }
+    return 0;
+}
+
 static int real_fd(proc_entry_t *proc, int fd) {
     if (!proc || fd < 0 || fd >= PROC_MAX_FDS)
         return -1;
@@ -314,6 +618,15 @@ long proc_write(int pid, int fd, const void *buf, size_t len) {
     return vfs_write(real_fd(proc, fd), buf, len);
 }
 
+long proc_splice(int pid, int fd_in, int fd_out, size_t len) {
+    proc_entry_t *proc = find_proc(pid);
+    return vfs_splice(real_fd(proc, fd_in), real_fd(proc, fd_out), len);
+}
+
+int proc_fd_bound(int pid, int fd) {
+    return real_fd(find_proc(pid), fd) >= 0;
+}
+
 long proc_lseek(int pid, int fd, long offset, int whence) {
     proc_entry_t *proc = find_proc(pid);
     return vfs_lseek(real_fd(proc, fd), offset, whence);
@@ -333,13 +646,10 @@ int proc_dup(int pid, int oldfd) {
     int backing = real_fd(proc, oldfd);
     if (backing < 0)
         return -1;
-    for (int fd = 0; fd < PROC_MAX_FDS; ++fd) {
-        if (proc->fds[fd] < 0) {
-            proc->fds[fd] = backing;
-            return fd;
-        }
-    }
-    return -1;
+    int fd = install_fd(proc, backing);
+    if (fd >= 0)
+        vfs_dup(backing);
+    return fd;
 }
 
 int proc_dup2(int pid, int oldfd, int newfd) {
@@ -347,7 +657,11 @@ int proc_dup2(int pid, int oldfd, int newfd) {
     int backing = real_fd(proc, oldfd);
     if (!proc || backing < 0 || newfd < 0 || newfd >= PROC_MAX_FDS)
         return -1;
-    if (proc->fds[newfd] >= 0 && proc->fds[newfd] != backing)
+    if (newfd == oldfd)
+        return newfd;
+    /* Take the new reference first so closing newfd cannot free it. */
+    vfs_dup(backing);
+    if (proc->fds[newfd] >= 0)
         vfs_close(proc->fds[newfd]);
     proc->fds[newfd] = backing;
     return newfd;
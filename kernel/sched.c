@@ -0,0 +1,526 @@
+#include "sched.h"
+#include "pit.h"
+#include "clock.h"
+#include "lapic.h"
+#include "smp.h"
+#include "idt.h"
+#include "panic.h"
+#include "vmm.h"
+
+extern void sched_switch(uint64_t *save_rsp, uint64_t load_rsp);
+extern void sched_thread_trampoline(void);
+void sched_thread_run(sched_entry_t fn, void *arg);
+
+/* Per-CPU run queue. Each CPU's boot context is its idle thread; idle
+ * threads are never queued and schedule() falls back to them when there
+ * is neither local nor stealable work. Everything here runs under the
+ * kernel lock.
+ */
+typedef struct {
+    sched_thread_t idle;
+    sched_thread_t *current;
+    sched_thread_t *ready_head;
+    sched_thread_t *ready_tail;
+    uint32_t nready;
+    uint32_t slice;
+    uint64_t switches;
+    uint64_t steals;
+} sched_cpu_t;
+
+static sched_cpu_t cpus[SMP_MAX_CPUS];
+static int active;
+static int pit_oneshot;     /* BSP PIT reprogrammed for an idle wait */
+
+static sched_cpu_t *this_cpu(void) {
+    return &cpus[smp_cpu_index()];
+}
+
+static void ready_push(sched_cpu_t *c, sched_thread_t *t) {
+    t->state = SCHED_READY;
+    t->cpu = (int)(c - cpus);
+    t->next = 0;
+    if (c->ready_tail)
+        c->ready_tail->next = t;
+    else
+        c->ready_head = t;
+    c->ready_tail = t;
+    c->nready++;
+}
+
+static sched_thread_t *ready_pop(sched_cpu_t *c) {
+    sched_thread_t *t = c->ready_head;
+    if (t) {
+        c->ready_head = t->next;
+        if (!c->ready_head)
+            c->ready_tail = 0;
+        t->next = 0;
+        c->nready--;
+    }
+    return t;
+}
+
+static int list_remove(sched_thread_t **head, sched_thread_t **tail, sched_thread_t *t) {
+    sched_thread_t *prev = 0;
+    for (sched_thread_t *it = *head; it; prev = it, it = it->next) {
+        if (it != t)
+            continue;
+        if (prev)
+            prev->next = it->next;
+        else
+            *head = it->next;
+        if (tail && *tail == it)
+            *tail = prev;
+        it->next = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* An idle CPU sleeps in hlt; an IPI makes it look at its queue again. */
+static void kick(sched_cpu_t *c) {
+    if (c != this_cpu() && c->current == &c->idle)
+        smp_send_ipi((int)(c - cpus), SCHED_KICK_VECTOR);
+}
+
+static void kick_idle_cpu(void) {
+    for (int i = 0; i < smp_cpu_count(); ++i) {
+        if (&cpus[i] != this_cpu() && cpus[i].current == &cpus[i].idle) {
+            kick(&cpus[i]);
+            return;
+        }
+    }
+}
+
+static void sleep_expired(void *arg) {
+    sched_wakeup(arg);
+}
+
+/* Take the most recently queued thread from the CPU with the longest
+ * queue. The head stays put so the victim keeps its oldest work.
+ */
+static sched_thread_t *steal(sched_cpu_t *self) {
+    sched_cpu_t *victim = 0;
+    int n = smp_cpu_count();
+    for (int i = 0; i < n; ++i) {
+        sched_cpu_t *c = &cpus[i];
+        if (c != self && c->nready && (!victim || c->nready > victim->nready))
+            victim = c;
+    }
+    if (!victim)
+        return 0;
+    sched_thread_t *t = victim->ready_tail;
+    list_remove(&victim->ready_head, &victim->ready_tail, t);
+    victim->nready--;
+    self->steals++;
+    return t;
+}
+
+static void pit_periodic(void) {
+    if (pit_oneshot) {
+        pit_oneshot = 0;
+        pit_init(SCHED_HZ);
+    }
+}
+
+/* Hand this CPU to the next ready thread. The caller has already queued or
+ * parked 'current'; a blocked caller with nothing else to run lands in
+ * idle. On return the caller may be running on a different CPU.
+ */
+static void schedule(void) {
+    sched_cpu_t *c = this_cpu();
+    sched_thread_t *prev = c->current;
+    sched_thread_t *next = ready_pop(c);
+    if (!next)
+        next = steal(c);
+    if (!next) {
+        if (prev == &c->idle)
+            return;
+        next = &c->idle;
+    }
+    if (next == prev) {
+        prev->state = SCHED_RUNNING;
+        return;
+    }
+    next->state = SCHED_RUNNING;
+    next->cpu = (int)(c - cpus);
+    c->current = next;
+    c->slice = SCHED_QUANTUM;
+    c->switches++;
+    if (c == &cpus[0])
+        pit_periodic();
+    smp_this_cpu()->current_owner = next->owner;
+    vmm_activate(next->cr3);
+    sched_switch(&prev->rsp, next->rsp);
+}
+
+/* The idle BSP stops ticking and instead wakes once for the earliest timer
+ * on the wheel (or after SCHED_IDLE_MAX_MS). APs keep their LAPIC tick
+ * and are kicked when work arrives.
+ */
+static void idle_halt(void) {
+    if (active && smp_cpu_index() == 0) {
+        uint64_t now = clock_ms();
+        uint64_t next = ktimer_next();
+        uint64_t wait = SCHED_IDLE_MAX_MS;
+        if (next != UINT64_MAX && next < now + wait)
+            wait = next > now ? next - now : 1;
+        pit_oneshot_us((uint32_t)wait * 1000u);
+        pit_oneshot = 1;
+    }
+    kernel_unlock();
+    __asm__ volatile ("sti\n\thlt\n\tcli" ::: "memory");
+    kernel_lock();
+    if (smp_cpu_index() == 0)
+        pit_periodic();
+}
+
+/* How the idle context waits: run whatever is ready, and halt only when
+ * nothing is.
+ */
+static void idle_wait(void) {
+    sched_cpu_t *c = this_cpu();
+    uint64_t switches = c->switches;
+    schedule();
+    if (c->switches == switches)
+        idle_halt();
+}
+
+static void tick_local(void) {
+    sched_cpu_t *c = this_cpu();
+    sched_thread_t *cur = c->current;
+    if (cur == &c->idle) {
+        schedule();
+        return;
+    }
+    if (cur->cancelled)
+        sched_exit();
+    if (c->slice)
+        c->slice--;
+    if (c->slice == 0 && c->nready) {
+        ready_push(c, cur);
+        schedule();
+    }
+}
+
+/* The PIT only interrupts the BSP; it turns the timer wheel. */
+static void pit_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+    pic_eoi(0);
+    pit_periodic();
+    ktimer_advance(clock_ms());
+    tick_local();
+}
+
+static void lapic_timer_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+    lapic_eoi();
+    tick_local();
+}
+
+static void kick_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+    lapic_eoi();
+    sched_cpu_t *c = this_cpu();
+    if (c->current == &c->idle)
+        schedule();
+}
+
+static void spurious_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)err; (void)rsp;
+    /* A spurious IRQ15 still needs the master's cascade acknowledged. */
+    if (num == PIC_VECTOR_BASE + 15)
+        pic_eoi(0);
+}
+
+void sched_init(void) {
+    if (active)
+        return;
+    sched_cpu_t *c = this_cpu();
+    pic_init();
+    register_irq_handler(PIC_VECTOR_BASE, pit_irq);
+    register_irq_handler(PIC_VECTOR_BASE + 7, spurious_irq);
+    register_irq_handler(PIC_VECTOR_BASE + 15, spurious_irq);
+    register_irq_handler(LAPIC_TIMER_VECTOR, lapic_timer_irq);
+    register_irq_handler(SCHED_KICK_VECTOR, kick_irq);
+    ktimer_init(clock_ms());
+    pit_init(SCHED_HZ);
+    c->idle.state = SCHED_RUNNING;
+    c->current = &c->idle;
+    c->slice = SCHED_QUANTUM;
+    /* From here on the boot context holds the kernel lock except while it
+     * halts.
+     */
+    kernel_lock();
+    active = 1;
+    pic_unmask(0);
+}
+
+void sched_ap_enter(void) {
+    sched_cpu_t *c = this_cpu();
+    c->idle.state = SCHED_RUNNING;
+    c->idle.cpu = (int)(c - cpus);
+    c->current = &c->idle;
+    c->slice = SCHED_QUANTUM;
+    for (;;) {
+        schedule();
+        idle_halt();
+    }
+}
+
+int sched_active(void) {
+    return active;
+}
+
+int sched_thread_start(sched_thread_t *t, uintptr_t stack_top, sched_entry_t fn, void *arg) {
+    if (!active || !t || !fn || !stack_top)
+        return -1;
+    /* Frame popped by sched_switch: r15 r14 r13 r12 rbp rbx, then the
+     * trampoline as return address. The trampoline starts on an aligned rsp.
+     */
+    uint64_t *sp = (uint64_t *)(stack_top & ~(uintptr_t)0xF) - 7;
+    sp[0] = 0;
+    sp[1] = 0;
+    sp[2] = (uint64_t)(uintptr_t)arg;
+    sp[3] = (uint64_t)(uintptr_t)fn;
+    sp[4] = 0;
+    sp[5] = 0;
+    sp[6] = (uint64_t)(uintptr_t)sched_thread_trampoline;
+    t->rsp = (uint64_t)(uintptr_t)sp;
+    t->sleep_timer.pprev = 0;
+    t->waitq = 0;
+    t->wait_next = 0;
+    t->cancelled = 0;
+    sched_cpu_t *c = this_cpu();
+    ready_push(c, t);
+    if (c->current != &c->idle)
+        kick_idle_cpu();
+    return 0;
+}
+
+/* New threads inherit the kernel lock from whoever switched to them. */
+void sched_thread_run(sched_entry_t fn, void *arg) {
+    if (!this_cpu()->current->cancelled) {
+        sched_unlock();
+        fn(arg);
+        sched_lock();
+    }
+    sched_exit();
+}
+
+sched_thread_t *sched_current(void) {
+    sched_cpu_t *c = this_cpu();
+    return c->current == &c->idle ? 0 : c->current;
+}
+
+void sched_set_address_space(uintptr_t cr3) {
+    sched_cpu_t *c = this_cpu();
+    if (c->current)
+        c->current->cr3 = cr3;
+    vmm_activate(cr3);
+}
+
+uintptr_t sched_address_space(void) {
+    sched_cpu_t *c = this_cpu();
+    return c->current ? c->current->cr3 : 0;
+}
+
+void sched_block(void) {
+    sched_cpu_t *c = this_cpu();
+    if (c->current == &c->idle) {
+        if (active)
+            idle_wait();
+        return;
+    }
+    if (c->current->cancelled)
+        return;
+    c->current->state = SCHED_BLOCKED;
+    schedule();
+}
+
+void sched_wakeup(sched_thread_t *t) {
+    if (!t)
+        return;
+    if (t->state == SCHED_SLEEPING)
+        ktimer_cancel(&t->sleep_timer);
+    else if (t->state != SCHED_BLOCKED)
+        return;
+    ready_push(&cpus[t->cpu], t);
+    kick(&cpus[t->cpu]);
+}
+
+static void waitq_remove(sched_thread_t *t) {
+    sched_thread_t **link = &t->waitq->head;
+    while (*link && *link != t)
+        link = &(*link)->wait_next;
+    if (*link)
+        *link = t->wait_next;
+    t->waitq = 0;
+    t->wait_next = 0;
+}
+
+int sched_wait(sched_waitq_t *q) {
+    sched_cpu_t *c = this_cpu();
+    sched_thread_t *cur = c->current;
+    if (cur == &c->idle) {
+        if (active)
+            idle_wait();
+        return 0;
+    }
+    if (cur->cancelled)
+        return -1;
+    cur->waitq = q;
+    cur->wait_next = q->head;
+    q->head = cur;
+    cur->state = SCHED_BLOCKED;
+    schedule();
+    if (cur->waitq)
+        waitq_remove(cur);
+    return cur->cancelled ? -1 : 0;
+}
+
+void sched_wake_all(sched_waitq_t *q) {
+    sched_thread_t *t = q->head;
+    q->head = 0;
+    while (t) {
+        sched_thread_t *next = t->wait_next;
+        t->waitq = 0;
+        t->wait_next = 0;
+        sched_wakeup(t);
+        t = next;
+    }
+}
+
+int sched_wait_key(sched_waitq_t *q, uintptr_t key, uint64_t timeout_ms) {
+    sched_cpu_t *c = this_cpu();
+    sched_thread_t *cur = c->current;
+    if (cur == &c->idle) {
+        if (active)
+            idle_wait();
+        return -1;
+    }
+    if (cur->cancelled)
+        return -1;
+    /* Appended, so sched_wake_key serves waiters in arrival order. */
+    sched_thread_t **link = &q->head;
+    while (*link)
+        link = &(*link)->wait_next;
+    *link = cur;
+    cur->waitq = q;
+    cur->wait_next = 0;
+    cur->wait_key = key;
+    cur->state = SCHED_BLOCKED;
+    if (timeout_ms) {
+        ktimer_arm(&cur->sleep_timer, clock_ms() + timeout_ms + 1, sleep_expired, cur);
+        if (c != &cpus[0])
+            kick(&cpus[0]);
+    }
+    schedule();
+    ktimer_cancel(&cur->sleep_timer);
+    if (!cur->waitq)
+        return cur->cancelled ? -1 : 0;
+    waitq_remove(cur);
+    return -1;
+}
+
+int sched_wake_key(sched_waitq_t *q, uintptr_t key, int max) {
+    int woken = 0;
+    sched_thread_t **link = &q->head;
+    while (*link && woken < max) {
+        sched_thread_t *t = *link;
+        if (t->wait_key != key) {
+            link = &t->wait_next;
+            continue;
+        }
+        *link = t->wait_next;
+        t->waitq = 0;
+        t->wait_next = 0;
+        sched_wakeup(t);
+        woken++;
+    }
+    return woken;
+}
+
+void sched_yield(void) {
+    sched_cpu_t *c = this_cpu();
+    if (c->current != &c->idle)
+        ready_push(c, c->current);
+    schedule();
+}
+
+/* Sleeps at least 'ms': the extra tick covers the partial current one. */
+void sched_sleep_ms(uint64_t ms) {
+    uint64_t wake = clock_ms() + (ms ? ms : 1) + 1;
+    sched_cpu_t *c = this_cpu();
+    sched_thread_t *cur = c->current;
+    if (cur == &c->idle) {
+        /* A callback-less timer only bounds the BSP's idle one-shot. */
+        ktimer_arm(&cur->sleep_timer, wake, 0, 0);
+        while (active && clock_ms() < wake)
+            idle_halt();
+        ktimer_cancel(&cur->sleep_timer);
+        return;
+    }
+    if (cur->cancelled)
+        return;
+    cur->state = SCHED_SLEEPING;
+    ktimer_arm(&cur->sleep_timer, wake, sleep_expired, cur);
+    /* The BSP may be idling on a later one-shot. */
+    if (c != &cpus[0])
+        kick(&cpus[0]);
+    schedule();
+}
+
+void sched_cancel(sched_thread_t *t) {
+    if (!t || t == sched_current() || t->state == SCHED_UNUSED || t->state == SCHED_DEAD)
+        return;
+    t->cancelled = 1;
+    /* A running or ready thread notices on its own; a waiting one is
+     * woken to unwind.
+     */
+    if (t->state == SCHED_BLOCKED && t->waitq)
+        waitq_remove(t);
+    sched_wakeup(t);
+}
+
+int sched_cancelled(void) {
+    sched_thread_t *t = sched_current();
+    return t && t->cancelled;
+}
+
+void sched_exit(void) {
+    sched_cpu_t *c = this_cpu();
+    if (c->current == &c->idle)
+        panic("sched: idle thread exited");
+    c->current->state = SCHED_DEAD;
+    schedule();
+    panic("sched: dead thread resumed");
+    for (;;) {}
+}
+
+void sched_lock(void) {
+    __asm__ volatile ("cli" ::: "memory");
+    kernel_lock();
+}
+
+void sched_unlock(void) {
+    kernel_unlock();
+    __asm__ volatile ("sti" ::: "memory");
+}
+
+uint64_t sched_ticks(void) {
+    return clock_ns() / (1000000000ull / SCHED_HZ);
+}
+
+uint64_t sched_switches(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < smp_cpu_count(); ++i)
+        total += cpus[i].switches;
+    return total;
+}
+
+uint64_t sched_steals(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < smp_cpu_count(); ++i)
+        total += cpus[i].steals;
+    return total;
+}
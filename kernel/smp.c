@@ -0,0 +1,246 @@
+#include "smp.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "idt.h"
+#include "syscall.h"
+#include "io.h"
+#include "mem.h"
+#include "memutils.h"
+#include "pit.h"
+#include "sched.h"
+#include "vmm.h"
+#include "console.h"
+#include <stddef.h>
+
+#define MSR_GS_BASE 0xC0000101
+#define GDT_TSS_SELECTOR 0x28
+#define CR4_OSXSAVE (1ULL << 18)
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint64_t smp_trampoline_cr3;
+extern uint64_t smp_trampoline_stack;
+extern uint64_t smp_trampoline_entry;
+extern uint64_t smp_trampoline_cpu;
+extern void smp_load_gdt(const void *gdtr);
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static int cpu_count = 1;
+static int gs_ready;
+static acpi_madt_info_t madt;
+static uint64_t bsp_cr4;
+static uint64_t bsp_xcr0;
+static uint8_t trampoline_save[4096];
+
+static volatile int bkl_word;
+static volatile int bkl_owner = -1;
+static int bkl_depth;
+
+/* Mirrors the boot GDT in boot.S, plus this CPU's own TSS descriptor. */
+static void build_gdt(cpu_t *cpu) {
+    uint64_t tss = (uint64_t)(uintptr_t)cpu->tss;
+    cpu->gdt[0] = 0;
+    cpu->gdt[1] = 0x00AF9A000000FFFFULL;
+    cpu->gdt[2] = 0x00AF92000000FFFFULL;
+    cpu->gdt[3] = 0x00AFFA000000FFFFULL;
+    cpu->gdt[4] = 0x00AFF2000000FFFFULL;
+    cpu->gdt[5] = (sizeof(cpu->tss) - 1) | ((tss & 0xFFFFFF) << 16) |
+                  (0x89ULL << 40) | (((tss >> 24) & 0xFF) << 56);
+    cpu->gdt[6] = tss >> 32;
+}
+
+static void build_tss(cpu_t *cpu) {
+    uint64_t rsp0 = (uint64_t)(uintptr_t)(cpu->stack + SMP_AP_STACK_SIZE);
+    uint64_t ist1 = (uint64_t)(uintptr_t)(cpu->df_stack + SMP_DF_STACK_SIZE);
+    uint16_t iomap = sizeof(cpu->tss);
+    memset(cpu->tss, 0, sizeof(cpu->tss));
+    memcpy(cpu->tss + 4, &rsp0, 8);
+    memcpy(cpu->tss + 36, &ist1, 8);
+    memcpy(cpu->tss + 102, &iomap, 2);
+}
+
+static void set_gs(cpu_t *cpu) {
+    cpu->self = cpu;
+    io_wrmsr(MSR_GS_BASE, (uint64_t)(uintptr_t)cpu);
+}
+
+static void lapic_spurious(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+}
+
+int smp_init(void) {
+    cpu_t *bsp = &cpus[0];
+    bsp->index = 0;
+    bsp->online = 1;
+    set_gs(bsp);
+    gs_ready = 1;
+    cpu_count = 1;
+    if (acpi_init() != 0 || acpi_parse_madt(&madt) != 0 || lapic_init(madt.lapic_base) != 0) {
+        madt.cpu_count = 1;
+        return 1;
+    }
+    register_irq_handler(LAPIC_SPURIOUS_VECTOR, lapic_spurious);
+    bsp->apic_id = lapic_id();
+    lapic_timer_calibrate();
+    return (int)madt.cpu_count;
+}
+
+void smp_ap_main(cpu_t *cpu) {
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) gdtr = { sizeof(cpu->gdt) - 1, (uint64_t)(uintptr_t)cpu->gdt };
+    smp_load_gdt(&gdtr);
+    __asm__ volatile ("ltr %w0" : : "r"(GDT_TSS_SELECTOR));
+    set_gs(cpu);
+    idt_load_cpu();
+    syscall_cpu_init();
+    vmm_cpu_init();
+    if (bsp_cr4 & CR4_OSXSAVE) {
+        uint64_t cr4;
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | CR4_OSXSAVE));
+        __asm__ volatile ("xsetbv" : : "a"((uint32_t)bsp_xcr0), "d"((uint32_t)(bsp_xcr0 >> 32)), "c"(0));
+    }
+    lapic_enable();
+    cpu->online = 1;
+    kernel_lock();
+    lapic_timer_start(SCHED_HZ);
+    sched_ap_enter();
+}
+
+static int start_ap(cpu_t *cpu) {
+    cpu->stack = mem_alloc(SMP_AP_STACK_SIZE);
+    cpu->df_stack = mem_alloc(SMP_DF_STACK_SIZE);
+    if (!cpu->stack || !cpu->df_stack) {
+        if (cpu->stack)
+            mem_free(cpu->stack, SMP_AP_STACK_SIZE);
+        if (cpu->df_stack)
+            mem_free(cpu->df_stack, SMP_DF_STACK_SIZE);
+        return -1;
+    }
+    build_tss(cpu);
+    build_gdt(cpu);
+    cpu->online = 0;
+
+    uint8_t *page = (uint8_t *)SMP_TRAMPOLINE_BASE;
+    size_t off = (size_t)((uint8_t *)&smp_trampoline_stack - smp_trampoline_start);
+    uint64_t stack_top = (uint64_t)(uintptr_t)(cpu->stack + SMP_AP_STACK_SIZE);
+    memcpy(page + off, &stack_top, 8);
+    off = (size_t)((uint8_t *)&smp_trampoline_cpu - smp_trampoline_start);
+    uint64_t arg = (uint64_t)(uintptr_t)cpu;
+    memcpy(page + off, &arg, 8);
+
+    lapic_send_init(cpu->apic_id);
+    pit_delay_us(10000);
+    for (int attempt = 0; attempt < 2 && !cpu->online; ++attempt) {
+        lapic_send_sipi(cpu->apic_id, SMP_TRAMPOLINE_BASE >> 12);
+        for (int wait = 0; wait < 1000 && !cpu->online; ++wait)
+            pit_delay_us(attempt ? 100 : 1);
+    }
+    if (!cpu->online) {
+        mem_free(cpu->stack, SMP_AP_STACK_SIZE);
+        mem_free(cpu->df_stack, SMP_DF_STACK_SIZE);
+        cpu->stack = NULL;
+        cpu->df_stack = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int smp_boot_aps(void) {
+    if (madt.cpu_count <= 1 || !lapic_ready())
+        return cpu_count;
+    size_t size = (size_t)(smp_trampoline_end - smp_trampoline_start);
+    if (size > sizeof(trampoline_save))
+        return cpu_count;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(bsp_cr4));
+    if (bsp_cr4 & CR4_OSXSAVE) {
+        uint32_t lo, hi;
+        __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        bsp_xcr0 = ((uint64_t)hi << 32) | lo;
+    }
+
+    uint8_t *page = (uint8_t *)SMP_TRAMPOLINE_BASE;
+    memcpy(trampoline_save, page, size);
+    memcpy(page, smp_trampoline_start, size);
+    uint64_t cr3;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    uint64_t entry = (uint64_t)(uintptr_t)smp_ap_main;
+    memcpy(page + ((uint8_t *)&smp_trampoline_cr3 - smp_trampoline_start), &cr3, 8);
+    memcpy(page + ((uint8_t *)&smp_trampoline_entry - smp_trampoline_start), &entry, 8);
+
+    for (uint32_t i = 0; i < madt.cpu_count && cpu_count < SMP_MAX_CPUS; ++i) {
+        if (madt.apic_ids[i] == cpus[0].apic_id)
+            continue;
+        cpu_t *cpu = &cpus[cpu_count];
+        cpu->index = cpu_count;
+        cpu->apic_id = madt.apic_ids[i];
+        if (start_ap(cpu) == 0)
+            cpu_count++;
+        else
+            console_puts("smp: an application processor did not start\n");
+    }
+    memcpy(page, trampoline_save, size);
+    return cpu_count;
+}
+
+int smp_cpu_count(void) {
+    return cpu_count;
+}
+
+void smp_send_ipi(int index, uint8_t vector) {
+    if (index >= 0 && index < cpu_count && index != smp_cpu_index())
+        lapic_send_ipi(cpus[index].apic_id, vector);
+}
+
+uint32_t smp_cpu_apic_id(int index) {
+    return index >= 0 && index < cpu_count ? cpus[index].apic_id : cpus[0].apic_id;
+}
+
+int smp_cpu_index(void) {
+    int index;
+    if (!gs_ready)
+        return 0;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(index) : "i"(offsetof(cpu_t, index)));
+    return index;
+}
+
+cpu_t *smp_this_cpu(void) {
+    cpu_t *cpu;
+    if (!gs_ready)
+        return &cpus[0];
+    __asm__ volatile ("movq %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+void *smp_current_owner(void) {
+    void *owner;
+    if (!gs_ready)
+        return cpus[0].current_owner;
+    __asm__ volatile ("movq %%gs:%c1, %0" : "=r"(owner) : "i"(offsetof(cpu_t, current_owner)));
+    return owner;
+}
+
+void kernel_lock(void) {
+    int me = smp_cpu_index();
+    if (bkl_owner == me) {
+        bkl_depth++;
+        return;
+    }
+    while (__sync_lock_test_and_set(&bkl_word, 1)) {
+        while (bkl_word)
+            __builtin_ia32_pause();
+    }
+    bkl_owner = me;
+    bkl_depth = 1;
+}
+
+void kernel_unlock(void) {
+    if (bkl_owner != smp_cpu_index() || bkl_depth <= 0)
+        return;
+    if (--bkl_depth == 0) {
+        bkl_owner = -1;
+        __sync_lock_release(&bkl_word);
+    }
+}
@@ -3,6 +3,7 @@
 #include "console.h"
 #include "fs.h"
 #include "mem.h"
+#include "heapprof.h"
 #include "proc.h"
 #include "vfs.h"
 #include "debuglog.h"
@@ -11,257 +12,512 @@
 #include "micropython.h"
 #include "framebuffer.h"
 #include "bootmode.h"
+#include "sched.h"
+#include "clock.h"
+#include "smp.h"
+#include "futex.h"
 #include <stdint.h>
 
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_FMASK 0xC0000084
+#define EFER_SCE 0x1
+#define GDT_KERNEL_CODE 0x08
+/* Clear TF, IF, DF and AC on entry. */
+#define SYSCALL_FMASK 0x40700
+
 extern void *isr_stub_table[];
-extern uint8_t end;
+extern void syscall_entry(void);
 
 static int user_ptr_valid(const void *ptr, size_t len) {
     uintptr_t p = (uintptr_t)ptr;
-    uintptr_t k_end = (uintptr_t)&end;
     uintptr_t e = p + len;
     if (e < p)
         return 0;
-    if (p >= k_end)
-        return 1;
-    proc_info_t info;
-    if (proc_info(proc_current_pid(), &info) != 0)
-        return 0;
-    if (info.stack_pointer >= 4096) {
-        uintptr_t stack_base = info.stack_pointer - 4096;
-        if (p >= stack_base && e <= info.stack_pointer)
-            return 1;
-    }
-    if (info.image_base && p >= info.image_base && e <= info.image_base + info.image_size)
-        return 1;
-    return 0;
+    return proc_current_range_valid(p, e);
 }
 
-static uint64_t syscall_dispatch(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3) {
-    int current_required = !(num == SYS_GETPID || num == SYS_PROC_INFO || num == SYS_PROC_LIST || num == SYS_UPTIME_MS || num == SYS_MEM_INFO || num == SYS_SYNC || num == SYS_FB_INFO || num == SYS_DISPLAY_MODE || num == SYS_FB_CLEAR || num == SYS_FB_DRAW_PIXEL);
-    if (current_required && !proc_current_valid())
-        return (uint64_t)-1;
-    switch (num) {
-    case SYS_WRITE: {
-        if (!user_ptr_valid((const void*)a1, a2)) return (uint64_t)-1;
-        const char *s = (const char*)a1;
-        console_write(s, (size_t)a2);
-        return (uint64_t)a2;
-    }
-    case SYS_WRITE_FD: {
-        int fd = (int)a1;
-        if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
-        const char *s = (const char*)a2;
-        if (fd == 1 || fd == 2) {
-            console_write(s, (size_t)a3);
-            return (uint64_t)a3;
-        }
-        if (fd >= 3)
-            return (uint64_t)proc_write(proc_current_pid(), fd, s, (size_t)a3);
-        return (uint64_t)-1;
+static uint64_t sys_write(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, a2)) return (uint64_t)-1;
+    const char *s = (const char*)a1;
+    console_write(s, (size_t)a2);
+    return (uint64_t)a2;
+}
+
+static uint64_t sys_write_fd(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    int fd = (int)a1;
+    if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
+    const char *s = (const char*)a2;
+    int pid = proc_current_pid();
+    if ((fd == 1 || fd == 2) && !proc_fd_bound(pid, fd)) {
+        console_write(s, (size_t)a3);
+        return (uint64_t)a3;
     }
-    case SYS_READ:
-        if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
-        if ((int)a1 == 0) {
-            char *b = (char*)a2;
-            for (size_t i = 0; i < a3; ++i) b[i] = console_getc();
-            return a3;
+    return (uint64_t)proc_write(pid, fd, s, (size_t)a3);
+}
+
+static uint64_t sys_read(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
+    if ((int)a1 == 0 && !proc_fd_bound(proc_current_pid(), 0)) {
+        char *b = (char*)a2;
+        /* Let other processes run while the keyboard is idle. */
+        for (size_t i = 0; i < a3; ++i) {
+            while (!console_try_getc(&b[i])) {
+                if (sched_cancelled())
+                    return i;
+                sched_sleep_ms(1);
+            }
         }
-        return (uint64_t)proc_read(proc_current_pid(), (int)a1, (void*)a2, (size_t)a3);
-    case SYS_EXIT:
-        proc_exit(proc_current_pid(), (int)a1);
-        return 0;
-    case SYS_MEM_ALLOC:
-        return (uint64_t)(uintptr_t)mem_alloc((size_t)a1);
-    case SYS_MEM_FREE:
-        if (!user_ptr_valid((const void*)a1, a2)) return (uint64_t)-1;
-        mem_free((void*)a1, (size_t)a2);
-        return 0;
-    case SYS_FS_READ:
-        if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
-        return (uint64_t)fs_read((size_t)a1, (void*)a2, (size_t)a3);
-    case SYS_FS_WRITE:
-        if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
-        return (uint64_t)fs_write((size_t)a1, (const void*)a2, (size_t)a3);
-    case SYS_PROC_SPAWN:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)proc_spawn_exec(proc_current_pid(), (const char*)a1);
-
-    case SYS_GETPID:
-        return proc_current_valid() ? (uint64_t)proc_current_pid() : (uint64_t)-1;
-    case SYS_GETPPID: {
-        proc_info_t info;
-        return proc_current_valid() && proc_info(proc_current_pid(), &info) == 0 ? (uint64_t)info.parent_pid : (uint64_t)-1;
-    }
-    case SYS_PROC_INFO:
-        if (!user_ptr_valid((void*)a2, sizeof(proc_info_t))) return (uint64_t)-1;
-        return (uint64_t)proc_info((int)a1, (proc_info_t*)a2);
-    case SYS_PROC_LIST:
-        if (!user_ptr_valid((void*)a1, a2 * sizeof(proc_info_t))) return (uint64_t)-1;
-        return (uint64_t)proc_list((proc_info_t*)a1, (size_t)a2);
-    case SYS_PROC_WAIT:
-        if (a2 && !user_ptr_valid((void*)a2, sizeof(int))) return (uint64_t)-1;
-        return (uint64_t)proc_wait(proc_current_pid(), (int)a1, (int*)a2);
-    case SYS_PROC_KILL:
-        return (uint64_t)proc_kill((int)a1, (int)a2);
-    case SYS_DUP:
-        return (uint64_t)proc_dup(proc_current_pid(), (int)a1);
-    case SYS_DUP2:
-        return (uint64_t)proc_dup2(proc_current_pid(), (int)a1, (int)a2);
-    case SYS_UPTIME_MS:
-        return (uint64_t)(io_rdtsc() / 1000000ULL);
-    case SYS_SLEEP_MS: {
-        uint64_t end = io_rdtsc() + a1 * 1000000ULL;
-        while (io_rdtsc() < end) {}
-        return 0;
-    }
-    case SYS_PIPE:
-        return (uint64_t)-1;
-    case SYS_EXECVE:
-    case SYS_PROC_SPAWN_EX:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)proc_spawn_exec(proc_current_pid(), (const char*)a1);
-    case SYS_DMESG_READ: {
-        if (!user_ptr_valid((void*)a1, a2)) return (uint64_t)-1;
-        size_t len = debuglog_length();
-        if (a3 >= len) return 0;
-        size_t n = len - a3;
-        if (n > a2) n = a2;
-        memcpy((void*)a1, debuglog_buffer() + a3, n);
-        return (uint64_t)n;
+        return a3;
     }
-    case SYS_MEM_INFO:
-        if (!user_ptr_valid((void*)a1, sizeof(mem_info_t))) return (uint64_t)-1;
-        mem_get_info((mem_info_t*)a1);
-        return 0;
-    case SYS_SYNC:
-        debuglog_flush();
-        return 0;
-    case SYS_IOCTL:
-        if (a1 == 1) {
-            console_clear();
-            return 0;
-        }
-        return 0;
-    case SYS_FS_OPEN:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)fs_open((const char*)a1, (int)a2);
-    case SYS_FS_READ_FD:
-        if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
-        return (uint64_t)fs_read_fd((int)a1, (void*)a2, (size_t)a3);
-    case SYS_FS_WRITE_FD:
-        if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
-        return (uint64_t)fs_write_fd((int)a1, (const void*)a2, (size_t)a3);
-    case SYS_FS_LSEEK_FD:
-        return (uint64_t)fs_lseek_fd((int)a1, (long)a2, (int)a3);
-    case SYS_FS_CLOSE:
-        return (uint64_t)fs_close((int)a1);
-    case SYS_FS_FILE_SIZE:
-        return (uint64_t)fs_file_size((int)a1);
-    case SYS_VFS_OPEN:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_open((const char*)a1, (int)a2);
-    case SYS_VFS_READ:
-        if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
-        return (uint64_t)vfs_read((int)a1, (void*)a2, (size_t)a3);
-    case SYS_VFS_WRITE:
-        if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
-        return (uint64_t)vfs_write((int)a1, (const void*)a2, (size_t)a3);
-    case SYS_VFS_LSEEK:
-        return (uint64_t)vfs_lseek((int)a1, (long)a2, (int)a3);
-    case SYS_VFS_CLOSE:
-        return (uint64_t)vfs_close((int)a1);
-    case SYS_VFS_MKDIR:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_mkdir((const char*)a1);
-    case SYS_VFS_UNLINK:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_unlink((const char*)a1);
-    case SYS_VFS_RMDIR:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_rmdir((const char*)a1);
-    case SYS_VFS_ACCESS:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_access((const char*)a1, (int)a2);
-    case SYS_VFS_RENAME:
-        if (!user_ptr_valid((const void*)a1, 1) || !user_ptr_valid((const void*)a2, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_rename((const char*)a1, (const char*)a2);
-    case SYS_VFS_CHDIR:
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        return (uint64_t)vfs_chdir((const char*)a1);
-    case SYS_VFS_GETCWD:
-        if (!user_ptr_valid((void*)a1, a2)) return (uint64_t)-1;
-        return (uint64_t)vfs_getcwd((char*)a1, (size_t)a2);
-    case SYS_VFS_STAT:
-        if (!user_ptr_valid((const void*)a1, 1) || !user_ptr_valid((void*)a2, sizeof(vfs_stat_t))) return (uint64_t)-1;
-        return (uint64_t)vfs_stat((const char*)a1, (vfs_stat_t*)a2);
-    case SYS_VFS_FSTAT:
-        if (!user_ptr_valid((void*)a2, sizeof(vfs_stat_t))) return (uint64_t)-1;
-        return (uint64_t)vfs_fstat((int)a1, (vfs_stat_t*)a2);
-    case SYS_VFS_GETDENTS:
-        if (!user_ptr_valid((void*)a2, a3 * sizeof(vfs_dirent_t))) return (uint64_t)-1;
-        return (uint64_t)vfs_getdents((int)a1, (vfs_dirent_t*)a2, (size_t)a3);
-    case SYS_MOUNT_INFO:
-    case SYS_DISK_LIST:
-    case SYS_DISK_INFO:
-        return 0;
-    case SYS_FB_INFO:
-        if (!user_ptr_valid((void*)a1, sizeof(syscall_fb_info_t))) return (uint64_t)-1;
-        ((syscall_fb_info_t*)a1)->width = framebuffer_width();
-        ((syscall_fb_info_t*)a1)->height = framebuffer_height();
-        ((syscall_fb_info_t*)a1)->pitch = framebuffer_pitch();
-        ((syscall_fb_info_t*)a1)->bpp = framebuffer_bpp();
-        ((syscall_fb_info_t*)a1)->theme = bootmode_theme();
-        ((syscall_fb_info_t*)a1)->logs_visible = bootmode_logs_visible();
-        return 0;
-    case SYS_DISPLAY_MODE:
-        if (a1 == SYS_DISPLAY_ENABLE_LOGS) console_set_logs_visible(1);
-        else if (a1 == SYS_DISPLAY_DISABLE_LOGS) console_set_logs_visible(0);
-        else if (a1 == SYS_DISPLAY_DARK_MODE) { bootmode_set_theme(BOOT_THEME_DARK); console_apply_boot_theme(); console_clear(); }
-        else if (a1 == SYS_DISPLAY_WHITE_MODE) { bootmode_set_theme(BOOT_THEME_WHITE); console_apply_boot_theme(); console_clear(); }
-        else return (uint64_t)-1;
-        return 0;
-    case SYS_FB_CLEAR:
+    return (uint64_t)proc_read(proc_current_pid(), (int)a1, (void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_pipe(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a1, 2 * sizeof(int))) return (uint64_t)-1;
+    return (uint64_t)proc_pipe(proc_current_pid(), (int*)a1);
+}
+
+static uint64_t sys_splice(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)proc_splice(proc_current_pid(), (int)a1, (int)a2, (size_t)a3);
+}
+
+static uint64_t sys_exit(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    proc_exit(proc_current_pid(), (int)a1);
+    return 0;
+}
+
+/* Process heap blocks come from the caller's memory context, so they
+ * pass user_ptr_valid and go away with the process.
+ */
+static uint64_t sys_mem_alloc(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)(uintptr_t)proc_alloc(proc_current_pid(), (size_t)a1);
+}
+
+static uint64_t sys_mem_free(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, a2)) return (uint64_t)-1;
+    return proc_free(proc_current_pid(), (void*)a1) == 0 ? 0 : (uint64_t)-1;
+}
+
+static uint64_t sys_fs_read(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
+    return (uint64_t)fs_read((size_t)a1, (void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_fs_write(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
+    return (uint64_t)fs_write((size_t)a1, (const void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_proc_spawn(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)proc_spawn_exec(proc_current_pid(), (const char*)a1);
+}
+
+static uint64_t sys_getpid(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return proc_current_valid() ? (uint64_t)proc_current_pid() : (uint64_t)-1;
+}
+
+static uint64_t sys_getppid(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    proc_info_t info;
+    return proc_current_valid() && proc_info(proc_current_pid(), &info) == 0 ? (uint64_t)info.parent_pid : (uint64_t)-1;
+}
+
+static uint64_t sys_proc_info(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, sizeof(proc_info_t))) return (uint64_t)-1;
+    return (uint64_t)proc_info((int)a1, (proc_info_t*)a2);
+}
+
+static uint64_t sys_proc_list(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a1, a2 * sizeof(proc_info_t))) return (uint64_t)-1;
+    return (uint64_t)proc_list((proc_info_t*)a1, (size_t)a2);
+}
+
+static uint64_t sys_proc_wait(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (a2 && !user_ptr_valid((void*)a2, sizeof(int))) return (uint64_t)-1;
+    return (uint64_t)proc_wait(proc_current_pid(), (int)a1, (int*)a2);
+}
+
+static uint64_t sys_proc_kill(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)proc_kill((int)a1, (int)a2);
+}
+
+static uint64_t sys_dup(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)proc_dup(proc_current_pid(), (int)a1);
+}
+
+static uint64_t sys_dup2(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)proc_dup2(proc_current_pid(), (int)a1, (int)a2);
+}
+
+static uint64_t sys_uptime_ms(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return clock_ms();
+}
+
+static uint64_t sys_clock_ns(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return clock_ns();
+}
+
+static uint64_t sys_sleep_ms(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    sched_sleep_ms(a1);
+    return 0;
+}
+
+static uint64_t sys_thread_create(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)proc_thread_create(proc_current_pid(), (uintptr_t)a1, (uintptr_t)a2);
+}
+
+static uint64_t sys_thread_exit(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)proc_thread_exit((int)a1);
+}
+
+static uint64_t sys_thread_join(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (a2 && !user_ptr_valid((void*)a2, sizeof(int))) return (uint64_t)-1;
+    return (uint64_t)proc_thread_join(proc_current_pid(), (int)a1, (int*)a2);
+}
+
+static uint64_t sys_futex_wait(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, sizeof(uint32_t))) return (uint64_t)-1;
+    return (uint64_t)futex_wait(proc_current_pid(), (volatile uint32_t*)a1, (uint32_t)a2, a3);
+}
+
+static uint64_t sys_futex_wake(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, sizeof(uint32_t))) return (uint64_t)-1;
+    return (uint64_t)futex_wake(proc_current_pid(), (volatile uint32_t*)a1, (int)a2);
+}
+
+static uint64_t sys_execve(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)proc_spawn_exec(proc_current_pid(), (const char*)a1);
+}
+
+static uint64_t sys_dmesg_read(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a1, a2)) return (uint64_t)-1;
+    size_t len = debuglog_length();
+    if (a3 >= len) return 0;
+    size_t n = len - a3;
+    if (n > a2) n = a2;
+    memcpy((void*)a1, debuglog_buffer() + a3, n);
+    return (uint64_t)n;
+}
+
+static uint64_t sys_mem_info(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    size_t len = a2 ? (size_t)a2 : MEM_INFO_BASIC_SIZE;
+    if (len > sizeof(mem_info_t)) len = sizeof(mem_info_t);
+    if (!user_ptr_valid((void*)a1, len)) return (uint64_t)-1;
+    mem_info_t info;
+    mem_get_info(&info);
+    memcpy((void*)a1, &info, len);
+    return 0;
+}
+
+static uint64_t sys_heap_profile(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (a2 > 0xFFFFu) return (uint64_t)-1;
+    int max = (int)a2;
+    if (max && !user_ptr_valid((void*)a1, (size_t)max * sizeof(heapprof_site_t))) return (uint64_t)-1;
+    if (a3 && !user_ptr_valid((void*)a3, sizeof(heapprof_summary_t))) return (uint64_t)-1;
+    if (a3)
+        heapprof_get_summary((heapprof_summary_t*)a3);
+    return (uint64_t)heapprof_snapshot((heapprof_site_t*)a1, max);
+}
+
+static uint64_t sys_sync(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    debuglog_flush();
+    return 0;
+}
+
+static uint64_t sys_ioctl(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (a1 == 1) {
         console_clear();
         return 0;
-    case SYS_FB_DRAW_PIXEL:
-        return framebuffer_draw_pixel_rgb((uint32_t)a1, (uint32_t)a2, (uint8_t)(a3 >> 16), (uint8_t)(a3 >> 8), (uint8_t)a3) ? 0 : (uint64_t)-1;
-    case SYS_MPY_EXEC_FILE: {
-        if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
-        const char *path = (const char*)a1;
-        vfs_stat_t st;
-        if (vfs_stat(path, &st) != 0 || st.type != VFS_TYPE_FILE || st.size == 0) return (uint64_t)-1;
-        char *buf = (char*)mem_alloc(st.size + 1);
-        if (!buf) return (uint64_t)-1;
-        int fd = vfs_open(path, VFS_O_RDONLY);
-        if (fd < 0) { mem_free(buf, st.size + 1); return (uint64_t)-1; }
-        long got = vfs_read(fd, buf, st.size);
-        vfs_close(fd);
-        if (got != (long)st.size) { mem_free(buf, st.size + 1); return (uint64_t)-1; }
-        buf[st.size] = 0;
-        mp_runtime_exec(buf, st.size, path);
-        mem_free(buf, st.size + 1);
-        return 0;
     }
-    case SYS_REBOOT:
-    case SYS_POWEROFF:
-        return 0;
-    default:
+    return 0;
+}
+
+static uint64_t sys_fs_open(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)fs_open((const char*)a1, (int)a2);
+}
+
+static uint64_t sys_fs_read_fd(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
+    return (uint64_t)fs_read_fd((int)a1, (void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_fs_write_fd(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
+    return (uint64_t)fs_write_fd((int)a1, (const void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_fs_lseek_fd(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)fs_lseek_fd((int)a1, (long)a2, (int)a3);
+}
+
+static uint64_t sys_fs_close(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)fs_close((int)a1);
+}
+
+static uint64_t sys_fs_file_size(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)fs_file_size((int)a1);
+}
+
+static uint64_t sys_vfs_open(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_open((const char*)a1, (int)a2);
+}
+
+static uint64_t sys_vfs_read(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, a3)) return (uint64_t)-1;
+    return (uint64_t)vfs_read((int)a1, (void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_vfs_write(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a2, a3)) return (uint64_t)-1;
+    return (uint64_t)vfs_write((int)a1, (const void*)a2, (size_t)a3);
+}
+
+static uint64_t sys_vfs_lseek(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)vfs_lseek((int)a1, (long)a2, (int)a3);
+}
+
+static uint64_t sys_vfs_close(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)vfs_close((int)a1);
+}
+
+static uint64_t sys_vfs_mkdir(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_mkdir((const char*)a1);
+}
+
+static uint64_t sys_vfs_unlink(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_unlink((const char*)a1);
+}
+
+static uint64_t sys_vfs_rmdir(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_rmdir((const char*)a1);
+}
+
+static uint64_t sys_vfs_access(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_access((const char*)a1, (int)a2);
+}
+
+static uint64_t sys_vfs_rename(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1) || !user_ptr_valid((const void*)a2, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_rename((const char*)a1, (const char*)a2);
+}
+
+static uint64_t sys_vfs_chdir(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    return (uint64_t)vfs_chdir((const char*)a1);
+}
+
+static uint64_t sys_vfs_getcwd(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a1, a2)) return (uint64_t)-1;
+    return (uint64_t)vfs_getcwd((char*)a1, (size_t)a2);
+}
+
+static uint64_t sys_vfs_stat(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1) || !user_ptr_valid((void*)a2, sizeof(vfs_stat_t))) return (uint64_t)-1;
+    return (uint64_t)vfs_stat((const char*)a1, (vfs_stat_t*)a2);
+}
+
+static uint64_t sys_vfs_fstat(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, sizeof(vfs_stat_t))) return (uint64_t)-1;
+    return (uint64_t)vfs_fstat((int)a1, (vfs_stat_t*)a2);
+}
+
+static uint64_t sys_vfs_getdents(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a2, a3 * sizeof(vfs_dirent_t))) return (uint64_t)-1;
+    return (uint64_t)vfs_getdents((int)a1, (vfs_dirent_t*)a2, (size_t)a3);
+}
+
+static uint64_t sys_storage_info(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return 0;
+}
+
+static uint64_t sys_fb_info(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((void*)a1, sizeof(syscall_fb_info_t))) return (uint64_t)-1;
+    ((syscall_fb_info_t*)a1)->width = framebuffer_width();
+    ((syscall_fb_info_t*)a1)->height = framebuffer_height();
+    ((syscall_fb_info_t*)a1)->pitch = framebuffer_pitch();
+    ((syscall_fb_info_t*)a1)->bpp = framebuffer_bpp();
+    ((syscall_fb_info_t*)a1)->theme = bootmode_theme();
+    ((syscall_fb_info_t*)a1)->logs_visible = bootmode_logs_visible();
+    return 0;
+}
+
+static uint64_t sys_display_mode(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (a1 == SYS_DISPLAY_ENABLE_LOGS) console_set_logs_visible(1);
+    else if (a1 == SYS_DISPLAY_DISABLE_LOGS) console_set_logs_visible(0);
+    else if (a1 == SYS_DISPLAY_DARK_MODE) { bootmode_set_theme(BOOT_THEME_DARK); console_apply_boot_theme(); console_clear(); }
+    else if (a1 == SYS_DISPLAY_WHITE_MODE) { bootmode_set_theme(BOOT_THEME_WHITE); console_apply_boot_theme(); console_clear(); }
+    else return (uint64_t)-1;
+    return 0;
+}
+
+static uint64_t sys_fb_clear(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    console_clear();
+    return 0;
+}
+
+static uint64_t sys_fb_draw_pixel(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return framebuffer_draw_pixel_rgb((uint32_t)a1, (uint32_t)a2, (uint8_t)(a3 >> 16), (uint8_t)(a3 >> 8), (uint8_t)a3) ? 0 : (uint64_t)-1;
+}
+
+static uint64_t sys_mpy_exec_file(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (!user_ptr_valid((const void*)a1, 1)) return (uint64_t)-1;
+    const char *path = (const char*)a1;
+    vfs_stat_t st;
+    if (vfs_stat(path, &st) != 0 || st.type != VFS_TYPE_FILE || st.size == 0) return (uint64_t)-1;
+    char *buf = (char*)mem_alloc(st.size + 1);
+    if (!buf) return (uint64_t)-1;
+    int fd = vfs_open(path, VFS_O_RDONLY);
+    if (fd < 0) { mem_free(buf, st.size + 1); return (uint64_t)-1; }
+    long got = vfs_read(fd, buf, st.size);
+    vfs_close(fd);
+    if (got != (long)st.size) { mem_free(buf, st.size + 1); return (uint64_t)-1; }
+    buf[st.size] = 0;
+    mp_runtime_exec(buf, st.size, path);
+    mem_free(buf, st.size + 1);
+    return 0;
+}
+
+static uint64_t sys_reboot(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return 0;
+}
+typedef uint64_t (*syscall_fn_t)(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
+
+/* Callable without a current process (boot context, diagnostics). */
+#define SYSCALL_ANY_CONTEXT 0x1u
+
+typedef struct {
+    syscall_fn_t fn;
+    uint32_t flags;
+} syscall_entry_t;
+
+/* Indexed by syscall number; holes are unimplemented and return -1. */
+static const syscall_entry_t syscall_table[] = {
+    [SYS_WRITE] = { sys_write, 0 },
+    [SYS_WRITE_FD] = { sys_write_fd, 0 },
+    [SYS_READ] = { sys_read, 0 },
+    [SYS_EXIT] = { sys_exit, 0 },
+    [SYS_MEM_ALLOC] = { sys_mem_alloc, 0 },
+    [SYS_MEM_FREE] = { sys_mem_free, 0 },
+    [SYS_FS_READ] = { sys_fs_read, 0 },
+    [SYS_FS_WRITE] = { sys_fs_write, 0 },
+    [SYS_PROC_SPAWN] = { sys_proc_spawn, 0 },
+    [SYS_GETPID] = { sys_getpid, SYSCALL_ANY_CONTEXT },
+    [SYS_GETPPID] = { sys_getppid, 0 },
+    [SYS_PROC_INFO] = { sys_proc_info, SYSCALL_ANY_CONTEXT },
+    [SYS_PROC_LIST] = { sys_proc_list, SYSCALL_ANY_CONTEXT },
+    [SYS_PROC_WAIT] = { sys_proc_wait, 0 },
+    [SYS_PROC_KILL] = { sys_proc_kill, 0 },
+    [SYS_DUP] = { sys_dup, 0 },
+    [SYS_DUP2] = { sys_dup2, 0 },
+    [SYS_UPTIME_MS] = { sys_uptime_ms, SYSCALL_ANY_CONTEXT },
+    [SYS_CLOCK_NS] = { sys_clock_ns, SYSCALL_ANY_CONTEXT },
+    [SYS_SLEEP_MS] = { sys_sleep_ms, 0 },
+    [SYS_THREAD_CREATE] = { sys_thread_create, 0 },
+    [SYS_THREAD_EXIT] = { sys_thread_exit, 0 },
+    [SYS_THREAD_JOIN] = { sys_thread_join, 0 },
+    [SYS_FUTEX_WAIT] = { sys_futex_wait, 0 },
+    [SYS_FUTEX_WAKE] = { sys_futex_wake, 0 },
+    [SYS_PIPE] = { sys_pipe, 0 },
+    [SYS_SPLICE] = { sys_splice, 0 },
+    [SYS_EXECVE] = { sys_execve, 0 },
+    [SYS_PROC_SPAWN_EX] = { sys_execve, 0 },
+    [SYS_DMESG_READ] = { sys_dmesg_read, 0 },
+    [SYS_MEM_INFO] = { sys_mem_info, SYSCALL_ANY_CONTEXT },
+    [SYS_HEAP_PROFILE] = { sys_heap_profile, SYSCALL_ANY_CONTEXT },
+    [SYS_SYNC] = { sys_sync, SYSCALL_ANY_CONTEXT },
+    [SYS_IOCTL] = { sys_ioctl, 0 },
+    [SYS_FS_OPEN] = { sys_fs_open, 0 },
+    [SYS_FS_READ_FD] = { sys_fs_read_fd, 0 },
+    [SYS_FS_WRITE_FD] = { sys_fs_write_fd, 0 },
+    [SYS_FS_LSEEK_FD] = { sys_fs_lseek_fd, 0 },
+    [SYS_FS_CLOSE] = { sys_fs_close, 0 },
+    [SYS_FS_FILE_SIZE] = { sys_fs_file_size, 0 },
+    [SYS_VFS_OPEN] = { sys_vfs_open, 0 },
+    [SYS_VFS_READ] = { sys_vfs_read, 0 },
+    [SYS_VFS_WRITE] = { sys_vfs_write, 0 },
+    [SYS_VFS_LSEEK] = { sys_vfs_lseek, 0 },
+    [SYS_VFS_CLOSE] = { sys_vfs_close, 0 },
+    [SYS_VFS_MKDIR] = { sys_vfs_mkdir, 0 },
+    [SYS_VFS_UNLINK] = { sys_vfs_unlink, 0 },
+    [SYS_VFS_RMDIR] = { sys_vfs_rmdir, 0 },
+    [SYS_VFS_ACCESS] = { sys_vfs_access, 0 },
+    [SYS_VFS_RENAME] = { sys_vfs_rename, 0 },
+    [SYS_VFS_CHDIR] = { sys_vfs_chdir, 0 },
+    [SYS_VFS_GETCWD] = { sys_vfs_getcwd, 0 },
+    [SYS_VFS_STAT] = { sys_vfs_stat, 0 },
+    [SYS_VFS_FSTAT] = { sys_vfs_fstat, 0 },
+    [SYS_VFS_GETDENTS] = { sys_vfs_getdents, 0 },
+    [SYS_MOUNT_INFO] = { sys_storage_info, 0 },
+    [SYS_DISK_LIST] = { sys_storage_info, 0 },
+    [SYS_DISK_INFO] = { sys_storage_info, 0 },
+    [SYS_FB_INFO] = { sys_fb_info, SYSCALL_ANY_CONTEXT },
+    [SYS_DISPLAY_MODE] = { sys_display_mode, SYSCALL_ANY_CONTEXT },
+    [SYS_FB_CLEAR] = { sys_fb_clear, SYSCALL_ANY_CONTEXT },
+    [SYS_FB_DRAW_PIXEL] = { sys_fb_draw_pixel, SYSCALL_ANY_CONTEXT },
+    [SYS_MPY_EXEC_FILE] = { sys_mpy_exec_file, 0 },
+    [SYS_REBOOT] = { sys_reboot, 0 },
+    [SYS_POWEROFF] = { sys_reboot, 0 },
+};
+
+#define SYSCALL_COUNT (sizeof(syscall_table) / sizeof(syscall_table[0]))
+
+static uint64_t syscall_dispatch(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    if (num >= SYSCALL_COUNT || !syscall_table[num].fn)
         return (uint64_t)-1;
-    }
+    const syscall_entry_t *e = &syscall_table[num];
+    if (!(e->flags & SYSCALL_ANY_CONTEXT) && !proc_current_valid())
+        return (uint64_t)-1;
+    return e->fn(a1, a2, a3, a4, a5, a6);
 }
 
+/* int 0x80 compatibility path: same registers as SYSCALL, so binaries
+ * built for the three-argument ABI keep working unchanged.
+ */
 static void syscall_irq_handler(uint32_t num, uint32_t err, uint64_t rsp) {
     (void)num; (void)err;
     uint64_t *regs = (uint64_t*)rsp;
-    uint64_t sysno = regs[0];
-    uint64_t a1 = regs[6];
-    uint64_t a2 = regs[5];
-    uint64_t a3 = regs[3];
-    regs[0] = syscall_dispatch(sysno, a1, a2, a3);
+    if (sched_cancelled())
+        sched_exit();
+    regs[0] = syscall_dispatch(regs[0], regs[6], regs[5], regs[3], regs[9], regs[7], regs[8]);
+    if (sched_cancelled())
+        sched_exit();
+}
+
+/* Called from syscall_entry with interrupts masked. frame: rax rdi rsi rdx
+ * r10 r8 r9; the result goes back into frame[0].
+ */
+void syscall_fast_entry(uint64_t *frame) {
+    kernel_lock();
+    if (sched_cancelled())
+        sched_exit();
+    frame[0] = syscall_dispatch(frame[0], frame[1], frame[2], frame[3], frame[4], frame[5], frame[6]);
+    /* Killed while inside: the call has unwound, so nothing is left in
+     * flight on this thread's stack.
+     */
+    if (sched_cancelled())
+        sched_exit();
+    kernel_unlock();
+}
+
+void syscall_cpu_init(void) {
+    io_wrmsr(MSR_EFER, io_rdmsr(MSR_EFER) | EFER_SCE);
+    io_wrmsr(MSR_STAR, (uint64_t)GDT_KERNEL_CODE << 32);
+    io_wrmsr(MSR_LSTAR, (uint64_t)(uintptr_t)syscall_entry);
+    io_wrmsr(MSR_FMASK, SYSCALL_FMASK);
 }
 
 void syscall_init(void) {
     idt_set_user_gate(0x80, isr_stub_table[0x80]);
     register_irq_handler(0x80, syscall_irq_handler);
+    syscall_cpu_init();
 }
@@ -1,12 +1,17 @@
 #include "vfs.h"
 #include "mem.h"
 #include "memutils.h"
+#include "kmem.h"
+#include "zram.h"
+#include "sched.h"
+#include "pmm.h"
 
-#define VFS_MAX_NODES 64
-#define VFS_MAX_OPEN 32
+/* Closed files at least this large may be compressed into zram. */
+#define VFS_PACK_MIN 4096
+/* File buffers this large come whole from the page allocator. */
+#define VFS_PAGE 4096
 
 typedef struct {
-    int used;
     uint32_t inode;
     uint32_t type;
     int parent;
@@ -14,21 +19,104 @@ typedef struct {
     unsigned char *data;
     size_t size;
     size_t capacity;
+    int paged;              /* 'data' is pmm pages rather than heap */
+    struct vfs_map *map;    /* callers using 'data' in place */
+    uint32_t opens;
+    /* Bumped on every content change; stands in for an mtime. */
+    uint32_t version;
+    zram_obj_t *packed;
+    /* Pipes: 'data' is a ring of VFS_PIPE_BUF bytes, 'size' of them
+     * buffered from 'head'.
+     */
+    size_t head;
+    uint32_t readers;
+    uint32_t writers;
+    sched_waitq_t readq;
+    sched_waitq_t writeq;
 } vfs_node_t;
 
 typedef struct {
-    int used;
     int node;
     size_t offset;
     int flags;
+    uint32_t refs;
 } vfs_open_t;
 
-static vfs_node_t nodes[VFS_MAX_NODES];
-static vfs_open_t open_files[VFS_MAX_OPEN];
+/* A pinned file buffer. Writes after vfs_map move the file to a fresh
+ * buffer, leaving this one unchanged until the last vfs_unmap.
+ */
+struct vfs_map {
+    unsigned char *data;
+    size_t capacity;
+    int paged;
+    vfs_node_t *node;       /* NULL once the file has moved on */
+    uint32_t refs;
+};
+
+/* Node numbers and fds index these tables; the objects come from slabs. */
+static kmem_cache_t *node_cache;
+static kmem_cache_t *open_cache;
+static kmem_table_t nodes;
+static kmem_table_t open_files;
 static uint32_t next_inode = 1;
 static int cwd_node = 0;
 static int ready = 0;
 
+static vfs_node_t *node_at(int idx) {
+    return kmem_table_get(&nodes, idx);
+}
+
+static vfs_open_t *file_at(int fd) {
+    return kmem_table_get(&open_files, fd);
+}
+
+/* Page-aligned buffers let executables on the ramdisk be mapped in place
+ * (see vfs_map).
+ */
+static unsigned char *data_alloc(size_t cap, int *paged) {
+    *paged = 0;
+    if (cap >= VFS_PAGE && pmm_ready()) {
+        int order = pmm_order_for(cap);
+        unsigned char *pages = order >= 0 ? pmm_alloc_pages((unsigned)order) : 0;
+        if (pages) {
+            *paged = 1;
+            return pages;
+        }
+    }
+    return mem_alloc(cap);
+}
+
+static void data_free(unsigned char *data, size_t cap, int paged) {
+    if (!data)
+        return;
+    if (paged)
+        pmm_free_pages(data, (unsigned)pmm_order_for(cap));
+    else
+        mem_free(data, cap);
+}
+
+/* Hand the current buffer to its mappings and leave 'node' without one. */
+static void node_unmap(vfs_node_t *node) {
+    if (!node->map)
+        return;
+    node->map->node = 0;
+    node->map = 0;
+    node->data = 0;
+    node->capacity = 0;
+    node->paged = 0;
+}
+
+static void release_node(int idx) {
+    vfs_node_t *node = node_at(idx);
+    if (!node)
+        return;
+    node_unmap(node);
+    data_free(node->data, node->capacity, node->paged);
+    zram_drop(node->packed);
+    kmem_table_remove(&nodes, idx);
+    kmem_cache_free(node_cache, node);
+}
+
 static size_t copy_name(char *dst, const char *src, size_t len) {
     size_t n = 0;
     while (n < len && n < VFS_MAX_NAME && src[n]) {
@@ -47,25 +135,27 @@ static int name_eq(const char *name, const char *seg, size_t len) {
 }
 
 static int alloc_node(uint32_t type, int parent, const char *name, size_t len) {
-    for (int i = 0; i < VFS_MAX_NODES; ++i) {
-        if (!nodes[i].used) {
-            memset(&nodes[i], 0, sizeof(nodes[i]));
-            nodes[i].used = 1;
-            nodes[i].inode = next_inode++;
-            nodes[i].type = type;
-            nodes[i].parent = parent;
-            copy_name(nodes[i].name, name, len);
-            return i;
-        }
-    }
-    return -1;
+    vfs_node_t *node = kmem_cache_alloc(node_cache);
+    if (!node)
+        return -1;
+    memset(node, 0, sizeof(*node));
+    node->inode = next_inode++;
+    node->type = type;
+    node->parent = parent;
+    copy_name(node->name, name, len);
+    int idx = kmem_table_insert(&nodes, node);
+    if (idx < 0)
+        kmem_cache_free(node_cache, node);
+    return idx;
 }
 
 static int find_child(int parent, const char *seg, size_t len) {
-    if (parent < 0 || parent >= VFS_MAX_NODES || !nodes[parent].used || nodes[parent].type != VFS_TYPE_DIR)
+    vfs_node_t *dir = node_at(parent);
+    if (!dir || dir->type != VFS_TYPE_DIR)
         return -1;
-    for (int i = 0; i < VFS_MAX_NODES; ++i) {
-        if (nodes[i].used && nodes[i].parent == parent && name_eq(nodes[i].name, seg, len))
+    for (int i = 0; i < nodes.count; ++i) {
+        vfs_node_t *node = node_at(i);
+        if (node && node->parent == parent && name_eq(node->name, seg, len))
             return i;
     }
     return -1;
@@ -73,8 +163,9 @@ static int find_child(int parent, const char *seg, size_t len) {
 
 static int child_count(int parent) {
     int count = 0;
-    for (int i = 0; i < VFS_MAX_NODES; ++i) {
-        if (i != parent && nodes[i].used && nodes[i].parent == parent)
+    for (int i = 0; i < nodes.count; ++i) {
+        vfs_node_t *node = node_at(i);
+        if (i != parent && node && node->parent == parent)
             ++count;
     }
     return count;
@@ -105,7 +196,7 @@ static int resolve_path(const char *path) {
             continue;
         if (len == 2 && seg[0] == '.' && seg[1] == '.') {
             if (node != 0)
-                node = nodes[node].parent;
+                node = node_at(node)->parent;
             continue;
         }
         node = find_child(node, seg, len);
@@ -116,7 +207,7 @@ static int resolve_path(const char *path) {
         if (len == 1 && seg[0] == '.')
             return node;
         if (len == 2 && seg[0] == '.' && seg[1] == '.')
-            return node == 0 ? 0 : nodes[node].parent;
+            return node == 0 ? 0 : node_at(node)->parent;
         node = find_child(node, seg, len);
     }
     return node;
@@ -138,10 +229,10 @@ static int resolve_parent(const char *path, int *parent, const char **leaf, size
         if (last) {
             if (last_len == 2 && last[0] == '.' && last[1] == '.') {
                 if (node != 0)
-                    node = nodes[node].parent;
+                    node = node_at(node)->parent;
             } else {
                 node = find_child(node, last, last_len);
-                if (node < 0 || nodes[node].type != VFS_TYPE_DIR)
+                if (node < 0 || node_at(node)->type != VFS_TYPE_DIR)
                     return -1;
             }
         }
@@ -152,10 +243,10 @@ static int resolve_parent(const char *path, int *parent, const char **leaf, size
         if (last) {
             if (last_len == 2 && last[0] == '.' && last[1] == '.') {
                 if (node != 0)
-                    node = nodes[node].parent;
+                    node = node_at(node)->parent;
             } else {
                 node = find_child(node, last, last_len);
-                if (node < 0 || nodes[node].type != VFS_TYPE_DIR)
+                if (node < 0 || node_at(node)->type != VFS_TYPE_DIR)
                     return -1;
             }
         }
@@ -171,36 +262,111 @@ static int resolve_parent(const char *path, int *parent, const char **leaf, size
 }
 
 static int ensure_capacity(vfs_node_t *node, size_t need) {
-    if (need <= node->capacity)
+    if (need <= node->capacity && !node->map)
         return 0;
     size_t cap = node->capacity ? node->capacity : 64;
     while (cap < need)
         cap *= 2;
-    unsigned char *new_data = mem_alloc(cap);
+    if (cap < VFS_PAGE && !node->paged && !node->map) {
+        unsigned char *grown = mem_realloc(node->data, node->capacity, cap);
+        if (!grown)
+            return -1;
+        node->data = grown;
+        node->capacity = cap;
+        return 0;
+    }
+    /* Growing into pages, or leaving a mapped buffer: copy. */
+    int paged;
+    unsigned char *new_data = data_alloc(cap, &paged);
     if (!new_data)
         return -1;
-    if (node->data && node->size)
+    if (node->size)
         memcpy(new_data, node->data, node->size);
-    if (node->data)
-        mem_free(node->data, node->capacity);
+    if (node->map)
+        node_unmap(node);
+    else
+        data_free(node->data, node->capacity, node->paged);
     node->data = new_data;
     node->capacity = cap;
+    node->paged = paged;
     return 0;
 }
 
+/* A packed file keeps its size but its bytes live only in zram until the
+ * next open brings them back.
+ */
+static int node_unpack(vfs_node_t *node) {
+    if (!node->packed)
+        return 0;
+    size_t size = zram_size(node->packed);
+    int paged;
+    unsigned char *data = data_alloc(size, &paged);
+    if (!data)
+        return -1;
+    if (zram_load(node->packed, data, size) != 0) {
+        data_free(data, size, paged);
+        return -1;
+    }
+    zram_drop(node->packed);
+    node->packed = 0;
+    node->data = data;
+    node->capacity = size;
+    node->paged = paged;
+    return 0;
+}
+
+static size_t node_pack(vfs_node_t *node) {
+    if (node->packed || node->opens || node->map || node->type != VFS_TYPE_FILE || node->size < VFS_PACK_MIN)
+        return 0;
+    zram_obj_t *obj = zram_store(node->data, node->size);
+    if (!obj)
+        return 0;
+    size_t freed = node->capacity;
+    data_free(node->data, node->capacity, node->paged);
+    node->data = 0;
+    node->capacity = 0;
+    node->paged = 0;
+    node->packed = obj;
+    return freed;
+}
+
+size_t vfs_pack_cold(size_t goal) {
+    size_t freed = 0;
+    for (int i = 0; i < nodes.count && freed < goal; ++i) {
+        vfs_node_t *node = node_at(i);
+        if (node)
+            freed += node_pack(node);
+    }
+    return freed;
+}
+
 static int fill_stat(int node, vfs_stat_t *st) {
-    if (node < 0 || node >= VFS_MAX_NODES || !nodes[node].used || !st)
+    if (!node_at(node) || !st)
         return -1;
-    st->type = nodes[node].type;
-    st->size = nodes[node].size;
-    st->inode = nodes[node].inode;
-    st->children = (nodes[node].type == VFS_TYPE_DIR) ? (uint32_t)child_count(node) : 0;
+    st->type = node_at(node)->type;
+    st->size = node_at(node)->size;
+    st->inode = node_at(node)->inode;
+    st->version = node_at(node)->version;
+    st->children = (node_at(node)->type == VFS_TYPE_DIR) ? (uint32_t)child_count(node) : 0;
     return 0;
 }
 
 int vfs_init(void) {
-    memset(nodes, 0, sizeof(nodes));
-    memset(open_files, 0, sizeof(open_files));
+    if (!node_cache)
+        node_cache = kmem_cache_create("vfs_node", sizeof(vfs_node_t), KMEM_CACHE_ALIGN_LINE, NULL);
+    if (!open_cache)
+        open_cache = kmem_cache_create("vfs_open", sizeof(vfs_open_t), 0, NULL);
+    if (!node_cache || !open_cache)
+        return -1;
+    mem_register_shrinker("vfs", MEM_SHRINK_PRIO_COMPRESS, vfs_pack_cold);
+    for (int i = 0; i < nodes.count; ++i)
+        release_node(i);
+    for (int fd = 0; fd < open_files.count; ++fd) {
+        if (file_at(fd))
+            kmem_cache_free(open_cache, file_at(fd));
+    }
+    kmem_table_reset(&nodes);
+    kmem_table_reset(&open_files);
     next_inode = 1;
     cwd_node = 0;
     ready = 1;
@@ -225,11 +391,9 @@ int vfs_mkdir(const char *path) {
 
 int vfs_unlink(const char *path) {
     int node = resolve_path(path);
-    if (node <= 0 || nodes[node].type == VFS_TYPE_DIR || child_count(node) != 0)
+    if (node <= 0 || node_at(node)->type == VFS_TYPE_DIR || child_count(node) != 0)
         return -1;
-    if (nodes[node].data)
-        mem_free(nodes[node].data, nodes[node].capacity);
-    memset(&nodes[node], 0, sizeof(nodes[node]));
+    release_node(node);
     return 0;
 }
 
@@ -242,14 +406,14 @@ int vfs_rename(const char *old_path, const char *new_path) {
         return -1;
     if (find_child(parent, leaf, len) >= 0)
         return -1;
-    nodes[node].parent = parent;
-    copy_name(nodes[node].name, leaf, len);
+    node_at(node)->parent = parent;
+    copy_name(node_at(node)->name, leaf, len);
     return 0;
 }
 
 int vfs_chdir(const char *path) {
     int node = resolve_path(path);
-    if (node < 0 || nodes[node].type != VFS_TYPE_DIR)
+    if (node < 0 || node_at(node)->type != VFS_TYPE_DIR)
         return -1;
     cwd_node = node;
     return 0;
@@ -270,15 +434,15 @@ static int build_path(int node, char *buf, size_t len) {
     int cur = node;
     while (cur != 0) {
         char next[VFS_MAX_PATH];
-        size_t name_len = strlen(nodes[cur].name);
+        size_t name_len = strlen(node_at(cur)->name);
         size_t tmp_len = strlen(tmp);
         if (name_len + tmp_len + 2 >= sizeof(next))
             return -1;
         next[0] = '/';
-        memcpy(next + 1, nodes[cur].name, name_len);
+        memcpy(next + 1, node_at(cur)->name, name_len);
         memcpy(next + 1 + name_len, tmp, tmp_len + 1);
         memcpy(tmp, next, strlen(next) + 1);
-        cur = nodes[cur].parent;
+        cur = node_at(cur)->parent;
     }
     if (strlen(tmp) + 1 > len)
         return -1;
@@ -290,6 +454,23 @@ int vfs_getcwd(char *buf, size_t len) {
     return build_path(cwd_node, buf, len);
 }
 
+static int open_node(int node, int flags) {
+    vfs_open_t *file = kmem_cache_alloc(open_cache);
+    if (!file)
+        return -1;
+    file->node = node;
+    file->flags = flags;
+    file->offset = (flags & VFS_O_APPEND) ? node_at(node)->size : 0;
+    file->refs = 1;
+    int fd = kmem_table_insert(&open_files, file);
+    if (fd < 0) {
+        kmem_cache_free(open_cache, file);
+        return -1;
+    }
+    node_at(node)->opens++;
+    return fd;
+}
+
 int vfs_open(const char *path, int flags) {
     int node = resolve_path(path);
     if (node < 0 && (flags & VFS_O_CREAT)) {
@@ -302,64 +483,138 @@ int vfs_open(const char *path, int flags) {
     }
     if (node < 0)
         return -1;
-    if (nodes[node].type == VFS_TYPE_DIR && (flags & (VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC | VFS_O_APPEND)))
-        return -1;
-    if ((flags & VFS_O_TRUNC) && nodes[node].type == VFS_TYPE_FILE && ensure_capacity(&nodes[node], 0) == 0)
-        nodes[node].size = 0;
-    for (int fd = 0; fd < VFS_MAX_OPEN; ++fd) {
-        if (!open_files[fd].used) {
-            open_files[fd].used = 1;
-            open_files[fd].node = node;
-            open_files[fd].flags = flags;
-            open_files[fd].offset = (flags & VFS_O_APPEND) ? nodes[node].size : 0;
-            return fd;
-        }
+    if (node_at(node)->type == VFS_TYPE_DIR && (flags & (VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC | VFS_O_APPEND)))
+        return -1;
+    if (node_unpack(node_at(node)) != 0)
+        return -1;
+    if ((flags & VFS_O_TRUNC) && node_at(node)->type == VFS_TYPE_FILE && ensure_capacity(node_at(node), 0) == 0) {
+        node_at(node)->size = 0;
+        node_at(node)->version++;
     }
-    return -1;
+    return open_node(node, flags);
+}
+
+/* Copy out of / into a pipe ring; the caller has checked there is data or
+ * room. Returns the bytes moved.
+ */
+static size_t pipe_pull(vfs_node_t *pipe, unsigned char *dst, size_t len) {
+    if (len > pipe->size)
+        len = pipe->size;
+    size_t first = VFS_PIPE_BUF - pipe->head;
+    if (first > len)
+        first = len;
+    memcpy(dst, pipe->data + pipe->head, first);
+    memcpy(dst + first, pipe->data, len - first);
+    pipe->head = (pipe->head + len) % VFS_PIPE_BUF;
+    pipe->size -= len;
+    sched_wake_all(&pipe->writeq);
+    return len;
+}
+
+static size_t pipe_push(vfs_node_t *pipe, const unsigned char *src, size_t len) {
+    if (len > VFS_PIPE_BUF - pipe->size)
+        len = VFS_PIPE_BUF - pipe->size;
+    size_t tail = (pipe->head + pipe->size) % VFS_PIPE_BUF;
+    size_t first = VFS_PIPE_BUF - tail;
+    if (first > len)
+        first = len;
+    memcpy(pipe->data + tail, src, first);
+    memcpy(pipe->data, src + first, len - first);
+    pipe->size += len;
+    sched_wake_all(&pipe->readq);
+    return len;
+}
+
+/* 1 once data is buffered, 0 at end of stream. */
+static int pipe_wait_readable(vfs_node_t *pipe) {
+    while (pipe->size == 0) {
+        if (pipe->writers == 0 || sched_wait(&pipe->readq) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* 1 once there is room, 0 when nobody will ever read it. */
+static int pipe_wait_writable(vfs_node_t *pipe) {
+    while (pipe->readers && pipe->size == VFS_PIPE_BUF) {
+        if (sched_wait(&pipe->writeq) != 0)
+            return 0;
+    }
+    return pipe->readers != 0;
+}
+
+static long pipe_read(vfs_open_t *file, vfs_node_t *pipe, void *buf, size_t len) {
+    if (!(file->flags & VFS_O_RDONLY))
+        return -1;
+    if (len == 0 || !pipe_wait_readable(pipe))
+        return 0;
+    return (long)pipe_pull(pipe, buf, len);
+}
+
+static long pipe_write(vfs_open_t *file, vfs_node_t *pipe, const void *buf, size_t len) {
+    if (!(file->flags & VFS_O_WRONLY))
+        return -1;
+    size_t done = 0;
+    while (done < len) {
+        if (!pipe_wait_writable(pipe))
+            return done ? (long)done : -1;
+        done += pipe_push(pipe, (const unsigned char *)buf + done, len - done);
+    }
+    return (long)done;
 }
 
 long vfs_read(int fd, void *buf, size_t len) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !open_files[fd].used || !buf)
+    vfs_open_t *file = file_at(fd);
+    if (!file || !buf)
         return -1;
-    vfs_node_t *node = &nodes[open_files[fd].node];
-    if (node->type != VFS_TYPE_FILE)
+    vfs_node_t *node = node_at(file->node);
+    if (node && node->type == VFS_TYPE_PIPE)
+        return pipe_read(file, node, buf, len);
+    if (!node || node->type != VFS_TYPE_FILE)
         return -1;
-    if (open_files[fd].offset >= node->size)
+    if (file->offset >= node->size)
         return 0;
-    if (open_files[fd].offset + len > node->size)
-        len = node->size - open_files[fd].offset;
-    memcpy(buf, node->data + open_files[fd].offset, len);
-    open_files[fd].offset += len;
+    if (file->offset + len > node->size)
+        len = node->size - file->offset;
+    memcpy(buf, node->data + file->offset, len);
+    file->offset += len;
     return (long)len;
 }
 
 long vfs_write(int fd, const void *buf, size_t len) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !open_files[fd].used || !buf)
+    vfs_open_t *file = file_at(fd);
+    if (!file || !buf)
         return -1;
-    vfs_node_t *node = &nodes[open_files[fd].node];
-    if (node->type != VFS_TYPE_FILE)
+    vfs_node_t *node = node_at(file->node);
+    if (node && node->type == VFS_TYPE_PIPE)
+        return pipe_write(file, node, buf, len);
+    if (!node || node->type != VFS_TYPE_FILE)
         return -1;
-    if ((open_files[fd].flags & VFS_O_APPEND))
-        open_files[fd].offset = node->size;
-    size_t end = open_files[fd].offset + len;
+    if ((file->flags & VFS_O_APPEND))
+        file->offset = node->size;
+    size_t end = file->offset + len;
     if (ensure_capacity(node, end) != 0)
         return -1;
-    memcpy(node->data + open_files[fd].offset, buf, len);
-    open_files[fd].offset = end;
+    memcpy(node->data + file->offset, buf, len);
+    file->offset = end;
     if (end > node->size)
         node->size = end;
+    node->version++;
     return (long)len;
 }
 
 long vfs_lseek(int fd, long offset, int whence) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !open_files[fd].used)
+    vfs_open_t *file = file_at(fd);
+    if (!file)
+        return -1;
+    vfs_node_t *node = node_at(file->node);
+    if (!node || node->type == VFS_TYPE_PIPE)
         return -1;
-    vfs_node_t *node = &nodes[open_files[fd].node];
     long base;
     if (whence == VFS_SEEK_SET)
         base = 0;
     else if (whence == VFS_SEEK_CUR)
-        base = (long)open_files[fd].offset;
+        base = (long)file->offset;
     else if (whence == VFS_SEEK_END)
         base = (long)node->size;
     else
@@ -367,59 +622,208 @@ long vfs_lseek(int fd, long offset, int whence) {
     long next = base + offset;
     if (next < 0)
         return -1;
-    open_files[fd].offset = (size_t)next;
+    file->offset = (size_t)next;
     return next;
 }
 
 int vfs_close(int fd) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !open_files[fd].used)
+    vfs_open_t *file = file_at(fd);
+    if (!file)
         return -1;
-    memset(&open_files[fd], 0, sizeof(open_files[fd]));
+    if (--file->refs)
+        return 0;
+    int idx = file->node;
+    vfs_node_t *node = node_at(idx);
+    int flags = file->flags;
+    kmem_table_remove(&open_files, fd);
+    kmem_cache_free(open_cache, file);
+    if (node && node->type == VFS_TYPE_PIPE) {
+        if (flags & VFS_O_RDONLY)
+            node->readers--;
+        if (flags & VFS_O_WRONLY)
+            node->writers--;
+        sched_wake_all(&node->readq);
+        sched_wake_all(&node->writeq);
+        if (!node->readers && !node->writers)
+            release_node(idx);
+        return 0;
+    }
+    if (node && node->opens && --node->opens == 0 && zram_under_pressure())
+        node_pack(node);
     return 0;
 }
 
+int vfs_dup(int fd) {
+    vfs_open_t *file = file_at(fd);
+    if (!file)
+        return -1;
+    file->refs++;
+    return fd;
+}
+
+int vfs_pipe(int fds[2]) {
+    if (!fds)
+        return -1;
+    /* Parent -1 keeps the node out of every directory listing. */
+    int idx = alloc_node(VFS_TYPE_PIPE, -1, "", 0);
+    if (idx < 0)
+        return -1;
+    vfs_node_t *pipe = node_at(idx);
+    pipe->data = mem_alloc(VFS_PIPE_BUF);
+    if (!pipe->data) {
+        release_node(idx);
+        return -1;
+    }
+    pipe->capacity = VFS_PIPE_BUF;
+    fds[0] = open_node(idx, VFS_O_RDONLY);
+    fds[1] = fds[0] >= 0 ? open_node(idx, VFS_O_WRONLY) : -1;
+    if (fds[1] < 0) {
+        if (fds[0] >= 0) {
+            vfs_open_t *file = file_at(fds[0]);
+            kmem_table_remove(&open_files, fds[0]);
+            kmem_cache_free(open_cache, file);
+        }
+        release_node(idx);
+        return -1;
+    }
+    pipe->readers = 1;
+    pipe->writers = 1;
+    return 0;
+}
+
+long vfs_splice(int fd_in, int fd_out, size_t len) {
+    vfs_open_t *in = file_at(fd_in);
+    vfs_open_t *out = file_at(fd_out);
+    if (!in || !out)
+        return -1;
+    vfs_node_t *src = node_at(in->node);
+    vfs_node_t *dst = node_at(out->node);
+    if (!src || !dst)
+        return -1;
+    if (src->type == VFS_TYPE_PIPE && dst->type == VFS_TYPE_FILE) {
+        if (!(in->flags & VFS_O_RDONLY))
+            return -1;
+        int dst_idx = out->node;
+        if (len == 0 || !pipe_wait_readable(src))
+            return 0;
+        /* Look both ends up again after blocking; either fd may have been
+         * closed, or reused for another file, while we slept.
+         */
+        in = file_at(fd_in);
+        out = file_at(fd_out);
+        if (!in || !out || out->node != dst_idx || node_at(in->node) != src)
+            return -1;
+        dst = node_at(dst_idx);
+        if (!dst || dst->type != VFS_TYPE_FILE)
+            return -1;
+        if (len > src->size)
+            len = src->size;
+        if (out->flags & VFS_O_APPEND)
+            out->offset = dst->size;
+        if (ensure_capacity(dst, out->offset + len) != 0)
+            return -1;
+        len = pipe_pull(src, dst->data + out->offset, len);
+        out->offset += len;
+        if (out->offset > dst->size)
+            dst->size = out->offset;
+        dst->version++;
+        return (long)len;
+    }
+    if (src->type == VFS_TYPE_FILE && dst->type == VFS_TYPE_PIPE) {
+        if (!(out->flags & VFS_O_WRONLY))
+            return -1;
+        if (in->offset >= src->size || len == 0)
+            return 0;
+        if (!pipe_wait_writable(dst))
+            return -1;
+        /* Re-read the file after blocking; a writer may have moved it. */
+        if (in->offset >= src->size)
+            return 0;
+        if (len > src->size - in->offset)
+            len = src->size - in->offset;
+        len = pipe_push(dst, src->data + in->offset, len);
+        in->offset += len;
+        return (long)len;
+    }
+    return -1;
+}
+
 int vfs_stat(const char *path, vfs_stat_t *st) {
     return fill_stat(resolve_path(path), st);
 }
 
 int vfs_fstat(int fd, vfs_stat_t *st) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !open_files[fd].used)
+    vfs_open_t *file = file_at(fd);
+    if (!file)
         return -1;
-    return fill_stat(open_files[fd].node, st);
+    return fill_stat(file->node, st);
+}
+
+const void *vfs_map(const char *path, size_t *size, vfs_map_t **map) {
+    int idx = resolve_path(path);
+    vfs_node_t *node = node_at(idx);
+    if (!node || !map || node->type != VFS_TYPE_FILE || node->size == 0 || node_unpack(node) != 0)
+        return 0;
+    if (!node->map) {
+        vfs_map_t *m = mem_alloc(sizeof(*m));
+        if (!m)
+            return 0;
+        m->data = node->data;
+        m->capacity = node->capacity;
+        m->paged = node->paged;
+        m->node = node;
+        m->refs = 0;
+        node->map = m;
+    }
+    node->map->refs++;
+    *map = node->map;
+    if (size)
+        *size = node->size;
+    return node->data;
+}
+
+void vfs_unmap(vfs_map_t *map) {
+    if (!map || --map->refs)
+        return;
+    if (map->node)
+        map->node->map = 0;
+    else
+        data_free(map->data, map->capacity, map->paged);
+    mem_free(map, sizeof(*map));
 }
 
 long vfs_getdents(int fd, vfs_dirent_t *ents, size_t max_ents) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN || !open_files[fd].used || !ents)
+    vfs_open_t *file = file_at(fd);
+    if (!file || !ents)
         return -1;
-    int dir = open_files[fd].node;
-    if (nodes[dir].type != VFS_TYPE_DIR)
+    int dir = file->node;
+    if (!node_at(dir) || node_at(dir)->type != VFS_TYPE_DIR)
         return -1;
     size_t emitted = 0;
     size_t index = 0;
-    for (int i = 0; i < VFS_MAX_NODES && emitted < max_ents; ++i) {
-        if (i == dir || !nodes[i].used || nodes[i].parent != dir)
+    for (int i = 0; i < nodes.count && emitted < max_ents; ++i) {
+        vfs_node_t *node = node_at(i);
+        if (i == dir || !node || node->parent != dir)
             continue;
-        if (index++ < open_files[fd].offset)
+        if (index++ < file->offset)
             continue;
-        ents[emitted].type = nodes[i].type;
-        ents[emitted].inode = nodes[i].inode;
-        ents[emitted].size = nodes[i].size;
-        copy_name(ents[emitted].name, nodes[i].name, strlen(nodes[i].name));
+        ents[emitted].type = node->type;
+        ents[emitted].inode = node->inode;
+        ents[emitted].size = node->size;
+        copy_name(ents[emitted].name, node->name, strlen(node->name));
         ++emitted;
     }
-    open_files[fd].offset += emitted;
+    file->offset += emitted;
     return (long)emitted;
 }
 
 int vfs_rmdir(const char *path) {
     int node = resolve_path(path);
-    if (node <= 0 || nodes[node].type != VFS_TYPE_DIR || child_count(node) != 0)
+    if (node <= 0 || node_at(node)->type != VFS_TYPE_DIR || child_count(node) != 0)
         return -1;
     if (cwd_node == node)
         cwd_node = 0;
-    if (nodes[node].data)
-        mem_free(nodes[node].data, nodes[node].capacity);
-    memset(&nodes[node], 0, sizeof(nodes[node]));
+    release_node(node);
     return 0;
 }
 
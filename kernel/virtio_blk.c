@@ -0,0 +1,386 @@
+#include "virtio_blk.h"
+#include "blkdev.h"
+#include "pci.h"
+#include "lapic.h"
+#include "idt.h"
+#include "sched.h"
+#include "clock.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "console.h"
+
+extern void boot_map_identity_span(uint64_t base, uint64_t size);
+
+#define VIRTIO_VENDOR            0x1AF4
+#define VIRTIO_DEVICE_BLK        0x1042
+#define VIRTIO_DEVICE_BLK_LEGACY 0x1001
+
+/* cfg_type of the vendor capabilities that locate each register block. */
+#define VIRTIO_CAP_COMMON 1
+#define VIRTIO_CAP_NOTIFY 2
+#define VIRTIO_CAP_DEVICE 4
+
+#define STATUS_ACKNOWLEDGE 0x01
+#define STATUS_DRIVER      0x02
+#define STATUS_DRIVER_OK   0x04
+#define STATUS_FEATURES_OK 0x08
+#define STATUS_FAILED      0x80
+
+#define F_BLK_RO        5
+#define F_INDIRECT_DESC 28
+#define F_VERSION_1     32
+
+#define DESC_F_NEXT     1
+#define DESC_F_WRITE    2
+#define DESC_F_INDIRECT 4
+#define USED_F_NO_NOTIFY 1
+#define MSIX_NO_VECTOR  0xFFFF
+
+#define BLK_T_IN  0
+#define BLK_T_OUT 1
+#define BLK_S_OK  0
+
+/* Split ring inside one page: descriptors, then the driver (avail) ring,
+ * then the device (used) ring at its own offset.
+ */
+#define RING_AVAIL_OFF 2048
+#define RING_USED_OFF  2560
+#define BOUNCE_BYTES (VIRTIO_BLK_CHUNK * BLKDEV_SECTOR_SIZE)
+
+typedef struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_lo;
+    uint32_t queue_desc_hi;
+    uint32_t queue_driver_lo;
+    uint32_t queue_driver_hi;
+    uint32_t queue_device_lo;
+    uint32_t queue_device_hi;
+} __attribute__((packed)) virtio_common_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_hdr_t;
+
+/* Everything a request needs besides its data buffer. */
+typedef struct {
+    virtq_desc_t table[3];      /* the indirect table, when negotiated */
+    virtio_blk_hdr_t hdr;
+    volatile uint8_t status;
+} __attribute__((aligned(16))) vblk_slot_t;
+
+static int present;
+static int broken;
+static virtio_blk_info_t disk;
+static volatile virtio_common_t *common;
+static volatile uint16_t *notify;
+static uint16_t qsize;
+static uint16_t avail_idx;
+static uint16_t last_used;
+static uint8_t ring[PMM_PAGE_SIZE] __attribute__((aligned(PMM_PAGE_SIZE)));
+static vblk_slot_t slots[VIRTIO_BLK_QUEUE_MAX];
+static blkdev_queue_t queue;
+static uint8_t bounce[BOUNCE_BYTES] __attribute__((aligned(PMM_PAGE_SIZE)));
+
+#define DESC  ((volatile virtq_desc_t *)ring)
+#define AVAIL ((volatile virtq_avail_t *)(ring + RING_AVAIL_OFF))
+#define USED  ((volatile virtq_used_t *)(ring + RING_USED_OFF))
+
+/* Map the window a capability describes; 0 if the BAR is not memory. */
+static volatile uint8_t *cap_window(const pci_device_t *d, uint8_t cap) {
+    uint8_t bar = pci_read8(d, cap + 4);
+    uint32_t off = pci_read32(d, cap + 8);
+    uint32_t len = pci_read32(d, cap + 12);
+    if (bar > 5 || (pci_read32(d, (uint8_t)(0x10 + bar * 4)) & 1))
+        return 0;
+    uint64_t base = pci_bar(d, bar) + off;
+    boot_map_identity_span(base, len);
+    return (volatile uint8_t *)(uintptr_t)base;
+}
+
+static int find_device(pci_device_t *d) {
+    if (pci_find_device(VIRTIO_VENDOR, VIRTIO_DEVICE_BLK, 0, d) == 0)
+        return 0;
+    return pci_find_device(VIRTIO_VENDOR, VIRTIO_DEVICE_BLK_LEGACY, 0, d);
+}
+
+/* Completed requests are marked in their slots; their owners free them. */
+static void reap(void *ctx) {
+    (void)ctx;
+    int any = 0;
+    __sync_synchronize();
+    while (last_used != USED->idx) {
+        uint32_t id = USED->ring[last_used % qsize].id;
+        uint32_t s = disk.indirect ? id : id / 3;
+        if (s < VIRTIO_BLK_QUEUE_MAX)
+            queue.done[s] = 1;
+        last_used++;
+        any = 1;
+    }
+    if (any)
+        sched_wake_all(&queue.done_waiters);
+}
+
+static void vblk_irq(uint32_t num, uint32_t err, uint64_t rsp) {
+    (void)num; (void)err; (void)rsp;
+    lapic_eoi();
+    reap(0);
+}
+
+static void desc_set(volatile virtq_desc_t *d, uint64_t addr, uint32_t len, uint16_t flags, uint16_t next) {
+    d->addr = addr;
+    d->len = len;
+    d->flags = flags;
+    d->next = next;
+}
+
+/* Fill slot 's' and publish it; the device is notified per batch. */
+static void submit(int s, uint64_t lba, uintptr_t addr, uint32_t n, int write) {
+    vblk_slot_t *slot = &slots[s];
+    uint16_t data_flags = write ? 0 : DESC_F_WRITE;
+    slot->hdr.type = write ? BLK_T_OUT : BLK_T_IN;
+    slot->hdr.reserved = 0;
+    slot->hdr.sector = lba;
+    slot->status = 0xFF;
+    queue.done[s] = 0;
+    uint16_t head;
+    if (disk.indirect) {
+        desc_set(&slot->table[0], (uintptr_t)&slot->hdr, sizeof(slot->hdr), DESC_F_NEXT, 1);
+        desc_set(&slot->table[1], addr, n * BLKDEV_SECTOR_SIZE, data_flags | DESC_F_NEXT, 2);
+        desc_set(&slot->table[2], (uintptr_t)&slot->status, 1, DESC_F_WRITE, 0);
+        head = (uint16_t)s;
+        desc_set(&DESC[head], (uintptr_t)slot->table, sizeof(slot->table), DESC_F_INDIRECT, 0);
+    } else {
+        head = (uint16_t)(s * 3);
+        desc_set(&DESC[head], (uintptr_t)&slot->hdr, sizeof(slot->hdr), DESC_F_NEXT, head + 1);
+        desc_set(&DESC[head + 1], addr, n * BLKDEV_SECTOR_SIZE, data_flags | DESC_F_NEXT, head + 2);
+        desc_set(&DESC[head + 2], (uintptr_t)&slot->status, 1, DESC_F_WRITE, 0);
+    }
+    AVAIL->ring[avail_idx % qsize] = head;
+    avail_idx++;
+}
+
+static void kick(void) {
+    __sync_synchronize();
+    AVAIL->idx = avail_idx;
+    __sync_synchronize();
+    if (!(USED->flags & USED_F_NO_NOTIFY))
+        *notify = 0;
+}
+
+/* 'addr' is identity mapped. Chunks go out in batches; each batch is
+ * published with one notification and waited for as a whole.
+ */
+static int transfer(void *ctx, uint64_t lba, uintptr_t addr, size_t count, int write) {
+    (void)ctx;
+    int ids[VIRTIO_BLK_BATCH];
+    while (count) {
+        int n = 0;
+        while (count && n < VIRTIO_BLK_BATCH) {
+            int s = blkdev_slot_alloc(&queue, n == 0);
+            if (s < 0)
+                break;
+            uint32_t chunk = count > VIRTIO_BLK_CHUNK ? VIRTIO_BLK_CHUNK : (uint32_t)count;
+            submit(s, lba, addr, chunk, write);
+            ids[n++] = s;
+            lba += chunk;
+            addr += (uintptr_t)chunk * BLKDEV_SECTOR_SIZE;
+            count -= chunk;
+        }
+        if (n == 0)
+            return -1;
+        kick();
+        if (blkdev_batch_wait(&queue, ids, n) != 0) {
+            /* The device may still own the slots; never reuse them. */
+            broken = 1;
+            console_puts("virtio-blk: request timed out\n");
+            return -1;
+        }
+        int rc = 0;
+        for (int i = 0; i < n; ++i) {
+            if (slots[ids[i]].status != BLK_S_OK)
+                rc = -1;
+            blkdev_slot_free(&queue, ids[i]);
+        }
+        if (rc != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int request(uint64_t lba, void *buf, size_t count, int write) {
+    if (!present || broken || (write && disk.readonly))
+        return -1;
+    if (count == 0)
+        return 0;
+    /* Process windows are not identity mapped. */
+    if ((uintptr_t)buf >= VMM_USER_BASE)
+        return blkdev_bounce(&queue, transfer, lba, buf, count, write);
+    return transfer(0, lba, (uintptr_t)buf, count, write);
+}
+
+int virtio_blk_read(uint64_t lba, void *buf, size_t count) {
+    return request(lba, buf, count, 0);
+}
+
+int virtio_blk_write(uint64_t lba, const void *buf, size_t count) {
+    return request(lba, (void *)buf, count, 1);
+}
+
+static int blk_read(void *ctx, uint64_t lba, void *buf, size_t count) {
+    (void)ctx;
+    return virtio_blk_read(lba, buf, count);
+}
+
+static int blk_write(void *ctx, uint64_t lba, const void *buf, size_t count) {
+    (void)ctx;
+    return virtio_blk_write(lba, buf, count);
+}
+
+static const blkdev_ops_t virtio_blk_ops = { blk_read, blk_write };
+
+static uint64_t device_features(void) {
+    common->device_feature_select = 0;
+    uint64_t f = common->device_feature;
+    common->device_feature_select = 1;
+    return f | ((uint64_t)common->device_feature << 32);
+}
+
+static void driver_features(uint64_t f) {
+    common->driver_feature_select = 0;
+    common->driver_feature = (uint32_t)f;
+    common->driver_feature_select = 1;
+    common->driver_feature = (uint32_t)(f >> 32);
+}
+
+/* Queue 0 with its vector routed, if MSI-X can be had. */
+static int setup_queue(const pci_device_t *d) {
+    common->queue_select = 0;
+    uint16_t size = common->queue_size;
+    if (size == 0)
+        return -1;
+    qsize = size < VIRTIO_BLK_QUEUE_MAX ? size : VIRTIO_BLK_QUEUE_MAX;
+    common->queue_size = qsize;
+    uintptr_t base = (uintptr_t)ring;
+    common->queue_desc_lo = (uint32_t)base;
+    common->queue_desc_hi = (uint32_t)((uint64_t)base >> 32);
+    common->queue_driver_lo = (uint32_t)(base + RING_AVAIL_OFF);
+    common->queue_driver_hi = (uint32_t)((uint64_t)(base + RING_AVAIL_OFF) >> 32);
+    common->queue_device_lo = (uint32_t)(base + RING_USED_OFF);
+    common->queue_device_hi = (uint32_t)((uint64_t)(base + RING_USED_OFF) >> 32);
+    common->msix_config = MSIX_NO_VECTOR;
+    if (sched_active() && pci_msix_route(d, 0, VIRTIO_BLK_VECTOR, lapic_id()) == 0) {
+        common->queue_msix_vector = 0;
+        disk.msix = common->queue_msix_vector == 0;
+        if (disk.msix)
+            register_irq_handler(VIRTIO_BLK_VECTOR, vblk_irq);
+    }
+    common->queue_enable = 1;
+    return 0;
+}
+
+int virtio_blk_init(void) {
+    pci_device_t d;
+    volatile uint8_t *device = 0;
+    volatile uint8_t *notify_base = 0;
+    uint32_t notify_mult = 0;
+    if (present || find_device(&d) != 0)
+        return present ? 0 : -1;
+    pci_enable(&d, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    common = 0;
+    for (uint8_t cap = pci_next_cap(&d, 0, PCI_CAP_VENDOR); cap; cap = pci_next_cap(&d, cap, PCI_CAP_VENDOR)) {
+        uint8_t type = pci_read8(&d, cap + 3);
+        if (type == VIRTIO_CAP_COMMON && !common)
+            common = (volatile virtio_common_t *)cap_window(&d, cap);
+        else if (type == VIRTIO_CAP_NOTIFY && !notify_base) {
+            notify_base = cap_window(&d, cap);
+            notify_mult = pci_read32(&d, cap + 16);
+        } else if (type == VIRTIO_CAP_DEVICE && !device)
+            device = cap_window(&d, cap);
+    }
+    if (!common || !notify_base || !device)
+        return -1;  /* legacy-only device */
+
+    common->device_status = 0;
+    uint64_t deadline = clock_ms() + VIRTIO_BLK_TIMEOUT_MS;
+    while (common->device_status != 0) {
+        if (clock_ms() >= deadline) {
+            console_puts("virtio-blk: device reset timed out\n");
+            return -1;
+        }
+        __asm__ volatile ("pause");
+    }
+    common->device_status = STATUS_ACKNOWLEDGE | STATUS_DRIVER;
+    uint64_t offered = device_features();
+    if (!(offered & (1ull << F_VERSION_1)))
+        goto fail;
+    uint64_t wanted = (1ull << F_VERSION_1) | (offered & (1ull << F_INDIRECT_DESC)) | (offered & (1ull << F_BLK_RO));
+    driver_features(wanted);
+    common->device_status = STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK;
+    if (!(common->device_status & STATUS_FEATURES_OK))
+        goto fail;
+    disk.indirect = (wanted & (1ull << F_INDIRECT_DESC)) != 0;
+    disk.readonly = (wanted & (1ull << F_BLK_RO)) != 0;
+    if (setup_queue(&d) != 0)
+        goto fail;
+    notify = (volatile uint16_t *)(notify_base + (uint32_t)common->queue_notify_off * notify_mult);
+    disk.queue_size = qsize;
+    blkdev_queue_init(&queue, disk.indirect ? qsize : qsize / 3, reap, 0);
+    queue.irq = disk.msix;
+    queue.poll_ms = VIRTIO_BLK_POLL_MS;
+    queue.timeout_ms = VIRTIO_BLK_TIMEOUT_MS;
+    queue.bounce = bounce;
+    queue.bounce_sectors = VIRTIO_BLK_CHUNK;
+    common->device_status = STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK | STATUS_DRIVER_OK;
+    disk.sectors = *(volatile uint32_t *)device | ((uint64_t)*(volatile uint32_t *)(device + 4) << 32);
+    present = 1;
+    blkdev_register("virtio0", disk.sectors, BLKDEV_RANK_VIRTIO, &virtio_blk_ops, 0);
+    return 0;
+fail:
+    common->device_status = STATUS_FAILED;
+    return -1;
+}
+
+int virtio_blk_info(virtio_blk_info_t *info) {
+    if (!present || !info)
+        return -1;
+    *info = disk;
+    return 0;
+}
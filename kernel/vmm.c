@@ -0,0 +1,228 @@
+#include "vmm.h"
+#include "pmm.h"
+#include "mem.h"
+#include "memutils.h"
+
+#define VMM_PAGE 4096u
+#define PTE_PRESENT 0x001ULL
+#define PTE_WRITE   0x002ULL
+#define PTE_PRIVATE 0x200ULL    /* available bit: frame belongs to the space */
+#define PTE_ADDR    0x000FFFFFFFFFF000ULL
+#define USER_SLOT ((unsigned)(VMM_USER_BASE >> 39) & 511u)
+#define CR0_WP (1ULL << 16)
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    const unsigned char *src;
+    size_t src_len;
+    int writable;
+} vmm_area_t;
+
+struct vmm_space {
+    uint64_t *pml4;
+    int nareas;
+    vmm_area_t areas[VMM_MAX_AREAS];
+    size_t private_pages;
+    struct vmm_space *next;
+};
+
+static uint64_t *kernel_pml4;
+static vmm_space_t *spaces;
+
+static uint64_t read_cr3(void) {
+    uint64_t cr3;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+static uint64_t *alloc_table(void) {
+    uint64_t *table = pmm_alloc_pages(0);
+    if (table)
+        memset(table, 0, VMM_PAGE);
+    return table;
+}
+
+static uint64_t *next_level(uint64_t *table, unsigned index, int create) {
+    if (!(table[index] & PTE_PRESENT)) {
+        uint64_t *next = create ? alloc_table() : 0;
+        if (!next)
+            return 0;
+        table[index] = (uintptr_t)next | PTE_PRESENT | PTE_WRITE;
+    }
+    return (uint64_t *)(uintptr_t)(table[index] & PTE_ADDR);
+}
+
+static uint64_t *pte_for(uint64_t *pml4, uintptr_t addr, int create) {
+    uint64_t *pdpt = next_level(pml4, (addr >> 39) & 511, create);
+    uint64_t *pd = pdpt ? next_level(pdpt, (addr >> 30) & 511, create) : 0;
+    uint64_t *pt = pd ? next_level(pd, (addr >> 21) & 511, create) : 0;
+    return pt ? &pt[(addr >> 12) & 511] : 0;
+}
+
+static int in_window(uintptr_t addr) {
+    return addr >= VMM_USER_BASE && addr - VMM_USER_BASE < VMM_USER_SIZE;
+}
+
+void vmm_cpu_init(void) {
+    /* Read-only pages must hold against the ring-0 code processes run as. */
+    uint64_t cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0 | CR0_WP) : "memory");
+}
+
+void vmm_init(void) {
+    kernel_pml4 = (uint64_t *)(uintptr_t)(read_cr3() & PTE_ADDR);
+    vmm_cpu_init();
+}
+
+vmm_space_t *vmm_space_create(void) {
+    if (!kernel_pml4 || !pmm_ready())
+        return 0;
+    vmm_space_t *space = mem_alloc(sizeof(*space));
+    if (!space)
+        return 0;
+    memset(space, 0, sizeof(*space));
+    space->pml4 = alloc_table();
+    if (!space->pml4) {
+        mem_free(space, sizeof(*space));
+        return 0;
+    }
+    /* The kernel's slots point at the same tables, so identity spans
+     * mapped later show up in every space.
+     */
+    for (unsigned i = 0; i < 512; ++i) {
+        if (i != USER_SLOT)
+            space->pml4[i] = kernel_pml4[i];
+    }
+    space->next = spaces;
+    spaces = space;
+    return space;
+}
+
+static void free_tree(uint64_t *table, int level) {
+    for (unsigned i = 0; i < 512; ++i) {
+        if (!(table[i] & PTE_PRESENT))
+            continue;
+        void *next = (void *)(uintptr_t)(table[i] & PTE_ADDR);
+        if (level > 1)
+            free_tree(next, level - 1);
+        else if (table[i] & PTE_PRIVATE)
+            pmm_free_pages(next, 0);
+    }
+    pmm_free_pages(table, 0);
+}
+
+void vmm_space_destroy(vmm_space_t *space) {
+    if (!space)
+        return;
+    for (vmm_space_t **link = &spaces; *link; link = &(*link)->next) {
+        if (*link == space) {
+            *link = space->next;
+            break;
+        }
+    }
+    if (space->pml4[USER_SLOT] & PTE_PRESENT)
+        free_tree((uint64_t *)(uintptr_t)(space->pml4[USER_SLOT] & PTE_ADDR), 3);
+    pmm_free_pages(space->pml4, 0);
+    mem_free(space, sizeof(*space));
+}
+
+uintptr_t vmm_space_root(const vmm_space_t *space) {
+    return space ? (uintptr_t)space->pml4 : 0;
+}
+
+void vmm_activate(uintptr_t root) {
+    if (!kernel_pml4)
+        return;
+    if (!root)
+        root = (uintptr_t)kernel_pml4;
+    if ((read_cr3() & PTE_ADDR) != root)
+        __asm__ volatile ("mov %0, %%cr3" : : "r"((uint64_t)root) : "memory");
+}
+
+int vmm_map_lazy(vmm_space_t *space, uintptr_t start, size_t len,
+                 const void *src, size_t src_len, int writable) {
+    if (!space || len == 0 || (start & (VMM_PAGE - 1)) || space->nareas >= VMM_MAX_AREAS)
+        return -1;
+    uintptr_t end = start + ((len + VMM_PAGE - 1) & ~(size_t)(VMM_PAGE - 1));
+    if (!in_window(start) || end < start || !in_window(end - 1))
+        return -1;
+    vmm_area_t *area = &space->areas[space->nareas++];
+    area->start = start;
+    area->end = end;
+    area->src = src;
+    area->src_len = src ? src_len : 0;
+    area->writable = writable;
+    return 0;
+}
+
+int vmm_fault_in(vmm_space_t *space, uintptr_t addr, int write) {
+    if (!space || !in_window(addr))
+        return -1;
+    uintptr_t page = addr & ~(uintptr_t)(VMM_PAGE - 1);
+    /* Segments may share a page; it is writable if any of them is. */
+    const vmm_area_t *area = 0;
+    int writable = 0;
+    for (int i = 0; i < space->nareas; ++i) {
+        const vmm_area_t *a = &space->areas[i];
+        if (page < a->start || page >= a->end)
+            continue;
+        if (!area)
+            area = a;
+        writable |= a->writable;
+    }
+    if (!area || (write && !writable))
+        return -1;
+    uint64_t *pte = pte_for(space->pml4, page, 1);
+    if (!pte)
+        return -1;
+    if (*pte & PTE_PRESENT)
+        return 0;
+
+    size_t off = page - area->start;
+    const unsigned char *src = area->src ? area->src + off : 0;
+    if (!writable && src && off + VMM_PAGE <= area->src_len && ((uintptr_t)src & (VMM_PAGE - 1)) == 0) {
+        *pte = (uintptr_t)src | PTE_PRESENT;
+        return 0;
+    }
+    unsigned char *frame = pmm_alloc_pages(0);
+    if (!frame)
+        return -1;
+    size_t n = 0;
+    if (src && off < area->src_len) {
+        n = area->src_len - off;
+        if (n > VMM_PAGE)
+            n = VMM_PAGE;
+        memcpy(frame, src, n);
+    }
+    memset(frame + n, 0, VMM_PAGE - n);
+    *pte = (uintptr_t)frame | PTE_PRESENT | PTE_PRIVATE | (writable ? PTE_WRITE : 0);
+    space->private_pages++;
+    return 0;
+}
+
+int vmm_handle_fault(uintptr_t addr, uint32_t err) {
+    /* Bit 0: the page was present, so this is a protection violation. */
+    if ((err & 1) || !in_window(addr))
+        return -1;
+    uintptr_t root = (uintptr_t)(read_cr3() & PTE_ADDR);
+    for (vmm_space_t *space = spaces; space; space = space->next) {
+        if ((uintptr_t)space->pml4 == root)
+            return vmm_fault_in(space, addr, (err & 2) != 0);
+    }
+    return -1;
+}
+
+uintptr_t vmm_translate(const vmm_space_t *space, uintptr_t addr) {
+    if (!space || !in_window(addr))
+        return 0;
+    uint64_t *pte = pte_for(space->pml4, addr, 0);
+    if (!pte || !(*pte & PTE_PRESENT))
+        return 0;
+    return (uintptr_t)(*pte & PTE_ADDR) | (addr & (VMM_PAGE - 1));
+}
+
+size_t vmm_private_pages(const vmm_space_t *space) {
+    return space ? space->private_pages : 0;
+}
@@ -0,0 +1,92 @@
+#include "zram.h"
+#include "lz4.h"
+#include "mem.h"
+#include "memutils.h"
+#include "pmm.h"
+
+struct zram_obj {
+    uint32_t orig_len;
+    uint32_t comp_len;
+    uint8_t data[];
+};
+
+static zram_stats_t stats;
+
+/* Small buffers compress into this bounce area so only the compressed size
+ * has to be allocated, which still succeeds when the heap is nearly full.
+ */
+#define ZRAM_SCRATCH_SIZE 16384
+static uint8_t scratch[ZRAM_SCRATCH_SIZE];
+
+zram_obj_t *zram_store(const void *data, size_t len) {
+    if (!data || len == 0 || len > 0xFFFFFFFFu)
+        return NULL;
+    size_t cap = len - len / 8;
+    zram_obj_t *obj;
+    size_t comp;
+    if (cap <= sizeof(scratch)) {
+        comp = lz4_compress(data, len, scratch, cap);
+        obj = comp ? mem_alloc(sizeof(*obj) + comp) : NULL;
+        if (!obj) {
+            stats.rejects++;
+            return NULL;
+        }
+        memcpy(obj->data, scratch, comp);
+    } else {
+        obj = mem_alloc(sizeof(*obj) + cap);
+        if (!obj) {
+            stats.rejects++;
+            return NULL;
+        }
+        comp = lz4_compress(data, len, obj->data, cap);
+        if (comp == 0) {
+            mem_free(obj, sizeof(*obj) + cap);
+            stats.rejects++;
+            return NULL;
+        }
+        /* Shrinking always succeeds in place and hands the tail back. */
+        obj = mem_realloc(obj, sizeof(*obj) + cap, sizeof(*obj) + comp);
+    }
+    obj->orig_len = (uint32_t)len;
+    obj->comp_len = (uint32_t)comp;
+    stats.objects++;
+    stats.orig_bytes += len;
+    stats.comp_bytes += comp;
+    return obj;
+}
+
+int zram_load(const zram_obj_t *obj, void *out, size_t out_len) {
+    if (!obj || !out || out_len < obj->orig_len)
+        return -1;
+    long got = lz4_decompress(obj->data, obj->comp_len, out, obj->orig_len);
+    if (got != (long)obj->orig_len)
+        return -1;
+    stats.faults++;
+    return 0;
+}
+
+size_t zram_size(const zram_obj_t *obj) {
+    return obj ? obj->orig_len : 0;
+}
+
+void zram_drop(zram_obj_t *obj) {
+    if (!obj)
+        return;
+    stats.objects--;
+    stats.orig_bytes -= obj->orig_len;
+    stats.comp_bytes -= obj->comp_len;
+    mem_free(obj, sizeof(*obj) + obj->comp_len);
+}
+
+void zram_get_stats(zram_stats_t *out) {
+    if (out)
+        *out = stats;
+}
+
+int zram_under_pressure(void) {
+    pmm_stats_t pmm;
+    if (!pmm_ready())
+        return 0;
+    pmm_get_stats(&pmm);
+    return pmm.free_pages < pmm.total_pages / 8;
+}
@@ -4,57 +4,225 @@
 #define ATA_IO_BASE 0x1F0
 #define ATA_CTRL_BASE 0x3F6
 
-static void ata_wait_bsy(void) {
-    while (io_inb(ATA_IO_BASE + 7) & 0x80) {
+#define ATA_REG_DATA    (ATA_IO_BASE + 0)
+#define ATA_REG_COUNT   (ATA_IO_BASE + 2)
+#define ATA_REG_LBA0    (ATA_IO_BASE + 3)
+#define ATA_REG_LBA1    (ATA_IO_BASE + 4)
+#define ATA_REG_LBA2    (ATA_IO_BASE + 5)
+#define ATA_REG_DRIVE   (ATA_IO_BASE + 6)
+#define ATA_REG_STATUS  (ATA_IO_BASE + 7)
+#define ATA_REG_COMMAND (ATA_IO_BASE + 7)
+/* Alternate status: same bits, but reading it does not ack INTRQ. */
+#define ATA_REG_ALTSTATUS ATA_CTRL_BASE
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF  0x20
+#define ATA_SR_BSY 0x80
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_CMD_READ_SECTORS       0x20
+#define ATA_CMD_READ_SECTORS_EXT   0x24
+#define ATA_CMD_WRITE_SECTORS      0x30
+#define ATA_CMD_WRITE_SECTORS_EXT  0x34
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_DMA_EXT       0x25
+#define ATA_CMD_WRITE_DMA_EXT      0x35
+#define ATA_CMD_READ_DMA           0xC8
+#define ATA_CMD_WRITE_DMA          0xCA
+#define ATA_CMD_READ_MULTIPLE      0xC4
+#define ATA_CMD_WRITE_MULTIPLE     0xC5
+#define ATA_CMD_SET_MULTIPLE       0xC6
+#define ATA_CMD_IDENTIFY           0xEC
+
+#define ATA_LBA28_LIMIT (1ull << 28)
+/* Status reads before a drive counts as hung; each costs about 1 us. */
+#define ATA_POLL_LIMIT 5000000u
+
+static ata_pio_info_t drive;
+static int ready;
+static ata_pio_irq_wait_t irq_wait;
+
+static void delay_400ns(void) {
+    for (int i = 0; i < 4; ++i)
+        io_inb(ATA_REG_ALTSTATUS);
+}
+
+/* Returns the status once BSY clears (acking INTRQ), or -1 on timeout. */
+static int wait_not_busy(void) {
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT; ++i) {
+        if (!(io_inb(ATA_REG_ALTSTATUS) & ATA_SR_BSY))
+            return io_inb(ATA_REG_STATUS);
     }
+    return -1;
 }
 
-static void ata_wait_drq(void) {
-    while (!(io_inb(ATA_IO_BASE + 7) & 0x08)) {
+/* Wait for the next DRQ block or the end of a command. Interrupts are
+ * only a hint: a lost or early one just means polling.
+ */
+static int wait_ready(int interrupts) {
+    if (interrupts && irq_wait)
+        irq_wait();
+    int status = wait_not_busy();
+    if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF)))
+        return -1;
+    return status;
+}
+
+static void select_lba(uint64_t lba, uint32_t count, int lba48) {
+    if (lba48) {
+        io_outb(ATA_REG_DRIVE, 0x40);
+        /* High-order bytes first; each register keeps the last two writes. */
+        io_outb(ATA_REG_COUNT, (uint8_t)(count >> 8));
+        io_outb(ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        io_outb(ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        io_outb(ATA_REG_LBA2, (uint8_t)(lba >> 40));
+    } else {
+        io_outb(ATA_REG_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));
     }
+    io_outb(ATA_REG_COUNT, (uint8_t)count);
+    io_outb(ATA_REG_LBA0, (uint8_t)lba);
+    io_outb(ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    io_outb(ATA_REG_LBA2, (uint8_t)(lba >> 16));
+}
+
+static uint8_t pick_command(int write, int lba48, int multiple) {
+    if (write) {
+        if (multiple)
+            return lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+        return lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+    }
+    if (multiple)
+        return lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    return lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+}
+
+static int set_multiple(uint32_t max) {
+    uint32_t count = 1;
+    while (count * 2 <= max && count * 2 <= ATA_PIO_MULTIPLE_MAX)
+        count *= 2;
+    if (count < 2)
+        return 1;
+    io_outb(ATA_REG_COUNT, (uint8_t)count);
+    io_outb(ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    delay_400ns();
+    return wait_ready(0) < 0 ? 1 : (int)count;
 }
 
-void ata_pio_init(void) {
-    /* Disable IRQs */
-    io_outb(ATA_CTRL_BASE, 0x02);
-}
-
-int ata_pio_read(uint32_t lba, void *buf, size_t count) {
-    uint16_t *buffer = (uint16_t *)buf;
-    for (size_t i = 0; i < count; ++i) {
-        ata_wait_bsy();
-        io_outb(ATA_IO_BASE + 6, 0xE0 | ((lba >> 24) & 0x0F));
-        io_outb(ATA_IO_BASE + 2, 1);
-        io_outb(ATA_IO_BASE + 3, (uint8_t)lba);
-        io_outb(ATA_IO_BASE + 4, (uint8_t)(lba >> 8));
-        io_outb(ATA_IO_BASE + 5, (uint8_t)(lba >> 16));
-        io_outb(ATA_IO_BASE + 7, 0x20);
-        ata_wait_bsy();
-        ata_wait_drq();
-        for (int w = 0; w < 256; ++w)
-            buffer[w] = io_inw(ATA_IO_BASE);
-        buffer += 256;
-        ++lba;
+int ata_pio_init(void) {
+    uint16_t id[256];
+    ready = 0;
+    /* Identify with the interrupt masked; nothing is waiting for it yet. */
+    io_outb(ATA_CTRL_BASE, ATA_CTRL_NIEN);
+    io_outb(ATA_REG_DRIVE, 0xA0);
+    delay_400ns();
+    if (io_inb(ATA_REG_STATUS) == 0xFF)
+        return -1;  /* floating bus */
+    io_outb(ATA_REG_COUNT, 0);
+    io_outb(ATA_REG_LBA0, 0);
+    io_outb(ATA_REG_LBA1, 0);
+    io_outb(ATA_REG_LBA2, 0);
+    io_outb(ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    delay_400ns();
+    if (io_inb(ATA_REG_STATUS) == 0)
+        return -1;
+    int status = wait_not_busy();
+    /* ATAPI and SATA bridges post a signature here instead of data. */
+    if (status < 0 || io_inb(ATA_REG_LBA1) || io_inb(ATA_REG_LBA2))
+        return -1;
+    for (uint32_t i = 0; !(status & (ATA_SR_DRQ | ATA_SR_ERR)); ++i) {
+        if (i == ATA_POLL_LIMIT)
+            return -1;
+        status = io_inb(ATA_REG_STATUS);
     }
+    if (status & ATA_SR_ERR)
+        return -1;
+    io_insw(ATA_REG_DATA, id, 256);
+    drive.lba48 = (id[83] & (1u << 10)) != 0;
+    if (drive.lba48)
+        drive.sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                        ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+    else
+        drive.sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+    drive.dma = (id[49] & (1u << 8)) != 0;
+    drive.multiple = (uint32_t)set_multiple(id[47] & 0xFF);
+    ready = 1;
+    if (irq_wait)
+        io_outb(ATA_CTRL_BASE, 0);
     return 0;
 }
 
-int ata_pio_write(uint32_t lba, const void *buf, size_t count) {
-    const uint16_t *buffer = (const uint16_t *)buf;
-    for (size_t i = 0; i < count; ++i) {
-        ata_wait_bsy();
-        io_outb(ATA_IO_BASE + 6, 0xE0 | ((lba >> 24) & 0x0F));
-        io_outb(ATA_IO_BASE + 2, 1);
-        io_outb(ATA_IO_BASE + 3, (uint8_t)lba);
-        io_outb(ATA_IO_BASE + 4, (uint8_t)(lba >> 8));
-        io_outb(ATA_IO_BASE + 5, (uint8_t)(lba >> 16));
-        io_outb(ATA_IO_BASE + 7, 0x30);
-        ata_wait_bsy();
-        ata_wait_drq();
-        for (int w = 0; w < 256; ++w)
-            io_outw(ATA_IO_BASE, buffer[w]);
-        buffer += 256;
-        ++lba;
+int ata_pio_info(ata_pio_info_t *info) {
+    if (!ready || !info)
+        return -1;
+    *info = drive;
+    return 0;
+}
+
+void ata_pio_set_irq_wait(ata_pio_irq_wait_t wait) {
+    irq_wait = wait;
+    io_outb(ATA_CTRL_BASE, wait ? 0 : ATA_CTRL_NIEN);
+}
+
+/* Reads interrupt before every DRQ block; writes get their first block's
+ * DRQ without one and interrupt after each block, including the last.
+ */
+static int transfer(uint64_t lba, uint8_t *buf, size_t count, int write) {
+    if (!ready && ata_pio_init() != 0)
+        return -1;
+    while (count) {
+        uint32_t n = count > ATA_PIO_MAX_SECTORS ? ATA_PIO_MAX_SECTORS : (uint32_t)count;
+        int lba48 = lba + n > ATA_LBA28_LIMIT;
+        if (lba48 && !drive.lba48)
+            return -1;
+        if (wait_not_busy() < 0)
+            return -1;
+        select_lba(lba, n, lba48);
+        io_outb(ATA_REG_COMMAND, pick_command(write, lba48, drive.multiple > 1));
+        delay_400ns();
+        for (uint32_t done = 0; done < n;) {
+            uint32_t block = n - done < drive.multiple ? n - done : drive.multiple;
+            int status = wait_ready(!write || done > 0);
+            if (status < 0 || !(status & ATA_SR_DRQ))
+                return -1;
+            if (write)
+                io_outsw(ATA_REG_DATA, buf, block * (ATA_PIO_SECTOR_SIZE / 2));
+            else
+                io_insw(ATA_REG_DATA, buf, block * (ATA_PIO_SECTOR_SIZE / 2));
+            buf += block * ATA_PIO_SECTOR_SIZE;
+            done += block;
+        }
+        if (write && wait_ready(1) < 0)
+            return -1;
+        lba += n;
+        count -= n;
     }
     return 0;
 }
+
+int ata_pio_read(uint64_t lba, void *buf, size_t count) {
+    return transfer(lba, buf, count, 0);
+}
+
+int ata_pio_write(uint64_t lba, const void *buf, size_t count) {
+    return transfer(lba, (uint8_t *)buf, count, 1);
+}
+
+int ata_pio_start_dma(uint64_t lba, uint32_t count, int write) {
+    if (!ready || !drive.dma || count == 0 || count > ATA_PIO_MAX_SECTORS)
+        return -1;
+    int lba48 = lba + count > ATA_LBA28_LIMIT;
+    if ((lba48 && !drive.lba48) || wait_not_busy() < 0)
+        return -1;
+    select_lba(lba, count, lba48);
+    if (write)
+        io_outb(ATA_REG_COMMAND, lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+    else
+        io_outb(ATA_REG_COMMAND, lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+    return 0;
+}
+
+int ata_pio_end_dma(void) {
+    return wait_ready(0) < 0 ? -1 : 0;
+}
@@ -30,6 +30,14 @@ uint32_t io_inl(uint16_t port) {
     return ret;
 }
 
+void io_insw(uint16_t port, void *buf, uint32_t count) {
+    __asm__ volatile ("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+void io_outsw(uint16_t port, const void *buf, uint32_t count) {
+    __asm__ volatile ("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
 void io_wait(void) {
     __asm__ volatile ("outb %%al, $0x80" : : "a"(0));
 }
@@ -45,3 +53,13 @@ void io_cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d)
                       : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
                       : "a"(leaf), "c"(0));
 }
+
+uint64_t io_rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void io_wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
@@ -7,6 +7,23 @@ register_app = _native.register_app
 app_used = _native.app_used
 save_block = _native.save_block
 load_block = _native.load_block
+heap_profile = _native.heap_profile
+
+
+def heap_sites(limit=16):
+    """Top allocation sites by live bytes, as dicts."""
+    out = []
+    for site, live_bytes, live_count, peak_bytes, total_count, hist in _native.heap_sites(limit):
+        out.append({
+            'site': site,
+            'live_bytes': live_bytes,
+            'live_count': live_count,
+            'peak_bytes': peak_bytes,
+            'total_count': total_count,
+            'hist': hist,
+        })
+    return out
+
 
 env['memory'] = {
     'heap_free': heap_free,
@@ -14,4 +31,6 @@ env['memory'] = {
     'app_used': app_used,
     'save_block': save_block,
     'load_block': load_block,
+    'heap_profile': heap_profile,
+    'heap_sites': heap_sites,
 }
@@ -1,5 +1,6 @@
 #include "py/runtime.h"
 #include "mem.h"
+#include "heapprof.h"
 #include <stdint.h>
 
 #ifndef STATIC
@@ -46,12 +47,59 @@ STATIC mp_obj_t memstats_load_block(mp_obj_t app_id_obj, mp_obj_t handle_obj) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(memstats_load_block_obj, memstats_load_block);
 
+#define MEMSTATS_MAX_SITES 32
+
+/* [(site, live_bytes, live_count, peak_bytes, total_count, (hist...)), ...] */
+STATIC mp_obj_t memstats_heap_sites(mp_obj_t max_obj) {
+    heapprof_site_t sites[MEMSTATS_MAX_SITES];
+    int max = mp_obj_get_int(max_obj);
+    if (max < 0) max = 0;
+    if (max > MEMSTATS_MAX_SITES) max = MEMSTATS_MAX_SITES;
+    int n = heapprof_snapshot(sites, max);
+    mp_obj_t items[MEMSTATS_MAX_SITES];
+    for (int i = 0; i < n; i++) {
+        mp_obj_t hist[HEAPPROF_HIST_BUCKETS];
+        for (int b = 0; b < HEAPPROF_HIST_BUCKETS; b++)
+            hist[b] = mp_obj_new_int_from_uint(sites[i].hist[b]);
+        mp_obj_t fields[6] = {
+            mp_obj_new_int_from_ull(sites[i].site),
+            mp_obj_new_int_from_ull(sites[i].live_bytes),
+            mp_obj_new_int_from_uint(sites[i].live_count),
+            mp_obj_new_int_from_ull(sites[i].peak_bytes),
+            mp_obj_new_int_from_uint(sites[i].total_count),
+            mp_obj_new_tuple(HEAPPROF_HIST_BUCKETS, hist),
+        };
+        items[i] = mp_obj_new_tuple(6, fields);
+    }
+    return mp_obj_new_list((size_t)n, items);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(memstats_heap_sites_obj, memstats_heap_sites);
+
+/* (enabled, live_blocks, live_bytes, sites, dropped, leaked_blocks, leaked_bytes) */
+STATIC mp_obj_t memstats_heap_profile(void) {
+    heapprof_summary_t sum;
+    heapprof_get_summary(&sum);
+    mp_obj_t fields[7] = {
+        mp_obj_new_bool(sum.enabled),
+        mp_obj_new_int_from_uint(sum.live_blocks),
+        mp_obj_new_int_from_ull(sum.live_bytes),
+        mp_obj_new_int_from_uint(sum.sites),
+        mp_obj_new_int_from_uint(sum.dropped),
+        mp_obj_new_int_from_ull(sum.leaked_blocks),
+        mp_obj_new_int_from_ull(sum.leaked_bytes),
+    };
+    return mp_obj_new_tuple(7, fields);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(memstats_heap_profile_obj, memstats_heap_profile);
+
 STATIC const mp_rom_map_elem_t memstats_module_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_heap_free), MP_ROM_PTR(&memstats_heap_free_obj) },
     { MP_ROM_QSTR(MP_QSTR_register_app), MP_ROM_PTR(&memstats_register_app_obj) },
     { MP_ROM_QSTR(MP_QSTR_app_used), MP_ROM_PTR(&memstats_app_used_obj) },
     { MP_ROM_QSTR(MP_QSTR_save_block), MP_ROM_PTR(&memstats_save_block_obj) },
     { MP_ROM_QSTR(MP_QSTR_load_block), MP_ROM_PTR(&memstats_load_block_obj) },
+    { MP_ROM_QSTR(MP_QSTR_heap_sites), MP_ROM_PTR(&memstats_heap_sites_obj) },
+    { MP_ROM_QSTR(MP_QSTR_heap_profile), MP_ROM_PTR(&memstats_heap_profile_obj) },
 };
 STATIC MP_DEFINE_CONST_DICT(memstats_module_globals, memstats_module_globals_table);
 
@@ -9,7 +9,7 @@ static char charbuf[2];
 
 static long syscall3(long n, long a, long b, long c) {
     long ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(n), "D"(a), "S"(b), "d"(c) : "memory");
+    __asm__ volatile("syscall" : "=a"(ret) : "a"(n), "D"(a), "S"(b), "d"(c) : "rcx", "r11", "memory");
     return ret;
 }
 
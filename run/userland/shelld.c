@@ -11,7 +11,7 @@
 typedef struct {size_t heap_used;size_t heap_free;size_t heap_committed;size_t heap_max;size_t grow_count;size_t alloc_fail_count;} mem_info_t;
 #define LINE_MAX 192
 static char hist[HIST_MAX][LINE_MAX]; static int hist_count=0,hist_next=0;
-static long syscall3(long n,long a,long b,long c){long r;__asm__ volatile("int $0x80":"=a"(r):"a"(n),"D"(a),"S"(b),"d"(c):"memory");return r;}
+static long syscall3(long n,long a,long b,long c){long r;__asm__ volatile("syscall":"=a"(r):"a"(n),"D"(a),"S"(b),"d"(c):"rcx","r11","memory");return r;}
 static size_t slen(const char*s){size_t n=0;while(s&&s[n])n++;return n;} static int seq(const char*a,const char*b){size_t i=0;while(a[i]&&b[i]&&a[i]==b[i])i++;return a[i]==b[i];}
 static int contains(const char*s,const char*n){if(!*n)return 1;for(size_t i=0;s[i];i++){size_t j=0;while(s[i+j]&&n[j]&&s[i+j]==n[j])j++;if(!n[j])return 1;}return 0;}
 static void outn(const char*s,size_t n){syscall3(SYS_WRITE,(long)s,(long)n,0);} static void out(const char*s){outn(s,slen(s));} static void nl(void){out("\n");}
@@ -33,7 +33,7 @@ static void stringscmd(char**av,int ac){if(ac!=2){need("strings","strings <file>
 static void hexdumpcmd(char**av,int ac){if(ac<2){need("hexdump","hexdump <file> [max_bytes]");return;}int ok=1,max=256;if(ac>2)max=(int)num(av[2],&ok);if(!ok||max<0){out("hexdump: invalid max_bytes\n");return;}int fd=openr(av[1]);if(fd<0){out("hexdump: cannot open file\n");return;}unsigned char b[16];long off=0,n;while(off<max&&(n=rd(fd,(char*)b,(max-off)>16?16:(size_t)(max-off)))>0){hex8(off);out("  ");for(int i=0;i<16;i++){if(i<n)hex2(b[i]);else out("  ");out(" ");}out(" ");for(int i=0;i<n;i++){char c=(b[i]>=32&&b[i]<=126)?b[i]:'.';outn(&c,1);}nl();off+=n;}closefd(fd);} 
 static void treewalk(const char*p,int depth){if(depth>8){out("...\n");return;}int fd=openr(p);if(fd<0){out("tree: cannot open ");out(p);nl();return;}vfs_dirent_t e[8];long n;while((n=syscall3(SYS_VFS_GETDENTS,fd,(long)e,8))>0)for(long i=0;i<n;i++){if(seq(e[i].name,".")||seq(e[i].name,".."))continue;for(int j=0;j<depth;j++)out("  ");out(e[i].name);nl();if(e[i].type==VFS_TYPE_DIR){char child[VFS_MAX_PATH];cpy(child,p,sizeof child);if(!seq(child,"/"))catp(child,"/",sizeof child);catp(child,e[i].name,sizeof child);treewalk(child,depth+1);}}closefd(fd);} 
 static void findwalk(const char*p,const char*term,int depth){if(depth>8)return;int fd=openr(p);if(fd<0)return;vfs_dirent_t e[8];long n;while((n=syscall3(SYS_VFS_GETDENTS,fd,(long)e,8))>0)for(long i=0;i<n;i++){if(seq(e[i].name,".")||seq(e[i].name,".."))continue;char child[VFS_MAX_PATH];cpy(child,p,sizeof child);if(!seq(child,"/"))catp(child,"/",sizeof child);catp(child,e[i].name,sizeof child);if(contains(e[i].name,term)) {out(child);nl();} if(e[i].type==VFS_TYPE_DIR)findwalk(child,term,depth+1);}closefd(fd);} 
-static const char* state(int s){return s==PROC_STATE_READY?"READY":s==PROC_STATE_RUNNING?"RUN":s==PROC_STATE_EXITED?"EXIT":s==PROC_STATE_ZOMBIE?"ZOMBIE":s==PROC_STATE_DEAD?"DEAD":"UNUSED";} static void pinfo(int pid){proc_info_t pi;if(syscall3(SYS_PROC_INFO,pid,(long)&pi,0)!=0){out("pinfo: process not found\n");return;}out("pid=");udec(pi.pid);out(" ppid=");udec(pi.parent_pid);out(" state=");out(state(pi.state));out(" exit=");udec(pi.exit_status);out(" name=");out(pi.name);out(" exe=");out(pi.exe_path);out(" cwd=");out(pi.cwd);nl();}
+static const char* state(int s){return s==PROC_STATE_READY?"READY":s==PROC_STATE_RUNNING?"RUN":s==PROC_STATE_EXITED?"EXIT":s==PROC_STATE_ZOMBIE?"ZOMBIE":s==PROC_STATE_DEAD?"DEAD":s==PROC_STATE_BLOCKED?"BLOCK":"UNUSED";} static void pinfo(int pid){proc_info_t pi;if(syscall3(SYS_PROC_INFO,pid,(long)&pi,0)!=0){out("pinfo: process not found\n");return;}out("pid=");udec(pi.pid);out(" ppid=");udec(pi.parent_pid);out(" state=");out(state(pi.state));out(" exit=");udec(pi.exit_status);out(" name=");out(pi.name);out(" exe=");out(pi.exe_path);out(" cwd=");out(pi.cwd);nl();}
 static void help(void){out("Builtins:\n  help clear echo version about exit history mpy\nFiles:\n  pwd cd ls ll tree stat find cat touch write append truncate rm mkdir rmdir mv cp size head tail hexdump strings wc grep access\nProcesses:\n  pid ppid ps pinfo run spawn wait kill\nSystem:\n  mem dmesg uptime sleep sync banner printtest alloctest\n");}
 static void banner(void){out("=== ExoCore shelld ===\n");}
 static void clear_screen(void){out("\033[2J\033[H");syscall3(SYS_IOCTL,1,0,0);}
@@ -45,8 +45,8 @@ static void show_log_step(int dir){char b[512];long len=0,n=0;while((n=syscall3(
 static void runline(char*line){char*av[MAX_ARGC];int ac=parse(line,av,MAX_ARGC);if(!ac)return;char*cmd=av[0];
 if(seq(cmd,"help"))help();else if(seq(cmd,"clear")){clear_screen();}else if(seq(cmd,"echo")){for(int i=1;i<ac;i++){if(i>1)out(" ");out(av[i]);}nl();}else if(seq(cmd,"version")){out(EXOCORE_VERSION);nl();}else if(seq(cmd,"about"))out("ExoCore Kernel shell daemon\n");else if(seq(cmd,"history")){int start=(hist_next-hist_count+HIST_MAX)%HIST_MAX;for(int i=0;i<hist_count;i++){udec(i+1);out(" ");out(hist[(start+i)%HIST_MAX]);nl();}}
 else if(seq(cmd,"pwd")){char b[128];if(!syscall3(SYS_VFS_GETCWD,(long)b,sizeof b,0))out(b);else out("pwd: failed");nl();}else if(seq(cmd,"cd")){if(ac>2)need("cd","cd [dir]");else if(syscall3(SYS_VFS_CHDIR,(long)(ac>1?av[1]:"/"),0,0))out("cd: not a directory or missing\n");}else if(seq(cmd,"ls"))list(ac>1?av[1]:".",0);else if(seq(cmd,"ll"))list(ac>1?av[1]:".",1);else if(seq(cmd,"tree")){out(ac>1?av[1]:".");nl();treewalk(ac>1?av[1]:".",1);}else if(seq(cmd,"find")){if(ac<2)need("find","find <name> [start_path]");else findwalk(ac>2?av[2]:".",av[1],0);}else if(seq(cmd,"cat"))catcmd(ac>1?av[1]:0);else if(seq(cmd,"touch")){if(ac!=2)need("touch","touch <file>");else{int fd=openw(av[1],VFS_O_CREAT|VFS_O_RDWR);if(fd<0)out("touch: failed\n");else closefd(fd);}}else if(seq(cmd,"write"))writecmd(av,ac,0);else if(seq(cmd,"append"))writecmd(av,ac,1);else if(seq(cmd,"truncate")){if(ac!=2)need("truncate","truncate <file>");else{int fd=openw(av[1],VFS_O_CREAT|VFS_O_RDWR|VFS_O_TRUNC);if(fd<0)out("truncate: failed\n");else closefd(fd);}}else if(seq(cmd,"rm")){if(ac!=2)need("rm","rm <file>");else if(syscall3(SYS_VFS_UNLINK,(long)av[1],0,0))out("rm: failed; missing file or directory\n");}else if(seq(cmd,"mkdir")){if(ac!=2)need("mkdir","mkdir <dir>");else if(syscall3(SYS_VFS_MKDIR,(long)av[1],0,0))out("mkdir: failed\n");}else if(seq(cmd,"rmdir")){if(ac!=2)need("rmdir","rmdir <dir>");else if(syscall3(SYS_VFS_RMDIR,(long)av[1],0,0))out("rmdir: failed; directory may be missing, non-empty, or not a directory\n");}else if(seq(cmd,"mv")){if(ac!=3)need("mv","mv <old> <new>");else if(syscall3(SYS_VFS_RENAME,(long)av[1],(long)av[2],0))out("mv: failed\n");}else if(seq(cmd,"cp"))cpcmd(av,ac);else if(seq(cmd,"stat")||seq(cmd,"size"))statcmd(ac>1?av[1]:0);else if(seq(cmd,"head"))headcmd(av,ac);else if(seq(cmd,"tail"))tailcmd(av,ac);else if(seq(cmd,"hexdump"))hexdumpcmd(av,ac);else if(seq(cmd,"strings"))stringscmd(av,ac);else if(seq(cmd,"wc")){if(ac!=2)need("wc","wc <file>");else{vfs_stat_t st;if(syscall3(SYS_VFS_STAT,(long)av[1],(long)&st,0))out("wc: missing file\n");else{udec(st.size);nl();}}}else if(seq(cmd,"grep"))grepcmd(av,ac);else if(seq(cmd,"access")){if(ac!=2)need("access","access <path>");else out(syscall3(SYS_VFS_ACCESS,(long)av[1],0,0)==0?"exists\n":"missing\n");}
-else if(seq(cmd,"pid")){long r=syscall3(SYS_GETPID,0,0,0);if(r<=0)out("pid: no current process");else udec(r);nl();}else if(seq(cmd,"ppid")){long r=syscall3(SYS_GETPPID,0,0,0);if(r<0)out("ppid: no current process");else udec(r);nl();}else if(seq(cmd,"ps")){proc_info_t p[16];long n=syscall3(SYS_PROC_LIST,(long)p,16,0);out("PID PPID STATE NAME EXE\n");for(int i=0;i<n;i++){udec(p[i].pid);out(" ");udec(p[i].parent_pid);out(" ");out(state(p[i].state));out(" ");out(p[i].name);out(" ");out(p[i].exe_path);nl();}}else if(seq(cmd,"pinfo")){int ok,pid;if(ac!=2)need("pinfo","pinfo <pid>");else{pid=(int)num(av[1],&ok);if(!ok)out("pinfo: invalid pid\n");else pinfo(pid);}}else if(seq(cmd,"wait")){int ok,pid,st=0;if(ac!=2)need("wait","wait <pid>");else{pid=(int)num(av[1],&ok);if(!ok)out("wait: invalid pid\n");else{long r=syscall3(SYS_PROC_WAIT,pid,(long)&st,0);if(r<0)out("wait: failed\n");else{out("exit status ");udec(st);nl();}}}}else if(seq(cmd,"kill")){int ok,pid;if(ac!=2)need("kill","kill <pid>");else{pid=(int)num(av[1],&ok);if(!ok)out("kill: invalid pid\n");else{long kr=syscall3(SYS_PROC_KILL,pid,-1,0);if(kr==0)out("killed\n");else if(kr==PROC_ERR_PROTECTED)out("kill: cannot kill PID 1\n");else if(kr==PROC_ERR_NOT_FOUND)out("kill: process not found\n");else if(kr==PROC_ERR_INVALID_STATE)out("kill: no running process with that PID\n");else out("kill: failed\n");}}}else if(seq(cmd,"mpy")){if(ac!=2)need("mpy","mpy <file.py>");else{long r=syscall3(SYS_MPY_EXEC_FILE,(long)av[1],0,0);if(r==PROC_ERR_NOMEM)out("mpy: out of memory\n");else if(r<0)out("mpy: failed; check that the raw .py file exists\n");}}
-else if(seq(cmd,"run")||seq(cmd,"spawn")){if(ac<2)need(cmd,"run <path> [args...]");else{if(ac>2)out("run: arguments are ignored by current kernel spawn ABI\n");long r=syscall3(SYS_PROC_SPAWN_EX,(long)av[1],0,0);if(r==PROC_ERR_NOMEM) { out(seq(cmd,"spawn")?"spawn: out of memory\n":"run: out of memory\n"); } else if(r<0)out(seq(cmd,"spawn")?"spawn: failed; check path and executable format\n":"run: spawn failed; check path and executable format\n");else{out("spawned pid ");udec(r);nl();}}}
+else if(seq(cmd,"pid")){long r=syscall3(SYS_GETPID,0,0,0);if(r<=0)out("pid: no current process");else udec(r);nl();}else if(seq(cmd,"ppid")){long r=syscall3(SYS_GETPPID,0,0,0);if(r<0)out("ppid: no current process");else udec(r);nl();}else if(seq(cmd,"ps")){proc_info_t p[16];long n=syscall3(SYS_PROC_LIST,(long)p,16,0);out("PID PPID STATE NAME EXE\n");for(int i=0;i<n&&i<16;i++){udec(p[i].pid);out(" ");udec(p[i].parent_pid);out(" ");out(state(p[i].state));out(" ");out(p[i].name);out(" ");out(p[i].exe_path);nl();}}else if(seq(cmd,"pinfo")){int ok,pid;if(ac!=2)need("pinfo","pinfo <pid>");else{pid=(int)num(av[1],&ok);if(!ok)out("pinfo: invalid pid\n");else pinfo(pid);}}else if(seq(cmd,"wait")){int ok,pid,st=0;if(ac!=2)need("wait","wait <pid>");else{pid=(int)num(av[1],&ok);if(!ok)out("wait: invalid pid\n");else{long r=syscall3(SYS_PROC_WAIT,pid,(long)&st,0);if(r<0)out("wait: failed\n");else{out("exit status ");udec(st);nl();}}}}else if(seq(cmd,"kill")){int ok,pid;if(ac!=2)need("kill","kill <pid>");else{pid=(int)num(av[1],&ok);if(!ok)out("kill: invalid pid\n");else{long kr=syscall3(SYS_PROC_KILL,pid,-1,0);if(kr==0)out("killed\n");else if(kr==PROC_ERR_PROTECTED)out("kill: cannot kill PID 1\n");else if(kr==PROC_ERR_NOT_FOUND)out("kill: process not found\n");else if(kr==PROC_ERR_INVALID_STATE)out("kill: no running process with that PID\n");else out("kill: failed\n");}}}else if(seq(cmd,"mpy")){if(ac!=2)need("mpy","mpy <file.py>");else{long r=syscall3(SYS_MPY_EXEC_FILE,(long)av[1],0,0);if(r==PROC_ERR_NOMEM)out("mpy: out of memory\n");else if(r<0)out("mpy: failed; check that the raw .py file exists\n");}}
+else if(seq(cmd,"run")||seq(cmd,"spawn")){if(ac<2)need(cmd,"run <path> [args...]");else{if(ac>2)out("run: arguments are ignored by current kernel spawn ABI\n");long r=syscall3(SYS_PROC_SPAWN_EX,(long)av[1],0,0);if(r==PROC_ERR_NOMEM) { out(seq(cmd,"spawn")?"spawn: out of memory\n":"run: out of memory\n"); } else if(r<0)out(seq(cmd,"spawn")?"spawn: failed; check path and executable format\n":"run: spawn failed; check path and executable format\n");else if(seq(cmd,"spawn")){out("spawned pid ");udec(r);nl();}else{int st=0;syscall3(SYS_PROC_WAIT,r,(long)&st,0);if(st){out("exit status ");udec(st);nl();}}}}
 else if(seq(cmd,"mem")){mem_info_t mi;if(syscall3(SYS_MEM_INFO,(long)&mi,0,0)==0){out("heap_used=");udec(mi.heap_used);out(" heap_free=");udec(mi.heap_free);out(" heap_committed=");udec(mi.heap_committed);out(" heap_max=");udec(mi.heap_max);out(" grow_count=");udec(mi.grow_count);out(" alloc_fail_count=");udec(mi.alloc_fail_count);nl();}else out("mem: failed\n");}else if(seq(cmd,"dmesg")){char b[256];long off=0,n;while((n=syscall3(SYS_DMESG_READ,(long)b,sizeof b,off))>0){outn(b,(size_t)n);off+=n;}nl();}else if(seq(cmd,"uptime")){unsigned long ms=syscall3(SYS_UPTIME_MS,0,0,0);udec(ms);out(" ms (");udec(ms/1000);out(" s)\n");}else if(seq(cmd,"sleep")){int ok;if(ac!=2)need("sleep","sleep <ms>");else{long ms=num(av[1],&ok);if(!ok)out("sleep: invalid ms\n");else syscall3(SYS_SLEEP_MS,ms,0,0);}}else if(seq(cmd,"sync")){out(syscall3(SYS_SYNC,0,0,0)==0?"sync ok\n":"sync failed\n");}else if(seq(cmd,"alloctest")){void*p=(void*)syscall3(SYS_MEM_ALLOC,64,0,0);out(p?"alloctest ok\n":"alloctest failed\n");}else if(seq(cmd,"printtest"))out("printtest ok\n");else if(seq(cmd,"banner"))banner();else out("unknown command\n");}
 static int valid_context(void){long pid=syscall3(SYS_GETPID,0,0,0);if(pid<=0){out("shelld: invalid process context; refusing to run commands\n");return 0;}return 1;}
 static int display_logs_visible(void){syscall_fb_info_t info;if(syscall3(SYS_FB_INFO,(long)&info,0,0)!=0)return 1;return info.logs_visible?1:0;}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/ktimer.h"
+
+static uint64_t fired_at[8];
+static int fired;
+
+static void record(void *arg) {
+    fired_at[(uintptr_t)arg] = ktimer_now() - 1;
+    fired++;
+}
+
+static ktimer_t rearm_timer;
+
+static void rearm(void *arg) {
+    (void)arg;
+    fired++;
+    if (fired < 3)
+        ktimer_arm(&rearm_timer, ktimer_now() + 10, rearm, 0);
+}
+
+int main() {
+    ktimer_t t[8] = {{0}};
+
+    /* Deadlines on every level fire on their tick, not before or after. */
+    ktimer_init(1000);
+    const uint64_t when[5] = { 1000, 1063, 1064, 1000 + 5000, 1000 + 300000 };
+    for (uintptr_t i = 0; i < 5; i++)
+        ktimer_arm(&t[i], when[i], record, (void *)i);
+    for (uint64_t now = 1000; now <= 1000 + 300000; now += 7)
+        ktimer_advance(now);
+    ktimer_advance(1000 + 300000);
+    if (fired != 5) return 1;
+    for (int i = 0; i < 5; i++)
+        if (fired_at[i] != when[i]) return 1;
+
+    /* A cancelled timer stays quiet; a past deadline fires on the next turn. */
+    fired = 0;
+    ktimer_arm(&t[0], ktimer_now() + 50, record, (void *)0);
+    ktimer_arm(&t[1], ktimer_now() - 10, record, (void *)1);
+    if (!ktimer_cancel(&t[0]) || ktimer_cancel(&t[0]) || ktimer_pending(&t[0])) return 1;
+    ktimer_advance(ktimer_now() + 100);
+    if (fired != 1 || ktimer_pending(&t[1])) return 1;
+
+    /* ktimer_next never overshoots the first deadline. */
+    ktimer_arm(&t[2], ktimer_now() + 20, record, (void *)2);
+    uint64_t next = ktimer_next();
+    if (next > t[2].expires) return 1;
+    ktimer_cancel(&t[2]);
+    if (ktimer_next() != UINT64_MAX) return 1;
+
+    /* Callbacks may re-arm themselves. */
+    fired = 0;
+    ktimer_arm(&rearm_timer, ktimer_now() + 10, rearm, 0);
+    ktimer_advance(ktimer_now() + 1000);
+    if (fired != 3 || ktimer_pending(&rearm_timer)) return 1;
+
+    printf("ktimer wheel ok\n");
+    return 0;
+}
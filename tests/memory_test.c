@@ -1,5 +1,27 @@
 #include <stdio.h>
 #include "../include/mem.h"
+#include "../include/heapprof.h"
+
+static void *held;
+static int shrink_calls;
+
+static size_t release_held(size_t goal) {
+    (void)goal;
+    shrink_calls++;
+    if (!held) return 0;
+    mem_free(held, 4096);
+    held = NULL;
+    return 4096;
+}
+
+/* One call site for every allocation; the barrier keeps -O2 from
+ * turning the call into a tail call that would record main instead.
+ */
+__attribute__((noinline)) static void *profiled_alloc(size_t n) {
+    void *p = mem_alloc(n);
+    __asm__ volatile ("" ::: "memory");
+    return p;
+}
 
 int main() {
     static unsigned char heap[0x10000];
@@ -24,6 +46,100 @@ int main() {
     mem_free(large_b, 20000);
     void *large_merged = mem_alloc(38000);
     if (!large_merged) return 1;
+    mem_free(large_merged, 38000);
+
+    /* Freeing the middle block last must merge all three neighbours. */
+    mem_info_t info;
+    void *x = mem_alloc(256);
+    void *y = mem_alloc(256);
+    void *z = mem_alloc(256);
+    void *fence = mem_alloc(16);
+    if (!x || !y || !z || !fence) return 1;
+    mem_free(x, 256);
+    mem_free(z, 256);
+    mem_get_info(&info);
+    size_t free_before = info.heap_free;
+    uint32_t free_blocks = 0;
+    for (int i = 0; i < MEM_SIZE_CLASSES; i++) free_blocks += info.class_free[i];
+    if (free_blocks != 2) return 1;
+    mem_free(y, 256);
+    mem_get_info(&info);
+    free_blocks = 0;
+    for (int i = 0; i < MEM_SIZE_CLASSES; i++) free_blocks += info.class_free[i];
+    if (free_blocks != 1 || info.heap_free <= free_before) return 1;
+    void *xyz = mem_alloc(700);
+    if (xyz != x) return 1;
+
+    /* mem_realloc grows in place at the frontier and into a free neighbour,
+     * and copies the contents when it has to move.
+     */
+    static unsigned char heap2[0x10000];
+    mem_init((uintptr_t)heap2, sizeof(heap2));
+    char *r = mem_alloc(64);
+    if (!r) return 1;
+    for (int i = 0; i < 64; i++) r[i] = (char)i;
+    char *r2 = mem_realloc(r, 64, 4096);
+    if (r2 != r) return 1;
+    void *gap = mem_alloc(512);
+    void *wall = mem_alloc(16);
+    if (!gap || !wall) return 1;
+    mem_free(gap, 512);
+    r2 = mem_realloc(r, 4096, 4400);
+    if (r2 != r) return 1;
+    r2 = mem_realloc(r, 4400, 8192);
+    if (!r2 || r2 == r) return 1;
+    for (int i = 0; i < 64; i++) if (r2[i] != (char)i) return 1;
+    mem_free(r2, 8192);
+
+    /* An exhausted heap runs the shrinkers in priority order and deflates
+     * app balloons into zram before an allocation is allowed to fail.
+     */
+    static unsigned char heap3[0x10000];
+    static char pattern[12000];
+    static void *chunks[256];
+    mem_init((uintptr_t)heap3, sizeof(heap3));
+    if (mem_register_shrinker("test", MEM_SHRINK_PRIO_CACHE, release_held) != 0) return 1;
+    int bid = mem_register_app(1);
+    for (int i = 0; i < (int)sizeof(pattern); i++) pattern[i] = (char)(i & 15);
+    int bh = mem_save_app(bid, pattern, sizeof(pattern));
+    held = mem_alloc(4096);
+    if (bh < 0 || !held) return 1;
+    int nchunks = 0;
+    while (nchunks < 256 && (chunks[nchunks] = mem_alloc(512)) != NULL) nchunks++;
+    if (nchunks == 256 || held || shrink_calls < 2) return 1;
+    if (mem_app_used(bid) != 0) return 1;
+    mem_get_info(&info);
+    if (info.reclaim_runs < 2 || info.reclaim_bytes < 4096 + sizeof(pattern)) return 1;
+    if (info.zram_objects != 1 || info.alloc_fail_count != 1) return 1;
+    for (int i = 0; i < nchunks; i++) mem_free(chunks[i], 512);
+    char *back = mem_retrieve_app(bid, bh, &sz);
+    if (!back || sz != sizeof(pattern) || mem_app_used(bid) != sizeof(pattern)) return 1;
+    for (int i = 0; i < (int)sizeof(pattern); i++) if (back[i] != pattern[i]) return 1;
+
+    /* The profiler charges blocks to the caller of mem_alloc. It is only
+     * compiled in with -DEXOCORE_HEAP_PROFILE=1.
+     */
+    static heapprof_site_t sites[64];
+    heapprof_summary_t prof;
+    heapprof_get_summary(&prof);
+    if (!prof.enabled) {
+        printf("memory manager ok (heap profiler off)\n");
+        return 0;
+    }
+    void *pa = profiled_alloc(100);
+    void *pb = profiled_alloc(100);
+    void *pc = profiled_alloc(100);
+    if (!pa || !pb || !pc) return 1;
+    mem_free(pb, 100);
+    int nsites = heapprof_snapshot(sites, 64);
+    int found = 0;
+    for (int i = 0; i < nsites; i++) {
+        if (sites[i].total_count == 3 && sites[i].live_count == 2 && sites[i].live_bytes == 200 && sites[i].hist[2] == 3)
+            found = 1;
+        if (i && sites[i].live_bytes > sites[i - 1].live_bytes) return 1;
+    }
+    heapprof_get_summary(&prof);
+    if (!found || !prof.enabled || prof.dropped) return 1;
 
     printf("memory manager ok\n");
     return 0;
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <cpuid.h>
+#include "../include/memutils.h"
+
+#define BIG (4200 * 1024)
+
+static unsigned char src[BIG + 64];
+static unsigned char dst[BIG + 64];
+static char str[256];
+
+static unsigned host_features(void) {
+    unsigned a, b, c, d, features = 0;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) features |= MEMUTILS_FEAT_SSE2;
+    if (__builtin_cpu_supports("avx2")) features |= MEMUTILS_FEAT_AVX2;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 9))) features |= MEMUTILS_FEAT_ERMS;
+    return features;
+}
+
+/* Copy and fill must touch exactly [off, off + n) for every length and
+ * alignment, including the non-temporal path.
+ */
+static int check_copy_fill(size_t n, size_t soff, size_t doff) {
+    for (size_t i = 0; i < n + 64 && i < sizeof(dst); i++) dst[i] = 0xEE;
+    if (memcpy(dst + doff, src + soff, n) != dst + doff) return -1;
+    for (size_t i = 0; i < doff; i++) if (dst[i] != 0xEE) return -1;
+    for (size_t i = 0; i < n; i++) if (dst[doff + i] != src[soff + i]) return -1;
+    if (dst[doff + n] != 0xEE) return -1;
+    memset(dst + doff, 0x5A, n);
+    for (size_t i = 0; i < n; i++) if (dst[doff + i] != 0x5A) return -1;
+    if (dst[doff + n] != 0xEE || (doff && dst[doff - 1] != 0xEE)) return -1;
+    return 0;
+}
+
+static int check_all(void) {
+    for (size_t n = 0; n <= 300; n++)
+        for (size_t off = 0; off < 8; off++)
+            if (check_copy_fill(n, off, (off * 5) & 7) != 0) return -1;
+    if (check_copy_fill(BIG, 3, 1) != 0 || check_copy_fill(4096, 0, 0) != 0) return -1;
+
+    for (size_t n = 1; n <= 100; n++) {
+        memcpy(dst, src, n);
+        if (memcmp(dst, src, n) != 0) return -1;
+        dst[n - 1] ^= 0x80;
+        int r = memcmp(dst, src, n);
+        if ((dst[n - 1] > src[n - 1]) ? r <= 0 : r >= 0) return -1;
+        dst[n - 1] ^= 0x80;
+    }
+
+    for (size_t off = 0; off < 32; off++) {
+        for (size_t len = 0; len < 80; len++) {
+            for (size_t i = 0; i < sizeof(str); i++) str[i] = 'x';
+            str[off + len] = 0;
+            if (strlen(str + off) != len) return -1;
+        }
+    }
+
+    /* memmove over overlapping ranges in both directions. */
+    for (size_t i = 0; i < 256; i++) dst[i] = (unsigned char)i;
+    memmove(dst + 7, dst, 200);
+    for (size_t i = 0; i < 200; i++) if (dst[7 + i] != (unsigned char)i) return -1;
+    for (size_t i = 0; i < 256; i++) dst[i] = (unsigned char)i;
+    memmove(dst, dst + 9, 200);
+    for (size_t i = 0; i < 200; i++) if (dst[i] != (unsigned char)(i + 9)) return -1;
+    return 0;
+}
+
+int main() {
+    unsigned x = 1;
+    for (size_t i = 0; i < sizeof(src); i++) {
+        x = x * 1103515245u + 12345u;
+        src[i] = (unsigned char)(x >> 16);
+    }
+    unsigned have = host_features();
+    static const unsigned sets[] = {
+        0, MEMUTILS_FEAT_SSE2, MEMUTILS_FEAT_ERMS,
+        MEMUTILS_FEAT_ERMS | MEMUTILS_FEAT_SSE2,
+        MEMUTILS_FEAT_ERMS | MEMUTILS_FEAT_SSE2 | MEMUTILS_FEAT_AVX2,
+    };
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        if ((sets[i] & have) != sets[i]) continue;
+        memutils_select(sets[i]);
+        if (check_all() != 0) {
+            printf("memutils variant %s failed\n", memutils_variant());
+            return 1;
+        }
+    }
+    memutils_select(0);
+    printf("memutils ok\n");
+    return 0;
+}
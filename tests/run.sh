@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# Build the host unit tests at the kernel's -O2 and run them. memory_test
+# runs twice: with the heap profiler off, as shipped, and with it on.
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+CC=${CC:-gcc}
+CFLAGS="-O2 -Wall -Iinclude"
+SRCS="kernel/mem.c kernel/pmm.c kernel/zram.c kernel/lz4.c kernel/heapprof.c
+      kernel/memutils.c kernel/fs.c kernel/ktimer.c tests/stub_console.c"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+run() {
+  local name=$1 src=$2
+  shift 2
+  echo "== $name"
+  # shellcheck disable=SC2086
+  $CC $CFLAGS "$@" "tests/$src.c" $SRCS -o "$OUT/$name"
+  "$OUT/$name"
+}
+
+run memory_test memory_test
+run memory_test_profiled memory_test -DEXOCORE_HEAP_PROFILE=1
+run fs_test fs_test
+run zram_test zram_test
+run memutils_test memutils_test
+run ktimer_test ktimer_test
+echo "host tests passed"
@@ -1,5 +1,7 @@
 #include "../include/console.h"
 #include "../include/serial.h"
+#include <stdio.h>
+#include <stdlib.h>
 
 int debug_mode = 0;
 void console_init(void) {}
@@ -24,3 +26,5 @@ void serial_uhex(uint64_t val) { (void)val; }
 void serial_raw_putc(char c) { (void)c; }
 void serial_raw_write(const char *s) { (void)s; }
 void serial_raw_uhex(uint64_t val) { (void)val; }
+
+void panic(const char *msg) { fprintf(stderr, "panic: %s\n", msg); abort(); }
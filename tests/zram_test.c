@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/lz4.h"
+#include "../include/zram.h"
+#include "../include/mem.h"
+
+static unsigned char src[20000];
+static unsigned char packed[24000];
+static unsigned char out[20000];
+
+static int roundtrip(size_t len) {
+    size_t n = lz4_compress(src, len, packed, sizeof(packed));
+    if (n == 0) return -1;
+    long got = lz4_decompress(packed, n, out, sizeof(out));
+    if (got != (long)len) return -1;
+    return memcmp(src, out, len) == 0 ? 0 : -1;
+}
+
+int main() {
+    static unsigned char heap[0x20000];
+    mem_init((uintptr_t)heap, sizeof(heap));
+
+    /* Text-like data, runs, random bytes and tiny inputs must round-trip. */
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = "exocore kernel log line "[i % 24] + (unsigned char)((i / 997) & 3);
+    if (roundtrip(sizeof(src)) != 0) return 1;
+    memset(src, 'A', sizeof(src));
+    if (roundtrip(sizeof(src)) != 0) return 1;
+    unsigned int x = 12345;
+    for (size_t i = 0; i < sizeof(src); i++) {
+        x = x * 1103515245u + 12345u;
+        src[i] = (unsigned char)(x >> 16);
+    }
+    if (roundtrip(sizeof(src)) != 0) return 1;
+    for (size_t len = 0; len < 40; len++)
+        if (roundtrip(len) != 0) return 1;
+
+    /* Truncated or corrupt blocks are rejected rather than overrunning. */
+    memset(src, 'B', 4096);
+    size_t n = lz4_compress(src, 4096, packed, sizeof(packed));
+    if (lz4_decompress(packed, n - 1, out, sizeof(out)) >= 0) return 1;
+    if (lz4_decompress(packed, n, out, 100) >= 0) return 1;
+
+    /* Random data is refused by the tier; compressible data is stored. */
+    if (zram_store(src + 0, 0) != NULL) return 1;
+    for (size_t i = 0; i < 8192; i++) {
+        x = x * 1103515245u + 12345u;
+        src[i] = (unsigned char)(x >> 16);
+    }
+    if (zram_store(src, 8192) != NULL) return 1;
+    memset(src, 'C', 8192);
+    zram_obj_t *obj = zram_store(src, 8192);
+    if (!obj || zram_size(obj) != 8192) return 1;
+    mem_info_t info;
+    mem_get_info(&info);
+    if (info.zram_objects != 1 || info.zram_orig_bytes != 8192 || info.zram_comp_bytes >= 1024) return 1;
+    memset(out, 0, sizeof(out));
+    if (zram_load(obj, out, sizeof(out)) != 0 || memcmp(out, src, 8192) != 0) return 1;
+    zram_drop(obj);
+    mem_get_info(&info);
+    if (info.zram_objects != 0 || info.zram_faults != 1 || info.zram_rejects != 1) return 1;
+
+    printf("zram tier ok\n");
+    return 0;
+}